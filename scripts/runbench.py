@@ -1,9 +1,13 @@
 #!/usr/bin/env python3
 
+import itertools
 import json
 import os
 from os import path
+import random
 import shutil
+import statistics
+import subprocess
 import sys
 import time
 
@@ -13,6 +17,18 @@ BENCHMARKS = {}
 DEFAULT_REPS = 5
 COMMIT_COUNT = 100
 
+# The metrics recorded for each full and no-op build. Larger values are worse for all of them.
+METRICS = ['runtime', 'max_rss_kb', 'rkr_max_rss_kb', 'phases', 'db_size', 'cache_size', 'cache_count']
+
+# A metric has regressed when its median grows by more than this fraction over the baseline...
+REGRESSION_THRESHOLD = 0.05
+
+# ...and a one-sided permutation test finds the increase significant at this level
+SIGNIFICANCE = 0.05
+
+# Permutation tests with more arrangements than this are sampled instead of enumerated
+MAX_PERMUTATIONS = 20000
+
 # Get information about all of the available benchmarks
 for entry in os.listdir(BENCH_DIR):
   # Does the config file exist?
@@ -132,6 +148,85 @@ def post_copy_setup(name, build_tool):
       if rc != 0:
         raise Exception('Setup command {} in benchmark {} failed'.format(cmd, name))
 
+# Add --stats to an rkr build command so it writes per-phase statistics to stats_path
+def stats_command(build_cmd, stats_path):
+  parts = build_cmd.split(' ', 1)
+  if parts[0] != 'rkr':
+    return build_cmd
+  return ' '.join(['rkr', '--stats', stats_path] + parts[1:])
+
+# Run a build command and return its runtime and the peak RSS of any process it ran
+def measured_build(checkout_path, build_cmd):
+  start_time = time.perf_counter()
+  proc = subprocess.Popen(build_cmd, shell=True, cwd=checkout_path,
+                          stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+  # wait4 reports the largest RSS of the shell and every descendant it waited for
+  (_, status, usage) = os.wait4(proc.pid, 0)
+  runtime = time.perf_counter() - start_time
+  proc.returncode = status
+
+  return (status, runtime, usage.ru_maxrss)
+
+# Get the size of the rkr database, the size of the cache, and the number of files in the cache
+def rkr_storage(checkout_path):
+  db_size = 0
+  db_path = path.join(checkout_path, '.rkr', 'db')
+  if path.isfile(db_path):
+    db_size = path.getsize(db_path)
+
+  cache_size = 0
+  cache_count = 0
+  for (dirname, subdirs, files) in os.walk(path.join(checkout_path, '.rkr', 'cache')):
+    for f in files:
+      cache_count += 1
+      cache_size += path.getsize(path.join(dirname, f))
+
+  return (db_size, cache_size, cache_count)
+
+# Read a CSV written by rkr --stats. Returns a list with a dictionary for each row.
+def read_stats(stats_path):
+  if not path.isfile(stats_path):
+    return []
+
+  rows = []
+  header = None
+  for line in open(stats_path, 'r'):
+    fields = [field.strip('"') for field in line.strip().split(',')]
+    if len(fields) < 2:
+      continue
+    if header is None:
+      header = fields
+    else:
+      rows.append(dict(zip(header, fields)))
+  return rows
+
+# Run one build and record its metrics. Per-phase stats for rkr builds are saved to stats_path.
+def metered_build(checkout_path, build_cmd, stats_path):
+  if path.isfile(stats_path):
+    os.remove(stats_path)
+
+  (rc, runtime, max_rss) = measured_build(checkout_path, stats_command(build_cmd, stats_path))
+  (db_size, cache_size, cache_count) = rkr_storage(checkout_path)
+  rows = read_stats(stats_path)
+
+  # Every row records the number of phases the whole build took. There is not one row per phase.
+  phases = max([int(r.get('phase_count', 0)) for r in rows], default=0)
+
+  metrics = {
+    'runtime': runtime,
+    'max_rss_kb': max_rss,
+    'rkr_max_rss_kb': max([int(r.get('max_rss_kb', 0)) for r in rows], default=0),
+    'phases': phases,
+    'db_size': db_size,
+    'cache_size': cache_size,
+    'cache_count': cache_count
+  }
+
+  print('    Finished in {:.2f}s with exit code {}, max RSS {}KB, {} phases'.format(
+      runtime, rc, max_rss, phases))
+  return metrics
+
 def full_build(name, build_tool):
   bench_path = path.join(BENCH_DIR, name)
   checkout_path = path.join(bench_path, 'checkout')
@@ -150,27 +245,126 @@ def full_build(name, build_tool):
   full_time = open(path.join(bench_path, 'full-build-{}.csv'.format(build_tool)), 'w')
   nop_time = open(path.join(bench_path, 'nop-build-{}.csv'.format(build_tool)), 'w')
 
+  metrics = open(metrics_path(name, build_tool), 'w')
+  print('build,rep,{}'.format(','.join(METRICS)), file=metrics)
+
+  stats_dir = path.join(bench_path, 'stats')
+  os.makedirs(stats_dir, exist_ok=True)
+
   for i in range(0, reps):
     setup(name, build_tool)
     copy_files(name, build_tool)
-    print('  Running build {}'.format(i+1))
 
     build_cmd = BENCHMARKS[name][build_tool]['build']
 
-    start_time = time.perf_counter()
-    rc = os.system('cd {}; {} 2> /dev/null 1> /dev/null'.format(checkout_path, build_cmd))
-    end_time = time.perf_counter()
-
-    print('{:.4f}'.format(end_time - start_time), file=full_time)
-    print('    Finished in {:.2f}s with exit code {}'.format(end_time - start_time, rc))
-
-    print('  Running no-op build {}'.format(i+1))
-    start_time = time.perf_counter()
-    rc = os.system('cd {}; {} 2> /dev/null 1> /dev/null'.format(checkout_path, build_cmd))
-    end_time = time.perf_counter()
-    
-    print('{:.4f}'.format(end_time - start_time), file=nop_time)
-    print('    Finished in {:.2f}s with exit code {}'.format(end_time - start_time, rc))
+    for (build, times) in [('full', full_time), ('nop', nop_time)]:
+      if build == 'full':
+        print('  Running build {}'.format(i+1))
+      else:
+        print('  Running no-op build {}'.format(i+1))
+
+      stats_path = path.join(stats_dir, '{}-build-{}-{}.csv'.format(build, build_tool, i))
+      result = metered_build(checkout_path, build_cmd, stats_path)
+
+      print('{:.4f}'.format(result['runtime']), file=times)
+      print('{},{},{}'.format(build, i, ','.join(str(result[m]) for m in METRICS)), file=metrics)
+
+  metrics.close()
+
+  # Check for regressions if there is a baseline to compare against
+  if path.isfile(baseline_path(name, build_tool)):
+    compare(name, build_tool)
+
+def metrics_path(name, build_tool):
+  return path.join(BENCH_DIR, name, 'full-build-{}-metrics.csv'.format(build_tool))
+
+def baseline_path(name, build_tool):
+  return path.join(BENCH_DIR, name, 'full-build-{}-metrics-baseline.csv'.format(build_tool))
+
+# Read a metrics CSV. Returns a dictionary that maps (build, metric) to a list of samples.
+def read_metrics(metrics_file):
+  samples = {}
+  lines = open(metrics_file, 'r').read().splitlines()
+  header = lines[0].split(',')
+  for line in lines[1:]:
+    row = dict(zip(header, line.split(',')))
+    for m in METRICS:
+      if m in row:
+        samples.setdefault((row['build'], m), []).append(float(row[m]))
+  return samples
+
+# Get the one-sided p-value for the hypothesis that current samples are larger than baseline
+# samples, using a permutation test on the difference of means
+def permutation_p_value(baseline, current):
+  pooled = baseline + current
+  observed = statistics.mean(current) - statistics.mean(baseline)
+  n = len(current)
+  total = sum(pooled)
+
+  def difference(chosen):
+    chosen_sum = sum(chosen)
+    return chosen_sum / n - (total - chosen_sum) / len(baseline)
+
+  # Enumerate every way to split the samples when there are few enough, and sample otherwise
+  arrangements = 1
+  for k in range(n):
+    arrangements = arrangements * (len(pooled) - k) // (k + 1)
+
+  if arrangements <= MAX_PERMUTATIONS:
+    splits = [[pooled[i] for i in chosen]
+              for chosen in itertools.combinations(range(len(pooled)), n)]
+  else:
+    rng = random.Random(0)
+    splits = [rng.sample(pooled, n) for _ in range(MAX_PERMUTATIONS)]
+
+  extreme = sum(1 for chosen in splits if difference(chosen) >= observed)
+  return extreme / len(splits)
+
+# Compare the last metrics for a benchmark to its baseline. Returns the number of regressions.
+def compare(name, build_tool):
+  if not path.isfile(baseline_path(name, build_tool)):
+    print('No {} baseline for {}'.format(build_tool, name))
+    return 0
+  if not path.isfile(metrics_path(name, build_tool)):
+    print('No {} metrics for {}'.format(build_tool, name))
+    return 0
+
+  print('Comparing {} build of {} to baseline'.format(build_tool, name))
+  baseline = read_metrics(baseline_path(name, build_tool))
+  current = read_metrics(metrics_path(name, build_tool))
+
+  regressions = 0
+  for key in sorted(current.keys()):
+    if key not in baseline:
+      continue
+    (build, m) = key
+
+    old = statistics.median(baseline[key])
+    new = statistics.median(current[key])
+    if old == 0:
+      continue
+    change = new / old - 1.0
+    p = permutation_p_value(baseline[key], current[key])
+
+    if change > REGRESSION_THRESHOLD and p < SIGNIFICANCE:
+      print('  REGRESSION {} build {}: {:.6g} -> {:.6g} ({:+.1%}, p={:.3f})'.format(
+          build, m, old, new, change, p))
+      regressions += 1
+    elif abs(change) > REGRESSION_THRESHOLD:
+      print('  {} build {}: {:.6g} -> {:.6g} ({:+.1%}, p={:.3f})'.format(
+          build, m, old, new, change, p))
+
+  if regressions == 0:
+    print('  No regressions')
+  return regressions
+
+# Save the last metrics for a benchmark as its baseline
+def save_baseline(name, build_tool):
+  if not path.isfile(metrics_path(name, build_tool)):
+    print('No {} metrics for {}'.format(build_tool, name))
+    return
+  shutil.copyfile(metrics_path(name, build_tool), baseline_path(name, build_tool))
+  print('Saved {} baseline for {}'.format(build_tool, name))
 
 # Count lines in a file (a list of commands) but exclude lines with known prefixes
 def count_lines(filepath, filter=[]):
@@ -243,16 +437,8 @@ def rkr_case_study(name):
       print('Warning: build failed')
       #raise Exception('Build failed')
 
-    # Get the size of the riker database
-    db_size = os.path.getsize('{}/.rkr/db'.format(checkout_path))
-
-    # Compute the size of the riker cache
-    cache_size = 0
-    cache_count = 0
-    for (dirname, subdirs, files) in os.walk('{}/.rkr/cache'.format(checkout_path)):
-      for f in files:
-        cache_count += 1
-        cache_size += os.path.getsize(os.path.join(dirname, f))
+    # Get the size of the riker database and cache
+    (db_size, cache_size, cache_count) = rkr_storage(checkout_path)
 
     commands = count_lines(cmds_path)
     print('{},{},{},{},{},{}'.format(i, commands, runtime, db_size, cache_size, cache_count), file=csv)
@@ -366,6 +552,9 @@ def show_usage():
   print('  full-build  Record the time to complete a full build')
   print('  all         Run both experiments')
   print()
+  print('  compare        Compare the last full-build metrics to the saved baseline')
+  print('  save-baseline  Save the last full-build metrics as the baseline')
+  print()
   print('Build Tools:')
   print('  default       Use each benchmark\'s default build system')
   print('  rkr           Build with riker')
@@ -385,7 +574,7 @@ if __name__ == '__main__':
     exit(1)
   
   # Validate and unpack the experiment argument
-  if sys.argv[1] not in ['case-study', 'full-build', 'all']:
+  if sys.argv[1] not in ['case-study', 'full-build', 'all', 'compare', 'save-baseline']:
     print('Invalid experiment name "{}"'.format(sys.argv[1]))
     show_usage()
     exit(1)
@@ -410,8 +599,11 @@ if __name__ == '__main__':
         print('Invalid benchmark name "{}"'.format(arg))
         show_usage()
         exit(1)
-      if experiment != 'all' and experiment not in BENCHMARKS[arg]['experiments']:
-        print('Warning: benchmark {} does not support the {} experiment'.format(arg, experiment))
+      required = experiment
+      if experiment == 'compare' or experiment == 'save-baseline':
+        required = 'full-build'
+      if required != 'all' and required not in BENCHMARKS[arg]['experiments']:
+        print('Warning: benchmark {} does not support the {} experiment'.format(arg, required))
       benchmarks.append(arg)
   
   # Make sure there's at least one benchmark to run
@@ -420,6 +612,23 @@ if __name__ == '__main__':
     show_usage()
     exit(1)
 
+  # Compare to or save baselines without running any builds
+  if experiment == 'compare' or experiment == 'save-baseline':
+    tools = [build_tool]
+    if build_tool == 'all':
+      tools = ['default', 'rkr']
+
+    regressions = 0
+    for bench in benchmarks:
+      for tool in tools:
+        if experiment == 'compare':
+          regressions += compare(bench, tool)
+        else:
+          save_baseline(bench, tool)
+
+    # Exit with an error if anything regressed so scripts can check the result
+    exit(1 if regressions > 0 else 0)
+
   # If rkr is going to be used make sure we have an updated release build
   if build_tool == 'rkr' or build_tool == 'rkr-parallel' or build_tool == 'all':
     print('Updating rkr release build')
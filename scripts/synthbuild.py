@@ -0,0 +1,248 @@
+#!/usr/bin/env python3
+
+# Generate synthetic projects with a Rikerfile, and measure how rkr scales as they grow.
+#
+#   synthbuild.py generate DIR [options]     Write one synthetic project to DIR
+#   synthbuild.py bench [options]            Time full, no-op, and single-edit builds across sizes
+#
+# Every command in a generated project is a cheap wc over its inputs, so build times are dominated
+# by rkr itself: tracing, trace replay, command matching, and planning. Outputs stay small no matter
+# how long the dependency chains are.
+
+import argparse
+import os
+from os import path
+import random
+import shutil
+import time
+
+RKR_DIR = path.abspath(path.join(path.dirname(__file__), '..'))
+SYNTH_DIR = path.join(RKR_DIR, 'benchmarks', 'synthetic')
+DEFAULT_SIZES = [1000, 10000, 100000]
+DEFAULT_REPS = 3
+
+# Generated files are spread over nested directories, with this many files in each leaf directory
+FILES_PER_DIR = 64
+
+# The number of subdirectories in each generated directory
+DIR_WIDTH = 16
+
+# Add the release version of rkr to the path
+os.environ['PATH'] = path.join(RKR_DIR, 'release', 'bin') + ':' + os.environ['PATH']
+
+# Get the directory that holds file number index, nested depth levels below root
+def nested_dir(root, index, depth):
+  n = index // FILES_PER_DIR
+  parts = []
+  for _ in range(depth):
+    n, r = divmod(n, DIR_WIDTH)
+    parts.append('d{}'.format(r))
+  parts.reverse()
+  return path.join(root, *parts)
+
+def source_path(i, depth):
+  return path.join(nested_dir('src', i, depth), 'c{}.in'.format(i))
+
+def output_path(i, depth):
+  return path.join(nested_dir('out', i, depth), 'c{}.out'.format(i))
+
+def header_path(j, depth):
+  return path.join(nested_dir('include', j, depth), 'h{}.h'.format(j))
+
+# Split the commands into layers. Each command reads outputs from the layer before its own.
+def make_layers(args):
+  if args.shape == 'flat':
+    count = 1
+  elif args.shape == 'chain':
+    count = args.commands
+  else:
+    count = min(args.layers, args.commands)
+
+  layers = []
+  start = 0
+  for l in range(count):
+    end = (args.commands * (l + 1)) // count
+    layers.append(range(start, end))
+    start = end
+  return layers
+
+# Write one command as a line of shell
+def command_line(inputs, output, rng, args):
+  kind = rng.random()
+  if kind < args.pipes:
+    return 'cat {} | wc -c > {}'.format(' '.join(inputs), output)
+  elif kind < args.pipes + args.tempfiles:
+    return 't=$(mktemp); cat {} > "$t"; wc -c < "$t" > {}; rm "$t"'.format(' '.join(inputs), output)
+  else:
+    return 'wc -c {} > {}'.format(' '.join(inputs), output)
+
+def generate(dest, args):
+  rng = random.Random(args.seed)
+
+  if path.isdir(dest):
+    shutil.rmtree(dest)
+  os.makedirs(dest)
+
+  def write(name, content, mode=0o644):
+    full = path.join(dest, name)
+    os.makedirs(path.dirname(full), exist_ok=True)
+    with open(full, 'w') as f:
+      f.write(content)
+    os.chmod(full, mode)
+
+  # Write the headers and sources
+  for j in range(args.headers):
+    write(header_path(j, args.depth), 'header {}\n'.format(j))
+  for i in range(args.commands):
+    write(source_path(i, args.depth), 'source {}\n'.format(i))
+
+  # Generate a line of shell for each command
+  lines = []
+  layers = make_layers(args)
+  for l, layer in enumerate(layers):
+    for i in layer:
+      inputs = [source_path(i, args.depth)]
+      if args.headers > 0:
+        for j in rng.sample(range(args.headers), min(args.includes, args.headers)):
+          inputs.append(header_path(j, args.depth))
+      if l > 0:
+        prev = layers[l - 1]
+        for k in rng.sample(prev, min(args.fan_in, len(prev))):
+          inputs.append(output_path(k, args.depth))
+      lines.append(command_line(inputs, output_path(i, args.depth), rng, args))
+
+  # The output directories are created by the build
+  out_dirs = sorted(set(path.dirname(output_path(i, args.depth)) for i in range(args.commands)))
+  setup = []
+  for k in range(0, len(out_dirs), 256):
+    setup.append('mkdir -p {}'.format(' '.join(out_dirs[k:k + 256])))
+
+  # Either run every command from the Rikerfile, or from a tree of group scripts
+  rikerfile = '#!/bin/sh\n\nset -e\n\n' + '\n'.join(setup) + '\n\n'
+  if args.group == 0:
+    rikerfile += '\n'.join(lines) + '\n'
+  else:
+    for g in range(0, len(lines), args.group):
+      script = path.join(nested_dir('build', g // args.group, args.depth),
+                         'b{}.sh'.format(g // args.group))
+      write(script, '#!/bin/sh\n\nset -e\n\n' + '\n'.join(lines[g:g + args.group]) + '\n', 0o755)
+      rikerfile += './{}\n'.format(script)
+
+  write('Rikerfile', rikerfile, 0o755)
+
+# Make the change measured by the single-edit build
+def edit(dest, args):
+  if args.edit == 'header' and args.headers > 0:
+    target = header_path(0, args.depth)
+  else:
+    target = source_path(0, args.depth)
+  with open(path.join(dest, target), 'a') as f:
+    f.write('edited\n')
+
+# Run a build and return its runtime
+def timed_build(dest, args):
+  start_time = time.perf_counter()
+  rc = os.system('cd {}; rkr {} 2> /dev/null 1> /dev/null'.format(dest, args.rkr_args))
+  runtime = time.perf_counter() - start_time
+  if rc != 0:
+    print('    Warning: build failed with exit code {}'.format(rc))
+  return runtime
+
+def bench(args):
+  sizes = [int(s) for s in args.sizes.split(',')]
+
+  os.makedirs(SYNTH_DIR, exist_ok=True)
+  csv_path = args.output or path.join(SYNTH_DIR, 'scale-rkr.csv')
+  csv = open(csv_path, 'w')
+  print('commands,rep,full,nop,edit,db_size', file=csv)
+
+  for size in sizes:
+    args.commands = size
+    dest = path.join(SYNTH_DIR, 'checkout-{}'.format(size))
+
+    for i in range(args.reps):
+      print('Synthetic build with {} commands, run {}'.format(size, i + 1))
+      generate(dest, args)
+
+      full = timed_build(dest, args)
+      print('  Full build finished in {:.2f}s'.format(full))
+
+      nop = timed_build(dest, args)
+      print('  No-op build finished in {:.2f}s'.format(nop))
+
+      edit(dest, args)
+      edited = timed_build(dest, args)
+      print('  Single-edit build finished in {:.2f}s'.format(edited))
+
+      db_size = 0
+      db_path = path.join(dest, '.rkr', 'db')
+      if path.isfile(db_path):
+        db_size = path.getsize(db_path)
+
+      print('{},{},{:.4f},{:.4f},{:.4f},{}'.format(size, i, full, nop, edited, db_size), file=csv)
+      csv.flush()
+
+    if not args.keep:
+      shutil.rmtree(dest)
+
+  print('Wrote results to {}'.format(path.relpath(csv_path)))
+
+def add_shape_arguments(parser):
+  parser.add_argument('--shape', choices=['flat', 'layered', 'chain'], default='layered',
+                      help='how commands depend on each other (default: layered)')
+  parser.add_argument('--layers', type=int, default=8,
+                      help='the number of layers in a layered build (default: 8)')
+  parser.add_argument('--fan-in', type=int, default=4,
+                      help='outputs from the previous layer each command reads (default: 4)')
+  parser.add_argument('--headers', type=int, default=256,
+                      help='the number of shared header files (default: 256)')
+  parser.add_argument('--includes', type=int, default=8,
+                      help='headers each command reads (default: 8)')
+  parser.add_argument('--depth', type=int, default=2,
+                      help='the directory depth of generated files (default: 2)')
+  parser.add_argument('--pipes', type=float, default=0.1,
+                      help='the fraction of commands that run a pipeline (default: 0.1)')
+  parser.add_argument('--tempfiles', type=float, default=0.05,
+                      help='the fraction of commands that use a temporary file (default: 0.05)')
+  parser.add_argument('--group', type=int, default=0,
+                      help='run commands from scripts of this many commands, or 0 to run every '
+                           'command from the Rikerfile (default: 0)')
+  parser.add_argument('--seed', type=int, default=0,
+                      help='the random seed used to pick inputs (default: 0)')
+
+if __name__ == '__main__':
+  parser = argparse.ArgumentParser(description='Generate and build synthetic rkr projects')
+  subparsers = parser.add_subparsers(dest='action', required=True)
+
+  gen_parser = subparsers.add_parser('generate', help='write a synthetic project')
+  gen_parser.add_argument('dest', help='the directory to write the project to')
+  gen_parser.add_argument('--commands', type=int, default=1000,
+                          help='the number of commands (default: 1000)')
+  add_shape_arguments(gen_parser)
+
+  bench_parser = subparsers.add_parser('bench', help='time builds of synthetic projects')
+  bench_parser.add_argument('--sizes', default=','.join(str(s) for s in DEFAULT_SIZES),
+                            help='comma-separated command counts to build (default: {})'.format(
+                                ','.join(str(s) for s in DEFAULT_SIZES)))
+  bench_parser.add_argument('--reps', type=int, default=DEFAULT_REPS,
+                            help='builds at each size (default: {})'.format(DEFAULT_REPS))
+  bench_parser.add_argument('--edit', choices=['source', 'header'], default='source',
+                            help='the file changed before the single-edit build (default: source)')
+  bench_parser.add_argument('--rkr-args', default='',
+                            help='extra arguments passed to every rkr build')
+  bench_parser.add_argument('--keep', action='store_true',
+                            help='keep generated projects after measuring them')
+  bench_parser.add_argument('-o', '--output', help='the CSV file to write results to')
+  add_shape_arguments(bench_parser)
+
+  args = parser.parse_args()
+  if args.action == 'generate':
+    generate(args.dest, args)
+    print('Generated {} commands in {}'.format(args.commands, args.dest))
+  else:
+    print('Updating rkr release build')
+    rc = os.system('cd {}; make release 2>&1 > /dev/null'.format(RKR_DIR))
+    if rc != 0:
+      print('Riker release build failed!')
+      exit(1)
+    bench(args)
@@ -0,0 +1,611 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <fcntl.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "artifacts/Artifact.hh"
+#include "artifacts/DirArtifact.hh"
+#include "data/AccessFlags.hh"
+#include "data/IRBuffer.hh"
+#include "data/IRSink.hh"
+#include "data/IRSource.hh"
+#include "data/ReadWriteCombiner.hh"
+#include "data/Trace.hh"
+#include "runtime/Build.hh"
+#include "runtime/Command.hh"
+#include "runtime/Ref.hh"
+#include "runtime/ResolutionCache.hh"
+#include "runtime/env.hh"
+#include "tracing/channel.h"
+#include "tracing/inject.h"
+#include "util/log.hh"
+#include "versions/FileVersion.hh"
+#include "versions/MetadataVersion.hh"
+
+using std::list;
+using std::make_shared;
+using std::shared_ptr;
+using std::string;
+using std::to_string;
+using std::tuple;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+using Clock = std::chrono::steady_clock;
+
+/// The result of a single benchmark
+struct Result {
+  string name;
+  size_t ops;
+  int64_t ns;
+  size_t bytes;
+};
+
+/// The results of every benchmark run so far
+static vector<Result> results;
+
+/**
+ * Record the result of a single benchmark, and print it for anyone watching
+ * \param name    The name of the benchmark
+ * \param ops     The number of operations the benchmark performed
+ * \param elapsed The total time taken to perform those operations
+ * \param bytes   The number of bytes the benchmark processed, if that is meaningful
+ */
+static void report(const char* name,
+                   size_t ops,
+                   Clock::duration elapsed,
+                   size_t bytes = 0) noexcept {
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+  fprintf(stderr, "%-24s %10zu ops %12.3f ms %10.1f ns/op", name, ops, ns / 1e6,
+          static_cast<double>(ns) / ops);
+  if (bytes > 0) fprintf(stderr, " %10.1f MB/s", bytes / 1e6 / (ns / 1e9));
+  fprintf(stderr, "\n");
+
+  results.push_back(Result{name, ops, ns, bytes});
+}
+
+/// Write every recorded result as JSON
+static void write_results(FILE* f) noexcept {
+  fprintf(f, "{\n  \"benchmarks\": [");
+  for (size_t i = 0; i < results.size(); i++) {
+    const auto& r = results[i];
+    fprintf(f, "%s\n    {\"name\": \"%s\", \"ops\": %zu, \"ns\": %lld, \"ns_per_op\": %.3f",
+            i == 0 ? "" : ",", r.name.c_str(), r.ops, static_cast<long long>(r.ns),
+            static_cast<double>(r.ns) / r.ops);
+    if (r.bytes > 0) fprintf(f, ", \"bytes\": %zu", r.bytes);
+    fprintf(f, "}");
+  }
+  fprintf(f, "\n  ]\n}\n");
+}
+
+/**
+ * Resolve paths against a synthetic directory tree that exists only in the filesystem model. The
+ * tree has dirs x dirs directories, each holding files regular files. Every lookup goes through
+ * DirArtifact::resolve, so this measures the cost of matching path components to entries.
+ */
+static void bench_resolve(size_t dirs, size_t files, size_t lookups) noexcept {
+  auto c = make_shared<Command>(vector<string>{"bench"});
+
+  // Build the tree and remember the path to every file in it
+  auto top = env::getDir(c, 0755);
+  vector<string> paths;
+  for (size_t i = 0; i < dirs; i++) {
+    auto d1 = env::getDir(c, 0755);
+    top->addEntry(c, "d" + to_string(i), d1);
+
+    for (size_t j = 0; j < dirs; j++) {
+      auto d2 = env::getDir(c, 0755);
+      d1->addEntry(c, "d" + to_string(j), d2);
+
+      for (size_t k = 0; k < files; k++) {
+        auto f = env::createFile(c, 0644);
+        d2->addEntry(c, "f" + to_string(k), f);
+        paths.push_back("d" + to_string(i) + "/d" + to_string(j) + "/f" + to_string(k));
+      }
+    }
+  }
+
+  AccessFlags flags;
+  flags.r = true;
+
+  auto start = Clock::now();
+  for (size_t n = 0; n < lookups; n++) {
+    auto ref = top->resolve(c, paths[n % paths.size()], flags);
+    ASSERT(ref.isSuccess()) << "Failed to resolve " << paths[n % paths.size()];
+  }
+  report("resolve", lookups, Clock::now() - start);
+
+  // Repeat the lookups through a resolution cache
+  ResolutionCache cache;
+  start = Clock::now();
+  for (size_t n = 0; n < lookups; n++) {
+    auto ref = cache.resolve(c, top, paths[n % paths.size()], flags);
+    ASSERT(ref.isSuccess()) << "Failed to resolve " << paths[n % paths.size()];
+  }
+  report("resolve_cached", lookups, Clock::now() - start);
+}
+
+/**
+ * Create artifacts for a directory tree on the real filesystem with dirs directories of files
+ * regular files each. The first pass measures creating an artifact for every path, which stats the
+ * file and adds it to the inode map. The second pass finds the same artifacts again by inode. The
+ * last pass drops every artifact and measures the rollback that compacts the artifact registry.
+ */
+static void bench_inodes(size_t dirs, size_t files) noexcept {
+  char tmpl[] = "/tmp/rkr-bench-XXXXXX";
+  fs::path root = ::mkdtemp(tmpl);
+
+  // Create the tree
+  vector<fs::path> paths;
+  for (size_t i = 0; i < dirs; i++) {
+    auto dir = root / ("d" + to_string(i));
+    fs::create_directory(dir);
+    for (size_t j = 0; j < files; j++) {
+      auto path = dir / ("f" + to_string(j));
+      int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      FAIL_IF(fd == -1) << "Failed to create " << path << ": " << ERR;
+      ::close(fd);
+      paths.push_back(path);
+    }
+  }
+
+  // Create an artifact for every file, and keep them alive
+  vector<shared_ptr<Artifact>> artifacts;
+  artifacts.reserve(paths.size());
+  auto start = Clock::now();
+  for (const auto& path : paths) {
+    artifacts.push_back(env::getFilesystemArtifact(path));
+  }
+  report("inode_create", paths.size(), Clock::now() - start);
+
+  // Look up every file again
+  start = Clock::now();
+  for (const auto& path : paths) {
+    auto a = env::getFilesystemArtifact(path);
+    ASSERT(a) << "Failed to find an artifact for " << path;
+  }
+  report("inode_lookup", paths.size(), Clock::now() - start);
+
+  // Drop the artifacts and compact the registry
+  artifacts.clear();
+  start = Clock::now();
+  env::rollback();
+  report("artifact_compact", paths.size(), Clock::now() - start);
+
+  fs::remove_all(root);
+}
+
+/// An IR sink that counts the steps it receives
+class CountingSink : public IRSink {
+ public:
+  size_t steps = 0;
+
+  virtual void pathRef(const IRSource& source,
+                       const shared_ptr<Command>& command,
+                       Ref::ID base,
+                       fs::path path,
+                       AccessFlags flags,
+                       Ref::ID output) noexcept override {
+    steps++;
+  }
+
+  virtual void expectResult(const IRSource& source,
+                            const shared_ptr<Command>& command,
+                            Scenario scenario,
+                            Ref::ID ref,
+                            int8_t expected) noexcept override {
+    steps++;
+  }
+
+  virtual void matchMetadata(const IRSource& source,
+                             const shared_ptr<Command>& command,
+                             Scenario scenario,
+                             Ref::ID ref,
+                             MetadataVersion version) noexcept override {
+    steps++;
+  }
+
+  virtual void matchContent(const IRSource& source,
+                            const shared_ptr<Command>& command,
+                            Scenario scenario,
+                            Ref::ID ref,
+                            shared_ptr<ContentVersion> version) noexcept override {
+    steps++;
+  }
+
+  virtual void updateContent(const IRSource& source,
+                             const shared_ptr<Command>& command,
+                             Ref::ID ref,
+                             shared_ptr<ContentVersion> version) noexcept override {
+    steps++;
+  }
+
+  virtual void launch(const IRSource& source,
+                      const shared_ptr<Command>& command,
+                      const shared_ptr<Command>& child,
+                      list<tuple<Ref::ID, Ref::ID>> refs) noexcept override {
+    steps++;
+  }
+
+  virtual void exit(const IRSource& source,
+                    const shared_ptr<Command>& command,
+                    int exit_status) noexcept override {
+    steps++;
+  }
+};
+
+/**
+ * Write a synthetic trace where a root command launches commands children, and each child reads
+ * and writes files files. Then decode the whole trace into a sink that only counts steps. This
+ * measures record emission and decoding without any emulation.
+ */
+static void bench_trace(size_t commands, size_t files) noexcept {
+  TracedIRSource source;
+
+  // The root of a trace is always the empty command, as in DefaultTrace
+  auto root = make_shared<Command>();
+
+  AccessFlags flags;
+  flags.r = true;
+  flags.w = true;
+  MetadataVersion metadata(0, 0, 0644);
+
+  TraceWriter writer;
+  size_t steps = 0;
+  auto start = Clock::now();
+  writer.start(root);
+  for (size_t i = 0; i < commands; i++) {
+    auto child = make_shared<Command>(vector<string>{"cc", "-c", "f" + to_string(i) + ".c"});
+    writer.launch(source, root, child, {});
+    steps++;
+
+    for (size_t j = 0; j < files; j++) {
+      Ref::ID ref = Ref::ReservedRefs + j;
+      writer.pathRef(source, child, Ref::Cwd, "d" + to_string(i) + "/f" + to_string(j), flags,
+                     ref);
+      writer.expectResult(source, child, Scenario::Build, ref, 0);
+      writer.matchMetadata(source, child, Scenario::Build, ref, metadata);
+      writer.matchContent(source, child, Scenario::Build, ref, make_shared<FileVersion>());
+      writer.updateContent(source, child, ref, make_shared<FileVersion>());
+      steps += 5;
+    }
+
+    writer.exit(source, child, 0);
+    steps++;
+  }
+  writer.finish();
+  report("trace_write", steps, Clock::now() - start);
+
+  auto reader = writer.getReader();
+  CountingSink sink;
+  start = Clock::now();
+  reader.sendTo(sink);
+  report("trace_read", sink.steps, Clock::now() - start);
+}
+
+/**
+ * Compare the two parts of loading the last build for a new one. A synthetic trace, where a top
+ * command launches commands children that each read files files and write one output, is saved
+ * to disk. The first measurement reads and decodes that trace into an IRBuffer, which is all the
+ * build server saves a build. The second emulates the buffered steps against the real files in a
+ * new Build, which every build still does, even when the server started it.
+ */
+static void bench_reload(size_t commands, size_t files) noexcept {
+  char tmpl[] = "/tmp/rkr-bench-XXXXXX";
+  fs::path root_dir = ::mkdtemp(tmpl);
+  auto old_cwd = fs::current_path();
+  fs::current_path(root_dir);
+
+  // Create the files the trace refers to
+  for (size_t i = 0; i < commands; i++) {
+    auto dir = "d" + to_string(i);
+    fs::create_directory(dir);
+    for (size_t j = 0; j <= files; j++) {
+      auto path = dir + "/f" + to_string(j);
+      int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      FAIL_IF(fd == -1) << "Failed to create " << path << ": " << ERR;
+      ::close(fd);
+    }
+  }
+
+  // Write the trace, starting as DefaultTrace does so the commands have a root and working dir
+  TracedIRSource source;
+  auto root = make_shared<Command>();
+  auto top = make_shared<Command>(vector<string>{"rkr-launch", "Rikerfile"});
+  list<tuple<Ref::ID, Ref::ID>> refs = {{Ref::Stdin, Ref::Stdin},   {Ref::Stdout, Ref::Stdout},
+                                        {Ref::Stderr, Ref::Stderr}, {Ref::Root, Ref::Root},
+                                        {Ref::Cwd, Ref::Cwd},       {Ref::Exe, Ref::Exe}};
+
+  AccessFlags read_flags;
+  read_flags.r = true;
+  AccessFlags write_flags;
+  write_flags.w = true;
+  MetadataVersion metadata(getuid(), getgid(), S_IFREG | 0644);
+
+  // The trace is saved when the writer is destroyed
+  auto db = (root_dir / "db").string();
+  size_t steps = 0;
+  {
+    TraceWriter writer(db);
+    writer.start(root);
+    for (auto [special, ref] : {tuple{SpecialRef::stdin, Ref::Stdin},
+                                tuple{SpecialRef::stdout, Ref::Stdout},
+                                tuple{SpecialRef::stderr, Ref::Stderr},
+                                tuple{SpecialRef::root, Ref::Root},
+                                tuple{SpecialRef::cwd, Ref::Cwd},
+                                tuple{SpecialRef::launch_exe, Ref::Exe}}) {
+      writer.specialRef(source, root, special, ref);
+      writer.usingRef(source, root, ref);
+      steps += 2;
+    }
+    writer.launch(source, root, top, refs);
+    steps++;
+
+    for (size_t i = 0; i < commands; i++) {
+      auto dir = "d" + to_string(i);
+      auto child = make_shared<Command>(vector<string>{"cc", "-c", dir + ".c"});
+      writer.launch(source, top, child, refs);
+      steps++;
+
+      for (size_t j = 0; j < files; j++) {
+        Ref::ID ref = Ref::ReservedRefs + j;
+        writer.pathRef(source, child, Ref::Cwd, dir + "/f" + to_string(j), read_flags, ref);
+        writer.expectResult(source, child, Scenario::Build, ref, 0);
+        writer.matchMetadata(source, child, Scenario::Build, ref, metadata);
+        writer.matchContent(source, child, Scenario::Build, ref, make_shared<FileVersion>());
+        steps += 4;
+      }
+
+      Ref::ID out = Ref::ReservedRefs + files;
+      writer.pathRef(source, child, Ref::Cwd, dir + "/f" + to_string(files), write_flags, out);
+      writer.expectResult(source, child, Scenario::Build, out, 0);
+      writer.updateContent(source, child, out, make_shared<FileVersion>());
+      writer.exit(source, child, 0);
+      steps += 4;
+    }
+    writer.exit(source, top, 0);
+    writer.finish();
+    steps++;
+  }
+
+  // Load and decode the trace, as the build server does before a build
+  auto start = Clock::now();
+  auto loaded = TraceReader::load(db);
+  FAIL_IF(!loaded.has_value()) << "Failed to load the trace from " << db;
+  IRBuffer buffer;
+  loaded->sendTo(buffer);
+  report("trace_load", steps, Clock::now() - start);
+
+  // Emulate the decoded trace, as every build does in its first phase
+  start = Clock::now();
+  {
+    TraceWriter output;
+    Build build(output);
+    buffer.sendTo(build);
+  }
+  report("trace_emulate", steps, Clock::now() - start);
+
+  env::rollback();
+  fs::current_path(old_cwd);
+  fs::remove_all(root_dir);
+}
+
+/**
+ * Send a stream of repeated reads and writes through the read/write combiner. Each command
+ * writes through one reference several times and reads it back, so most steps are filtered out.
+ */
+static void bench_combiner(size_t commands, size_t repeats) noexcept {
+  TracedIRSource source;
+  ReadWriteCombiner<CountingSink> combiner;
+
+  vector<shared_ptr<Command>> cmds;
+  for (size_t i = 0; i < commands; i++) {
+    cmds.push_back(make_shared<Command>(vector<string>{"c" + to_string(i)}));
+  }
+
+  size_t steps = 0;
+  auto start = Clock::now();
+  for (const auto& c : cmds) {
+    for (size_t r = 0; r < repeats; r++) {
+      combiner.updateContent(source, c, Ref::Stdout, make_shared<FileVersion>());
+      combiner.matchContent(source, c, Scenario::Build, Ref::Stdout, nullptr);
+      combiner.matchContent(source, c, Scenario::Build, Ref::Stdin, nullptr);
+      steps += 3;
+    }
+  }
+  combiner.finish();
+  report("combiner", steps, Clock::now() - start);
+
+  LOG(phase) << "Combiner passed " << combiner.steps << " of " << steps << " steps";
+}
+
+/**
+ * Fingerprint files of a given size with BLAKE3, using a new version each time so no result is
+ * reused. Each pass reads from the page cache, so this measures hashing rather than disk reads.
+ */
+static void bench_fingerprint(const char* name, size_t size, size_t count) noexcept {
+  char tmpl[] = "/tmp/rkr-bench-XXXXXX";
+  int fd = ::mkstemp(tmpl);
+  FAIL_IF(fd == -1) << "Failed to create a temporary file: " << ERR;
+
+  vector<char> data(size);
+  for (size_t i = 0; i < size; i++) data[i] = i * 31 + (i >> 8);
+  FAIL_IF(::write(fd, data.data(), size) != static_cast<ssize_t>(size))
+      << "Failed to write a temporary file: " << ERR;
+  ::close(fd);
+
+  auto start = Clock::now();
+  for (size_t i = 0; i < count; i++) {
+    auto v = make_shared<FileVersion>();
+    v->fingerprint(tmpl, FingerprintType::Full);
+    ASSERT(v->getHash().has_value()) << "Failed to fingerprint " << tmpl;
+  }
+  report(name, count, Clock::now() - start, size * count);
+
+  ::unlink(tmpl);
+}
+
+/**
+ * Plan a build over a synthetic dependency graph. Commands are arranged in layers of width
+ * commands, and each command reads the output of fan_in commands in the layer before it. Outputs
+ * alternate between versions that can be committed and versions that can't, so planning follows
+ * both MayRun and MustRun edges. Every pass starts from a changed first layer.
+ */
+static void bench_planning(size_t layers, size_t width, size_t fan_in, size_t passes) noexcept {
+  auto root = make_shared<Command>(vector<string>{"root"});
+
+  vector<shared_ptr<Command>> all;
+  vector<tuple<shared_ptr<Command>, shared_ptr<Artifact>, shared_ptr<FileVersion>>> previous;
+  for (size_t l = 0; l < layers; l++) {
+    vector<tuple<shared_ptr<Command>, shared_ptr<Artifact>, shared_ptr<FileVersion>>> layer;
+    for (size_t i = 0; i < width; i++) {
+      auto c = make_shared<Command>(vector<string>{"c" + to_string(l) + "." + to_string(i)});
+      root->addChild(c);
+      all.push_back(c);
+
+      for (size_t k = 0; k < fan_in && !previous.empty(); k++) {
+        const auto& [producer, a, v] = previous[(i * 7 + k) % previous.size()];
+        c->addContentInput(a, v, producer);
+      }
+
+      auto v = make_shared<FileVersion>();
+      if (i % 2 == 0) v->makeEmptyFingerprint();
+      layer.emplace_back(c, env::createFile(c, 0644), v);
+    }
+    previous = std::move(layer);
+  }
+
+  // The first layer observed a change. The current runs then become the previous runs that
+  // planning reads.
+  for (size_t i = 0; i < width; i++) all[i]->observeChange(Scenario::Both);
+  root->finishRun();
+  for (const auto& c : all) c->finishRun();
+
+  auto start = Clock::now();
+  for (size_t p = 0; p < passes; p++) {
+    for (const auto& c : all) c->setMarking(RebuildMarking::Emulate);
+    root->planBuild();
+  }
+  report("planning", all.size() * passes, Clock::now() - start);
+}
+
+/**
+ * Pass system calls through a shared memory tracing channel between this process and a child
+ * that plays the tracee. The child uses the injected library's own acquire, wait and release
+ * functions from tracing/channel.h, including their statistics, and this process answers each
+ * call the way the tracer does. This measures the round-trip cost of the fast tracing path without
+ * ptrace or seccomp.
+ * \param calls The number of calls to pass through the channel
+ * \param stats Should the tracee record channel statistics, as it does with --syscall-stats?
+ */
+static void bench_channel(size_t calls, bool stats) noexcept {
+  void* p = ::mmap(nullptr, sizeof(shared_tracing_data), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  FAIL_IF(p == MAP_FAILED) << "Failed to map a tracing channel: " << ERR;
+
+  auto shmem = static_cast<shared_tracing_data*>(p);
+  memset(shmem, 0, sizeof(shared_tracing_data));
+  sem_init(&shmem->available, 1, TRACING_CHANNEL_COUNT);
+  for (size_t i = 0; i < TRACING_CHANNEL_COUNT; i++) {
+    sem_init(&shmem->channels[i].wake_tracee, 1, 0);
+  }
+  shmem->collect_stats = stats;
+
+  auto start = Clock::now();
+
+  pid_t child = ::fork();
+  FAIL_IF(child == -1) << "Failed to fork: " << ERR;
+  if (child == 0) {
+    pid_t tid = ::getpid();
+    for (size_t n = 0; n < calls; n++) {
+      size_t c = channel_acquire(shmem, tid);
+      __atomic_store_n(&shmem->channels[c].state, CHANNEL_STATE_PRE_SYSCALL_WAIT,
+                       __ATOMIC_RELEASE);
+      channel_wait(shmem, c);
+      channel_release(shmem, c);
+    }
+    ::_exit(0);
+  }
+
+  // Answer each call the way the tracer does for a channelContinue
+  size_t handled = 0;
+  while (handled < calls) {
+    for (size_t i = 0; i < TRACING_CHANNEL_COUNT; i++) {
+      auto state = __atomic_load_n(&shmem->channels[i].state, __ATOMIC_ACQUIRE);
+      if (state != CHANNEL_STATE_PRE_SYSCALL_WAIT) continue;
+
+      shmem->channels[i].state = CHANNEL_STATE_OBSERVED;
+      shmem->channels[i].action = CHANNEL_ACTION_CONTINUE;
+      __atomic_store_n(&shmem->channels[i].state, CHANNEL_STATE_PROCEED, __ATOMIC_RELEASE);
+      while (sem_post(&shmem->channels[i].wake_tracee) == -1) {
+      }
+      handled++;
+    }
+  }
+
+  int status;
+  ::waitpid(child, &status, 0);
+  report(stats ? "channel_round_trip_stats" : "channel_round_trip", calls, Clock::now() - start);
+
+  ::munmap(p, sizeof(shared_tracing_data));
+}
+
+/// Should a benchmark group run, given the names requested on the command line?
+static bool selected(const vector<string>& names, const char* group) noexcept {
+  if (names.empty()) return true;
+  for (const auto& name : names) {
+    if (name == group) return true;
+  }
+  return false;
+}
+
+/**
+ * This is the entry point for the rkr microbenchmarks. Results are written as JSON to standard
+ * output, or to the file passed with -o. Any other arguments select benchmark groups by name.
+ */
+int main(int argc, char* argv[]) noexcept {
+  FILE* output = stdout;
+  vector<string> names;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = fopen(argv[++i], "w");
+      FAIL_IF(output == nullptr) << "Failed to open " << argv[i] << ": " << ERR;
+    } else {
+      names.push_back(argv[i]);
+    }
+  }
+
+  if (selected(names, "resolve")) bench_resolve(16, 64, 1000000);
+  if (selected(names, "inodes")) bench_inodes(1000, 1000);
+  if (selected(names, "trace")) bench_trace(10000, 20);
+  if (selected(names, "reload")) bench_reload(1000, 20);
+  if (selected(names, "combiner")) bench_combiner(10000, 100);
+  if (selected(names, "fingerprint")) {
+    bench_fingerprint("fingerprint_4k", 4 << 10, 10000);
+    bench_fingerprint("fingerprint_1m", 1 << 20, 1000);
+    bench_fingerprint("fingerprint_64m", 64 << 20, 16);
+  }
+  if (selected(names, "planning")) bench_planning(100, 1000, 4, 10);
+  if (selected(names, "channel")) {
+    bench_channel(100000, false);
+    bench_channel(100000, true);
+  }
+
+  write_results(output);
+  if (output != stdout) fclose(output);
+
+  return 0;
+}
@@ -2,6 +2,7 @@
 #define _GNU_SOURCE
 #endif
 
+#include "tracing/channel.h"
 #include "tracing/inject.h"
 
 #include <dlfcn.h>
@@ -18,9 +19,6 @@
 #include <syscall.h>
 #include <unistd.h>
 
-// How many times should a thread spin on a contended lock before backing off?
-#define SPIN_BACKOFF_COUNT 512
-
 // These symbols are provided by the assembly implementation of the safe syscall function
 extern void safe_syscall_start;
 extern void safe_syscall_end;
@@ -38,9 +36,6 @@ static struct shared_tracing_data* shmem = NULL;
 // The function to initialize the injected library
 void rkr_inject_init();
 
-// A function to pause briefly while spinning
-void spinlock_pause();
-
 // Replacement implementations of simple functions that use fast shared-memory tracing
 static int fast_open(const char* pathname, int flags, mode_t mode);
 static int fast_openat(int dfd, const char* pathname, int flags, mode_t mode);
@@ -211,61 +206,6 @@ void rkr_inject_init() {
   rkr_detour("getdents64", fast_getdents);
 }
 
-size_t channel_acquire(pid_t tid) {
-  // Block until we know there's an available channel
-  while (sem_wait(&shmem->available) == -1) {
-  }
-
-  // Loop until we find a channel to claim
-  size_t i = tid % TRACING_CHANNEL_COUNT;
-  while (true) {
-    // Peek at the state of the channel
-    uint8_t state = __atomic_load_n(&shmem->channels[i].state, __ATOMIC_RELAXED);
-
-    // If the channel is available, try to acquire it.
-    if (state == CHANNEL_STATE_AVAILABLE &&
-        __atomic_compare_exchange_n(&shmem->channels[i].state, &state, CHANNEL_STATE_ACQUIRED, true,
-                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
-      // Successfully acquired the channel
-      shmem->channels[i].tid = tid;
-      shmem->channels[i].buffer_pos = 0;
-
-      return i;
-    }
-
-    i = (i + 1) % TRACING_CHANNEL_COUNT;
-  }
-}
-
-void channel_release(size_t c) {
-  // Reset the channel to available
-  __atomic_store_n(&shmem->channels[c].state, CHANNEL_STATE_AVAILABLE, __ATOMIC_RELEASE);
-
-  // Post an available channel
-  while (sem_post(&shmem->available) == -1) {
-  }
-}
-
-/// Spin until the tracer sets the channel state to PROCEED
-void channel_wait(size_t c) {
-  for (size_t i = 0; i < SPIN_BACKOFF_COUNT; i++) {
-    // Load the channel state
-    uint8_t state = __atomic_load_n(&shmem->channels[c].state, __ATOMIC_ACQUIRE);
-
-    // Can we proceed?
-    if (state == CHANNEL_STATE_PROCEED) {
-      // Yes. Break out of the loop
-      break;
-    } else {
-      spinlock_pause();
-    }
-  }
-
-  // Wait on the semaphore
-  while (sem_wait(&shmem->channels[c].wake_tracee) != 0) {
-  }
-}
-
 /// Block until the tracer allows the given syscall to proceed
 void channel_enter(size_t c,
                    long syscall_nr,
@@ -288,7 +228,7 @@ void channel_enter(size_t c,
   __atomic_store_n(&shmem->channels[c].state, CHANNEL_STATE_PRE_SYSCALL_WAIT, __ATOMIC_RELEASE);
 
   // Wait
-  channel_wait(c);
+  channel_wait(shmem, c);
 }
 
 long channel_proceed(size_t c,
@@ -305,7 +245,7 @@ long channel_proceed(size_t c,
 
   if (action == CHANNEL_ACTION_CONTINUE) {
     // Release the channel and run the system call without further interruption
-    channel_release(c);
+    channel_release(shmem, c);
     rc = safe_syscall(syscall_nr, arg1, arg2, arg3, arg4, arg5, arg6);
 
   } else if (action == CHANNEL_ACTION_NOTIFY) {
@@ -313,7 +253,7 @@ long channel_proceed(size_t c,
     pid_t tid;
     if (unblock_channel) {
       tid = shmem->channels[c].tid;
-      channel_release(c);
+      channel_release(shmem, c);
     }
 
     // Run the syscall, report the result, and move on (the tracer will release the channel)
@@ -321,7 +261,7 @@ long channel_proceed(size_t c,
 
     // Acquire a new channel if it was previously unblocked
     if (unblock_channel) {
-      c = channel_acquire(tid);
+      c = channel_acquire(shmem, tid);
     }
 
     // Store the result of the system call in the channel
@@ -338,7 +278,7 @@ long channel_proceed(size_t c,
     pid_t tid;
     if (unblock_channel) {
       tid = shmem->channels[c].tid;
-      channel_release(c);
+      channel_release(shmem, c);
     }
 
     // Run the syscall, report the result, and move on (the tracer will release the channel)
@@ -346,7 +286,7 @@ long channel_proceed(size_t c,
 
     // Acquire a new channel if it was previously unblocked
     if (unblock_channel) {
-      c = channel_acquire(tid);
+      c = channel_acquire(shmem, tid);
     }
 
     // Store the result of the system call in the channel
@@ -356,15 +296,15 @@ long channel_proceed(size_t c,
     __atomic_store_n(&shmem->channels[c].state, CHANNEL_STATE_POST_SYSCALL_WAIT, __ATOMIC_RELEASE);
 
     // Spin until the tracer allows us to proceed
-    channel_wait(c);
+    channel_wait(shmem, c);
 
     // Release the channel
-    channel_release(c);
+    channel_release(shmem, c);
 
   } else if (action == CHANNEL_ACTION_EXIT) {
     // Pull the exit status out of the channel registers, release it, and then exit
     uint64_t exit_status = shmem->channels[c].regs.SYSCALL_ARG1;
-    channel_release(c);
+    channel_release(shmem, c);
     safe_syscall(__NR_exit, exit_status);
 
     // Should be unreachable
@@ -373,7 +313,7 @@ long channel_proceed(size_t c,
   } else if (action == CHANNEL_ACTION_SKIP) {
     // Pull the syscall result out of the channel registers and release it
     rc = shmem->channels[c].regs.SYSCALL_RETURN;
-    channel_release(c);
+    channel_release(shmem, c);
 
   } else {
     abort();
@@ -458,7 +398,7 @@ int fast_openat(int dfd, const char* pathname, int flags, mode_t mode) {
   pid_t tid = gettid();
 
   // Find an available channel
-  size_t c = channel_acquire(tid);
+  size_t c = channel_acquire(shmem, tid);
 
   // Try to pass the pathname argument in the channel's data buffer
   uint64_t pathname_arg = channel_buffer_string(c, pathname);
@@ -474,7 +414,7 @@ int fast_close(int fd) {
   pid_t tid = gettid();
 
   // Find an available channel
-  size_t c = channel_acquire(tid);
+  size_t c = channel_acquire(shmem, tid);
 
   // Inform the tracer that this command is entering a syscall
   channel_enter(c, __NR_close, fd, 0, 0, 0, 0, 0);
@@ -496,7 +436,7 @@ void* fast_mmap(void* addr, size_t length, int prot, int flags, int fd, off_t of
   pid_t tid = gettid();
 
   // Find an available channel
-  size_t c = channel_acquire(tid);
+  size_t c = channel_acquire(shmem, tid);
 
   // Inform the tracer that this command is entering a system call
   channel_enter(c, __NR_mmap, (uint64_t)addr, length, prot, flags, fd, offset);
@@ -522,7 +462,7 @@ int fast_fxstatat(int ver, int dfd, const char* pathname, struct stat* statbuf,
   pid_t tid = gettid();
 
   // Find an available channel
-  size_t c = channel_acquire(tid);
+  size_t c = channel_acquire(shmem, tid);
 
   // Try to pass the pathname argument in the channel's data buffer
   uint64_t pathname_arg = channel_buffer_string(c, pathname);
@@ -543,7 +483,7 @@ ssize_t fast_readlinkat(int dfd, const char* pathname, char* buf, size_t bufsiz)
   pid_t tid = gettid();
 
   // Find an available channel
-  size_t c = channel_acquire(tid);
+  size_t c = channel_acquire(shmem, tid);
 
   // Try to pass the pathname argument in the channel's data buffer
   uint64_t pathname_arg = channel_buffer_string(c, pathname);
@@ -564,7 +504,7 @@ int fast_faccessat(int dfd, const char* pathname, int mode, int flags) {
   pid_t tid = gettid();
 
   // Find an available channel
-  size_t c = channel_acquire(tid);
+  size_t c = channel_acquire(shmem, tid);
 
   // Try to pass the pathname argument in the channel's data buffer
   uint64_t pathname_arg = channel_buffer_string(c, pathname);
@@ -580,7 +520,7 @@ long fast_read(int fd, void* data, size_t count) {
   pid_t tid = gettid();
 
   // Find an available channel
-  size_t c = channel_acquire(tid);
+  size_t c = channel_acquire(shmem, tid);
 
   // Inform the tracer that this command is entering a system call
   channel_enter(c, __NR_read, fd, (uint64_t)data, count, 0, 0, 0);
@@ -593,7 +533,7 @@ ssize_t fast_pread(int fd, void* buf, size_t count, off_t offset) {
   pid_t tid = gettid();
 
   // Find an available channel
-  size_t c = channel_acquire(tid);
+  size_t c = channel_acquire(shmem, tid);
 
   // Inform the tracer that this command is entering a system call
   channel_enter(c, __NR_pread64, fd, (uint64_t)buf, count, offset, 0, 0);
@@ -606,7 +546,7 @@ long fast_write(int fd, const void* data, size_t count) {
   pid_t tid = gettid();
 
   // Find an available channel
-  size_t c = channel_acquire(tid);
+  size_t c = channel_acquire(shmem, tid);
 
   // Inform the tracer that this command is entering a system call
   channel_enter(c, __NR_write, fd, (uint64_t)data, count, 0, 0, 0);
@@ -619,7 +559,7 @@ int fast_execve(const char* pathname, char* const* argv, char* const* envp) {
   pid_t tid = gettid();
 
   // Find an available channel
-  size_t c = channel_acquire(tid);
+  size_t c = channel_acquire(shmem, tid);
 
   // Try to pass the pathname string in the channel's data buffer
   uint64_t pathname_arg = channel_buffer_string(c, pathname);
@@ -639,7 +579,7 @@ int fast_getdents(unsigned int fd, void* dirp, unsigned int count) {
   pid_t tid = gettid();
 
   // Find an available channel
-  size_t c = channel_acquire(tid);
+  size_t c = channel_acquire(shmem, tid);
 
   // Inform the tracer that this command is entering a system call
   channel_enter(c, __NR_getdents64, fd, (uint64_t)dirp, count, 0, 0, 0);
@@ -659,21 +599,3 @@ int execve_untraced(const char* pathname, char* const* argv, char* const* envp)
     return 0;
   }
 }
-
-// Include architecture-specific register names
-#if defined(__x86_64__) || defined(_M_X64)
-
-#include <emmintrin.h>
-void spinlock_pause() {
-  _mm_pause();
-}
-
-#elif defined(__aarch64__) || defined(_M_ARM64)
-
-void spinlock_pause() {}
-
-#else
-
-void spinlock_pause() {}
-
-#endif
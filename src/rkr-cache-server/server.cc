@@ -0,0 +1,255 @@
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "blake3.h"
+#include "util/remote.hh"
+
+namespace fs = std::filesystem;
+
+using std::string;
+
+/// The directory where content is stored
+fs::path cache_dir;
+
+/// Used to give each temporary file a unique name
+std::atomic<uint64_t> tmp_counter;
+
+/// Write an entire buffer to a file descriptor. Returns false on failure.
+bool write_all(int fd, const void* data, size_t len) {
+  auto p = static_cast<const char*>(data);
+  while (len > 0) {
+    ssize_t n = ::write(fd, p, len);
+    if (n == -1 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+/// Read an entire buffer from a file descriptor. Returns false on failure or end of file.
+bool read_all(int fd, void* data, size_t len) {
+  auto p = static_cast<char*>(data);
+  while (len > 0) {
+    ssize_t n = ::read(fd, p, len);
+    if (n == -1 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+/// Send the content with a given hash. Returns false if the connection failed.
+bool handle_get(int sock, const remote::Hash& hash) {
+  auto path = cache_dir / remote::hash_path(hash);
+
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat statbuf;
+  if (fd == -1 || ::fstat(fd, &statbuf) == -1) {
+    if (fd != -1) ::close(fd);
+    uint8_t status = remote::Missing;
+    return write_all(sock, &status, sizeof(status));
+  }
+
+  uint8_t status = remote::Ok;
+  uint64_t size = statbuf.st_size;
+  bool ok = write_all(sock, &status, sizeof(status)) && write_all(sock, &size, sizeof(size));
+
+  off_t offset = 0;
+  while (ok && static_cast<uint64_t>(offset) < size) {
+    if (::sendfile(sock, fd, &offset, size - offset) <= 0) ok = false;
+  }
+
+  ::close(fd);
+  return ok;
+}
+
+/// Receive content and store it under its hash. Content that does not match its hash is
+/// rejected, and content that is already stored is never replaced. Returns false if the
+/// connection failed.
+bool handle_put(int sock, const remote::Hash& hash) {
+  uint64_t size;
+  if (!read_all(sock, &size, sizeof(size))) return false;
+
+  auto path = cache_dir / remote::hash_path(hash);
+  std::error_code ec;
+  fs::create_directories(path.parent_path(), ec);
+
+  // If the content is already stored, read and discard the upload
+  bool exists = fs::exists(path, ec);
+
+  // Write to a temporary file so readers never see partial content
+  auto tmp = path;
+  tmp += ".tmp." + std::to_string(tmp_counter++);
+  int fd = exists ? -1 : ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0444);
+
+  blake3_hasher hasher;
+  blake3_hasher_init(&hasher);
+
+  // Read all of the content even if it can't be saved, to stay in sync with the client
+  char buf[65536];
+  bool saved = fd != -1;
+  while (size > 0) {
+    size_t chunk = size < sizeof(buf) ? size : sizeof(buf);
+    if (!read_all(sock, buf, chunk)) {
+      if (fd != -1) ::close(fd);
+      ::unlink(tmp.c_str());
+      return false;
+    }
+    blake3_hasher_update(&hasher, buf, chunk);
+    if (saved) saved = write_all(fd, buf, chunk);
+    size -= chunk;
+  }
+
+  if (fd != -1) ::close(fd);
+
+  remote::Hash received;
+  blake3_hasher_finalize(&hasher, received.data(), received.size());
+
+  uint8_t status = remote::Ok;
+  if (received != hash) {
+    fprintf(stderr, "rkr-cache-server: rejected %s because its content does not match\n",
+            path.c_str());
+    status = remote::Error;
+
+  } else if (exists) {
+    // Keep the copy that is already stored
+
+  } else if (!saved || (::link(tmp.c_str(), path.c_str()) != 0 && errno != EEXIST)) {
+    // A link fails if another client stored the same content first, which keeps its copy
+    fprintf(stderr, "rkr-cache-server: failed to store %s: %s\n", path.c_str(), strerror(errno));
+    status = remote::Error;
+  }
+
+  if (fd != -1) ::unlink(tmp.c_str());
+
+  return write_all(sock, &status, sizeof(status));
+}
+
+/// Handle requests from one client until it disconnects
+void serve(int sock) {
+  while (true) {
+    uint8_t op;
+    remote::Hash hash;
+    if (!read_all(sock, &op, sizeof(op)) || !read_all(sock, hash.data(), hash.size())) break;
+
+    bool ok;
+    if (op == remote::Get) {
+      ok = handle_get(sock, hash);
+    } else if (op == remote::Put) {
+      ok = handle_put(sock, hash);
+    } else {
+      fprintf(stderr, "rkr-cache-server: unknown request %d\n", op);
+      ok = false;
+    }
+
+    if (!ok) break;
+  }
+
+  ::close(sock);
+}
+
+/// Open a listening socket on a Unix socket path, or a loopback TCP port
+int listen_on(const string& unix_path, int port) {
+  int sock;
+  if (!unix_path.empty()) {
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (unix_path.size() >= sizeof(addr.sun_path)) {
+      fprintf(stderr, "rkr-cache-server: socket path is too long\n");
+      return -1;
+    }
+    strncpy(addr.sun_path, unix_path.c_str(), sizeof(addr.sun_path) - 1);
+
+    ::unlink(unix_path.c_str());
+    sock = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1 || ::bind(sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+      perror("rkr-cache-server: bind");
+      return -1;
+    }
+
+  } else {
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    sock = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int one = 1;
+    ::setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (sock == -1 || ::bind(sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+      perror("rkr-cache-server: bind");
+      return -1;
+    }
+  }
+
+  if (::listen(sock, 64) != 0) {
+    perror("rkr-cache-server: listen");
+    return -1;
+  }
+
+  return sock;
+}
+
+void usage(const char* argv0) {
+  fprintf(stderr, "Usage: %s [--unix PATH | --port N] DIR\n", argv0);
+}
+
+int main(int argc, char** argv) {
+  string unix_path;
+  int port = 0;
+
+  int i = 1;
+  for (; i < argc - 1; i++) {
+    if (strcmp(argv[i], "--unix") == 0 && i + 1 < argc - 1) {
+      unix_path = argv[++i];
+    } else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc - 1) {
+      port = atoi(argv[++i]);
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (i != argc - 1 || (unix_path.empty() && port == 0)) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  cache_dir = argv[i];
+  std::error_code ec;
+  fs::create_directories(cache_dir, ec);
+
+  // A client that disconnects while content is being sent should not kill the server
+  signal(SIGPIPE, SIG_IGN);
+
+  int sock = listen_on(unix_path, port);
+  if (sock == -1) return 1;
+
+  while (true) {
+    int client = ::accept4(sock, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client == -1) {
+      if (errno == EINTR) continue;
+      perror("rkr-cache-server: accept");
+      return 1;
+    }
+    std::thread(serve, client).detach();
+  }
+}
@@ -13,6 +13,7 @@
 #include "runtime/Command.hh"
 #include "runtime/Ref.hh"
 #include "runtime/env.hh"
+#include "util/pool.hh"
 #include "versions/ContentVersion.hh"
 #include "versions/DirVersion.hh"
 #include "versions/MetadataVersion.hh"
@@ -29,7 +30,7 @@ using std::tuple;
 Artifact::Artifact() noexcept {}
 
 Artifact::Artifact(MetadataVersion v) noexcept {
-  auto mv = make_shared<MetadataVersion>(v);
+  auto mv = make_pooled<MetadataVersion>(v);
   appendVersion(mv);
   _metadata.update(mv);
 }
@@ -288,9 +289,10 @@ void Artifact::matchMetadata(const shared_ptr<Command>& c,
 
 /// Apply a new metadata version to this artifact
 void Artifact::updateMetadata(const shared_ptr<Command>& c, MetadataVersion writing) noexcept {
-  auto mv = make_shared<MetadataVersion>(writing);
+  auto mv = make_pooled<MetadataVersion>(writing);
   appendVersion(mv);
   _metadata.update(c, mv);
+  _generation++;
 
   // Report the output to the build
   c->addMetadataOutput(shared_from_this(), mv);
@@ -264,7 +264,9 @@ class Artifact : public std::enable_shared_from_this<Artifact> {
 
   /**
    * Resolve a path relative to this artifact
-   * \param c     The command this resolution is performed on behalf of
+   * \param c     The command this resolution is performed on behalf of. If c is null, the path is
+   *                resolved without recording any dependencies. Do not pass create flags in that
+   *                case.
    * \param path  The path being resolved
    * \param flags The access mode requested
    * \param symlink_limit Don't follow symlinks deeper than this number of levels
@@ -295,6 +297,11 @@ class Artifact : public std::enable_shared_from_this<Artifact> {
                       AccessFlags flags,
                       size_t symlink_limit) noexcept;
 
+  /// Get this artifact's generation. The generation changes whenever a command updates the
+  /// artifact's metadata or directory entries, so any cached path resolution that depended on the
+  /// artifact can be invalidated.
+  size_t getGeneration() const noexcept { return _generation; }
+
   /****** Utility Methods ******/
 
   /// Print this artifact
@@ -350,6 +357,9 @@ class Artifact : public std::enable_shared_from_this<Artifact> {
   /// The set of links to this artifact in the filesystem model. This will include committed links
   /// unless they have been unlinked in the model but that unlink has not been committed.
   LinkSet _modeled_links;
+
+  /// Incremented each time a command changes state that path resolution depends on
+  size_t _generation = 0;
 };
 
 template <>
@@ -14,7 +14,9 @@
 #include "runtime/Command.hh"
 #include "runtime/Ref.hh"
 #include "runtime/env.hh"
+#include "util/intern.hh"
 #include "util/log.hh"
+#include "util/pool.hh"
 #include "versions/ContentVersion.hh"
 #include "versions/DirListVersion.hh"
 #include "versions/DirVersion.hh"
@@ -40,7 +42,7 @@ DirArtifact::DirArtifact(MetadataVersion mv, shared_ptr<BaseDirVersion> dv) noex
 void DirArtifact::rollback() noexcept {
   _base.rollback();
 
-  for (const auto& [name, entry] : _entries) {
+  for (const auto& [id, entry] : _entries) {
     entry->rollback();
   }
 
@@ -96,14 +98,14 @@ void DirArtifact::commitAll() noexcept {
   commitMetadataTo(path.value());
 
   // Commit each entry in this directory
-  for (auto& [name, entry] : _entries) {
+  for (auto& [id, entry] : _entries) {
     entry->commit();
   }
 }
 
 /// Commit a specific entry in this directory
 void DirArtifact::commitEntry(string name) noexcept {
-  auto iter = _entries.find(name);
+  auto iter = _entries.find(intern::get(name));
   if (iter != _entries.end()) {
     iter->second->commit();
   }
@@ -210,12 +212,12 @@ void DirArtifact::commitUnlink(shared_ptr<DirEntry> entry) noexcept {
 // Compare all final versions of this artifact to the filesystem state
 void DirArtifact::checkFinalState(fs::path path) noexcept {
   // Recursively check the final state of all known entries
-  for (const auto& [name, entry] : _entries) {
+  for (const auto& [id, entry] : _entries) {
     // Get the targeted artifact
     auto artifact = entry->peekTarget();
 
     // If there is a target, make sure that artifact is in the expected final state
-    if (artifact) artifact->checkFinalState(path / name);
+    if (artifact) artifact->checkFinalState(path / entry->getName());
 
     // If the entry doesn't reference an artifact, we don't need to check for its absence. We only
     // have a record of this artifact being missing because some other part of the build accessed
@@ -234,24 +236,24 @@ void DirArtifact::applyFinalState(fs::path path) noexcept {
   Artifact::applyFinalState(path);
 
   // Recursively apply final state for all known entries
-  for (const auto& [name, entry] : _entries) {
+  for (const auto& [id, entry] : _entries) {
     // Get the targeted artifact
     auto artifact = entry->peekTarget();
 
     // If there is a target, commit its final state
-    if (artifact) artifact->applyFinalState(path / name);
+    if (artifact) artifact->applyFinalState(path / entry->getName());
   }
 }
 
 // Fingerprint and cache the committed state of this artifact
 void DirArtifact::cacheAll(fs::path path) const noexcept {
   // Recursively cache all known entries
-  for (const auto& [name, entry] : _entries) {
+  for (const auto& [id, entry] : _entries) {
     // Get the targeted artifact
     auto artifact = entry->peekTarget();
 
     // If there is a target, commit its final state
-    if (artifact) artifact->cacheAll(path / name);
+    if (artifact) artifact->cacheAll(path / entry->getName());
   }
 }
 
@@ -276,7 +278,7 @@ void DirArtifact::afterRead(Build& build,
 // Get a version that lists all the entries in this directory
 shared_ptr<ContentVersion> DirArtifact::getContent(const shared_ptr<Command>& c) noexcept {
   // Create a DirListVersion to hold the list of directory entries
-  auto result = make_shared<DirListVersion>();
+  auto result = make_pooled<DirListVersion>();
 
   // Get the committed base version (if there is one)
   auto [committed_base, weak_committed_creator] = _base.getCommitted();
@@ -305,15 +307,15 @@ shared_ptr<ContentVersion> DirArtifact::getContent(const shared_ptr<Command>& c)
   // The command listing this directory depends on its base version
   if (c) c->addDirectoryInput(shared_from_this(), base, creator);
 
-  for (const auto& [name, entry] : _entries) {
+  for (const auto& [id, entry] : _entries) {
     // Get the artifact targeted by this entry. This access records a dependency on the entry.
     const auto& artifact = entry->getTarget(c);
 
     // Does the entry target an artifact?
     if (artifact) {
-      result->addEntry(name);
+      result->addEntry(entry->getName());
     } else {
-      result->removeEntry(name);
+      result->removeEntry(entry->getName());
     }
   }
 
@@ -384,7 +386,8 @@ Ref DirArtifact::resolve(const shared_ptr<Command>& c,
   Ref res;
 
   // Check the map of known entries for a match
-  auto entries_iter = _entries.find(entry_str);
+  auto entry_id = intern::get(entry_str);
+  auto entries_iter = _entries.find(entry_id);
   if (entries_iter != _entries.end()) {
     // Found a match.
 
@@ -401,7 +404,7 @@ Ref DirArtifact::resolve(const shared_ptr<Command>& c,
   } else {
     // Add a path resolution input from the base version
     auto [base, creator] = _base.getLatest();
-    c->addDirectoryInput(shared_from_this(), base, creator.lock());
+    if (c) c->addDirectoryInput(shared_from_this(), base, creator.lock());
 
     // There's no match in the directory entry map. We need to check the base version for a match
     if (base->getCreated()) {
@@ -428,11 +431,11 @@ Ref DirArtifact::resolve(const shared_ptr<Command>& c,
       }
 
       // Add the entry to this directory's map of entries
-      auto entry_object = make_shared<DirEntry>(this->as<DirArtifact>(), entry);
-      auto entry_version = make_shared<DirEntryVersion>(entry, artifact);
+      auto entry_object = make_pooled<DirEntry>(this->as<DirArtifact>(), entry);
+      auto entry_version = make_pooled<DirEntryVersion>(entry, artifact);
       appendVersion(entry_version);
       entry_object->setCommittedState(entry_version);
-      _entries.emplace_hint(entries_iter, entry, entry_object);
+      _entries.try_emplace(entry_id, entry_object);
     }
   }
 
@@ -500,18 +503,20 @@ void DirArtifact::addEntry(const shared_ptr<Command>& c,
                            string name,
                            shared_ptr<Artifact> target) noexcept {
   // Make sure we have a record of this entry
-  auto iter = _entries.find(name);
+  auto id = intern::get(name);
+  auto iter = _entries.find(id);
   if (iter == _entries.end()) {
-    auto entry = make_shared<DirEntry>(this->as<DirArtifact>(), name);
-    iter = _entries.emplace_hint(iter, name, entry);
+    auto entry = make_pooled<DirEntry>(this->as<DirArtifact>(), name);
+    iter = _entries.try_emplace(id, entry).first;
   }
 
   // Create a version to represent this update
-  auto version = make_shared<DirEntryVersion>(name, target);
+  auto version = make_pooled<DirEntryVersion>(name, target);
   appendVersion(version);
 
   // Update the entry
   iter->second->updateEntry(c, version);
+  _generation++;
 }
 
 // Remove a directory entry from this artifact
@@ -519,18 +524,20 @@ void DirArtifact::removeEntry(const shared_ptr<Command>& c,
                               string name,
                               shared_ptr<Artifact> target) noexcept {
   // Make sure we have a record of this entry
-  auto iter = _entries.find(name);
+  auto id = intern::get(name);
+  auto iter = _entries.find(id);
   if (iter == _entries.end()) {
-    auto entry = make_shared<DirEntry>(this->as<DirArtifact>(), name);
-    iter = _entries.emplace_hint(iter, name, entry);
+    auto entry = make_pooled<DirEntry>(this->as<DirArtifact>(), name);
+    iter = _entries.try_emplace(id, entry).first;
   }
 
   // Create a version to represent this update
-  auto version = make_shared<DirEntryVersion>(name, nullptr);
+  auto version = make_pooled<DirEntryVersion>(name, nullptr);
   appendVersion(version);
 
   // Update the entry
   iter->second->updateEntry(c, version);
+  _generation++;
 }
 
 DirEntry::DirEntry(shared_ptr<DirArtifact> dir, string name) noexcept : _dir(dir), _name(name) {}
@@ -2,7 +2,6 @@
 
 #include <cstddef>
 #include <filesystem>
-#include <map>
 #include <memory>
 #include <optional>
 #include <string>
@@ -11,6 +10,8 @@
 #include "artifacts/Artifact.hh"
 #include "runtime/Ref.hh"
 #include "runtime/VersionState.hh"
+#include "util/FlatMap.hh"
+#include "util/intern.hh"
 
 namespace fs = std::filesystem;
 
@@ -123,7 +124,7 @@ class DirArtifact final : public Artifact {
 
  private:
   /// A map of entries in this directory
-  std::map<std::string, std::shared_ptr<DirEntry>> _entries;
+  FlatMap<intern::ID, std::shared_ptr<DirEntry>> _entries;
 
   /// The base directory content is the backstop for all resolution queries
   VersionState<BaseDirVersion> _base;
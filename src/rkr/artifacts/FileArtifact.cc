@@ -11,6 +11,7 @@
 #include "runtime/policy.hh"
 #include "util/log.hh"
 #include "util/options.hh"
+#include "util/pool.hh"
 #include "versions/ContentVersion.hh"
 #include "versions/FileVersion.hh"
 #include "versions/MetadataVersion.hh"
@@ -267,7 +268,7 @@ void FileArtifact::afterWrite(Build& build,
                               const shared_ptr<Command>& c,
                               Ref::ID ref) noexcept {
   // Create a new version
-  auto writing = make_shared<FileVersion>();
+  auto writing = make_pooled<FileVersion>();
 
   // The command wrote to this file
   build.updateContent(source, c, ref, writing);
@@ -287,7 +288,7 @@ void FileArtifact::afterTruncate(Build& build,
                                  const shared_ptr<Command>& c,
                                  Ref::ID ref) noexcept {
   // The command wrote an empty content version to this artifact
-  auto written = make_shared<FileVersion>();
+  auto written = make_pooled<FileVersion>();
   written->makeEmptyFingerprint();
 
   build.updateContent(source, c, ref, written);
@@ -10,6 +10,7 @@
 #include "runtime/Build.hh"
 #include "runtime/Command.hh"
 #include "util/log.hh"
+#include "util/pool.hh"
 #include "versions/ContentVersion.hh"
 #include "versions/PipeVersion.hh"
 
@@ -53,7 +54,7 @@ void PipeArtifact::beforeClose(Build& build,
                                Ref::ID ref) noexcept {
   // Is the command closing the last writable reference to this pipe?
   if (c->getRef(ref)->getFlags().w) {
-    auto final_write = make_shared<PipeCloseVersion>();
+    auto final_write = make_pooled<PipeCloseVersion>();
 
     // Intentionally not calling build.traceUpdateContent here. That will implicitly be invoked when
     // the final reference to this pipe is closed.
@@ -90,7 +91,7 @@ void PipeArtifact::afterRead(Build& build,
   }
 
   // Create a new version to track this read
-  auto read_version = make_shared<PipeReadVersion>();
+  auto read_version = make_pooled<PipeReadVersion>();
 
   LOG(artifact) << "Creating pipe read version " << read_version;
 
@@ -107,7 +108,7 @@ void PipeArtifact::beforeWrite(Build& build,
                                const shared_ptr<Command>& c,
                                Ref::ID ref) noexcept {
   // Create a new version
-  auto writing = make_shared<PipeWriteVersion>();
+  auto writing = make_pooled<PipeWriteVersion>();
 
   // The command writes this version to the pipe
   build.updateContent(source, c, ref, writing);
@@ -126,7 +127,7 @@ shared_ptr<ContentVersion> PipeArtifact::getContent(const shared_ptr<Command>& c
         c->addContentInput(shared_from_this(), write, writer.lock());
       }
     }
-    return make_shared<PipeReadVersion>();
+    return make_pooled<PipeReadVersion>();
   }
 }
 
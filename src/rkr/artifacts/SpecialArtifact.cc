@@ -10,6 +10,7 @@
 #include "runtime/Command.hh"
 #include "util/log.hh"
 #include "util/options.hh"
+#include "util/pool.hh"
 #include "versions/ContentVersion.hh"
 #include "versions/MetadataVersion.hh"
 #include "versions/SpecialVersion.hh"
@@ -133,7 +134,7 @@ void SpecialArtifact::afterWrite(Build& build,
                                  const shared_ptr<Command>& c,
                                  Ref::ID ref) noexcept {
   // Create a new version
-  auto writing = make_shared<SpecialVersion>(!_always_changed);
+  auto writing = make_pooled<SpecialVersion>(!_always_changed);
 
   // The command wrote to this special artifact
   build.updateContent(source, c, ref, writing);
@@ -153,7 +154,7 @@ void SpecialArtifact::afterTruncate(Build& build,
                                     const shared_ptr<Command>& c,
                                     Ref::ID ref) noexcept {
   // The command wrote an empty content version to this artifact
-  auto written = make_shared<SpecialVersion>(!_always_changed);
+  auto written = make_pooled<SpecialVersion>(!_always_changed);
 
   build.updateContent(source, c, ref, written);
 }
@@ -0,0 +1,207 @@
+#include "IRBuffer.hh"
+
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <string>
+#include <tuple>
+
+#include "data/AccessFlags.hh"
+#include "runtime/Command.hh"
+#include "runtime/Ref.hh"
+#include "versions/ContentVersion.hh"
+#include "versions/MetadataVersion.hh"
+
+using std::list;
+using std::shared_ptr;
+using std::string;
+using std::tuple;
+
+namespace fs = std::filesystem;
+
+void IRBuffer::sendTo(IRSink& sink) const noexcept {
+  for (const auto& step : _steps) {
+    step(*this, sink);
+  }
+}
+
+void IRBuffer::start(const shared_ptr<Command>& c) noexcept {
+  _root_command = c;
+  _steps.emplace_back([c](const IRBuffer& b, IRSink& sink) { sink.start(c); });
+}
+
+void IRBuffer::finish() noexcept {
+  _steps.emplace_back([](const IRBuffer& b, IRSink& sink) { sink.finish(); });
+}
+
+void IRBuffer::specialRef(const IRSource& source,
+                          const shared_ptr<Command>& command,
+                          SpecialRef entity,
+                          Ref::ID output) noexcept {
+  _steps.emplace_back([=](const IRBuffer& b, IRSink& sink) {
+    sink.specialRef(b, command, entity, output);
+  });
+}
+
+void IRBuffer::pipeRef(const IRSource& source,
+                       const shared_ptr<Command>& command,
+                       Ref::ID read_end,
+                       Ref::ID write_end) noexcept {
+  _steps.emplace_back([=](const IRBuffer& b, IRSink& sink) {
+    sink.pipeRef(b, command, read_end, write_end);
+  });
+}
+
+void IRBuffer::fileRef(const IRSource& source,
+                       const shared_ptr<Command>& command,
+                       mode_t mode,
+                       Ref::ID output) noexcept {
+  _steps.emplace_back([=](const IRBuffer& b, IRSink& sink) {
+    sink.fileRef(b, command, mode, output);
+  });
+}
+
+void IRBuffer::symlinkRef(const IRSource& source,
+                          const shared_ptr<Command>& command,
+                          fs::path target,
+                          Ref::ID output) noexcept {
+  _steps.emplace_back([=](const IRBuffer& b, IRSink& sink) {
+    sink.symlinkRef(b, command, target, output);
+  });
+}
+
+void IRBuffer::dirRef(const IRSource& source,
+                      const shared_ptr<Command>& command,
+                      mode_t mode,
+                      Ref::ID output) noexcept {
+  _steps.emplace_back([=](const IRBuffer& b, IRSink& sink) {
+    sink.dirRef(b, command, mode, output);
+  });
+}
+
+void IRBuffer::pathRef(const IRSource& source,
+                       const shared_ptr<Command>& command,
+                       Ref::ID base,
+                       fs::path path,
+                       AccessFlags flags,
+                       Ref::ID output) noexcept {
+  _steps.emplace_back([=](const IRBuffer& b, IRSink& sink) {
+    sink.pathRef(b, command, base, path, flags, output);
+  });
+}
+
+void IRBuffer::usingRef(const IRSource& source,
+                        const shared_ptr<Command>& command,
+                        Ref::ID ref) noexcept {
+  _steps.emplace_back([=](const IRBuffer& b, IRSink& sink) { sink.usingRef(b, command, ref); });
+}
+
+void IRBuffer::doneWithRef(const IRSource& source,
+                           const shared_ptr<Command>& command,
+                           Ref::ID ref) noexcept {
+  _steps.emplace_back(
+      [=](const IRBuffer& b, IRSink& sink) { sink.doneWithRef(b, command, ref); });
+}
+
+void IRBuffer::compareRefs(const IRSource& source,
+                           const shared_ptr<Command>& command,
+                           Ref::ID ref1,
+                           Ref::ID ref2,
+                           RefComparison type) noexcept {
+  _steps.emplace_back([=](const IRBuffer& b, IRSink& sink) {
+    sink.compareRefs(b, command, ref1, ref2, type);
+  });
+}
+
+void IRBuffer::expectResult(const IRSource& source,
+                            const shared_ptr<Command>& command,
+                            Scenario scenario,
+                            Ref::ID ref,
+                            int8_t expected) noexcept {
+  _steps.emplace_back([=](const IRBuffer& b, IRSink& sink) {
+    sink.expectResult(b, command, scenario, ref, expected);
+  });
+}
+
+void IRBuffer::matchMetadata(const IRSource& source,
+                             const shared_ptr<Command>& command,
+                             Scenario scenario,
+                             Ref::ID ref,
+                             MetadataVersion version) noexcept {
+  _steps.emplace_back([=](const IRBuffer& b, IRSink& sink) {
+    sink.matchMetadata(b, command, scenario, ref, version);
+  });
+}
+
+void IRBuffer::matchContent(const IRSource& source,
+                            const shared_ptr<Command>& command,
+                            Scenario scenario,
+                            Ref::ID ref,
+                            shared_ptr<ContentVersion> version) noexcept {
+  _steps.emplace_back([=](const IRBuffer& b, IRSink& sink) {
+    sink.matchContent(b, command, scenario, ref, version);
+  });
+}
+
+void IRBuffer::updateMetadata(const IRSource& source,
+                              const shared_ptr<Command>& command,
+                              Ref::ID ref,
+                              MetadataVersion version) noexcept {
+  _steps.emplace_back([=](const IRBuffer& b, IRSink& sink) {
+    sink.updateMetadata(b, command, ref, version);
+  });
+}
+
+void IRBuffer::updateContent(const IRSource& source,
+                             const shared_ptr<Command>& command,
+                             Ref::ID ref,
+                             shared_ptr<ContentVersion> version) noexcept {
+  _steps.emplace_back([=](const IRBuffer& b, IRSink& sink) {
+    sink.updateContent(b, command, ref, version);
+  });
+}
+
+void IRBuffer::addEntry(const IRSource& source,
+                        const shared_ptr<Command>& command,
+                        Ref::ID dir,
+                        string name,
+                        Ref::ID target) noexcept {
+  _steps.emplace_back([=](const IRBuffer& b, IRSink& sink) {
+    sink.addEntry(b, command, dir, name, target);
+  });
+}
+
+void IRBuffer::removeEntry(const IRSource& source,
+                           const shared_ptr<Command>& command,
+                           Ref::ID dir,
+                           string name,
+                           Ref::ID target) noexcept {
+  _steps.emplace_back([=](const IRBuffer& b, IRSink& sink) {
+    sink.removeEntry(b, command, dir, name, target);
+  });
+}
+
+void IRBuffer::launch(const IRSource& source,
+                      const shared_ptr<Command>& command,
+                      const shared_ptr<Command>& child,
+                      list<tuple<Ref::ID, Ref::ID>> refs) noexcept {
+  _steps.emplace_back([=](const IRBuffer& b, IRSink& sink) {
+    sink.launch(b, command, child, refs);
+  });
+}
+
+void IRBuffer::join(const IRSource& source,
+                    const shared_ptr<Command>& command,
+                    const shared_ptr<Command>& child,
+                    int exit_status) noexcept {
+  _steps.emplace_back([=](const IRBuffer& b, IRSink& sink) {
+    sink.join(b, command, child, exit_status);
+  });
+}
+
+void IRBuffer::exit(const IRSource& source,
+                    const shared_ptr<Command>& command,
+                    int exit_status) noexcept {
+  _steps.emplace_back(
+      [=](const IRBuffer& b, IRSink& sink) { sink.exit(b, command, exit_status); });
+}
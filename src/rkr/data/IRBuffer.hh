@@ -0,0 +1,171 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "data/IRSink.hh"
+#include "data/IRSource.hh"
+
+class Command;
+class ContentVersion;
+
+namespace fs = std::filesystem;
+
+/**
+ * An IRBuffer holds a decoded trace in memory. Steps sent to the buffer are saved, and the whole
+ * sequence can be sent on to another IRSink later. Unlike a TraceReader, a buffer does not decode
+ * anything when it is sent, and it can be sent more than once.
+ *
+ * The commands and versions in the buffer are shared with every sink it is sent to. A sink that
+ * runs a build changes their state, so a buffer should only be sent to one build in a process.
+ * The build server (see rkr-server.cc) sends a buffer once in each forked build process.
+ */
+class IRBuffer : public IRSink, public IRSource {
+ public:
+  /// Create an empty buffer
+  IRBuffer() noexcept = default;
+
+  // Disallow copy
+  IRBuffer(const IRBuffer&) = delete;
+  IRBuffer& operator=(const IRBuffer&) = delete;
+
+  // Allow move
+  IRBuffer(IRBuffer&&) noexcept = default;
+  IRBuffer& operator=(IRBuffer&&) noexcept = default;
+
+  /// Send the buffered steps to an IRSink
+  void sendTo(IRSink& sink) const noexcept;
+
+  /// Send the buffered steps to an r-value reference IRSink
+  void sendTo(IRSink&& sink) const noexcept { sendTo(sink); }
+
+  /// Get the root command from the buffered trace
+  std::shared_ptr<Command> getRootCommand() const noexcept { return _root_command; }
+
+  /// Get the number of buffered steps
+  size_t size() const noexcept { return _steps.size(); }
+
+  /// A buffered trace is never an executing IRSource
+  virtual bool isExecuting() const override { return false; }
+
+  /********** IRSink Interface **********/
+
+  virtual void start(const std::shared_ptr<Command>& c) noexcept override;
+
+  virtual void finish() noexcept override;
+
+  virtual void specialRef(const IRSource& source,
+                          const std::shared_ptr<Command>& command,
+                          SpecialRef entity,
+                          Ref::ID output) noexcept override;
+
+  virtual void pipeRef(const IRSource& source,
+                       const std::shared_ptr<Command>& command,
+                       Ref::ID read_end,
+                       Ref::ID write_end) noexcept override;
+
+  virtual void fileRef(const IRSource& source,
+                       const std::shared_ptr<Command>& command,
+                       mode_t mode,
+                       Ref::ID output) noexcept override;
+
+  virtual void symlinkRef(const IRSource& source,
+                          const std::shared_ptr<Command>& command,
+                          fs::path target,
+                          Ref::ID output) noexcept override;
+
+  virtual void dirRef(const IRSource& source,
+                      const std::shared_ptr<Command>& command,
+                      mode_t mode,
+                      Ref::ID output) noexcept override;
+
+  virtual void pathRef(const IRSource& source,
+                       const std::shared_ptr<Command>& command,
+                       Ref::ID base,
+                       fs::path path,
+                       AccessFlags flags,
+                       Ref::ID output) noexcept override;
+
+  virtual void usingRef(const IRSource& source,
+                        const std::shared_ptr<Command>& command,
+                        Ref::ID ref) noexcept override;
+
+  virtual void doneWithRef(const IRSource& source,
+                           const std::shared_ptr<Command>& command,
+                           Ref::ID ref) noexcept override;
+
+  virtual void compareRefs(const IRSource& source,
+                           const std::shared_ptr<Command>& command,
+                           Ref::ID ref1,
+                           Ref::ID ref2,
+                           RefComparison type) noexcept override;
+
+  virtual void expectResult(const IRSource& source,
+                            const std::shared_ptr<Command>& command,
+                            Scenario scenario,
+                            Ref::ID ref,
+                            int8_t expected) noexcept override;
+
+  virtual void matchMetadata(const IRSource& source,
+                             const std::shared_ptr<Command>& command,
+                             Scenario scenario,
+                             Ref::ID ref,
+                             MetadataVersion version) noexcept override;
+
+  virtual void matchContent(const IRSource& source,
+                            const std::shared_ptr<Command>& command,
+                            Scenario scenario,
+                            Ref::ID ref,
+                            std::shared_ptr<ContentVersion> version) noexcept override;
+
+  virtual void updateMetadata(const IRSource& source,
+                              const std::shared_ptr<Command>& command,
+                              Ref::ID ref,
+                              MetadataVersion version) noexcept override;
+
+  virtual void updateContent(const IRSource& source,
+                             const std::shared_ptr<Command>& command,
+                             Ref::ID ref,
+                             std::shared_ptr<ContentVersion> version) noexcept override;
+
+  virtual void addEntry(const IRSource& source,
+                        const std::shared_ptr<Command>& command,
+                        Ref::ID dir,
+                        std::string name,
+                        Ref::ID target) noexcept override;
+
+  virtual void removeEntry(const IRSource& source,
+                           const std::shared_ptr<Command>& command,
+                           Ref::ID dir,
+                           std::string name,
+                           Ref::ID target) noexcept override;
+
+  virtual void launch(const IRSource& source,
+                      const std::shared_ptr<Command>& command,
+                      const std::shared_ptr<Command>& child,
+                      std::list<std::tuple<Ref::ID, Ref::ID>> refs) noexcept override;
+
+  virtual void join(const IRSource& source,
+                    const std::shared_ptr<Command>& command,
+                    const std::shared_ptr<Command>& child,
+                    int exit_status) noexcept override;
+
+  virtual void exit(const IRSource& source,
+                    const std::shared_ptr<Command>& command,
+                    int exit_status) noexcept override;
+
+ private:
+  /// A buffered step, which replays itself to a sink. The buffer is passed as the step's source.
+  using Step = std::function<void(const IRBuffer&, IRSink&)>;
+
+  /// The root command passed to start()
+  std::shared_ptr<Command> _root_command;
+
+  /// The buffered steps, in order
+  std::vector<Step> _steps;
+};
@@ -1,26 +1,395 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <list>
+#include <map>
 #include <memory>
+#include <optional>
+#include <set>
+#include <string>
+#include <tuple>
+#include <utility>
 
 #include "artifacts/Artifact.hh"
+#include "data/AccessFlags.hh"
 #include "runtime/Command.hh"
 #include "runtime/Ref.hh"
+#include "util/log.hh"
 #include "versions/ContentVersion.hh"
+#include "versions/MetadataVersion.hh"
+
+namespace fs = std::filesystem;
+
+/**
+ * The outcome of a single Build-scenario predicate evaluated against the state left at the end of
+ * a build. Outcomes are computed by a PostBuildRecorder while a build phase runs, and are later
+ * applied to that phase's trace by a PostBuildChecker.
+ */
+struct PostBuildOutcome {
+  /// The kinds of predicates an outcome can be recorded for
+  enum Kind : uint8_t { Result, Metadata, Content };
+
+  /// The kind of predicate this outcome belongs to
+  Kind kind = Result;
+
+  /// The reference the predicate checks
+  Ref::ID ref = 0;
+
+  /// Did the reference resolve in the post-build state?
+  bool resolved = false;
+
+  /// The post-build result code, used for ExpectResult predicates
+  int8_t result = SUCCESS;
 
-class MetadataVersion;
+  /// The post-build metadata, used for MatchMetadata predicates
+  std::optional<MetadataVersion> metadata;
+
+  /// The post-build content, used for MatchContent predicates
+  std::shared_ptr<ContentVersion> content;
+};
+
+/**
+ * This class watches the IR steps produced during a build phase and works out how each
+ * Build-scenario predicate would evaluate if the phase's trace were emulated again, starting from
+ * the state left at the end of the build. That replay sees the final state of the build, except
+ * for artifacts and directory entries it has already modified by the time it reaches the
+ * predicate; those have the state the predicate observed during the phase.
+ *
+ * Most outcomes are settled using the state at the time of the predicate. The rest are settled
+ * when the phase finishes, when the model holds the final state, by peeking at final versions and
+ * resolving paths again when an entry along them changed later in the phase. Some outcomes cannot
+ * be worked out this way, such as a path through an entry that changed both before and after the
+ * predicate. When that happens the recorder is no longer exact(), and the caller has to replay the
+ * trace instead.
+ *
+ * This class sits behind a ReadWriteCombiner, so writes can reach it later than they happened.
+ * The combiner always passes along a deferred write before any predicate of the same kind, other
+ * than reads by the writing command through the same reference, which it drops. A recorded
+ * predicate has therefore already seen every write that could change its outcome.
+ *
+ * The PostBuildRecorder class expects a template parameter that is an IRSink, which will receive
+ * all of the original trace steps unchanged.
+ */
+template <class Next>
+class PostBuildRecorder : public Next {
+ public:
+  /// The constructor for a post-build recorder passes any arguments along to the next layer
+  template <typename... Args>
+  PostBuildRecorder(Args&&... args) noexcept : Next(std::forward<Args>(args)...) {}
+
+  /// Take the outcomes for all Build-scenario predicates, in trace order. Only valid after finish()
+  std::list<PostBuildOutcome> takeOutcomes() noexcept { return std::move(_outcomes); }
+
+  /// Do the recorded outcomes match what replaying the trace would produce?
+  bool exact() const noexcept { return _exact; }
+
+  /// Handle a PathRef IR step
+  virtual void pathRef(const IRSource& source,
+                       const std::shared_ptr<Command>& command,
+                       Ref::ID base,
+                       fs::path path,
+                       AccessFlags flags,
+                       Ref::ID output) noexcept override {
+    // Remember how the reference was made so it can be resolved again after the build
+    _path_refs[{command, output}] = PathInfo{command->getRef(base)->getArtifact(), path, flags};
+
+    // A reference that may create its target modifies an entry in the containing directory
+    if (flags.create) modifiedEntry(path.filename().string());
+
+    Next::pathRef(source, command, base, path, flags, output);
+  }
+
+  /// Handle an ExpectResult IR step
+  virtual void expectResult(const IRSource& source,
+                            const std::shared_ptr<Command>& command,
+                            Scenario scenario,
+                            Ref::ID ref,
+                            int8_t expected) noexcept override {
+    if (scenario & Scenario::Build) record(command, ref, PostBuildOutcome::Result);
+    Next::expectResult(source, command, scenario, ref, expected);
+  }
+
+  /// Handle a MatchMetadata IR step
+  virtual void matchMetadata(const IRSource& source,
+                             const std::shared_ptr<Command>& command,
+                             Scenario scenario,
+                             Ref::ID ref,
+                             MetadataVersion expected) noexcept override {
+    if (scenario & Scenario::Build) record(command, ref, PostBuildOutcome::Metadata);
+    Next::matchMetadata(source, command, scenario, ref, expected);
+  }
+
+  /// Handle a MatchContent IR step
+  virtual void matchContent(const IRSource& source,
+                            const std::shared_ptr<Command>& command,
+                            Scenario scenario,
+                            Ref::ID ref,
+                            std::shared_ptr<ContentVersion> expected) noexcept override {
+    if (scenario & Scenario::Build) record(command, ref, PostBuildOutcome::Content);
+    Next::matchContent(source, command, scenario, ref, expected);
+  }
+
+  /// Handle an UpdateMetadata IR step
+  virtual void updateMetadata(const IRSource& source,
+                              const std::shared_ptr<Command>& command,
+                              Ref::ID ref,
+                              MetadataVersion written) noexcept override {
+    if (const auto& a = command->getRef(ref)->getArtifact(); a) _metadata_written.insert(a);
+    Next::updateMetadata(source, command, ref, written);
+  }
+
+  /// Handle an UpdateContent IR step
+  virtual void updateContent(const IRSource& source,
+                             const std::shared_ptr<Command>& command,
+                             Ref::ID ref,
+                             std::shared_ptr<ContentVersion> written) noexcept override {
+    if (const auto& a = command->getRef(ref)->getArtifact(); a) _content_written.insert(a);
+    Next::updateContent(source, command, ref, written);
+  }
+
+  /// Handle an AddEntry IR step
+  virtual void addEntry(const IRSource& source,
+                        const std::shared_ptr<Command>& command,
+                        Ref::ID dir,
+                        std::string name,
+                        Ref::ID target) noexcept override {
+    modifiedEntry(name);
+    if (const auto& a = command->getRef(target)->getArtifact(); a) _linked.insert(a);
+    Next::addEntry(source, command, dir, name, target);
+  }
+
+  /// Handle a RemoveEntry IR step
+  virtual void removeEntry(const IRSource& source,
+                           const std::shared_ptr<Command>& command,
+                           Ref::ID dir,
+                           std::string name,
+                           Ref::ID target) noexcept override {
+    modifiedEntry(name);
+    Next::removeEntry(source, command, dir, name, target);
+  }
+
+  /// The phase is finished, so the model now holds the post-build state
+  virtual void finish() noexcept override {
+    for (auto& p : _pending) {
+      auto artifact = p.artifact.lock();
+
+      // An artifact that is gone can't be checked against the final state
+      if (p.had_artifact && !artifact) _exact = false;
+
+      if (p.path.has_value()) {
+        // A replay would see the state from the earlier change, not the final state
+        if (modifiedAround(p.path->path, p.seq)) _exact = false;
+
+        // Resolve the path again if an entry it passes through changed after the predicate
+        if (p.resolve_again && modifiedSince(p.path->path, p.seq)) {
+          auto flags = p.path->flags;
+          flags.create = false;
+          flags.exclusive = false;
+          flags.truncate = false;
+
+          auto base = p.path->base.lock();
+          auto ref = base ? base->resolve(nullptr, p.path->path, flags) : Ref(ENOENT);
+
+          if (p.path->flags.create && ref.getResultCode() == ENOENT) {
+            // The reference would create its target again, so it keeps the outcome from the build
+
+          } else if (p.path->flags.create && p.path->flags.exclusive && ref.isSuccess()) {
+            p.outcome.resolved = false;
+            p.outcome.result = EEXIST;
+            artifact.reset();
+
+          } else {
+            p.outcome.resolved = ref.isResolved();
+            p.outcome.result = ref.getResultCode();
+
+            // A replay would see any earlier writes to a different artifact, not its final state
+            if (ref.getArtifact() != artifact && wasWritten(ref.getArtifact())) _exact = false;
+            artifact = ref.getArtifact();
+          }
+        }
+      }
+
+      // Fill in any post-build version that was not settled when the predicate ran
+      if (p.outcome.resolved && artifact) {
+        if (p.outcome.kind == PostBuildOutcome::Metadata && !p.outcome.metadata.has_value()) {
+          p.outcome.metadata = artifact->peekMetadata();
+        } else if (p.outcome.kind == PostBuildOutcome::Content && !p.outcome.content) {
+          p.outcome.content = artifact->peekContent();
+        }
+      }
+
+      _outcomes.push_back(std::move(p.outcome));
+    }
+
+    if (!_exact) LOG(phase) << "Post-build outcomes from this phase need a replay";
+
+    _pending.clear();
+    _path_refs.clear();
+
+    Next::finish();
+  }
+
+ private:
+  /// The set type used to track artifacts without keeping them alive or confusing reused addresses
+  using ArtifactSet = std::set<std::weak_ptr<Artifact>, std::owner_less<>>;
+
+  /// The information needed to resolve a PathRef again
+  struct PathInfo {
+    std::weak_ptr<Artifact> base;
+    fs::path path;
+    AccessFlags flags;
+  };
+
+  /// A predicate whose post-build outcome may not be settled until the end of the phase
+  struct Pending {
+    PostBuildOutcome outcome;
+    std::weak_ptr<Artifact> artifact;
+    bool had_artifact;
+    std::optional<PathInfo> path;
+    bool resolve_again;
+    size_t seq;
+  };
+
+  /// The first and last points in the phase where an entry with some name was added or removed
+  struct EntryChanges {
+    size_t first;
+    size_t last;
+  };
+
+  /// Record the state a Build-scenario predicate observes on a reference
+  void record(const std::shared_ptr<Command>& command,
+              Ref::ID ref_id,
+              PostBuildOutcome::Kind kind) noexcept {
+    const auto& ref = command->getRef(ref_id);
+
+    Pending p;
+    p.outcome.kind = kind;
+    p.outcome.ref = ref_id;
+    p.outcome.resolved = ref->isResolved();
+    p.outcome.result = ref->getResultCode();
+    p.resolve_again = false;
+    p.seq = _seq;
+
+    std::shared_ptr<Artifact> artifact;
+    if (ref->isResolved()) artifact = ref->getArtifact();
+    p.artifact = artifact;
+    p.had_artifact = static_cast<bool>(artifact);
+
+    // Was this reference made with a path?
+    if (auto iter = _path_refs.find({command, ref_id}); iter != _path_refs.end()) {
+      p.path = iter->second;
+
+      // A reference that creates its target leaves that target linked and written
+      if (iter->second.flags.create && artifact) {
+        _linked.insert(artifact);
+        _metadata_written.insert(artifact);
+        _content_written.insert(artifact);
+      }
+
+      // If the target was not linked earlier in the phase, the path may resolve differently
+      p.resolve_again = !artifact || _linked.count(artifact) == 0;
+    }
+
+    // If the artifact was already written in this phase, the post-build state keeps the version
+    // observed now. Otherwise the final version will be used.
+    if (artifact) {
+      if (kind == PostBuildOutcome::Metadata && _metadata_written.count(artifact) > 0) {
+        p.outcome.metadata = artifact->peekMetadata();
+      } else if (kind == PostBuildOutcome::Content && _content_written.count(artifact) > 0) {
+        p.outcome.content = artifact->peekContent();
+      }
+    }
+
+    _pending.push_back(std::move(p));
+  }
+
+  /// Record a change to a directory entry with the given name
+  void modifiedEntry(std::string name) noexcept {
+    auto [iter, added] = _modified_names.emplace(name, EntryChanges{_seq + 1, _seq + 1});
+    iter->second.last = ++_seq;
+  }
+
+  /// Has any entry named along this path changed since a given point in the phase?
+  bool modifiedSince(const fs::path& path, size_t seq) const noexcept {
+    for (const auto& part : path) {
+      auto iter = _modified_names.find(part.string());
+      if (iter != _modified_names.end() && iter->second.last > seq) return true;
+    }
+    return false;
+  }
+
+  /// Did any entry named along this path change both before and after a point in the phase?
+  bool modifiedAround(const fs::path& path, size_t seq) const noexcept {
+    for (const auto& part : path) {
+      auto iter = _modified_names.find(part.string());
+      if (iter != _modified_names.end() && iter->second.first <= seq && iter->second.last > seq) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// Was an artifact's content or metadata written in this phase?
+  bool wasWritten(const std::shared_ptr<Artifact>& a) const noexcept {
+    return a && (_content_written.count(a) > 0 || _metadata_written.count(a) > 0);
+  }
+
+  /// Predicates recorded so far in this phase
+  std::list<Pending> _pending;
+
+  /// Outcomes for all predicates, available once the phase finishes
+  std::list<PostBuildOutcome> _outcomes;
+
+  /// The most recent PathRef that assigned each command's references
+  std::map<std::tuple<std::shared_ptr<Command>, Ref::ID>, PathInfo> _path_refs;
+
+  /// Artifacts whose metadata was written in this phase
+  ArtifactSet _metadata_written;
+
+  /// Artifacts whose content was written in this phase
+  ArtifactSet _content_written;
+
+  /// Artifacts linked into a directory in this phase
+  ArtifactSet _linked;
+
+  /// The changes to entries with each name in this phase. Entries are tracked by name alone, which
+  /// may resolve a path again when it isn't needed, but never misses a change.
+  std::map<std::string, EntryChanges> _modified_names;
+
+  /// A counter that orders directory entry changes and predicates within the phase
+  size_t _seq = 0;
+
+  /// Cleared when an outcome may differ from the outcome a replay would produce
+  bool _exact = true;
+};
 
 /**
  * This class processes a build trace that has already been completed, and adds new predicates to
  * check against the state left at the end of a build.
  *
+ * A checker created with recorded outcomes takes the post-build outcome of every Build-scenario
+ * predicate from the PostBuildRecorder that watched the same trace, and can be sent the trace
+ * directly. If the outcomes don't line up with the trace's predicates, the checker emits only the
+ * Build-scenario predicates from that point on and reports that it failed(). A checker created
+ * without recorded outcomes must sit behind a Build that emulates the trace again, and checks each
+ * predicate against the emulated state as it arrives.
+ *
  * The PostBuildChecker class expects a template parameter that is an IRSink, which will receive all
  * of the original trace steps along with the additional steps for post-build checks. A likely use
- * case would be to instantiate a PostBuildChecker<IRBuffer>.
+ * case would be to instantiate a PostBuildChecker<TraceWriter>.
  */
 template <class Next>
 class PostBuildChecker : public Next {
  public:
-  /// The constructor for a post-build checker passes any arguments along to the next layer
+  /// The constructor for a post-build checker passes any arguments after the outcomes along to
+  /// the next layer
   template <typename... Args>
-  PostBuildChecker(Args&&... args) noexcept : Next(std::forward<Args>(args)...) {}
+  PostBuildChecker(std::optional<std::list<PostBuildOutcome>> outcomes, Args&&... args) noexcept :
+      Next(std::forward<Args>(args)...), _outcomes(std::move(outcomes)) {}
+
+  /// Did the recorded outcomes fail to match the trace?
+  bool failed() const noexcept { return _failed; }
 
   /// Handle an ExpectResult IR step
   virtual void expectResult(const IRSource& source,
@@ -29,12 +398,15 @@ class PostBuildChecker : public Next {
                             Ref::ID ref,
                             int8_t expected) noexcept override {
     if (scenario & Scenario::Build) {
-      auto post_build = command->getRef(ref)->getResultCode();
-      if (post_build == expected) {
+      auto outcome = getOutcome(command, ref, PostBuildOutcome::Result);
+
+      if (!outcome.has_value()) {
+        Next::expectResult(source, command, Scenario::Build, ref, expected);
+      } else if (outcome->result == expected) {
         Next::expectResult(source, command, Scenario::Both, ref, expected);
       } else {
         Next::expectResult(source, command, Scenario::Build, ref, expected);
-        Next::expectResult(source, command, Scenario::PostBuild, ref, post_build);
+        Next::expectResult(source, command, Scenario::PostBuild, ref, outcome->result);
       }
     }
   }
@@ -46,10 +418,12 @@ class PostBuildChecker : public Next {
                              Ref::ID ref,
                              MetadataVersion expected) noexcept override {
     if (scenario & Scenario::Build) {
+      auto outcome = getOutcome(command, ref, PostBuildOutcome::Metadata);
+
       // Did the reference resolve in the post-build state?
-      if (command->getRef(ref)->isResolved()) {
+      if (outcome.has_value() && outcome->resolved && outcome->metadata.has_value()) {
         // Yes. Grab the outcome from the post-build match.
-        auto post_build = command->getRef(ref)->getArtifact()->peekMetadata();
+        auto post_build = outcome->metadata.value();
 
         // Is the post-build version match the version from during the build?
         if (post_build.matches(expected)) {
@@ -74,10 +448,12 @@ class PostBuildChecker : public Next {
                             Ref::ID ref,
                             std::shared_ptr<ContentVersion> expected) noexcept override {
     if (scenario & Scenario::Build) {
+      auto outcome = getOutcome(command, ref, PostBuildOutcome::Content);
+
       // Did the reference resolve in the post-build state?
-      if (command->getRef(ref)->isResolved()) {
+      if (outcome.has_value() && outcome->resolved && outcome->content) {
         // Yes. Grab the outcome from the post-build match
-        const auto& post_build = command->getRef(ref)->getArtifact()->peekContent();
+        const auto& post_build = outcome->content;
 
         // Does the post-build version match the version from during the build?
         if (post_build->matches(expected)) {
@@ -95,4 +471,52 @@ class PostBuildChecker : public Next {
       }
     }
   }
+
+ private:
+  /**
+   * Get the post-build outcome for the next Build-scenario predicate in the trace
+   * \returns the outcome, or nullopt if the recorded outcomes do not match the trace
+   */
+  std::optional<PostBuildOutcome> getOutcome(const std::shared_ptr<Command>& command,
+                                             Ref::ID ref_id,
+                                             PostBuildOutcome::Kind kind) noexcept {
+    // Without recorded outcomes, check the state of the emulated reference
+    if (!_outcomes.has_value()) {
+      const auto& ref = command->getRef(ref_id);
+
+      PostBuildOutcome outcome;
+      outcome.kind = kind;
+      outcome.ref = ref_id;
+      outcome.resolved = ref->isResolved();
+      outcome.result = ref->getResultCode();
+
+      if (outcome.resolved && kind == PostBuildOutcome::Metadata) {
+        outcome.metadata = ref->getArtifact()->peekMetadata();
+      } else if (outcome.resolved && kind == PostBuildOutcome::Content) {
+        outcome.content = ref->getArtifact()->peekContent();
+      }
+
+      return outcome;
+    }
+
+    if (_failed) return std::nullopt;
+
+    // The next recorded outcome must belong to this predicate
+    if (_outcomes->empty() || _outcomes->front().kind != kind ||
+        _outcomes->front().ref != ref_id) {
+      WARN << "Recorded post-build outcomes do not match the trace";
+      _failed = true;
+      return std::nullopt;
+    }
+
+    auto outcome = std::move(_outcomes->front());
+    _outcomes->pop_front();
+    return outcome;
+  }
+
+  /// The recorded post-build outcomes in trace order, or nullopt to check the emulated state
+  std::optional<std::list<PostBuildOutcome>> _outcomes;
+
+  /// Set when the recorded outcomes did not match the trace
+  bool _failed = false;
 };
@@ -17,7 +17,11 @@
 
 #include "data/IRSink.hh"
 #include "runtime/Command.hh"
+#include "util/cache.hh"
 #include "util/log.hh"
+#include "util/pool.hh"
+#include "util/remote.hh"
+#include "util/stats.hh"
 #include "versions/ContentVersion.hh"
 #include "versions/DirListVersion.hh"
 #include "versions/FileVersion.hh"
@@ -259,6 +263,8 @@ enum class RecordType : uint8_t {
 /********** TraceReader Constructor and Destructor **********/
 
 optional<TraceReader> TraceReader::load(string path) noexcept {
+  TIME_SCOPE(TraceLoad);
+
   // Open the trace file
   auto file = TraceFile::open(path);
   if (!file) return nullopt;
@@ -284,6 +290,17 @@ shared_ptr<Command> TraceReader::getRootCommand() const noexcept {
   return _commands[0];
 }
 
+void TraceReader::rewind() noexcept {
+  // Commands and versions keep their IDs, so the tables are filled in the same way again
+  _file.pos = 0;
+  _done = false;
+  _next_command_id = 0;
+  _next_version_id = 0;
+  _strings.clear();
+  _current_command_id = 0;
+  _current_command.reset();
+}
+
 /********** TraceWriter Constructor and Destructor **********/
 
 TraceWriter::TraceWriter(optional<string> path) noexcept :
@@ -329,6 +346,8 @@ void TraceWriter::link() const noexcept {
   // Is there an open file? If not, just return
   if (!_file) return;
 
+  TIME_SCOPE(DatabaseWrite);
+
   // Was a path provided?
   if (_path.has_value()) {
     // Yes. Link the trace onto the filesystem before it vanishes
@@ -528,7 +547,7 @@ void TraceReader::setVersion(ContentVersion::ID id, std::shared_ptr<ContentVersi
 }
 
 // Add a content version to the table and assign a new ID
-void TraceReader::addVersion(std::shared_ptr<ContentVersion> v) noexcept {
+bool TraceReader::addVersion(std::shared_ptr<ContentVersion> v) noexcept {
   // Assign an ID for the new version
   size_t id = _next_version_id++;
 
@@ -536,7 +555,9 @@ void TraceReader::addVersion(std::shared_ptr<ContentVersion> v) noexcept {
   if (id >= _versions.size()) _versions.resize(id + 1);
 
   // If the version isn't already stored, store it
-  if (!_versions[id]) _versions[id] = v;
+  if (_versions[id]) return false;
+  _versions[id] = v;
+  return true;
 }
 
 /********** String and Path Table Methods **********/
@@ -1299,7 +1320,11 @@ void TraceReader::handleRecord<RecordType::FileVersion>(IRSink& sink) noexcept {
   optional<FileVersion::Hash> hash;
   if (data.has_hash) hash = data.hash;
 
-  addVersion(make_shared<FileVersion>(data.is_empty, data.is_cached, mtime, hash));
+  auto v = make_pooled<FileVersion>(data.is_empty, data.is_cached, mtime, hash);
+
+  // Start fetching any cached copies that are missing locally as soon as the trace is read, so the
+  // fetches are in flight together instead of each waiting for the last when it is needed
+  if (addVersion(v) && remote::enabled()) v->prefetch();
 }
 
 // Write a FileVersion record to the output trace
@@ -1313,6 +1338,9 @@ void TraceWriter::emitFileVersion(const shared_ptr<FileVersion>& v) noexcept {
   // Emit the file version
   emitRecord<RecordType::FileVersion>(v->isEmpty(), v->isCached(), has_mtime, has_hash, mtime,
                                       hash);
+
+  // Keep the cached copy from being evicted while a saved trace refers to it
+  if (v->isCached() && has_hash) cache::reference(remote::hash_path(hash));
 }
 
 /********** SymlinkVersion Record **********/
@@ -1327,7 +1355,7 @@ struct Record<RecordType::SymlinkVersion> {
 template <>
 void TraceReader::handleRecord<RecordType::SymlinkVersion>(IRSink& sink) noexcept {
   const auto& data = takeRecord<RecordType::SymlinkVersion>();
-  addVersion(make_shared<SymlinkVersion>(getString(data.dest)));
+  addVersion(make_pooled<SymlinkVersion>(getString(data.dest)));
 }
 
 // Write a SymlinkVersion record to the output trace
@@ -1349,7 +1377,7 @@ void TraceReader::handleRecord<RecordType::DirListVersion>(IRSink& sink) noexcep
   const auto& data = takeRecord<RecordType::DirListVersion>();
   const PathID* entry_ids = takeArray<PathID>(data.entry_count);
 
-  auto v = make_shared<DirListVersion>();
+  auto v = make_pooled<DirListVersion>();
   for (size_t i = 0; i < data.entry_count; i++) {
     v->addEntry(getString(entry_ids[i]));
   }
@@ -1393,7 +1421,7 @@ struct Record<RecordType::PipeWriteVersion> {
 template <>
 void TraceReader::handleRecord<RecordType::PipeWriteVersion>(IRSink& sink) noexcept {
   takeRecord<RecordType::PipeWriteVersion>();
-  addVersion(make_shared<PipeWriteVersion>());
+  addVersion(make_pooled<PipeWriteVersion>());
 }
 
 // Write a PipeWriteVersion record to the output trace
@@ -1412,7 +1440,7 @@ struct Record<RecordType::PipeCloseVersion> {
 template <>
 void TraceReader::handleRecord<RecordType::PipeCloseVersion>(IRSink& sink) noexcept {
   takeRecord<RecordType::PipeCloseVersion>();
-  addVersion(make_shared<PipeCloseVersion>());
+  addVersion(make_pooled<PipeCloseVersion>());
 }
 
 // Write a PipeCloseVersion record to the output trace
@@ -1431,7 +1459,7 @@ struct Record<RecordType::PipeReadVersion> {
 template <>
 void TraceReader::handleRecord<RecordType::PipeReadVersion>(IRSink& sink) noexcept {
   takeRecord<RecordType::PipeReadVersion>();
-  addVersion(make_shared<PipeReadVersion>());
+  addVersion(make_pooled<PipeReadVersion>());
 }
 
 // Write a PipeReadVersion record to the output trace
@@ -1451,7 +1479,7 @@ struct Record<RecordType::SpecialVersion> {
 template <>
 void TraceReader::handleRecord<RecordType::SpecialVersion>(IRSink& sink) noexcept {
   const auto& data = takeRecord<RecordType::SpecialVersion>();
-  addVersion(make_shared<SpecialVersion>(data.can_commit));
+  addVersion(make_pooled<SpecialVersion>(data.can_commit));
 }
 
 // Write a SpecialVersion record to the output trace
@@ -94,6 +94,9 @@ class TraceReader : public IRSource {
   /// Get the root command
   std::shared_ptr<Command> getRootCommand() const noexcept;
 
+  /// Go back to the beginning of the trace so it can be sent to another sink
+  void rewind() noexcept;
+
   /// A saved trace is never an executing IRSource
   virtual bool isExecuting() const override { return false; }
 
@@ -147,8 +150,9 @@ class TraceReader : public IRSource {
   /// Set a content version in the versions table using a known ID
   void setVersion(ContentVersion::ID id, std::shared_ptr<ContentVersion> v) noexcept;
 
-  /// Add a content version to the table and assign a new ID
-  void addVersion(std::shared_ptr<ContentVersion> v) noexcept;
+  /// Add a content version to the table and assign a new ID. Returns false if a version was
+  /// already stored with that ID, in which case the new version is not used.
+  bool addVersion(std::shared_ptr<ContentVersion> v) noexcept;
 
  private:
   /// The trace file mapped for this TraceReader
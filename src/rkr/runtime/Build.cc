@@ -22,10 +22,12 @@
 #include "runtime/Ref.hh"
 #include "runtime/env.hh"
 #include "runtime/policy.hh"
+#include "runtime/prefetch.hh"
 #include "tracing/Tracer.hh"
 #include "util/TracePrinter.hh"
 #include "util/log.hh"
 #include "util/options.hh"
+#include "util/pool.hh"
 #include "util/stats.hh"
 #include "util/wrappers.hh"
 #include "versions/ContentVersion.hh"
@@ -119,28 +121,28 @@ void Build::specialRef(const IRSource& source,
   if (entity == SpecialRef::stdin) {
     // Create the stdin ref. Add one user, which accounts for the build tool itself
     // That way we won't close stdin when the build is finishing
-    auto stdin_ref = make_shared<Ref>(ReadAccess, env::getStdin(c));
+    auto stdin_ref = make_pooled<Ref>(ReadAccess, env::getStdin(c));
     stdin_ref->addUser();
     c->setRef(output, stdin_ref);
 
   } else if (entity == SpecialRef::stdout) {
     // Create the stdout ref and add one user (the build tool)
-    auto stdout_ref = make_shared<Ref>(WriteAccess, env::getStdout(c));
+    auto stdout_ref = make_pooled<Ref>(WriteAccess, env::getStdout(c));
     stdout_ref->addUser();
     c->setRef(output, stdout_ref);
 
   } else if (entity == SpecialRef::stderr) {
     // Create the stderr ref and add one user (the build tool)
-    auto stderr_ref = make_shared<Ref>(WriteAccess, env::getStderr(c));
+    auto stderr_ref = make_pooled<Ref>(WriteAccess, env::getStderr(c));
     stderr_ref->addUser();
     c->setRef(output, stderr_ref);
 
   } else if (entity == SpecialRef::root) {
-    c->setRef(output, make_shared<Ref>(ReadAccess + ExecAccess, env::getRootDir()));
+    c->setRef(output, make_pooled<Ref>(ReadAccess + ExecAccess, env::getRootDir()));
 
   } else if (entity == SpecialRef::cwd) {
     auto cwd_path = fs::current_path().relative_path();
-    auto ref = make_shared<Ref>(env::getRootDir()->resolve(c, cwd_path, ReadAccess + ExecAccess));
+    auto ref = make_pooled<Ref>(env::getRootDir()->resolve(c, cwd_path, ReadAccess + ExecAccess));
     c->setRef(output, ref);
 
     ASSERT(ref->isSuccess()) << "Failed to resolve current working directory";
@@ -150,7 +152,7 @@ void Build::specialRef(const IRSource& source,
     auto rkr = readlink("/proc/self/exe");
     auto rkr_launch = (rkr.parent_path() / "rkr-launch").relative_path();
 
-    auto ref = make_shared<Ref>(env::getRootDir()->resolve(c, rkr_launch, ReadAccess + ExecAccess));
+    auto ref = make_pooled<Ref>(env::getRootDir()->resolve(c, rkr_launch, ReadAccess + ExecAccess));
     c->setRef(output, ref);
 
   } else {
@@ -190,8 +192,8 @@ void Build::pipeRef(const IRSource& source,
 
   // Resolve the reference and save the result in output
   auto pipe = env::getPipe(c);
-  c->setRef(read_end, make_shared<Ref>(ReadAccess, pipe));
-  c->setRef(write_end, make_shared<Ref>(WriteAccess, pipe));
+  c->setRef(read_end, make_pooled<Ref>(ReadAccess, pipe));
+  c->setRef(write_end, make_pooled<Ref>(WriteAccess, pipe));
 }
 
 // A command references a new anonymous file
@@ -225,7 +227,7 @@ void Build::fileRef(const IRSource& source,
   _output.fileRef(source, c, mode, output);
 
   // Resolve the reference and save the result in output
-  c->setRef(output, make_shared<Ref>(ReadAccess + WriteAccess, env::createFile(c, mode)));
+  c->setRef(output, make_pooled<Ref>(ReadAccess + WriteAccess, env::createFile(c, mode)));
 }
 
 // A command references a new anonymous symlink
@@ -260,7 +262,7 @@ void Build::symlinkRef(const IRSource& source,
 
   // Resolve the reference and save the result in output
   c->setRef(output,
-            make_shared<Ref>(ReadAccess + WriteAccess + ExecAccess, env::getSymlink(c, target)));
+            make_pooled<Ref>(ReadAccess + WriteAccess + ExecAccess, env::getSymlink(c, target)));
 }
 
 // A command references a new anonymous directory
@@ -294,7 +296,7 @@ void Build::dirRef(const IRSource& source,
   _output.dirRef(source, c, mode, output);
 
   // Resolve the reference and save the result in output
-  c->setRef(output, make_shared<Ref>(ReadAccess + WriteAccess + ExecAccess, env::getDir(c, mode)));
+  c->setRef(output, make_pooled<Ref>(ReadAccess + WriteAccess + ExecAccess, env::getDir(c, mode)));
 }
 
 // A command makes a reference with a path
@@ -349,11 +351,17 @@ void Build::pathRef(const IRSource& source,
   }
 
   // Resolve the reference
-  shared_ptr<Ref> result = make_shared<Ref>(base_dir->resolve(c, path, flags));
+  shared_ptr<Ref> result = make_pooled<Ref>(_resolutions.resolve(c, base_dir, path, flags));
 
   // If this reference was to a temporary file, inform the command
   if (result->isSuccess() && is_tempfile) c->addTempfile(result->getArtifact());
 
+  // Record paths that did not exist, so a check can tell if they have been created since
+  if (result->getResultCode() == ENOENT && !is_tempfile) {
+    auto base_path = base_dir->getPath();
+    if (base_path.has_value()) c->addMissingPath((base_path.value() / path).lexically_normal());
+  }
+
   // Assign to the command's reference
   c->setRef(output, result);
 }
@@ -457,6 +465,9 @@ void Build::compareRefs(const IRSource& source,
       _deferred_steps.compareRefs(source, c, ref1_id, ref2_id, type);
       return;
     }
+
+    // Count the emulated predicate once the command has launched
+    c->getProfile().predicates++;
   }
 
   // Create an IR step and add it to the output trace
@@ -512,6 +523,9 @@ void Build::expectResult(const IRSource& source,
       _deferred_steps.expectResult(source, c, scenario, ref_id, expected);
       return;
     }
+
+    // Count the emulated predicate once the command has launched
+    c->getProfile().predicates++;
   }
 
   // Create an IR step and add it to the output trace
@@ -561,6 +575,9 @@ void Build::matchMetadata(const IRSource& source,
       _deferred_steps.matchMetadata(source, c, scenario, ref_id, expected);
       return;
     }
+
+    // Count the emulated predicate once the command has launched
+    c->getProfile().predicates++;
   }
 
   // Create an IR step and add it to the output trace
@@ -610,6 +627,9 @@ void Build::matchContent(const IRSource& source,
       _deferred_steps.matchContent(source, c, scenario, ref_id, expected);
       return;
     }
+
+    // Count the emulated predicate once the command has launched
+    c->getProfile().predicates++;
   }
 
   // Create an IR step and add it to the output trace
@@ -894,6 +914,9 @@ void Build::launch(const IRSource& source,
   // Add the child to the parent's list of children
   parent->addChild(child);
 
+  // If the child may run, try to decide now whether it must run in this phase
+  if (child->mayRun() && child->resolveMayRun()) stats::promoted_commands++;
+
   // Is the child going to run?
   if (child->mustRun()) {
     // Yes. The child is going to run
@@ -928,6 +951,9 @@ void Build::launch(const IRSource& source,
   if (parent->canEmulate()) {
     // Yes. We need to launch the child if it is supposed to run
     if (child->mustRun()) {
+      // Prefetched stat results could be stale once a command runs, so stop using them
+      prefetch::stop();
+
       // Start the child command in the tracer and record it as launched
       child->setLaunched(_tracer.start(*this, child));
 
@@ -17,6 +17,7 @@
 #include "data/IRSource.hh"
 #include "data/Trace.hh"
 #include "runtime/Ref.hh"
+#include "runtime/ResolutionCache.hh"
 #include "tracing/Tracer.hh"
 
 namespace fs = std::filesystem;
@@ -197,6 +198,9 @@ class Build : public IRSink {
   /// The tracer that will be used to execute any commands that must rerun
   Tracer _tracer;
 
+  /// Path resolutions performed during this build phase
+  ResolutionCache _resolutions;
+
   /// The default output is used if a trace handler is not provided during setup
   inline static IRSink _default_output;
 
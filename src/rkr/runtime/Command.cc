@@ -1,5 +1,6 @@
 #include "Command.hh"
 
+#include <chrono>
 #include <filesystem>
 #include <list>
 #include <map>
@@ -13,7 +14,9 @@
 #include "artifacts/DirArtifact.hh"
 #include "runtime/env.hh"
 #include "tracing/Process.hh"
+#include "util/events.hh"
 #include "util/options.hh"
+#include "util/timeline.hh"
 #include "versions/ContentVersion.hh"
 #include "versions/DirVersion.hh"
 #include "versions/MetadataVersion.hh"
@@ -316,6 +319,43 @@ set<shared_ptr<Command>> Command::collectMustRun() noexcept {
   return result;
 }
 
+// Try to promote a MayRun command to MustRun using inputs produced earlier in this phase
+bool Command::resolveMayRun() noexcept {
+  if (!mayRun()) return false;
+
+  // Marking this command MustRun requires producers of its uncached inputs to run (rule 3). That
+  // is only possible if they have already run in this phase.
+  for (const auto& weak_producer : _previous_run._needs_output_from) {
+    auto producer = weak_producer.lock();
+    if (!producer || !producer->mustRun() || !producer->hasExited()) return false;
+  }
+
+  // Commands that use this command's output will be marked too (rule 5). Leave the decision to
+  // the next phase if any of them has already launched.
+  for (const auto& weak_user : _previous_run._output_used_by) {
+    auto user = weak_user.lock();
+    if (user && user->isLaunched()) return false;
+  }
+
+  // Re-check every cached input this command read from another command on its last run
+  bool changed = false;
+  for (const auto& [a, expected, weak_writer] : _previous_run._produced_inputs) {
+    // If the writer has not exited in this phase, its output is not final yet
+    auto writer = weak_writer.lock();
+    if (!writer || !writer->hasExited()) return false;
+
+    auto observed = a->peekContent();
+    if (!observed || !observed->matches(expected)) changed = true;
+  }
+
+  if (!changed) return false;
+
+  LOGF(rebuild, "{} must run: input changed by a command that ran earlier in this phase", *this);
+  mark(RebuildMarking::MustRun);
+
+  return true;
+}
+
 // Assign a marking to this command. Return true if the marking is new.
 bool Command::mark(RebuildMarking m) noexcept {
   // See rebuild planning rules in docs/new-rebuild.md
@@ -461,6 +501,9 @@ bool Command::isLaunched() noexcept {
 void Command::setLaunched(shared_ptr<Process> p) noexcept {
   _current_run._launched = true;
   _current_run._process = p;
+
+  // Start the clock for a traced run
+  if (p) _profile.launched = std::chrono::steady_clock::now();
 }
 
 const shared_ptr<Process>& Command::getProcess() noexcept {
@@ -475,6 +518,20 @@ int Command::getExitStatus() noexcept {
 // Set this command's exit status, and record that it has exited
 void Command::setExitStatus(int status) noexcept {
   _current_run._exit_status = status;
+
+  // Add the time a traced run took to the command's profile, and show the run on the timeline
+  if (_current_run._process) {
+    auto now = std::chrono::steady_clock::now();
+    _profile.wall_ns +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(now - _profile.launched).count();
+
+    if (timeline::enabled) {
+      timeline::span("command", getShortName(), timeline::CommandProcess,
+                     _current_run._process->getID(), _profile.launched, now);
+    }
+
+    events::exit(*this, status);
+  }
 }
 
 // Apply a set of substitutions to this command and save the mappings for future paths
@@ -611,6 +668,7 @@ void Command::inputChanged(shared_ptr<Artifact> artifact,
 void Command::addMetadataInput(shared_ptr<Artifact> a,
                                shared_ptr<MetadataVersion> v,
                                shared_ptr<Command> writer) noexcept {
+  if (_recorded_inputs) _recorded_inputs->emplace_back(a, v, writer);
   if (options::track_inputs_outputs) _current_run._inputs.emplace_back(a, v, writer);
 
   // If this command wrote the version there's no need to do any additional tracking
@@ -626,6 +684,10 @@ void Command::addMetadataInput(shared_ptr<Artifact> a,
 
     // Otherwise, add this command run to the creator's set of output users
     writer->_current_run._output_used_by.emplace(shared_from_this());
+
+  } else {
+    // No command wrote the version, so it comes from outside the build
+    _current_run._external_inputs.emplace(a, v);
   }
 }
 
@@ -633,6 +695,7 @@ void Command::addMetadataInput(shared_ptr<Artifact> a,
 void Command::addContentInput(shared_ptr<Artifact> a,
                               shared_ptr<ContentVersion> v,
                               shared_ptr<Command> writer) noexcept {
+  if (_recorded_inputs) _recorded_inputs->emplace_back(a, v, writer);
   if (options::track_inputs_outputs) _current_run._inputs.emplace_back(a, v, writer);
 
   // Is the artifact one of our temporary files?
@@ -669,7 +732,11 @@ void Command::addContentInput(shared_ptr<Artifact> a,
     writer->_current_run._output_used_by.emplace(shared_from_this());
 
     // Is the version committable?
-    if (!v->canCommit()) {
+    if (v->canCommit()) {
+      // Yes. Remember it so a MayRun marking can be resolved early during the next phase
+      _current_run._produced_inputs.emplace_back(a, v, writer);
+
+    } else {
       // No. Is the input uncommitted? If so, the writer must produce it for this command
       if (a->hasUncommittedContent()) {
         _current_run._needs_output_from.emplace(writer);
@@ -678,6 +745,10 @@ void Command::addContentInput(shared_ptr<Artifact> a,
       // If the writer has to run, the reader must also run.
       writer->_current_run._output_needed_by.emplace(shared_from_this());
     }
+
+  } else {
+    // No command wrote the version, so it comes from outside the build
+    _current_run._external_inputs.emplace(a, v);
   }
 }
 
@@ -687,6 +758,7 @@ void Command::addDirectoryInput(std::shared_ptr<Artifact> a,
                                 std::shared_ptr<Command> writer) noexcept {
   if (!v) return;
 
+  if (_recorded_inputs) _recorded_inputs->emplace_back(a, v, writer);
   if (options::track_inputs_outputs) _current_run._inputs.emplace_back(a, v, writer);
 
   // If this command is running, make sure the directory version is committed
@@ -714,6 +786,25 @@ void Command::addDirectoryInput(std::shared_ptr<Artifact> a,
   }
 }
 
+// Record that a path this command resolved did not exist
+void Command::addMissingPath(string path) noexcept {
+  _current_run._missing_paths.emplace(std::move(path));
+}
+
+// Track a list of previously-recorded inputs to this command
+void Command::replayInputs(const InputList& inputs) noexcept {
+  for (const auto& [a, v, weak_writer] : inputs) {
+    auto writer = weak_writer.lock();
+    if (auto mv = std::dynamic_pointer_cast<MetadataVersion>(v)) {
+      addMetadataInput(a, mv, writer);
+    } else if (auto cv = std::dynamic_pointer_cast<ContentVersion>(v)) {
+      addContentInput(a, cv, writer);
+    } else if (auto dv = std::dynamic_pointer_cast<DirVersion>(v)) {
+      addDirectoryInput(a, dv, writer);
+    }
+  }
+}
+
 // Add an output to this command
 void Command::addMetadataOutput(shared_ptr<Artifact> a, shared_ptr<MetadataVersion> v) noexcept {
   if (options::track_inputs_outputs) _current_run._outputs.emplace_back(a, v);
@@ -721,6 +812,7 @@ void Command::addMetadataOutput(shared_ptr<Artifact> a, shared_ptr<MetadataVersi
 
 // Add an output to this command
 void Command::addContentOutput(shared_ptr<Artifact> a, shared_ptr<ContentVersion> v) noexcept {
+  _current_run._content_outputs[a] = v;
   if (options::track_inputs_outputs) _current_run._outputs.emplace_back(a, v);
 }
 
@@ -754,6 +846,41 @@ const Command::WeakCommandSet& Command::getInputProducers() const noexcept {
   return _previous_run._uses_output_from;
 }
 
+// Get the set of commands that produce uncached inputs to this command
+const Command::WeakCommandSet& Command::getUncachedInputProducers() const noexcept {
+  return _previous_run._needs_output_from;
+}
+
+// Get the set of commands that use this command's outputs
+const Command::WeakCommandSet& Command::getOutputUsers() const noexcept {
+  return _previous_run._output_used_by;
+}
+
+// Get the set of commands that require uncached outputs from this command
+const Command::WeakCommandSet& Command::getUncachedOutputUsers() const noexcept {
+  return _previous_run._output_needed_by;
+}
+
+// Get the inputs to this command that were not written by any command
+const Command::ExternalInputSet& Command::getExternalInputs() const noexcept {
+  return _previous_run._external_inputs;
+}
+
+// Get the paths this command found did not exist
+const set<string>& Command::getMissingPaths() const noexcept {
+  return _previous_run._missing_paths;
+}
+
+// Get the last content this command wrote to each artifact
+const Command::ContentOutputMap& Command::getContentOutputs() const noexcept {
+  return _previous_run._content_outputs;
+}
+
+// Get the scenarios where this command observed a change
+Scenario Command::getChanges() const noexcept {
+  return _previous_run._changed;
+}
+
 optional<map<string, string>> Command::tryToMatch(const vector<string>& other_args,
                                                   const map<int, Ref::ID>& fds) const noexcept {
   // If the argument arrays are different lengths, there cannot be a match
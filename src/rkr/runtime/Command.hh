@@ -8,10 +8,13 @@
 #include <memory>
 #include <optional>
 #include <ostream>
+#include <set>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "runtime/Ref.hh"
+#include "runtime/profile.hh"
 #include "util/log.hh"
 
 namespace fs = std::filesystem;
@@ -127,6 +130,9 @@ class Command : public std::enable_shared_from_this<Command> {
   /// Is this command the null command?
   bool isEmptyCommand() const noexcept;
 
+  /// Get the cost counters for this command in the current build
+  profile::Counters& getProfile() noexcept { return _profile; }
+
   /// Check if this command has ever executed
   bool hasExecuted() const noexcept { return _executed; }
 
@@ -201,6 +207,16 @@ class Command : public std::enable_shared_from_this<Command> {
   /// Get a set of all commands that must run from this command and its descendants
   std::set<std::shared_ptr<Command>> collectMustRun() noexcept;
 
+  /**
+   * Try to settle a MayRun marking as this command is launched, instead of waiting for another
+   * build phase. The command re-checks the cached inputs it read from other commands on its last
+   * run. If all of those commands have exited in the current phase and one of the inputs has
+   * changed, the command is promoted to MustRun.
+   *
+   * \returns true if the command was promoted to MustRun
+   */
+  bool resolveMayRun() noexcept;
+
   /****** Types and struct used to track run-specific data ******/
 
   using WeakCommandSet = std::set<std::weak_ptr<Command>, std::owner_less<std::weak_ptr<Command>>>;
@@ -210,10 +226,23 @@ class Command : public std::enable_shared_from_this<Command> {
                            std::shared_ptr<Version>,   // The input version
                            std::weak_ptr<Command>>>;   // The command that created theinput
 
+  using ProducedInputList =
+      std::list<std::tuple<std::shared_ptr<Artifact>,        // The artifact that was accessed
+                           std::shared_ptr<ContentVersion>,  // The input version
+                           std::weak_ptr<Command>>>;         // The command that wrote the input
+
   using OutputList =
       std::list<std::tuple<std::shared_ptr<Artifact>,   // The artifact that was written
                            std::shared_ptr<Version>>>;  // The version written to that artifact
 
+  using ExternalInputSet =
+      std::set<std::pair<std::shared_ptr<Artifact>,   // The artifact that was accessed
+                         std::shared_ptr<Version>>>;  // The input version, which no command wrote
+
+  using ContentOutputMap =
+      std::map<std::shared_ptr<Artifact>,          // The artifact that was written
+               std::shared_ptr<ContentVersion>>;  // The last content written to that artifact
+
   struct Run {
     /// The command's local references
     std::vector<std::shared_ptr<Ref>> _refs;
@@ -256,6 +285,10 @@ class Command : public std::enable_shared_from_this<Command> {
     /// Outputs from this command
     OutputList _outputs;
 
+    /// Cached content inputs written by other commands. Always recorded, and used to resolve a
+    /// MayRun marking during the next phase
+    ProducedInputList _produced_inputs;
+
     /// The set of commands that produce any inputs to this command
     WeakCommandSet _uses_output_from;
 
@@ -267,6 +300,15 @@ class Command : public std::enable_shared_from_this<Command> {
 
     /// The set of commands that require uncached outputs from this command
     WeakCommandSet _output_needed_by;
+
+    /// Inputs to this command that were not written by any command. Saved in the check summary.
+    ExternalInputSet _external_inputs;
+
+    /// Paths this command found did not exist. Saved in the check summary.
+    std::set<std::string> _missing_paths;
+
+    /// The last content this command wrote to each artifact. Saved in the check summary.
+    ContentOutputMap _content_outputs;
   };
 
   /****** Data for the current run ******/
@@ -292,6 +334,9 @@ class Command : public std::enable_shared_from_this<Command> {
   /// Set this command's exit status, and record that it has exited
   void setExitStatus(int status) noexcept;
 
+  /// Has the current run of this command exited?
+  bool hasExited() noexcept { return _current_run._exit_status != -1; }
+
   /// Apply a set of subsitutions to this command's arguments, and save the set for future path
   /// substitutions
   void applySubstitutions(std::map<std::string, std::string> substitutions) noexcept;
@@ -350,6 +395,16 @@ class Command : public std::enable_shared_from_this<Command> {
                          std::shared_ptr<DirVersion> v,
                          std::shared_ptr<Command> writer) noexcept;
 
+  /// Record that a path this command resolved did not exist
+  void addMissingPath(std::string path) noexcept;
+
+  /// Copy every input this command is given into a list, in addition to tracking it as usual.
+  /// Pass nullptr to stop recording.
+  void recordInputs(InputList* inputs) noexcept { _recorded_inputs = inputs; }
+
+  /// Track a list of previously-recorded inputs to this command, in order
+  void replayInputs(const InputList& inputs) noexcept;
+
   /// Track a metadata version output from this command
   void addMetadataOutput(std::shared_ptr<Artifact> a, std::shared_ptr<MetadataVersion> v) noexcept;
 
@@ -373,6 +428,27 @@ class Command : public std::enable_shared_from_this<Command> {
   /// Get the set of commands that produce inputs to this command
   const WeakCommandSet& getInputProducers() const noexcept;
 
+  /// Get the set of commands that produce uncached inputs to this command
+  const WeakCommandSet& getUncachedInputProducers() const noexcept;
+
+  /// Get the set of commands that use this command's outputs
+  const WeakCommandSet& getOutputUsers() const noexcept;
+
+  /// Get the set of commands that require uncached outputs from this command
+  const WeakCommandSet& getUncachedOutputUsers() const noexcept;
+
+  /// Get the inputs to this command that were not written by any command
+  const ExternalInputSet& getExternalInputs() const noexcept;
+
+  /// Get the paths this command found did not exist
+  const std::set<std::string>& getMissingPaths() const noexcept;
+
+  /// Get the last content this command wrote to each artifact
+  const ContentOutputMap& getContentOutputs() const noexcept;
+
+  /// Get the scenarios where this command observed a change
+  Scenario getChanges() const noexcept;
+
   /**
    * Does this command match a given set of launch arguments? If so, return a set of
    * substitutions required to make the match work. These substitutions should be applied if the
@@ -426,12 +502,18 @@ class Command : public std::enable_shared_from_this<Command> {
   /// The marking state for this command that determines how the command is run
   RebuildMarking _marking = RebuildMarking::Emulate;
 
+  /// If set, inputs to this command are also recorded in this list
+  InputList* _recorded_inputs = nullptr;
+
   /// Short names of different lengths for this command
   mutable std::map<size_t, std::optional<std::string>> _short_names;
 
   /// The total count of commands the last time the short name was computed
   mutable size_t _short_name_command_count = 0;
 
+  /// The cost counters for this command in the current build
+  profile::Counters _profile;
+
   // ID for this command and the buffer it is identified in
   Command::ID _id;
   size_t _buffer_id;
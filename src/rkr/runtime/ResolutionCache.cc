@@ -0,0 +1,76 @@
+#include "ResolutionCache.hh"
+
+#include <filesystem>
+#include <memory>
+#include <utility>
+
+#include "artifacts/Artifact.hh"
+#include "util/stats.hh"
+#include "versions/DirVersion.hh"
+
+using std::shared_ptr;
+
+namespace fs = std::filesystem;
+
+Ref ResolutionCache::resolve(const shared_ptr<Command>& c,
+                             const shared_ptr<Artifact>& base,
+                             const fs::path& path,
+                             AccessFlags flags) noexcept {
+  // A resolution that may create an entry changes the state it depends on. Don't cache it.
+  if (flags.create) return base->resolve(c, path, flags);
+
+  // Pack the expected outcome for each artifact type into the key
+  uint32_t type = static_cast<uint8_t>(flags.type.getResult(ArtifactType::File)) |
+                  static_cast<uint8_t>(flags.type.getResult(ArtifactType::Symlink)) << 8 |
+                  static_cast<uint8_t>(flags.type.getResult(ArtifactType::Dir)) << 16;
+
+  Key key(base.get(), path.string(), flags._data, type);
+
+  // Is there a cached resolution that is still valid?
+  if (auto iter = _entries.find(key); iter != _entries.end() && isValid(iter->second)) {
+    stats::resolution_hits++;
+
+    // Report the resolution's inputs to this command, then return the cached result
+    const auto& entry = iter->second;
+    c->replayInputs(entry.inputs);
+
+    if (entry.rc == SUCCESS) return Ref(flags, entry.artifact);
+    return entry.rc;
+  }
+
+  stats::resolution_misses++;
+
+  // Resolve the path and record the inputs the resolution reports along the way
+  Command::InputList inputs;
+  c->recordInputs(&inputs);
+  auto result = base->resolve(c, path, flags);
+  c->recordInputs(nullptr);
+
+  // If the resolution loaded a new entry from an on-disk directory, it depended on that
+  // directory's base version. Any later lookup of that entry will depend on the loaded entry
+  // instead, so wait for that lookup to cache the resolution.
+  for (const auto& [a, v, writer] : inputs) {
+    auto base_version = std::dynamic_pointer_cast<BaseDirVersion>(v);
+    if (base_version && !base_version->getCreated()) return result;
+  }
+
+  Entry entry{result.getResultCode(), result.getArtifact(), std::move(inputs), {}};
+
+  // Save the generation of the base artifact and every artifact that provided an input
+  entry.generations.emplace_back(base, base->getGeneration());
+  for (const auto& [a, v, writer] : entry.inputs) {
+    if (entry.generations.back().first == a) continue;
+    entry.generations.emplace_back(a, a->getGeneration());
+  }
+
+  _entries.insert_or_assign(std::move(key), std::move(entry));
+
+  return result;
+}
+
+bool ResolutionCache::isValid(const Entry& entry) noexcept {
+  for (const auto& [a, generation] : entry.generations) {
+    if (a->getGeneration() != generation) return false;
+  }
+  return true;
+}
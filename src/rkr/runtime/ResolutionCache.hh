@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "data/AccessFlags.hh"
+#include "runtime/Command.hh"
+#include "runtime/Ref.hh"
+
+namespace fs = std::filesystem;
+
+class Artifact;
+
+/**
+ * A ResolutionCache remembers the outcome of path resolutions during a single build phase. Many
+ * commands resolve the same path from the same base directory with the same flags (e.g. every
+ * compile opening the same header), and each resolution walks the path one entry at a time.
+ *
+ * A cached resolution stores its result along with every input the resolution reported to the
+ * command that performed it. When the same resolution is requested again, the inputs are replayed
+ * to the new command so it observes exactly the dependencies it would have observed by resolving
+ * the path itself.
+ *
+ * Each cached resolution also records the generation of every artifact it depended on. Adding or
+ * removing a directory entry, or changing an artifact's metadata, changes that artifact's
+ * generation, which invalidates only the cached resolutions that passed through it.
+ */
+class ResolutionCache {
+ public:
+  /**
+   * Resolve a path relative to a base artifact on behalf of a command
+   * \param c     The command performing the resolution
+   * \param base  The artifact where resolution begins
+   * \param path  The path being resolved
+   * \param flags The access mode requested
+   * \returns a resolution result, which is either an artifact or an error code
+   */
+  Ref resolve(const std::shared_ptr<Command>& c,
+              const std::shared_ptr<Artifact>& base,
+              const fs::path& path,
+              AccessFlags flags) noexcept;
+
+ private:
+  /// Cached resolutions are identified by base artifact, path, access flags, and expected type
+  using Key = std::tuple<Artifact*, std::string, uint16_t, uint32_t>;
+
+  struct KeyHash {
+    size_t operator()(const Key& k) const noexcept {
+      const auto& [base, path, data, type] = k;
+      size_t h = std::hash<std::string>()(path);
+      h ^= std::hash<Artifact*>()(base) + 0x9E3779B97F4A7C15ull + (h << 6) + (h >> 2);
+      h ^= (static_cast<size_t>(data) << 32 | type) + 0x9E3779B97F4A7C15ull + (h << 6) + (h >> 2);
+      return h;
+    }
+  };
+
+  /// The recorded outcome of a resolution
+  struct Entry {
+    /// The result code of the resolution
+    int rc;
+
+    /// The artifact reached by the resolution, if it succeeded
+    std::shared_ptr<Artifact> artifact;
+
+    /// The inputs reported to the command that performed the resolution
+    Command::InputList inputs;
+
+    /// The generation of each artifact the resolution depended on
+    std::vector<std::pair<std::shared_ptr<Artifact>, size_t>> generations;
+  };
+
+  /// Check if a cached resolution still reflects the current state of the artifacts it used
+  static bool isValid(const Entry& entry) noexcept;
+
+  /// The cached resolutions
+  std::unordered_map<Key, Entry, KeyHash> _entries;
+};
@@ -1,13 +1,14 @@
 #include "env.hh"
 
+#include <algorithm>
 #include <cstddef>
 #include <filesystem>
-#include <list>
 #include <map>
 #include <memory>
 #include <sstream>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -21,6 +22,9 @@
 #include "artifacts/SpecialArtifact.hh"
 #include "artifacts/SymlinkArtifact.hh"
 #include "runtime/Command.hh"
+#include "runtime/journal.hh"
+#include "runtime/prefetch.hh"
+#include "util/FlatMap.hh"
 #include "util/log.hh"
 #include "util/stats.hh"
 #include "util/wrappers.hh"
@@ -29,13 +33,13 @@
 #include "versions/MetadataVersion.hh"
 #include "versions/SymlinkVersion.hh"
 
-using std::list;
 using std::make_shared;
 using std::map;
 using std::pair;
 using std::set;
 using std::shared_ptr;
 using std::string;
+using std::vector;
 using std::weak_ptr;
 
 namespace fs = std::filesystem;
@@ -50,11 +54,39 @@ namespace env {
   shared_ptr<Artifact> _stderr;       //< Standard error
   shared_ptr<DirArtifact> _root_dir;  //< The root directory
 
+  /// Hash a (device, inode) pair
+  struct InodeHash {
+    size_t operator()(const pair<dev_t, ino_t>& id) const noexcept {
+      return std::hash<ino_t>()(id.second) ^ (std::hash<dev_t>()(id.first) << 1);
+    }
+  };
+
   /// A set of all the artifacts used during the build
-  list<weak_ptr<Artifact>> _artifacts;
+  vector<weak_ptr<Artifact>> _artifacts;
 
   /// A map of artifacts identified by inode
-  map<pair<dev_t, ino_t>, weak_ptr<Artifact>> _inodes;
+  FlatMap<pair<dev_t, ino_t>, weak_ptr<Artifact>, InodeHash> _inodes;
+
+  /// Expired entries are dropped when the artifact list grows to this size
+  size_t _compact_at = 1024;
+
+  /// Drop entries for artifacts that no longer exist from the artifact list and inode map
+  static void compact() noexcept {
+    auto expired = [](const weak_ptr<Artifact>& a) { return a.expired(); };
+    _artifacts.erase(std::remove_if(_artifacts.begin(), _artifacts.end(), expired),
+                     _artifacts.end());
+    _inodes.erase_if([&](const auto& entry) { return expired(entry.second); });
+
+    // Compact again once the list has doubled, so the cost is amortized over new artifacts
+    _compact_at = std::max(_artifacts.size() * 2, size_t(1024));
+  }
+
+  /// Record a new artifact in the list of all artifacts
+  static void addArtifact(const shared_ptr<Artifact>& a) noexcept {
+    if (_artifacts.size() >= _compact_at) compact();
+    _artifacts.push_back(a);
+    stats::artifacts++;
+  }
 
   // Reset the state of the environment by clearing all known artifacts
   void rollback() noexcept {
@@ -62,6 +94,9 @@ namespace env {
     _stdout.reset();
     _stderr.reset();
     if (_root_dir) _root_dir->rollback();
+
+    // Artifacts that were only used in the last phase are gone now
+    compact();
   }
 
   // Fingerprint and cache any versions on the filesystem
@@ -71,7 +106,7 @@ namespace env {
   void commitAll() noexcept { getRootDir()->applyFinalState("/"); }
 
   // Get the set of all artifacts
-  const list<weak_ptr<Artifact>>& getArtifacts() noexcept { return _artifacts; }
+  const vector<weak_ptr<Artifact>>& getArtifacts() noexcept { return _artifacts; }
 
   shared_ptr<Artifact> getStdin(const shared_ptr<Command>& c) noexcept {
     if (!_stdin) {
@@ -89,8 +124,7 @@ namespace env {
       a->setName("stdin");
 
       // Record stats for this artifact
-      _artifacts.push_back(_stdin);
-      stats::artifacts++;
+      addArtifact(_stdin);
     }
 
     return _stdin;
@@ -112,8 +146,7 @@ namespace env {
       a->setName("stdout");
 
       // Record stats for this artifact
-      _artifacts.push_back(_stdout);
-      stats::artifacts++;
+      addArtifact(_stdout);
     }
 
     return _stdout;
@@ -135,8 +168,7 @@ namespace env {
       a->setName("stderr");
 
       // Record stats for this artifact
-      _artifacts.push_back(_stderr);
-      stats::artifacts++;
+      addArtifact(_stderr);
     }
 
     return _stderr;
@@ -190,20 +222,19 @@ namespace env {
   shared_ptr<Artifact> getFilesystemArtifact(fs::path path) noexcept {
     // Stat the path on the filesystem to get the file type and an inode number
     struct stat info;
-    int rc = ::lstat(path.c_str(), &info);
+    int rc;
+    if (!prefetch::take(path, rc, info)) rc = ::lstat(path.c_str(), &info);
+    prefetch::record(path);
+    journal::record(path, rc, info);
 
     // If the lstat call failed, the file does not exist
     if (rc != 0) return nullptr;
 
-    // Does the inode for this path match an artifact we've already created?
-    auto inode_iter = _inodes.find({info.st_dev, info.st_ino});
-    if (inode_iter != _inodes.end()) {
-      // Found a match. Is the weak pointer still valid?
-      auto result = inode_iter->second.lock();
-      if (result) return result;
-
-      // Invalid weak pointer, so we can erase the entry
-      _inodes.erase(inode_iter);
+    // Does the inode for this path match an artifact we've already created? An entry whose
+    // artifact no longer exists is replaced below.
+    auto [inode_iter, added] = _inodes.try_emplace({info.st_dev, info.st_ino});
+    if (!added) {
+      if (auto result = inode_iter->second.lock(); result) return result;
     }
 
     // Create a new artifact for this inode
@@ -244,12 +275,12 @@ namespace env {
       }
     }
 
-    // Add the new artifact to the inode map
-    _inodes.emplace_hint(inode_iter, pair{info.st_dev, info.st_ino}, a);
+    // Add the new artifact to the inode map. Creating the artifact does not touch the map, so
+    // the entry found above is still valid.
+    inode_iter->second = a;
 
     // Also add the artifact to the set of all artifacts
-    _artifacts.push_back(a);
-    stats::artifacts++;
+    addArtifact(a);
 
     // Return the artifact
     return a;
@@ -267,8 +298,7 @@ namespace env {
     // Set the pipe's metadata on behalf of the command
     pipe->updateMetadata(c, MetadataVersion(uid, gid, mode));
 
-    _artifacts.push_back(pipe);
-    stats::artifacts++;
+    addArtifact(pipe);
 
     return pipe;
   }
@@ -286,8 +316,7 @@ namespace env {
     symlink->updateMetadata(c, MetadataVersion(uid, gid, mode));
     symlink->updateContent(c, make_shared<SymlinkVersion>(target));
 
-    _artifacts.push_back(symlink);
-    stats::artifacts++;
+    addArtifact(symlink);
 
     return symlink;
   }
@@ -307,8 +336,7 @@ namespace env {
     // Set the metadata for the new directory artifact
     dir->updateMetadata(c, MetadataVersion(uid, gid, stat_mode));
 
-    _artifacts.push_back(dir);
-    stats::artifacts++;
+    addArtifact(dir);
 
     return dir;
   }
@@ -333,8 +361,7 @@ namespace env {
     // Observe output to metadata and content for the new file
     c->addContentOutput(artifact, cv);
 
-    _artifacts.push_back(artifact);
-    stats::artifacts++;
+    addArtifact(artifact);
 
     return artifact;
   }
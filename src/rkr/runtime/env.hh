@@ -1,9 +1,9 @@
 #pragma once
 
 #include <filesystem>
-#include <list>
 #include <memory>
 #include <set>
+#include <vector>
 
 #include <sys/types.h>
 
@@ -45,7 +45,7 @@ namespace env {
   fs::path getTempPath() noexcept;
 
   /// Get a set of all the artifacts in the build
-  const std::list<std::weak_ptr<Artifact>>& getArtifacts() noexcept;
+  const std::vector<std::weak_ptr<Artifact>>& getArtifacts() noexcept;
 
   /**
    * Get an artifact to represent a statted file/dir/pipe/symlink.
@@ -0,0 +1,361 @@
+#include "journal.hh"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "runtime/prefetch.hh"
+#include "util/log.hh"
+
+using std::ifstream;
+using std::ofstream;
+using std::pair;
+using std::string;
+using std::unordered_map;
+using std::unordered_set;
+
+namespace fs = std::filesystem;
+
+namespace journal {
+  /// The header of the file that holds saved stat results
+  struct SavedHeader {
+    char magic[8];
+    uint64_t session;
+    uint64_t mark;
+    uint64_t count;
+  };
+
+  /// The magic string at the start of the saved stat results
+  static const char SavedMagic[8] = "rkrjst1";
+
+  /// How long a build waits for the watcher to journal its cookie file
+  enum : int { CookieTimeoutMs = 2000 };
+
+  /// Is the journal being kept for this build?
+  static bool _recording = false;
+
+  /// The journal session this build started in
+  static uint64_t _session;
+
+  /// The position in the journal when this build started
+  static uint64_t _mark;
+
+  /// The project root the watcher covers
+  static string _root;
+
+  /// The database directory, which the watcher does not cover
+  static string _db_dir;
+
+  /// The lstat results to save, keyed by path
+  static unordered_map<string, pair<int, struct stat>> _stats;
+
+  /// Get the path to the saved stat results
+  static fs::path saved_path(fs::path db_dir) noexcept {
+    return db_dir / "journal.stats";
+  }
+
+  /// Check if a path is under a directory, or is the directory itself
+  static bool is_under(const string& path, const string& dir) noexcept {
+    if (path.compare(0, dir.size(), dir) != 0) return false;
+    return path.size() == dir.size() || path[dir.size()] == '/' || dir.back() == '/';
+  }
+
+  /// Check if a path has changed, or falls under a subtree that may have changed
+  static bool changed(const unordered_set<string>& changed_paths,
+                      const unordered_set<string>& changed_subtrees,
+                      fs::path path) noexcept {
+    if (changed_paths.count(path.string()) > 0) return true;
+    while (true) {
+      if (changed_subtrees.count(path.string()) > 0) return true;
+      if (!path.has_relative_path()) return false;
+      path = path.parent_path();
+    }
+  }
+
+  /// The paths journaled since this build started, found by refresh()
+  static unordered_set<string> _changed_paths;
+
+  /// The subtrees journaled since this build started, found by refresh()
+  static unordered_set<string> _changed_subtrees;
+
+  /// Set once refresh() has confirmed that the journal is current
+  static bool _refreshed = false;
+
+  /// Parse the journal header line. Returns false if it is invalid.
+  static bool parse_header(const string& header,
+                           pid_t& pid,
+                           uint64_t& session,
+                           string& root) noexcept {
+    std::istringstream h(header);
+    string magic;
+    int version;
+    if (!(h >> magic >> version >> pid >> session >> std::ws) || magic != Header ||
+        version != Version) {
+      return false;
+    }
+    std::getline(h, root);
+    return !root.empty() && root[0] == '/';
+  }
+
+  /// Collect the changed paths from journal lines. A line ending in a slash marks a directory
+  /// where anything below it may have changed.
+  static void read_changes(const string& lines,
+                           unordered_set<string>& changed_paths,
+                           unordered_set<string>& changed_subtrees) noexcept {
+    std::istringstream l(lines);
+    string line;
+    while (std::getline(l, line)) {
+      if (line.size() > 1 && line.back() == '/') {
+        line.pop_back();
+        changed_subtrees.insert(line);
+      }
+      changed_paths.insert(line);
+    }
+  }
+
+  /**
+   * Read the complete lines added to the journal since it was last read. If the watcher started
+   * a new session, the header changes and the contents are read again from the start.
+   * \param path     The path to the journal
+   * \param header   The journal's header line, updated when the journal is read
+   * \param contents The complete lines read so far, which new lines are added to
+   * \returns false if the journal could not be read
+   */
+  static bool read_journal(const fs::path& path, string& header, string& contents) noexcept {
+    ifstream f(path);
+    string h;
+    if (!f || !std::getline(f, h)) return false;
+
+    if (h != header) {
+      header = h;
+      contents.clear();
+    } else {
+      f.seekg(header.size() + 1 + contents.size());
+    }
+
+    // Stop at the last complete line, because the watcher may be in the middle of writing one
+    string added((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    auto complete = added.rfind('\n');
+    added.resize(complete == string::npos ? 0 : complete + 1);
+    contents += added;
+    return true;
+  }
+
+  /**
+   * Create a cookie file in the watched tree and wait until the watcher journals it. Once the
+   * cookie appears, every change made before this build started is in the journal too.
+   * \param path     The path to the journal
+   * \param header   The journal's header line, updated as the journal is read
+   * \param contents The complete lines in the journal, updated as the journal is read
+   * \returns true if the watcher journaled the cookie in time
+   */
+  static bool handshake(const fs::path& path, string& header, string& contents) noexcept {
+    auto cookie = fs::path(_root) / (".rkr-cookie." + std::to_string(::getpid()));
+    int fd = ::open(cookie.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) return false;
+    ::close(fd);
+
+    auto line = cookie.string() + "\n";
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(CookieTimeoutMs);
+
+    bool seen = false;
+    while (!seen && std::chrono::steady_clock::now() < deadline) {
+      ::usleep(500);
+
+      pid_t pid;
+      uint64_t session;
+      string root;
+      if (!read_journal(path, header, contents) || !parse_header(header, pid, session, root)) {
+        break;
+      }
+
+      // Look for the cookie at the start of a line
+      for (size_t pos = contents.find(line); pos != string::npos && !seen;
+           pos = contents.find(line, pos + 1)) {
+        seen = pos == 0 || contents[pos - 1] == '\n';
+      }
+    }
+
+    ::unlink(cookie.c_str());
+    return seen;
+  }
+
+  void begin(fs::path db_dir) noexcept {
+    _recording = false;
+    _refreshed = false;
+    _stats.clear();
+
+    // Read the journal
+    auto path = journal_path(db_dir);
+    string header;
+    string contents;
+    if (!read_journal(path, header, contents)) return;
+
+    pid_t pid;
+    if (!parse_header(header, pid, _session, _root)) {
+      LOG(phase) << "Ignoring invalid change journal " << path;
+      return;
+    }
+
+    // The journal is only complete while the watcher is running
+    if (::kill(pid, 0) != 0 && errno != EPERM) {
+      LOG(phase) << "The change journal watcher is not running";
+      return;
+    }
+
+    // The watcher may not have caught up with recent changes yet. It may also have started a new
+    // session while the build waited, so read the header again.
+    if (!handshake(path, header, contents) || !parse_header(header, pid, _session, _root)) {
+      LOG(phase) << "The change journal watcher did not respond";
+      return;
+    }
+
+    std::error_code ec;
+    _db_dir = fs::absolute(db_dir, ec).lexically_normal().string();
+    _mark = header.size() + 1 + contents.size();
+    _recording = true;
+
+    // Load the stat results saved by the last build
+    ifstream saved(saved_path(db_dir), std::ios::binary);
+    SavedHeader sh;
+    if (!saved.read(reinterpret_cast<char*>(&sh), sizeof(sh)) ||
+        memcmp(sh.magic, SavedMagic, sizeof(SavedMagic)) != 0) {
+      return;
+    }
+
+    if (sh.session != _session || sh.mark > _mark) {
+      LOG(phase) << "The change journal was restarted since the last build";
+      return;
+    }
+
+    // Collect the paths that changed since the last build started
+    unordered_set<string> changed_paths;
+    unordered_set<string> changed_subtrees;
+    read_changes(contents.substr(sh.mark - (header.size() + 1)), changed_paths, changed_subtrees);
+
+    // Seed results for every path that has not changed
+    size_t seeded = 0;
+    for (uint64_t i = 0; i < sh.count; i++) {
+      int32_t rc;
+      uint32_t len;
+      struct stat info;
+      saved.read(reinterpret_cast<char*>(&rc), sizeof(rc));
+      saved.read(reinterpret_cast<char*>(&len), sizeof(len));
+      saved.read(reinterpret_cast<char*>(&info), sizeof(info));
+      string p(len, '\0');
+      saved.read(p.data(), len);
+      if (!saved) break;
+
+      if (changed(changed_paths, changed_subtrees, p)) continue;
+
+      prefetch::seed(p, rc, info);
+      _stats.emplace(p, pair{rc, info});
+      seeded++;
+    }
+
+    LOG(phase) << "Change journal lists " << changed_paths.size() << " changed paths; reusing "
+               << seeded << " stat results";
+  }
+
+  void record(const fs::path& path, int rc, const struct stat& info) noexcept {
+    if (!_recording) return;
+
+    auto p = path.string();
+    if (!is_under(p, _root) || is_under(p, _db_dir)) return;
+
+    _stats[p] = pair{rc, info};
+  }
+
+  void refresh(fs::path db_dir) noexcept {
+    _refreshed = false;
+    _changed_paths.clear();
+    _changed_subtrees.clear();
+    if (!_recording) return;
+
+    // The journal must still be in the session this build started in
+    auto path = journal_path(db_dir);
+    string header;
+    string contents;
+    pid_t pid;
+    uint64_t session;
+    string root;
+    if (!read_journal(path, header, contents) || !parse_header(header, pid, session, root) ||
+        session != _session || header.size() + 1 + contents.size() < _mark) {
+      return;
+    }
+
+    // Make sure changes made during the build have been journaled
+    if (!handshake(path, header, contents) || !parse_header(header, pid, session, root) ||
+        session != _session) {
+      LOG(phase) << "The change journal watcher did not respond";
+      return;
+    }
+
+    read_changes(contents.substr(_mark - (header.size() + 1)), _changed_paths, _changed_subtrees);
+    _refreshed = true;
+  }
+
+  bool lookup(const fs::path& path, int& rc, struct stat& info) noexcept {
+    if (!_refreshed) return false;
+
+    auto iter = _stats.find(path.string());
+    if (iter == _stats.end()) return false;
+    if (changed(_changed_paths, _changed_subtrees, iter->first)) return false;
+
+    rc = iter->second.first;
+    info = iter->second.second;
+    return true;
+  }
+
+  void finish(fs::path db_dir) noexcept {
+    if (!_recording) return;
+
+    auto path = saved_path(db_dir);
+    auto tmp = path;
+    tmp += ".tmp";
+
+    ofstream f(tmp, std::ios::binary);
+    SavedHeader sh;
+    memcpy(sh.magic, SavedMagic, sizeof(SavedMagic));
+    sh.session = _session;
+    sh.mark = _mark;
+    sh.count = _stats.size();
+    f.write(reinterpret_cast<const char*>(&sh), sizeof(sh));
+
+    for (const auto& [p, result] : _stats) {
+      int32_t rc = result.first;
+      uint32_t len = p.size();
+      f.write(reinterpret_cast<const char*>(&rc), sizeof(rc));
+      f.write(reinterpret_cast<const char*>(&len), sizeof(len));
+      f.write(reinterpret_cast<const char*>(&result.second), sizeof(result.second));
+      f.write(p.data(), len);
+    }
+    f.close();
+
+    std::error_code ec;
+    if (f) fs::rename(tmp, path, ec);
+    if (!f || ec) WARN << "Failed to save stat results for the change journal in " << path;
+
+    _recording = false;
+    _refreshed = false;
+    _stats.clear();
+    _changed_paths.clear();
+    _changed_subtrees.clear();
+  }
+}
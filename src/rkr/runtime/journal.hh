@@ -0,0 +1,81 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+
+#include <sys/stat.h>
+
+namespace fs = std::filesystem;
+
+/**
+ * The journal namespace lets a build skip lstat calls for paths that have not changed since the
+ * last build. `rkr watch` runs an inotify watcher over the project tree and appends every changed
+ * path to a journal in the database directory. A build records the lstat result for every path
+ * under the project tree, along with its position in the journal when the build started. The
+ * next build replays those results for paths that do not appear in the journal after that
+ * position, and that have no changed parent directory.
+ *
+ * The watcher may lag behind recent changes. Each build creates a cookie file in the project
+ * root and waits for the watcher to journal it, so every change made before the build started
+ * has been journaled by the time it is read.
+ *
+ * The watcher starts a new journal session whenever it might have missed a change, for example
+ * when its event queue overflows or a watched directory is moved. A build that finds no journal,
+ * a watcher that has exited or does not journal the cookie in time, or a session other than the
+ * one its saved results came from falls back to checking every path.
+ *
+ * Changes inotify does not report are not seen: writes through a shared mmap, and changes made
+ * through a hard link outside the project tree.
+ *
+ * Journal format: a header line "rkr-journal 1 PID SESSION ROOT", then one changed path per line.
+ */
+namespace journal {
+  /// The first word of the journal's header line
+  inline const std::string Header = "rkr-journal";
+
+  /// The journal format version
+  enum : int { Version = 1 };
+
+  /// Get the path to the journal in a database directory
+  inline fs::path journal_path(fs::path db_dir) noexcept {
+    return db_dir / "journal";
+  }
+
+  /**
+   * Check the journal at the start of a build, and seed stat results for unchanged paths
+   * \param db_dir The database directory
+   */
+  void begin(fs::path db_dir) noexcept;
+
+  /**
+   * Record the result of an lstat call made during the build
+   * \param path The path that was checked
+   * \param rc   The return code from lstat
+   * \param info The stat result, if rc is zero
+   */
+  void record(const fs::path& path, int rc, const struct stat& info) noexcept;
+
+  /**
+   * Read the changes journaled since the build started, so lookup() can tell which of the stat
+   * results recorded during the build are still current. Call this once the build is done.
+   * \param db_dir The database directory
+   */
+  void refresh(fs::path db_dir) noexcept;
+
+  /**
+   * Get the current lstat result for a path without calling lstat. Only results recorded or
+   * seeded during this build are returned, and only if the watcher has not journaled a change to
+   * the path since the build started.
+   * \param path The path to look up
+   * \param rc   Set to the return code from lstat
+   * \param info Set to the stat result if rc is zero
+   * \returns true if a current result was found
+   */
+  bool lookup(const fs::path& path, int& rc, struct stat& info) noexcept;
+
+  /**
+   * Save the stat results recorded during the build for the next build to use
+   * \param db_dir The database directory
+   */
+  void finish(fs::path db_dir) noexcept;
+}
@@ -0,0 +1,164 @@
+#include "prefetch.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "util/log.hh"
+#include "util/options.hh"
+#include "util/stats.hh"
+
+using std::lock_guard;
+using std::mutex;
+using std::pair;
+using std::string;
+using std::unordered_map;
+using std::unordered_set;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+namespace prefetch {
+  /// The most threads used to stat paths. Stats mostly wait on the disk, so this can exceed the
+  /// number of processors.
+  enum : size_t { MaxThreads = 16 };
+
+  /// The paths to stat
+  static vector<string> _paths;
+
+  /// The paths this build has looked up, in the order they were first used
+  static vector<string> _used_paths;
+
+  /// The set of paths this build has looked up
+  static unordered_set<string> _seen;
+
+  /// The index of the next path a thread should stat
+  static std::atomic<size_t> _next;
+
+  /// The threads that stat paths
+  static vector<std::thread> _threads;
+
+  /// Protects the results table
+  static mutex _results_mutex;
+
+  /// lstat results waiting to be used
+  static unordered_map<string, pair<int, struct stat>> _results;
+
+  /// The number of prefetched results that were used
+  static size_t _used = 0;
+
+  /// Are results being collected for the current phase?
+  static bool _active = false;
+
+  /// Stat paths until there are none left, or prefetching is stopped
+  static void worker() noexcept {
+    size_t i;
+    while ((i = _next++) < _paths.size()) {
+      // Skip paths that were seeded from the change journal
+      {
+        lock_guard lock(_results_mutex);
+        if (_results.count(_paths[i]) > 0) continue;
+      }
+
+      struct stat info;
+      int rc = ::lstat(_paths[i].c_str(), &info);
+
+      lock_guard lock(_results_mutex);
+      _results.emplace(_paths[i], pair{rc, info});
+    }
+  }
+
+  /// Start threads to stat a list of paths
+  static void start_threads(vector<string> paths) noexcept {
+    _paths = std::move(paths);
+    _next = 0;
+    _active = true;
+
+    size_t threads = std::min<size_t>(MaxThreads, std::thread::hardware_concurrency() * 2);
+    threads = std::max<size_t>(std::min(threads, _paths.size() / 64), 1);
+
+    LOG(phase) << "Prefetching stat results for " << _paths.size() << " paths with " << threads
+               << " threads";
+
+    for (size_t i = 0; i < threads; i++) {
+      _threads.emplace_back(worker);
+    }
+  }
+
+  void start(fs::path path) noexcept {
+    // The list holds paths separated by null bytes, because paths can contain newlines
+    std::ifstream input(path);
+    if (!input) return;
+
+    vector<string> paths;
+    string p;
+    while (std::getline(input, p, '\0')) {
+      paths.push_back(std::move(p));
+    }
+
+    start_threads(std::move(paths));
+  }
+
+  void seed(const string& path, int rc, const struct stat& info) noexcept {
+    lock_guard lock(_results_mutex);
+    _results.emplace(path, pair{rc, info});
+    _active = true;
+  }
+
+  bool take(const fs::path& path, int& rc, struct stat& info) noexcept {
+    if (!_active) return false;
+
+    lock_guard lock(_results_mutex);
+    auto iter = _results.find(path.string());
+    if (iter == _results.end()) return false;
+
+    std::tie(rc, info) = iter->second;
+    _results.erase(iter);
+    _used++;
+    return true;
+  }
+
+  void record(const fs::path& path) noexcept {
+    if (!options::prefetch_stats) return;
+
+    auto p = path.string();
+    if (_seen.insert(p).second) _used_paths.push_back(std::move(p));
+  }
+
+  void save(fs::path path) noexcept {
+    if (!options::prefetch_stats) return;
+
+    std::ofstream output(path, std::ios::trunc);
+    for (const auto& p : _used_paths) {
+      output << p << '\0';
+    }
+  }
+
+  void stop() noexcept {
+    if (!_active) return;
+
+    // Skip any paths that have not been started, then wait for the threads to finish
+    _next = _paths.size();
+    for (auto& t : _threads) t.join();
+
+    LOG(phase) << "Used " << _used << " prefetched stat results";
+
+    _active = false;
+    _used = 0;
+    _threads.clear();
+    _paths.clear();
+    _results.clear();
+  }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+
+#include <sys/stat.h>
+
+namespace fs = std::filesystem;
+
+/**
+ * The prefetch namespace warms a table of stat results before a loaded trace is emulated. On a
+ * build with nothing to do, emulation spends most of its time in lstat calls made one at a time
+ * as paths are resolved against the filesystem. On a cold metadata cache each call waits on disk.
+ *
+ * Each build records the paths it looks up, in the order it first uses them, and saves the list
+ * next to the database. Before the first phase of the next build, a pool of threads lstats those
+ * paths in order while the trace is emulated, so most lookups find their result already waiting.
+ * The list is read instead of the trace, so the trace is only decoded once.
+ *
+ * Results are only used during the first phase, before any command runs. Each result is used at
+ * most once, and the table is discarded when the phase ends.
+ */
+namespace prefetch {
+  /**
+   * Start prefetching stat results for the paths saved by the last build
+   * \param path The path list written by save()
+   */
+  void start(fs::path path) noexcept;
+
+  /**
+   * Add a stat result that is known to be current without calling lstat. The change journal
+   * (see journal.hh) seeds results for paths that have not changed since the last build.
+   */
+  void seed(const std::string& path, int rc, const struct stat& info) noexcept;
+
+  /**
+   * Take a prefetched lstat result for a path, if there is one
+   * \param path The path to look up
+   * \param rc   Set to the return code from lstat
+   * \param info Set to the stat result if rc is zero
+   * \returns true if a result was found
+   */
+  bool take(const fs::path& path, int& rc, struct stat& info) noexcept;
+
+  /// Stop prefetching and discard any unused results
+  void stop() noexcept;
+
+  /// Record that the build looked up a path, so the next build can prefetch it
+  void record(const fs::path& path) noexcept;
+
+  /// Save the paths this build looked up for the next build
+  void save(fs::path path) noexcept;
+}
@@ -0,0 +1,54 @@
+#include "profile.hh"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "runtime/Command.hh"
+
+using std::ifstream;
+using std::ofstream;
+using std::set;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+namespace profile {
+  void save(fs::path path, const set<shared_ptr<Command>>& commands) noexcept {
+    ofstream f(path);
+    for (const auto& c : commands) {
+      const auto& p = c->getProfile();
+      if (p.wall_ns == 0 && p.tracer_ns == 0 && p.predicates == 0) continue;
+
+      // The name goes last, because it may contain spaces. It must stay on one line.
+      auto name = c->getFullName();
+      std::replace(name.begin(), name.end(), '\n', ' ');
+
+      f << p.wall_ns << " " << p.tracer_ns << " " << p.ptrace_stops << " " << p.channel_events
+        << " " << p.bytes_read << " " << p.bytes_written << " " << p.predicates << " "
+        << name << "\n";
+    }
+  }
+
+  vector<Entry> load(fs::path path) noexcept {
+    vector<Entry> result;
+    ifstream f(path);
+
+    Entry e;
+    auto& p = e.counters;
+    while (f >> p.wall_ns >> p.tracer_ns >> p.ptrace_stops >> p.channel_events >> p.bytes_read >>
+           p.bytes_written >> p.predicates) {
+      f.ignore(1);
+      std::getline(f, e.name);
+      result.push_back(e);
+    }
+
+    return result;
+  }
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "util/timeline.hh"
+
+class Command;
+
+namespace fs = std::filesystem;
+
+/**
+ * The profile namespace tracks what each command costs during a build: how long it ran, how much
+ * time the tracer spent handling its system calls, how it stopped for the tracer, how many bytes
+ * it moved through traced reads and writes, and how many predicates were emulated for it.
+ *
+ * The counters live in each Command. At the end of a build they are saved to the database
+ * directory, and `rkr stats --commands` prints them ranked by cost.
+ */
+namespace profile {
+  /// Per-command cost counters, summed over every phase of one build
+  struct Counters {
+    /// Wall time from launch to exit for traced runs, in nanoseconds
+    uint64_t wall_ns = 0;
+
+    /// Time the tracer spent in this command's system call handlers, in nanoseconds
+    uint64_t tracer_ns = 0;
+
+    /// System call stops delivered through ptrace
+    uint64_t ptrace_stops = 0;
+
+    /// System call stops delivered through the shared memory channel
+    uint64_t channel_events = 0;
+
+    /// Bytes returned by traced read calls
+    uint64_t bytes_read = 0;
+
+    /// Bytes accepted by traced write calls
+    uint64_t bytes_written = 0;
+
+    /// Predicates emulated for this command
+    uint64_t predicates = 0;
+
+    /// When the current traced run was launched
+    std::chrono::steady_clock::time_point launched;
+  };
+
+  /// A command's saved counters, with its name
+  struct Entry {
+    Counters counters;
+    std::string name;
+  };
+
+  /**
+   * A SyscallTimer adds the time the tracer spends handling one system call stop to a command.
+   * When a timeline is being recorded, the stop also appears on its Tracer track.
+   */
+  class SyscallTimer {
+   public:
+    /**
+     * Start timing a system call stop
+     * \param counters The counters for the command that made the system call
+     * \param channel  Was the stop delivered through the shared memory channel?
+     * \param name     The name of the handler, which is shown on the timeline
+     */
+    SyscallTimer(Counters& counters, bool channel, const char* name) noexcept :
+        _counters(counters), _name(name), _start(std::chrono::steady_clock::now()) {
+      if (channel) {
+        _counters.channel_events++;
+      } else {
+        _counters.ptrace_stops++;
+      }
+    }
+
+    /// Stop timing
+    ~SyscallTimer() noexcept {
+      auto now = std::chrono::steady_clock::now();
+      auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - _start);
+      _counters.tracer_ns += elapsed.count();
+
+      if (timeline::enabled) {
+        timeline::span("syscall", _name, timeline::RkrProcess, timeline::TracerTrack, _start, now);
+      }
+    }
+
+    // Disallow copy and move
+    SyscallTimer(const SyscallTimer&) = delete;
+    SyscallTimer& operator=(const SyscallTimer&) = delete;
+
+   private:
+    /// The counters to update
+    Counters& _counters;
+
+    /// The name of the handler
+    const char* _name;
+
+    /// When the stop started
+    std::chrono::steady_clock::time_point _start;
+  };
+
+  /**
+   * Save the counters for a set of commands. Commands with no recorded cost are skipped.
+   * \param path     The file to write
+   * \param commands The commands to save
+   */
+  void save(fs::path path, const std::set<std::shared_ptr<Command>>& commands) noexcept;
+
+  /**
+   * Load counters saved by save()
+   * \param path The file to read
+   * \returns the saved entries, which are empty if the file could not be read
+   */
+  std::vector<Entry> load(fs::path path) noexcept;
+}
@@ -0,0 +1,620 @@
+#include "summary.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "blake3.h"
+
+#include "artifacts/Artifact.hh"
+#include "runtime/Command.hh"
+#include "runtime/journal.hh"
+#include "util/log.hh"
+#include "util/options.hh"
+#include "versions/DirListVersion.hh"
+#include "versions/FileVersion.hh"
+#include "versions/MetadataVersion.hh"
+#include "versions/SymlinkVersion.hh"
+
+using std::ifstream;
+using std::istringstream;
+using std::nullopt;
+using std::ofstream;
+using std::optional;
+using std::ostringstream;
+using std::pair;
+using std::shared_ptr;
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+namespace summary {
+  /// The first word of a summary file, followed by the format version
+  static const char* Magic = "rkr-summary";
+
+  /// The summary format version. Summaries with any other version are ignored.
+  enum : int { FormatVersion = 2 };
+
+  /// The most threads used to check inputs. Checks mostly wait on the disk, so this can exceed the
+  /// number of cores.
+  enum : size_t { MaxThreads = 16 };
+
+  /// The number of bytes read from a file at once when hashing it
+  enum : size_t { BlockSize = 1 << 16 };
+
+  /// The markings a check can give a command, in increasing order
+  enum class Marking { Emulate, MayRun, MustRun };
+
+  /// A saved input or output of one command, checked against the filesystem
+  struct Record {
+    /// The kind of input. Outputs are checked too, because a command must rerun if an output it
+    /// wrote has changed and there is no cached copy to restore.
+    enum class Kind { File, Metadata, Stat, Absent, Output } kind;
+
+    /// The index of the command that depends on this input
+    size_t command;
+
+    /// File inputs and outputs: was the file empty?
+    bool empty = false;
+
+    /// File, stat, and output records: the modification time in nanoseconds, if it is known
+    optional<int64_t> mtime;
+
+    /// File inputs and outputs: the hash of the file contents, if it is known
+    optional<FileVersion::Hash> hash;
+
+    /// Metadata inputs: the owner, group, and mode
+    uid_t uid = 0;
+    gid_t gid = 0;
+    mode_t mode = 0;
+
+    /// Stat inputs: the size and inode number
+    off_t size = 0;
+    ino_t ino = 0;
+
+    /// Set during a check if the input no longer matches the filesystem
+    bool changed = false;
+  };
+
+  /// The result of an lstat call
+  struct StatResult {
+    int rc = -1;
+    struct stat info;
+  };
+
+  /// A command in a saved summary
+  struct Entry {
+    string name;
+    bool changed = false;
+    vector<size_t> needs;
+    vector<size_t> used_by;
+    vector<size_t> needed_by;
+    Marking marking = Marking::Emulate;
+  };
+
+  /// Get a modification time in nanoseconds
+  static int64_t to_ns(const struct timespec& ts) noexcept {
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+  }
+
+  /// Write a hash as hex
+  static string hash_to_hex(const FileVersion::Hash& hash) noexcept {
+    string result;
+    char buf[3];
+    for (auto b : hash) {
+      snprintf(buf, sizeof(buf), "%02x", b);
+      result += buf;
+    }
+    return result;
+  }
+
+  /// Parse a hash written by hash_to_hex
+  static optional<FileVersion::Hash> parse_hash(const string& hex) noexcept {
+    FileVersion::Hash hash;
+    if (hex.size() != hash.size() * 2) return nullopt;
+
+    auto digit = [](char c) -> int {
+      if (c >= '0' && c <= '9') return c - '0';
+      if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+      return -1;
+    };
+
+    for (size_t i = 0; i < hash.size(); i++) {
+      int hi = digit(hex[i * 2]);
+      int lo = digit(hex[i * 2 + 1]);
+      if (hi == -1 || lo == -1) return nullopt;
+      hash[i] = (hi << 4) | lo;
+    }
+    return hash;
+  }
+
+  /// Hash the contents of a file
+  static optional<FileVersion::Hash> hash_file(const string& path) noexcept {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return nullopt;
+
+    blake3_hasher hasher;
+    blake3_hasher_init(&hasher);
+
+    vector<uint8_t> buf(BlockSize);
+    ssize_t n;
+    while ((n = ::read(fd, buf.data(), buf.size())) > 0) {
+      blake3_hasher_update(&hasher, buf.data(), n);
+    }
+    ::close(fd);
+    if (n < 0) return nullopt;
+
+    FileVersion::Hash result;
+    blake3_hasher_finalize(&hasher, result.data(), BLAKE3_OUT_LEN);
+    return result;
+  }
+
+  /// Choose how many threads to use for checking a number of paths
+  static size_t thread_count(size_t paths) noexcept {
+    size_t threads = std::min<size_t>(MaxThreads, std::thread::hardware_concurrency() * 2);
+    return std::max<size_t>(std::min(threads, paths / 64), 1);
+  }
+
+  /// Call a function with every index below a count, spread over a number of threads
+  template <class F>
+  static void parallel_for(size_t count, size_t threads, F f) noexcept {
+    std::atomic<size_t> next(0);
+    auto worker = [&] {
+      size_t i;
+      while ((i = next++) < count) f(i);
+    };
+
+    vector<std::thread> pool;
+    for (size_t i = 1; i < threads; i++) pool.emplace_back(worker);
+    worker();
+    for (auto& t : pool) t.join();
+  }
+
+  /// Fill in the lstat result for each path. Results the build already has are reused if the
+  /// change journal shows they are still current. The rest are checked in parallel.
+  static void stat_all(unordered_map<string, StatResult>& stats) noexcept {
+    vector<pair<const string, StatResult>*> pending;
+    for (auto& entry : stats) {
+      if (!journal::lookup(entry.first, entry.second.rc, entry.second.info)) {
+        pending.push_back(&entry);
+      }
+    }
+
+    LOG(phase) << "Reused " << (stats.size() - pending.size()) << " of " << stats.size()
+               << " stat results for the build summary";
+
+    parallel_for(pending.size(), thread_count(pending.size()), [&](size_t i) {
+      auto& [p, result] = *pending[i];
+      result.rc = ::lstat(p.c_str(), &result.info);
+    });
+  }
+
+  /// Write a file fingerprint: whether it is empty, its mtime, and its hash, using "-" for a
+  /// missing value
+  static void write_fingerprint(ofstream& f, const shared_ptr<FileVersion>& fv) noexcept {
+    f << (fv->isEmpty() ? 1 : 0) << " ";
+    if (fv->getModificationTime().has_value()) {
+      f << to_ns(fv->getModificationTime().value());
+    } else {
+      f << "-";
+    }
+    f << " ";
+    if (fv->getHash().has_value()) {
+      f << hash_to_hex(fv->getHash().value());
+    } else {
+      f << "-";
+    }
+  }
+
+  /// Is a version one the summary can check against the filesystem?
+  static bool checkable(const shared_ptr<Version>& v) noexcept {
+    return v->is_a<FileVersion>() || v->is_a<MetadataVersion>() || v->is_a<DirListVersion>() ||
+           v->is_a<SymlinkVersion>();
+  }
+
+  /// Get the first line of a summary that describes a database
+  static optional<string> header_for(const fs::path& db) noexcept {
+    struct stat statbuf;
+    if (::stat(db.c_str(), &statbuf) != 0) return nullopt;
+
+    ostringstream header;
+    header << Magic << " " << FormatVersion << " " << statbuf.st_size << " "
+           << to_ns(statbuf.st_mtim);
+    return header.str();
+  }
+
+  /// Number a command and its descendants in preorder
+  static void number(const shared_ptr<Command>& c,
+                     vector<shared_ptr<Command>>& commands,
+                     unordered_map<const Command*, size_t>& ids) noexcept {
+    if (!ids.emplace(c.get(), commands.size()).second) return;
+    commands.push_back(c);
+    for (const auto& child : c->getChildren()) {
+      number(child, commands, ids);
+    }
+  }
+
+  /// Write the indices of a set of commands after a label, if the set has any numbered commands
+  static void write_indices(ofstream& f,
+                            const char* label,
+                            const Command::WeakCommandSet& set,
+                            const unordered_map<const Command*, size_t>& ids) noexcept {
+    vector<size_t> indices;
+    for (const auto& weak : set) {
+      auto c = weak.lock();
+      if (!c) continue;
+      if (auto iter = ids.find(c.get()); iter != ids.end()) indices.push_back(iter->second);
+    }
+
+    if (indices.empty()) return;
+
+    std::sort(indices.begin(), indices.end());
+    f << label;
+    for (auto i : indices) f << " " << i;
+    f << "\n";
+  }
+
+  void save(fs::path path, fs::path db, const shared_ptr<Command>& root) noexcept {
+    std::error_code err;
+
+    // Without a database there is nothing to summarize. Remove any old summary.
+    auto header = header_for(db);
+    if (!header.has_value() || !root) {
+      fs::remove(path, err);
+      return;
+    }
+
+    vector<shared_ptr<Command>> commands;
+    unordered_map<const Command*, size_t> ids;
+    number(root, commands, ids);
+
+    // Write to a temporary file so a check never reads a partial summary
+    auto tmp = path;
+    tmp += ".tmp";
+    ofstream f(tmp);
+    if (!f) {
+      WARN << "Failed to write the build summary to " << path;
+      fs::remove(path, err);
+      return;
+    }
+
+    // Directory listings, symlinks, and missing paths are checked against their state at the end
+    // of the build. Collect them first, so each path is checked once.
+    unordered_map<string, StatResult> stats;
+    for (const auto& c : commands) {
+      for (const auto& [a, v] : c->getExternalInputs()) {
+        if (!v->is_a<DirListVersion>() && !v->is_a<SymlinkVersion>()) continue;
+        if (auto p = a->getPath(); p.has_value()) stats.try_emplace(p.value().string());
+      }
+      for (const auto& missing : c->getMissingPaths()) {
+        stats.try_emplace(missing);
+      }
+    }
+    stat_all(stats);
+
+    f << header.value() << "\n";
+
+    for (const auto& c : commands) {
+      // Paths and names go last on each line. They must stay on one line.
+      auto name = c->getShortName(options::command_length);
+      std::replace(name.begin(), name.end(), '\n', ' ');
+      f << "command " << name << "\n";
+
+      // A command that observed a change will run next time, whatever its inputs are now
+      bool changed = c->getChanges() == Scenario::Both;
+
+      write_indices(f, "needs", c->getUncachedInputProducers(), ids);
+      write_indices(f, "used-by", c->getOutputUsers(), ids);
+      write_indices(f, "needed-by", c->getUncachedOutputUsers(), ids);
+
+      for (const auto& [a, v] : c->getExternalInputs()) {
+        auto p = a->getPath();
+        if (!p.has_value()) continue;
+        auto path_str = p.value().string();
+
+        // Pipes and special files are not checked
+        if (!checkable(v)) continue;
+
+        // A path that cannot be written on one line cannot be checked
+        if (path_str.find('\n') != string::npos) {
+          changed = true;
+          continue;
+        }
+
+        if (auto fv = std::dynamic_pointer_cast<FileVersion>(v)) {
+          f << "file ";
+          write_fingerprint(f, fv);
+          f << " " << path_str << "\n";
+
+        } else if (auto mv = std::dynamic_pointer_cast<MetadataVersion>(v)) {
+          f << "meta " << mv->getUser() << " " << mv->getGroup() << " " << mv->getMode() << " "
+            << path_str << "\n";
+
+        } else {
+          // If the path is already gone, the command will have to run
+          const auto& result = stats[path_str];
+          if (result.rc != 0) {
+            changed = true;
+            continue;
+          }
+          f << "stat " << to_ns(result.info.st_mtim) << " " << result.info.st_size << " "
+            << result.info.st_ino << " " << path_str << "\n";
+        }
+      }
+
+      // Only record missing paths that are still missing. Paths the build created are left to the
+      // trace, which knows which command created them.
+      for (const auto& missing : c->getMissingPaths()) {
+        if (missing.find('\n') != string::npos) continue;
+        if (stats[missing].rc != 0) f << "absent " << missing << "\n";
+      }
+
+      // Record the final content of each file this command wrote. A cached output can be restored
+      // without running the command, and content a later command overwrote is that command's
+      // output, so neither is recorded.
+      for (const auto& [a, v] : c->getContentOutputs()) {
+        auto fv = std::dynamic_pointer_cast<FileVersion>(v);
+        if (!fv || fv->isCached() || a->peekContent() != v) continue;
+
+        auto p = a->getPath();
+        if (!p.has_value()) continue;
+        auto path_str = p.value().string();
+
+        if (path_str.find('\n') != string::npos) {
+          changed = true;
+          continue;
+        }
+
+        f << "output ";
+        write_fingerprint(f, fv);
+        f << " " << path_str << "\n";
+      }
+
+      if (changed) f << "changed\n";
+    }
+
+    f.close();
+    if (!f) {
+      WARN << "Failed to write the build summary to " << path;
+      fs::remove(tmp, err);
+      fs::remove(path, err);
+      return;
+    }
+
+    fs::rename(tmp, path, err);
+    if (err) {
+      WARN << "Failed to write the build summary to " << path << ": " << err.message();
+      fs::remove(tmp, err);
+    }
+  }
+
+  /// Parse an optional number written by save(), which uses "-" for a missing value
+  static bool parse_optional(const string& s, optional<int64_t>& result) noexcept {
+    if (s == "-") return true;
+    char* end;
+    errno = 0;
+    result = std::strtoll(s.c_str(), &end, 10);
+    return errno == 0 && !s.empty() && *end == '\0';
+  }
+
+  /// Check one record against the result of lstat on its path
+  static bool matches(const Record& r,
+                      const string& path,
+                      bool exists,
+                      const struct stat& statbuf,
+                      optional<optional<FileVersion::Hash>>& hash) noexcept {
+    if (r.kind == Record::Kind::Absent) return !exists;
+    if (!exists) return false;
+
+    // An output without a fingerprint can only be checked for a regular file at its path
+    if (r.kind == Record::Kind::Output && !r.empty && !r.mtime.has_value() &&
+        !r.hash.has_value()) {
+      return S_ISREG(statbuf.st_mode);
+    }
+
+    if (r.kind == Record::Kind::Metadata) {
+      return r.uid == statbuf.st_uid && r.gid == statbuf.st_gid &&
+             (r.mode & S_IFMT) == (statbuf.st_mode & S_IFMT);
+
+    } else if (r.kind == Record::Kind::Stat) {
+      return r.mtime == to_ns(statbuf.st_mtim) && r.size == statbuf.st_size &&
+             r.ino == statbuf.st_ino;
+    }
+
+    // The rest of the checks are for file contents, in the order a fingerprint is compared
+    if (!S_ISREG(statbuf.st_mode)) return false;
+    if (r.empty && statbuf.st_size == 0) return true;
+    if (r.mtime == to_ns(statbuf.st_mtim)) return true;
+    if (!r.hash.has_value()) return false;
+
+    // Hash the file at most once, no matter how many commands read it
+    if (!hash.has_value()) hash = hash_file(path);
+    return hash.value() == r.hash;
+  }
+
+  optional<Plan> check(fs::path path, fs::path db) noexcept {
+    ifstream f(path);
+    if (!f) return nullopt;
+
+    // Make sure the summary describes the current database
+    string line;
+    auto header = header_for(db);
+    if (!std::getline(f, line) || !header.has_value() || line != header.value()) {
+      LOG(phase) << "The build summary is missing or out of date";
+      return nullopt;
+    }
+
+    vector<Entry> entries;
+
+    // Records are grouped by path, so each path is checked once
+    vector<pair<string, vector<Record>>> groups;
+    unordered_map<string, size_t> group_index;
+
+    while (std::getline(f, line)) {
+      auto space = line.find(' ');
+      auto word = line.substr(0, space);
+      auto rest = space == string::npos ? string() : line.substr(space + 1);
+
+      if (word == "command") {
+        entries.emplace_back();
+        entries.back().name = rest;
+        continue;
+      }
+
+      // Every other line belongs to a command
+      if (entries.empty()) return nullopt;
+      auto& e = entries.back();
+      size_t command = entries.size() - 1;
+
+      if (word == "changed") {
+        e.changed = true;
+
+      } else if (word == "needs" || word == "used-by" || word == "needed-by") {
+        auto& list = word == "needs" ? e.needs : word == "used-by" ? e.used_by : e.needed_by;
+        istringstream fields(rest);
+        size_t i;
+        while (fields >> i) list.push_back(i);
+        if (!fields.eof()) return nullopt;
+
+      } else {
+        Record r;
+        r.command = command;
+        istringstream fields(rest);
+
+        if (word == "file" || word == "output") {
+          r.kind = word == "file" ? Record::Kind::File : Record::Kind::Output;
+          string mtime, hash;
+          if (!(fields >> r.empty >> mtime >> hash)) return nullopt;
+          if (!parse_optional(mtime, r.mtime)) return nullopt;
+          if (hash != "-") {
+            r.hash = parse_hash(hash);
+            if (!r.hash.has_value()) return nullopt;
+          }
+
+        } else if (word == "meta") {
+          r.kind = Record::Kind::Metadata;
+          if (!(fields >> r.uid >> r.gid >> r.mode)) return nullopt;
+
+        } else if (word == "stat") {
+          r.kind = Record::Kind::Stat;
+          int64_t mtime;
+          if (!(fields >> mtime >> r.size >> r.ino)) return nullopt;
+          r.mtime = mtime;
+
+        } else if (word == "absent") {
+          r.kind = Record::Kind::Absent;
+
+        } else {
+          return nullopt;
+        }
+
+        // The path is the rest of the line after one space
+        string p;
+        if (word == "absent") {
+          p = rest;
+        } else {
+          fields.ignore(1);
+          std::getline(fields, p);
+        }
+        if (p.empty()) return nullopt;
+
+        auto [iter, added] = group_index.emplace(p, groups.size());
+        if (added) groups.emplace_back(p, vector<Record>());
+        groups[iter->second].second.push_back(r);
+      }
+    }
+
+    // Make sure every command index refers to a command in the summary
+    for (const auto& e : entries) {
+      for (const auto& list : {e.needs, e.used_by, e.needed_by}) {
+        for (auto i : list) {
+          if (i >= entries.size()) return nullopt;
+        }
+      }
+    }
+
+    // Check each path in parallel
+    size_t threads = thread_count(groups.size());
+
+    LOG(phase) << "Checking " << groups.size() << " paths for " << entries.size()
+               << " commands with " << threads << " threads";
+
+    parallel_for(groups.size(), threads, [&](size_t i) {
+      auto& [p, records] = groups[i];
+      struct stat statbuf;
+      bool exists = ::lstat(p.c_str(), &statbuf) == 0;
+      optional<optional<FileVersion::Hash>> hash;
+      for (auto& r : records) {
+        r.changed = !matches(r, p, exists, statbuf, hash);
+      }
+    });
+
+    for (const auto& [p, records] : groups) {
+      for (const auto& r : records) {
+        if (r.changed) {
+          LOGF(rebuild, "{} must run: {} {} changed", entries[r.command].name,
+               r.kind == Record::Kind::Output ? "output" : "input", p);
+          entries[r.command].changed = true;
+        }
+      }
+    }
+
+    // Mark commands with the same rules the trace uses. See docs/new-rebuild.md.
+    vector<pair<size_t, Marking>> work;
+    for (size_t i = 0; i < entries.size(); i++) {
+      if (entries[i].changed) work.emplace_back(i, Marking::MustRun);
+    }
+
+    while (!work.empty()) {
+      auto [i, m] = work.back();
+      work.pop_back();
+
+      auto& e = entries[i];
+      if (e.marking >= m) continue;
+      e.marking = m;
+
+      if (m == Marking::MustRun) {
+        // Rules 3 and 5
+        for (auto j : e.needs) work.emplace_back(j, Marking::MustRun);
+        for (auto j : e.needed_by) work.emplace_back(j, Marking::MustRun);
+        for (auto j : e.used_by) work.emplace_back(j, Marking::MayRun);
+      } else {
+        // Rules 6 and 7
+        for (auto j : e.needs) work.emplace_back(j, Marking::MayRun);
+        for (auto j : e.used_by) work.emplace_back(j, Marking::MayRun);
+      }
+    }
+
+    Plan plan;
+    for (const auto& e : entries) {
+      if (e.marking == Marking::MustRun) {
+        plan.must_run.push_back(e.name);
+      } else if (e.marking == Marking::MayRun) {
+        plan.may_run.push_back(e.name);
+      }
+    }
+
+    return plan;
+  }
+}
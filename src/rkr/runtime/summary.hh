@@ -0,0 +1,48 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+class Command;
+
+namespace fs = std::filesystem;
+
+/**
+ * The summary namespace saves a compact description of what each command depended on at the end
+ * of a build: the external inputs it read, the paths it found missing, the uncached files it left
+ * as outputs, and the commands it shares outputs with. `rkr check` uses the summary to decide
+ * which commands would rerun by checking those inputs and outputs against the filesystem, without
+ * loading and emulating the whole trace.
+ *
+ * The summary records the size and modification time of the database it was saved with. A
+ * summary that does not match the current database is ignored.
+ */
+namespace summary {
+  /// The commands a check found would run in the next build
+  struct Plan {
+    /// Commands that must run, in the order they appear in the build
+    std::vector<std::string> must_run;
+
+    /// Commands that may run, in the order they appear in the build
+    std::vector<std::string> may_run;
+  };
+
+  /**
+   * Save a summary of the last completed run of a build
+   * \param path The file to write
+   * \param db   The database the summary describes, which must already be written
+   * \param root The build's root command
+   */
+  void save(fs::path path, fs::path db, const std::shared_ptr<Command>& root) noexcept;
+
+  /**
+   * Check a saved summary against the filesystem
+   * \param path The summary file to read
+   * \param db   The current database
+   * \returns the commands that would run, or nullopt if the summary is missing or out of date
+   */
+  std::optional<Plan> check(fs::path path, fs::path db) noexcept;
+}
@@ -14,6 +14,7 @@
 #include <elf.h>
 #include <sys/mman.h>
 #include <sys/ptrace.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <sys/wait.h>
@@ -29,15 +30,18 @@
 #include "runtime/Build.hh"
 #include "runtime/Command.hh"
 #include "runtime/Ref.hh"
+#include "runtime/profile.hh"
 #include "tracing/Flags.hh"
 #include "tracing/SyscallTable.hh"
 #include "tracing/Tracer.hh"
+#include "util/events.hh"
 #include "util/log.hh"
 #include "util/options.hh"
 #include "util/wrappers.hh"
 #include "versions/MetadataVersion.hh"
 
 using std::function;
+using std::nullopt;
 using std::optional;
 using std::shared_ptr;
 using std::string;
@@ -52,6 +56,9 @@ void Thread::syscallEntryChannel(Build& build, const IRSource& source, ssize_t c
 
   auto& entry = SyscallTable<Build>::get(Tracer::getSyscallNumber(_channel));
 
+  auto cmd = getCommand();
+  profile::SyscallTimer timer(cmd->getProfile(), true, entry.getName());
+
   if (options::syscall_stats) {
     Tracer::syscall_counts[string(entry.getName()) + " (fast)"]++;
     Tracer::fast_syscall_count++;
@@ -72,9 +79,12 @@ void Thread::syscallExitChannel(Build& build, const IRSource& source, ssize_t ch
   ASSERT(!_post_syscall_handlers.empty())
       << "Stopped on syscall exit with no available post-syscall handlers";
 
-  LOG(trace) << this << " handling "
-             << SyscallTable<Build>::get(Tracer::getSyscallNumber(_channel)).getName()
-             << " exit via shared memory channel";
+  auto name = SyscallTable<Build>::get(Tracer::getSyscallNumber(_channel)).getName();
+
+  auto cmd = getCommand();
+  profile::SyscallTimer timer(cmd->getProfile(), true, name);
+
+  LOG(trace) << this << " handling " << name << " exit via shared memory channel";
 
   // Run the post-syscall handler
   _post_syscall_handlers.top()(build, source, Tracer::getSyscallResult(_channel));
@@ -88,6 +98,9 @@ void Thread::syscallExitChannel(Build& build, const IRSource& source, ssize_t ch
 void Thread::syscallExitPtrace(Build& build, const IRSource& source) noexcept {
   ASSERT(!_post_syscall_handlers.empty()) << "Thread does not have a post-syscall handler";
 
+  auto cmd = getCommand();
+  profile::SyscallTimer timer(cmd->getProfile(), false, "syscall exit");
+
   // Clear errno so we can check for errors
   errno = 0;
 
@@ -137,6 +150,23 @@ fs::path Thread::getPath(at_fd fd) const noexcept {
   return "<no path>";
 }
 
+optional<fs::path> Thread::getAbsolutePath(at_fd dfd, fs::path p) const noexcept {
+  if (p.is_relative()) {
+    // getPath returns a relative placeholder when the directory has no path
+    auto dir = getPath(dfd);
+    if (dir.is_relative()) return nullopt;
+    p = dir / p;
+  }
+  return p.lexically_normal();
+}
+
+void Thread::reportEntryChange(at_fd dfd, fs::path p) const noexcept {
+  if (!events::enabled) return;
+  if (auto path = getAbsolutePath(dfd, p); path.has_value()) {
+    events::access(*getCommand(), path.value(), events::Access::Write);
+  }
+}
+
 Ref::ID Thread::makePathRef(Build& build,
                             const IRSource& source,
                             fs::path p,
@@ -410,6 +440,15 @@ void Thread::_openat(Build& build,
     ref->getArtifact()->beforeTruncate(build, source, getCommand(), ref_id);
   }
 
+  // If events are being streamed, check whether this call will create the file. With O_EXCL it
+  // must, and otherwise it does if nothing is there yet.
+  bool creates = false;
+  if (events::enabled && flags.creat()) {
+    auto path = getAbsolutePath(dfd, filename);
+    struct stat statbuf;
+    creates = flags.excl() || (path.has_value() && ::lstat(path->c_str(), &statbuf) != 0);
+  }
+
   // If the open call will fail, just run it and don't wait for completion
   // We can't skip the call because it could still have a side effect
   if (!ref->isResolved()) {
@@ -431,6 +470,9 @@ void Thread::_openat(Build& build,
       // The command observed a successful openat, so add this predicate to the command log
       build.expectResult(source, getCommand(), Scenario::Build, ref_id, SUCCESS);
 
+      // Creating the file changes an entry in its directory
+      if (creates) reportEntryChange(dfd, filename);
+
       // If the O_TMPFILE flag was passed, this call created a reference to an anonymous file
       if (flags.tmpfile()) {
         auto mask = getProcess()->getUmask();
@@ -444,6 +486,7 @@ void Thread::_openat(Build& build,
         // If the file is truncated by the open call, set the contents in the artifact
         if (ref_flags.truncate) {
           ref->getArtifact()->afterTruncate(build, source, getCommand(), ref_id);
+          events::access(*getCommand(), *ref->getArtifact(), events::Access::Write);
         }
 
         // Record the reference in the correct location in this process' file descriptor table
@@ -499,6 +542,7 @@ void Thread::_mknodat(Build& build,
 
         // Link the pipe into the directory
         build.addEntry(source, getCommand(), dir_ref, entry, read_end);
+        reportEntryChange(dfd, filename);
 
       } else {
         // The syscall failed. Record the outcome of both references
@@ -928,8 +972,11 @@ void Thread::_read(Build& build, const IRSource& source, int fd) noexcept {
     resume();
 
     if (rc >= 0) {
+      getCommand()->getProfile().bytes_read += rc;
+
       // Inform the artifact that the read succeeded
       ref->getArtifact()->afterRead(build, source, getCommand(), ref_id);
+      events::access(*getCommand(), *ref->getArtifact(), events::Access::Read);
     }
   });
 }
@@ -951,8 +998,11 @@ void Thread::_write(Build& build, const IRSource& source, int fd) noexcept {
     // If the write syscall failed, there's no need to log a write
     if (rc < 0) return;
 
+    getCommand()->getProfile().bytes_written += rc;
+
     // Inform the artifact that it was written
     ref->getArtifact()->afterWrite(build, source, getCommand(), ref_id);
+    events::access(*getCommand(), *ref->getArtifact(), events::Access::Write);
   });
 }
 
@@ -1001,6 +1051,9 @@ void Thread::_mmap(Build& build,
     ref->getArtifact()->afterRead(build, source, getCommand(), ref_id);
     if (writable) ref->getArtifact()->afterWrite(build, source, getCommand(), ref_id);
 
+    events::access(*getCommand(), *ref->getArtifact(), events::Access::Read);
+    if (writable) events::access(*getCommand(), *ref->getArtifact(), events::Access::Write);
+
     // TODO: we need to track which commands have a given artifact mapped.
     // Any time that artifact is modified, all commands that have it mapped will get an
     // implicit CONTENTS_MATCH line added because they could see the new version.
@@ -1055,6 +1108,7 @@ void Thread::_truncate(Build& build,
         } else {
           ref->getArtifact()->afterTruncate(build, source, getCommand(), ref_id);
         }
+        events::access(*getCommand(), *ref->getArtifact(), events::Access::Write);
       }
     });
   }
@@ -1085,6 +1139,7 @@ void Thread::_ftruncate(Build& build, const IRSource& source, int fd, long lengt
       } else {
         ref->getArtifact()->afterTruncate(build, source, getCommand(), ref_id);
       }
+      events::access(*getCommand(), *ref->getArtifact(), events::Access::Write);
     }
   });
 }
@@ -1164,6 +1219,7 @@ void Thread::_mkdirat(Build& build,
 
       // Link the directory into the parent dir
       build.addEntry(source, getCommand(), parent_ref, entry, dir_ref);
+      reportEntryChange(dfd, pathname);
 
     } else {
       // The failure could be caused by either dir_ref or entry_ref. Record the result of both.
@@ -1261,6 +1317,10 @@ void Thread::_renameat2(Build& build,
       if (flags.exchange()) {
         build.addEntry(source, getCommand(), old_dir_ref, old_entry, new_entry_ref);
       }
+
+      // Both entries changed
+      reportEntryChange(old_dfd, old_path);
+      reportEntryChange(new_dfd, new_path);
     } else {
       // The syscall failed. Be conservative and save the result of all references. If any of them
       // change, that COULD change the syscall outcome.
@@ -1294,6 +1354,7 @@ void Thread::_getdents(Build& build, const IRSource& source, int fd) noexcept {
     if (rc == 0) {
       // Create a dependency on the artifact's directory list
       ref->getArtifact()->afterRead(build, source, getCommand(), ref_id);
+      events::access(*getCommand(), *ref->getArtifact(), events::Access::Read);
     }
   });
 }
@@ -1347,6 +1408,7 @@ void Thread::_linkat(Build& build,
 
       // Record the link operation
       build.addEntry(source, getCommand(), dir_ref, entry, target_ref);
+      reportEntryChange(new_dfd, newpath);
 
     } else {
       // The failure could be caused by the dir_ref, entry_ref, or target_ref. To be safe, just
@@ -1398,6 +1460,7 @@ void Thread::_symlinkat(Build& build,
 
       // Link the symlink into the directory
       build.addEntry(source, getCommand(), dir_ref, entry, symlink_ref);
+      reportEntryChange(dfd, newpath);
 
     } else {
       // The failure could be caused by either dir_ref or entry_ref. Record the result of both.
@@ -1491,6 +1554,7 @@ void Thread::_unlinkat(Build& build,
 
       // Perform the unlink
       build.removeEntry(source, getCommand(), dir_ref_id, entry, entry_ref_id);
+      reportEntryChange(dfd, pathname);
 
     } else {
       // The failure could be caused by either references. Record the outcome of both.
@@ -1642,10 +1706,20 @@ void Thread::_execveat(Build& build,
   if (getCommand()->getRef(exe_ref_id)->isResolved()) {
     // The reference resolved successfully, so the exec should succeed
     build.expectResult(source, getCommand(), Scenario::Build, exe_ref_id, SUCCESS);
+
+    // The process moves to the child command, so hold on to the parent and executable
+    auto parent = getCommand();
+    auto exe = parent->getRef(exe_ref_id)->getArtifact();
     const auto& child = _process->exec(build, source, exe_ref_id, args);
 
     // Does the child command need to run?
     if (child->mustRun()) {
+      // Report the launch to any scheduler reading the event stream
+      if (events::enabled) {
+        events::exec(*parent, *child);
+        if (exe) events::access(*child, *exe, events::Access::Exec);
+      }
+
       // Yes. Run the actual exec syscall
       /*finishSyscall([=](Build& build, const IRSource& source, long rc) {
         resume();
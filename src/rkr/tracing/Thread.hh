@@ -102,6 +102,13 @@ class Thread {
   /// Get the path associated with a file descriptor that may be AT_FDCWD
   fs::path getPath(at_fd fd) const noexcept;
 
+  /// Get the absolute path for a path argument, or nullopt if the directory it is relative to has
+  /// no path
+  std::optional<fs::path> getAbsolutePath(at_fd dfd, fs::path p) const noexcept;
+
+  /// Report a created, removed, or renamed directory entry as a write in the event stream
+  void reportEntryChange(at_fd dfd, fs::path p) const noexcept;
+
   /**
    * This thread referenced a path. Create an Access reference to track this reference and record it
    * in the command.
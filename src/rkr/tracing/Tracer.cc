@@ -7,6 +7,7 @@
 #include <cstdlib>
 #include <filesystem>
 #include <fstream>
+#include <iomanip>
 #include <list>
 #include <map>
 #include <memory>
@@ -33,6 +34,7 @@
 #include "runtime/Build.hh"
 #include "runtime/Command.hh"
 #include "runtime/Ref.hh"
+#include "runtime/profile.hh"
 #include "tracing/Process.hh"
 #include "tracing/SyscallTable.hh"
 #include "tracing/Thread.hh"
@@ -65,6 +67,8 @@ int seccomp(unsigned int operation, unsigned int flags, void* args) {
 }
 
 shared_ptr<Process> Tracer::start(Build& build, const shared_ptr<Command>& cmd) noexcept {
+  TIME_SCOPE(Tracing);
+
   // Launch the command with tracing
   return launchTraced(build, cmd);
 }
@@ -90,12 +94,16 @@ optional<tuple<pid_t, int>> Tracer::getEvent(Build& build) noexcept {
   while (true) {
     // Check the shared memory channel
     if (_shmem != nullptr) {
+      channel_polls++;
+
       // Loop over all the shared memory channels
       for (size_t i = 0; i < TRACING_CHANNEL_COUNT; i++) {
         auto state = __atomic_load_n(&_shmem->channels[i].state, __ATOMIC_ACQUIRE);
 
         if (state == CHANNEL_STATE_PRE_SYSCALL_WAIT || state == CHANNEL_STATE_POST_SYSCALL_NOTIFY ||
             state == CHANNEL_STATE_POST_SYSCALL_WAIT) {
+          channel_observed++;
+
           // Reset the state so we don't try to handle this event again later
           _shmem->channels[i].state = CHANNEL_STATE_OBSERVED;
 
@@ -154,6 +162,8 @@ optional<tuple<pid_t, int>> Tracer::getEvent(Build& build) noexcept {
 }
 
 void Tracer::wait(Build& build, shared_ptr<Process> p) noexcept {
+  TIME_SCOPE(Tracing);
+
   if (p) {
     LOG(exec) << "Waiting for " << p;
   } else {
@@ -396,6 +406,9 @@ void Tracer::handleSyscall(Build& build, Thread& t) noexcept {
   if (entry.isTraced()) {
     LOG(trace) << t << ": stopped on syscall " << entry.getName();
 
+    auto cmd = t.getCommand();
+    profile::SyscallTimer timer(cmd->getProfile(), false, entry.getName());
+
     if (options::syscall_stats) {
       std::stringstream ss;
       ss << entry.getName() << " (ptrace "
@@ -506,6 +519,9 @@ shared_ptr<Process> Tracer::launchTraced(Build& build, const shared_ptr<Command>
       // Zero out the tracing channel data
       memset(_shmem, 0, sizeof(struct shared_tracing_data));
 
+      // Tracees only time their round trips when statistics will be printed
+      _shmem->collect_stats = options::syscall_stats;
+
       // Initialize the semaphore that tracees use to coordinate channel acquisition
       sem_init(&_shmem->available, 1, TRACING_CHANNEL_COUNT);
 
@@ -736,6 +752,64 @@ void Tracer::printSyscallStats() noexcept {
   size_t percent_fast = (100 * Tracer::fast_syscall_count) / total_syscalls;
   std::cout << Tracer::fast_syscall_count << "/" << total_syscalls << " (" << percent_fast
             << "%) syscalls handed by fast tracing" << std::endl;
+
+  printChannelStats();
+}
+
+/// Get the latency below which a fraction of the waits in a histogram finished, in nanoseconds
+static uint64_t latency_percentile(const uint64_t* latency, uint64_t total, double p) noexcept {
+  uint64_t target = total * p;
+  uint64_t seen = 0;
+  for (size_t b = 0; b < CHANNEL_LATENCY_BUCKETS; b++) {
+    seen += latency[b];
+    if (seen > target) return channel_latency_bucket_min(b);
+  }
+  return channel_latency_bucket_min(CHANNEL_LATENCY_BUCKETS - 1);
+}
+
+void Tracer::printChannelStats() noexcept {
+  if (_shmem == nullptr) return;
+
+  // Add up the statistics tracees recorded for each channel
+  tracing_channel_stats_t total = {};
+  for (size_t i = 0; i < TRACING_CHANNEL_COUNT; i++) {
+    const auto& s = _shmem->stats[i];
+    total.acquisitions += s.acquisitions;
+    total.acquire_blocked += s.acquire_blocked;
+    total.acquire_probes += s.acquire_probes;
+    total.waits += s.waits;
+    total.spins += s.spins;
+    total.sem_fallbacks += s.sem_fallbacks;
+    for (size_t b = 0; b < CHANNEL_LATENCY_BUCKETS; b++) total.latency[b] += s.latency[b];
+  }
+
+  std::cout << std::endl;
+  std::cout << "Shared Memory Channel Stats:" << std::endl;
+  std::cout << "  Acquisitions: " << total.acquisitions << " (" << total.acquire_blocked
+            << " blocked, " << total.acquire_probes << " busy channels probed)" << std::endl;
+  std::cout << "  Waits: " << total.waits << " (" << total.spins << " spins, "
+            << total.sem_fallbacks << " semaphore fallbacks)" << std::endl;
+  std::cout << "  Tracer polls: " << channel_polls << " (" << channel_observed
+            << " channel events observed)" << std::endl;
+
+  if (total.waits == 0) return;
+
+  std::cout << "  Round-trip latency: p50 " << latency_percentile(total.latency, total.waits, 0.5)
+            << "ns, p90 " << latency_percentile(total.latency, total.waits, 0.9) << "ns, p99 "
+            << latency_percentile(total.latency, total.waits, 0.99) << "ns, max "
+            << latency_percentile(total.latency, total.waits, 1.0) << "ns" << std::endl;
+
+  // Print the channels tracees used, which shows how evenly they are spread
+  std::cout << "  Channel  Acquired     Waits     Spins  Fallbacks  p50 ns  p99 ns" << std::endl;
+  for (size_t i = 0; i < TRACING_CHANNEL_COUNT; i++) {
+    const auto& s = _shmem->stats[i];
+    if (s.acquisitions == 0) continue;
+
+    std::cout << "  " << std::setw(7) << i << std::setw(10) << s.acquisitions << std::setw(10)
+              << s.waits << std::setw(10) << s.spins << std::setw(11) << s.sem_fallbacks
+              << std::setw(8) << latency_percentile(s.latency, s.waits, 0.5) << std::setw(8)
+              << latency_percentile(s.latency, s.waits, 0.99) << std::endl;
+  }
 }
 
 // Get the system call being traced through the specified shared memory channel
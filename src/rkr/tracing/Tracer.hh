@@ -65,8 +65,17 @@ class Tracer {
   inline static size_t ptrace_syscall_count = 0;
   inline static size_t fast_syscall_count = 0;
 
+  /// The number of times the tracer checked the shared memory channels for events
+  inline static size_t channel_polls = 0;
+
+  /// The number of channel events the tracer observed
+  inline static size_t channel_observed = 0;
+
   static void printSyscallStats() noexcept;
 
+  /// Print the statistics tracees recorded in the shared memory channels
+  static void printChannelStats() noexcept;
+
   /// Get the system call being traced through the specified shared memory channel
   static long getSyscallNumber(ssize_t channel) noexcept;
 
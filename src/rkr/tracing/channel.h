@@ -0,0 +1,123 @@
+#pragma once
+
+#include <semaphore.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "tracing/inject.h"
+
+/**
+ * The tracee's side of the shared memory tracing channel protocol. The injected library uses
+ * these functions to talk to the tracer, and the channel benchmark uses them to play a tracee
+ * without loading the library. Everything here is static inline so the functions are compiled
+ * into each user, and the injected library does not need to export them.
+ */
+
+// How many times should a thread spin on a contended lock before backing off?
+#define SPIN_BACKOFF_COUNT 512
+
+// Pause briefly while spinning
+#if defined(__x86_64__) || defined(_M_X64)
+
+#include <emmintrin.h>
+static inline void spinlock_pause() {
+  _mm_pause();
+}
+
+#else
+
+static inline void spinlock_pause() {}
+
+#endif
+
+// Get the current time in nanoseconds. This is answered by the vDSO, so it is not traced.
+static inline uint64_t channel_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Acquire a channel for a thread, blocking until one is available
+static inline size_t channel_acquire(struct shared_tracing_data* shmem, pid_t tid) {
+  // Block until we know there's an available channel
+  bool blocked = false;
+  if (sem_trywait(&shmem->available) == -1) {
+    blocked = true;
+    while (sem_wait(&shmem->available) == -1) {
+    }
+  }
+
+  // Loop until we find a channel to claim
+  size_t i = tid % TRACING_CHANNEL_COUNT;
+  uint64_t probes = 0;
+  while (true) {
+    // Peek at the state of the channel
+    uint8_t state = __atomic_load_n(&shmem->channels[i].state, __ATOMIC_RELAXED);
+
+    // If the channel is available, try to acquire it.
+    if (state == CHANNEL_STATE_AVAILABLE &&
+        __atomic_compare_exchange_n(&shmem->channels[i].state, &state, CHANNEL_STATE_ACQUIRED, true,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      // Successfully acquired the channel
+      shmem->channels[i].tid = tid;
+      shmem->channels[i].buffer_pos = 0;
+
+      // Record the acquisition, now that this tracee owns the channel's statistics
+      if (shmem->collect_stats) {
+        shmem->stats[i].acquisitions++;
+        shmem->stats[i].acquire_blocked += blocked;
+        shmem->stats[i].acquire_probes += probes;
+      }
+
+      return i;
+    }
+
+    i = (i + 1) % TRACING_CHANNEL_COUNT;
+    probes++;
+  }
+}
+
+// Release a channel so another tracee can acquire it
+static inline void channel_release(struct shared_tracing_data* shmem, size_t c) {
+  // Reset the channel to available
+  __atomic_store_n(&shmem->channels[c].state, CHANNEL_STATE_AVAILABLE, __ATOMIC_RELEASE);
+
+  // Post an available channel
+  while (sem_post(&shmem->available) == -1) {
+  }
+}
+
+// Spin until the tracer sets the channel state to PROCEED
+static inline void channel_wait(struct shared_tracing_data* shmem, size_t c) {
+  // Only read the clock if the tracer wants statistics
+  bool collect = shmem->collect_stats;
+  uint64_t start = collect ? channel_now_ns() : 0;
+
+  size_t i;
+  for (i = 0; i < SPIN_BACKOFF_COUNT; i++) {
+    // Load the channel state
+    uint8_t state = __atomic_load_n(&shmem->channels[c].state, __ATOMIC_ACQUIRE);
+
+    // Can we proceed?
+    if (state == CHANNEL_STATE_PROCEED) {
+      // Yes. Break out of the loop
+      break;
+    } else {
+      spinlock_pause();
+    }
+  }
+
+  // Wait on the semaphore
+  while (sem_wait(&shmem->channels[c].wake_tracee) != 0) {
+  }
+
+  // Record the wait
+  if (!collect) return;
+  tracing_channel_stats_t* stats = &shmem->stats[c];
+  stats->waits++;
+  stats->spins += i;
+  stats->sem_fallbacks += (i == SPIN_BACKOFF_COUNT);
+  stats->latency[channel_latency_bucket(channel_now_ns() - start)]++;
+}
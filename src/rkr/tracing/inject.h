@@ -69,6 +69,72 @@
 #define CHANNEL_ACTION_EXIT 3
 #define CHANNEL_ACTION_SKIP 4
 
+/********** Channel Statistics **********/
+
+/**
+ * Tracees record how they use each channel so the fast path can be tuned (see --syscall-stats).
+ * Only the tracee that owns a channel updates its statistics, so no atomics are needed. Recording
+ * reads the clock twice on every round trip, so tracees only do it when the tracer sets
+ * collect_stats.
+ *
+ * Round-trip latencies go in a log-linear histogram: values below CHANNEL_LATENCY_LINEAR
+ * nanoseconds each have their own bucket, and every larger power of two is split into
+ * CHANNEL_LATENCY_SUB_BUCKETS buckets, so a bucket's lower bound is within 12.5% of its values.
+ */
+
+#define CHANNEL_LATENCY_SUB_BITS 3
+#define CHANNEL_LATENCY_SUB_BUCKETS (1 << CHANNEL_LATENCY_SUB_BITS)
+#define CHANNEL_LATENCY_LINEAR (2 * CHANNEL_LATENCY_SUB_BUCKETS)
+#define CHANNEL_LATENCY_MAX_BITS 40
+#define CHANNEL_LATENCY_BUCKETS \
+  (CHANNEL_LATENCY_LINEAR +     \
+   (CHANNEL_LATENCY_MAX_BITS - CHANNEL_LATENCY_SUB_BITS - 1) * CHANNEL_LATENCY_SUB_BUCKETS)
+
+// Get the histogram bucket for a latency in nanoseconds
+static inline size_t channel_latency_bucket(uint64_t ns) {
+  if (ns < CHANNEL_LATENCY_LINEAR) return ns;
+
+  size_t bits = 63 - __builtin_clzll(ns);
+  if (bits >= CHANNEL_LATENCY_MAX_BITS) return CHANNEL_LATENCY_BUCKETS - 1;
+
+  size_t group = bits - CHANNEL_LATENCY_SUB_BITS - 1;
+  size_t sub = (ns >> (bits - CHANNEL_LATENCY_SUB_BITS)) & (CHANNEL_LATENCY_SUB_BUCKETS - 1);
+  return CHANNEL_LATENCY_LINEAR + group * CHANNEL_LATENCY_SUB_BUCKETS + sub;
+}
+
+// Get the smallest latency in nanoseconds that falls in a histogram bucket
+static inline uint64_t channel_latency_bucket_min(size_t bucket) {
+  if (bucket < CHANNEL_LATENCY_LINEAR) return bucket;
+
+  size_t bits = (bucket - CHANNEL_LATENCY_LINEAR) / CHANNEL_LATENCY_SUB_BUCKETS +
+                CHANNEL_LATENCY_SUB_BITS + 1;
+  size_t sub = (bucket - CHANNEL_LATENCY_LINEAR) % CHANNEL_LATENCY_SUB_BUCKETS;
+  return (uint64_t)(CHANNEL_LATENCY_SUB_BUCKETS + sub) << (bits - CHANNEL_LATENCY_SUB_BITS);
+}
+
+typedef struct tracing_channel_stats {
+  // The number of times a tracee acquired this channel
+  uint64_t acquisitions;
+
+  // The number of acquisitions that had to block until any channel was available
+  uint64_t acquire_blocked;
+
+  // The number of busy channels probed before acquiring this one
+  uint64_t acquire_probes;
+
+  // The number of times a tracee waited for the tracer on this channel
+  uint64_t waits;
+
+  // The number of spin iterations while waiting
+  uint64_t spins;
+
+  // The number of waits that stopped spinning and blocked on the semaphore
+  uint64_t sem_fallbacks;
+
+  // The time from the start of each wait until the tracer let the tracee proceed
+  uint64_t latency[CHANNEL_LATENCY_BUCKETS];
+} tracing_channel_stats_t;
+
 typedef struct tracing_channel {
   sem_t wake_tracee;
   uint8_t state;
@@ -81,5 +147,7 @@ typedef struct tracing_channel {
 
 struct shared_tracing_data {
   sem_t available;
+  bool collect_stats;
   tracing_channel_t channels[TRACING_CHANNEL_COUNT];
+  tracing_channel_stats_t stats[TRACING_CHANNEL_COUNT];
 };
@@ -5,6 +5,8 @@
 #include <string>
 #include <vector>
 
+#include "util/Graph.hh"
+
 namespace fs = std::filesystem;
 
 void do_build(std::vector<std::string> args,
@@ -14,15 +16,27 @@ void do_build(std::vector<std::string> args,
 
 void do_audit(std::vector<std::string> args, std::string command_output) noexcept;
 
-void do_check(std::vector<std::string> args, fs::path dbDir) noexcept;
+void do_check(std::vector<std::string> args, bool full, fs::path dbDir) noexcept;
 
 void do_trace(std::vector<std::string> args, std::string output, fs::path dbDir) noexcept;
 
 void do_graph(std::vector<std::string> args,
               std::string output,
               std::string type,
-              bool show_all,
+              Graph::Filter filter,
               bool no_render,
               fs::path dbDir) noexcept;
 
-void do_stats(std::vector<std::string> args, bool list_artifacts, fs::path dbDir) noexcept;
+void do_stats(std::vector<std::string> args,
+              bool list_artifacts,
+              bool cache_stats,
+              bool timer_stats,
+              bool command_stats,
+              fs::path dbDir) noexcept;
+
+void do_watch(fs::path dbDir) noexcept;
+
+void do_server(fs::path dbDir) noexcept;
+
+/// Parse a command line and run the selected subcommand. Returns the process exit status.
+int rkr_main(int argc, char* argv[]) noexcept;
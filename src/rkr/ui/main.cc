@@ -0,0 +1,9 @@
+#include "ui/commands.hh"
+
+/**
+ * This is the entry point for the rkr command line tool. It lives apart from rkr_main so the
+ * benchmark binary can link everything else.
+ */
+int main(int argc, char* argv[]) noexcept {
+  return rkr_main(argc, argv);
+}
@@ -1,23 +1,39 @@
 #include <filesystem>
 #include <fstream>
+#include <list>
 #include <memory>
 #include <optional>
 #include <string>
 #include <vector>
 
 #include "data/DefaultTrace.hh"
+#include "data/IRBuffer.hh"
 #include "data/PostBuildChecker.hh"
 #include "data/ReadWriteCombiner.hh"
 #include "data/Trace.hh"
 #include "runtime/Build.hh"
 #include "runtime/env.hh"
+#include "runtime/journal.hh"
+#include "runtime/prefetch.hh"
+#include "runtime/profile.hh"
+#include "runtime/summary.hh"
 #include "tracing/Tracer.hh"
 #include "ui/commands.hh"
+#include "ui/server.hh"
+#include "util/background.hh"
+#include "util/cache.hh"
+#include "util/constants.hh"
+#include "util/events.hh"
+#include "util/options.hh"
+#include "util/remote.hh"
 #include "util/stats.hh"
+#include "util/timeline.hh"
 
 namespace fs = std::filesystem;
 
+using std::list;
 using std::make_unique;
+using std::nullopt;
 using std::ofstream;
 using std::optional;
 using std::ostream;
@@ -35,12 +51,12 @@ void do_build(vector<string> args,
               fs::path dbDir) noexcept {
   // Make sure the output directory exists
   auto outputDir = dbDir;
-  auto CacheDir = dbDir / "cache";
   auto DatabaseFilename = dbDir / "db";
   fs::create_directories(outputDir);
 
-  // Also ensure that the cache directory exists
-  fs::create_directory(CacheDir);
+  // Use a shared cache directory if one was provided, and make sure it exists
+  constants::CacheDir = options::cache_dir.value_or(dbDir / "cache");
+  fs::create_directories(constants::CacheDir);
 
   // Set up an ostream to print to if necessary
   unique_ptr<ostream> print_to;
@@ -54,6 +70,15 @@ void do_build(vector<string> args,
   // Reset the statistics counters
   reset_stats();
 
+  // Start recording a timeline if one was requested
+  if (options::timeline.has_value()) timeline::start();
+
+  // Start streaming dependency events if a destination was given
+  if (options::events.has_value()) events::start(options::events.value());
+
+  // Keep other builds sharing the cache from evicting files this build may use
+  if (options::enable_cache) cache::begin();
+
   // The input TraceReader will supply the trace to each phase except the first
   TraceReader input;
 
@@ -61,18 +86,37 @@ void do_build(vector<string> args,
   shared_ptr<Command> root_cmd;
 
   LOG(phase) << "Starting build phase 0";
+  auto phase_start = timeline::clock::now();
 
-  // Is there a trace to load?
-  if (auto loaded = TraceReader::load(DatabaseFilename); loaded) {
+  // Use the trace the build server decoded, if this build was started by a server. Otherwise,
+  // load the trace from the database.
+  auto warm = server::take_trace();
+  optional<TraceReader> loaded;
+  if (!warm) loaded = TraceReader::load(DatabaseFilename);
+
+  // Is there a trace to evaluate?
+  if (warm || loaded) {
     // Yes. Remember the root command
-    root_cmd = loaded->getRootCommand();
+    root_cmd = warm ? warm->getRootCommand() : loaded->getRootCommand();
 
     // Create a trace writer to store the output trace
     TraceWriter output;
 
-    // Evaluate the loaded trace
+    // Reuse stat results from the last build for paths the change journal shows are unchanged,
+    // then stat the remaining paths the last build used in the background while the trace is
+    // evaluated
+    journal::begin(dbDir);
+    if (options::prefetch_stats) prefetch::start(dbDir / "paths");
+
+    // Evaluate the trace
+    TIME_SCOPE(Emulation);
     Build eval(output, print_to ? *print_to : std::cout);
-    loaded->sendTo(eval);
+    if (warm) {
+      warm->sendTo(eval);
+    } else {
+      loaded->sendTo(eval);
+    }
+    prefetch::stop();
 
     // The output now holds the next input. Save it
     input = output.getReader();
@@ -88,6 +132,7 @@ void do_build(vector<string> args,
     TraceWriter output;
 
     // Evaluate the default trace
+    TIME_SCOPE(Emulation);
     Build eval(output, print_to ? *print_to : std::cout);
     def.sendTo(eval);
 
@@ -99,6 +144,7 @@ void do_build(vector<string> args,
   root_cmd->planBuild();
 
   LOG(phase) << "Finished build phase 0";
+  timeline::span("phase", "Phase 0", phase_start, timeline::clock::now());
 
   // Write stats out to CSV & reset counters
   gather_stats(stats_log_path, stats, 0);
@@ -107,10 +153,16 @@ void do_build(vector<string> args,
   // Keep track of the build phase
   size_t iteration = 1;
 
+  // The post-build outcomes recorded during the latest phase, and whether they are exact
+  list<PostBuildOutcome> post_build;
+  bool post_build_exact = true;
+
   // Loop as long as there are commands left to run
   while (!root_cmd->allFinished()) {
-    // Prepare a new output buffer with read/write combining
-    auto output = ReadWriteCombiner<TraceWriter>();
+    timeline::Span phase_span("phase", "Phase " + std::to_string(iteration));
+
+    // Prepare a new output buffer with read/write combining that also records post-build outcomes
+    auto output = ReadWriteCombiner<PostBuildRecorder<TraceWriter>>();
 
     // Revert the environment to committed state
     env::rollback();
@@ -118,8 +170,11 @@ void do_build(vector<string> args,
     LOGF(phase, "Starting build phase {}", iteration);
 
     // Run the trace and send the new trace to output
-    Build build(output, print_to ? *print_to : std::cout);
-    input.sendTo(build);
+    {
+      TIME_SCOPE(Emulation);
+      Build build(output, print_to ? *print_to : std::cout);
+      input.sendTo(build);
+    }
 
     // Plan the next iteration
     root_cmd->planBuild();
@@ -133,35 +188,87 @@ void do_build(vector<string> args,
     // Increment the iteration
     iteration++;
 
+    // Keep the post-build outcomes in case this was the last phase
+    post_build = output.takeOutcomes();
+    post_build_exact = output.exact();
+
     // The output becomes the next input
     input = output.getReader();
   }
 
+  LOGF(phase, "Build finished after {} phases", iteration);
+
   // Commit anything left in the environment
   LOG(phase) << "Committing environment changes";
-  env::commitAll();
+  {
+    TIME_SCOPE(Commit);
+    env::commitAll();
+  }
 
   // If more than one phase of the build ran, then we know the trace could have changed
   if (iteration > 1) {
     LOG(phase) << "Starting post-build checks";
 
-    // Run the post-build checks and send the resulting trace directly to output
-    PostBuildChecker<TraceWriter> output(DatabaseFilename);
-
-    // Reset the environment
-    env::rollback();
-
-    // Evaluate the trace in the output buffer from the last phase
-    Build build(output, print_to ? *print_to : std::cout);
-    input.sendTo(build);
+    TIME_SCOPE(PostBuild);
+
+    // The post-build checks write the trace that is saved. Cached files that only the traces of
+    // earlier phases referred to no longer need to be kept.
+    cache::clear_references();
+
+    // Apply the post-build outcomes recorded during the last phase and send the resulting trace
+    // directly to output, so the trace does not need to be emulated again
+    bool replay = options::replay_post_build || !post_build_exact;
+    if (!replay) {
+      PostBuildChecker<TraceWriter> output(std::move(post_build), DatabaseFilename);
+      input.sendTo(output);
+      replay = output.failed();
+    }
+
+    // If the recorded outcomes can't be used, emulate the trace again from the final state and
+    // check each predicate as it is emulated. This replaces any database written above.
+    if (replay) {
+      LOG(phase) << "Replaying the final trace for post-build checks";
+      input.rewind();
+
+      PostBuildChecker<TraceWriter> output(nullopt, DatabaseFilename);
+      env::rollback();
+      Build build(output, print_to ? *print_to : std::cout);
+      input.sendTo(build);
+    }
 
     LOG(phase) << "Finished post-build checks";
   }
 
+  // Wait for files being cached in the background and uploads to the cache server, then update
+  // the cache index and evict unused files if the cache is over its size limit
+  if (options::enable_cache) {
+    TIME_SCOPE(Cache);
+    background::wait();
+    remote::flush();
+    cache::finish(dbDir);
+  }
+
+  // Save the inputs and outputs of each command, so `rkr check` can skip emulating the trace.
+  // The summary reuses stat results from the build that the change journal shows are current.
+  journal::refresh(dbDir);
+  summary::save(dbDir / "summary", DatabaseFilename, root_cmd);
+
+  // Save the stat results from this build and the paths it used for the next one
+  journal::finish(dbDir);
+  prefetch::save(dbDir / "paths");
+
+  // Save the subsystem timers and per-command costs for `rkr stats`
+  stats::save_timers(dbDir / "timers");
+  profile::save(dbDir / "profile", root_cmd->collectCommands());
+
   gather_stats(stats_log_path, stats, iteration);
-  write_stats(stats_log_path, stats);
+  write_stats(stats_log_path, stats, iteration);
 
   if (options::syscall_stats) {
     Tracer::printSyscallStats();
   }
+
+  if (options::timeline.has_value()) timeline::write(options::timeline.value());
+
+  events::finish();
 }
@@ -5,6 +5,7 @@
 
 #include "data/Trace.hh"
 #include "runtime/Build.hh"
+#include "runtime/summary.hh"
 #include "ui/commands.hh"
 #include "util/options.hh"
 
@@ -15,12 +16,46 @@ using std::endl;
 using std::string;
 using std::vector;
 
+/// Print the commands a check found would run
+static void print_plan(const vector<string>& must_run, const vector<string>& may_run) noexcept {
+  // Print commands that must run
+  if (!must_run.empty()) {
+    cout << "Commands that must run:" << endl;
+    for (const auto& name : must_run) {
+      cout << "  " << name << endl;
+    }
+    cout << endl;
+  }
+
+  // Print the rebuild plan
+  if (!may_run.empty()) {
+    cout << "Commands that may run:" << endl;
+    for (const auto& name : may_run) {
+      cout << "  " << name << endl;
+    }
+  }
+
+  // If we never printed the header, there were no commands to rerun
+  if (must_run.empty() && may_run.empty()) {
+    cout << "No commands to rerun" << endl;
+  }
+}
+
 /**
  * Run the `check` subcommand
  */
-void do_check(vector<string> args, fs::path dbDir) noexcept {
-  // Load the build trace
+void do_check(vector<string> args, bool full, fs::path dbDir) noexcept {
   auto DatabaseFilename = dbDir / "db";
+
+  // Check the summary saved by the last build, unless it is missing or out of date
+  if (!full) {
+    if (auto plan = summary::check(dbDir / "summary", DatabaseFilename); plan.has_value()) {
+      print_plan(plan->must_run, plan->may_run);
+      return;
+    }
+  }
+
+  // Load the build trace
   auto trace = TraceReader::load(DatabaseFilename);
   FAIL_IF(!trace) << "A trace could not be loaded. Run a full build first.";
   auto root_cmd = trace->getRootCommand();
@@ -32,34 +67,15 @@ void do_check(vector<string> args, fs::path dbDir) noexcept {
   // Plan the next build
   root_cmd->planBuild();
 
-  // Print commands that must run
-  bool must_run_header_printed = false;
+  vector<string> must_run;
   for (const auto& c : root_cmd->collectMustRun()) {
-    // Print the header if necessary
-    if (!must_run_header_printed) {
-      cout << "Commands that must run:" << endl;
-      must_run_header_printed = true;
-    }
-
-    // Print the command
-    cout << "  " << c->getShortName(options::command_length) << endl;
+    must_run.push_back(c->getShortName(options::command_length));
   }
 
-  // If we printed anything, add a newline
-  if (must_run_header_printed) cout << endl;
-
-  // Print the rebuild plan
-  bool may_run_header_printed = false;
+  vector<string> may_run;
   for (const auto& c : root_cmd->collectMayRun()) {
-    if (!may_run_header_printed) {
-      cout << "Commands that may run:" << endl;
-      may_run_header_printed = true;
-    }
-    cout << "  " << c->getShortName(options::command_length) << endl;
+    may_run.push_back(c->getShortName(options::command_length));
   }
 
-  // If we never printed the header, there were no commands to rerun
-  if (!must_run_header_printed && !may_run_header_printed) {
-    cout << "No commands to rerun" << endl;
-  }
+  print_plan(must_run, may_run);
 }
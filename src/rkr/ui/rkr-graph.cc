@@ -2,11 +2,11 @@
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
-#include <sstream>
 #include <string>
 #include <vector>
 #include <filesystem>
 
+#include <ext/stdio_filebuf.h>
 #include <unistd.h>
 
 #include "data/Trace.hh"
@@ -15,9 +15,9 @@
 #include "util/Graph.hh"
 #include "util/TracePrinter.hh"
 
+using std::cout;
 using std::ofstream;
 using std::string;
-using std::stringstream;
 using std::vector;
 
 namespace fs = std::filesystem;
@@ -26,13 +26,13 @@ namespace fs = std::filesystem;
  * Run the `graph` subcommand
  * \param output      The name of the output file, or "-" for stdout
  * \param type        The type of output to produce
- * \param show_all    If true, include system files in the graph
+ * \param filter      The parts of the build to include in the graph
  * \param no_render   If set, generate graphviz source instead of a rendered graph
  */
 void do_graph(vector<string> args,
               string output,
               string type,
-              bool show_all,
+              Graph::Filter filter,
               bool no_render,
               fs::path dbDir) noexcept {
   // Turn on input/output tracking
@@ -43,7 +43,10 @@ void do_graph(vector<string> args,
   if (output.empty()) output = "out." + type;
 
   // If the output filename is not empty, but has no extension, append one
-  if (output.find('.') == string::npos) output += "." + type;
+  if (output != "-" && output.find('.') == string::npos) output += "." + type;
+
+  // JSON output is an edge list for other tools, and is never rendered
+  auto format = type == "json" ? Graph::Format::JSON : Graph::Format::Dot;
 
   // Load the build trace
   auto DatabaseFilename = dbDir / "db";
@@ -57,18 +60,15 @@ void do_graph(vector<string> args,
   // Plan the next build
   root_cmd->planBuild();
 
-  Graph graph(show_all);
-  graph.addCommands(root_cmd->collectCommands());
-
-  if (no_render) {
-    ofstream f(output);
-    f << graph;
+  if (no_render || format == Graph::Format::JSON) {
+    if (output == "-") {
+      Graph(cout, format, filter).write(root_cmd);
+    } else {
+      ofstream f(output);
+      Graph(f, format, filter).write(root_cmd);
+    }
 
   } else {
-    // Send graph source to a stringstream
-    stringstream ss;
-    ss << graph;
-
     // Create a pipe to send the graphviz output through
     int pipe_fds[2];
     pipe(pipe_fds);
@@ -89,12 +89,13 @@ void do_graph(vector<string> args,
       // Running in the parent. Close the read end of the pipe
       close(pipe_fds[0]);
 
-      // Write the graphviz output to the pipe
-      auto message = ss.str();
-      write(pipe_fds[1], message.c_str(), message.size());
-
-      // Close the pipe
-      close(pipe_fds[1]);
+      // Stream the graphviz source through the pipe instead of building it in a string first.
+      // The buffer closes the write end of the pipe when it goes out of scope, so dot sees EOF.
+      {
+        __gnu_cxx::stdio_filebuf<char> buf(pipe_fds[1], std::ios::out);
+        std::ostream f(&buf);
+        Graph(f, format, filter).write(root_cmd);
+      }
 
       // Wait for graphviz to finish
       int status;
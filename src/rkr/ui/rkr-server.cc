@@ -0,0 +1,403 @@
+#include "server.hh"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "data/IRBuffer.hh"
+#include "data/Trace.hh"
+#include "ui/commands.hh"
+#include "util/log.hh"
+
+namespace fs = std::filesystem;
+
+using std::make_unique;
+using std::optional;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+extern char** environ;
+
+namespace server {
+  /// The standard streams passed from the client to the server
+  enum : size_t { StreamCount = 3 };
+
+  /// How often the server checks whether a client has gone away while its build runs
+  enum : int { PollIntervalMS = 200 };
+
+  /// The trace decoded by the server, which is handed to a forked build
+  static unique_ptr<IRBuffer> _trace;
+
+  /// Is this process a build started by the server?
+  static bool _in_server_build = false;
+
+  /// The exit status of a forwarded build
+  static int _forwarded_status = 0;
+
+  /// Set by the signal handler when the server should exit
+  static volatile sig_atomic_t _stop = 0;
+
+  /// Write an entire buffer to a socket. Returns false on failure.
+  static bool send_all(int fd, const void* data, size_t len) noexcept {
+    auto p = static_cast<const char*>(data);
+    while (len > 0) {
+      ssize_t n = ::send(fd, p, len, MSG_NOSIGNAL);
+      if (n == -1 && errno == EINTR) continue;
+      if (n <= 0) return false;
+      p += n;
+      len -= n;
+    }
+    return true;
+  }
+
+  /// Read an entire buffer from a socket. Returns false on failure or end of file.
+  static bool read_all(int fd, void* data, size_t len) noexcept {
+    auto p = static_cast<char*>(data);
+    while (len > 0) {
+      ssize_t n = ::read(fd, p, len);
+      if (n == -1 && errno == EINTR) continue;
+      if (n <= 0) return false;
+      p += n;
+      len -= n;
+    }
+    return true;
+  }
+
+  /// Fill in a Unix socket address. Returns false if the path is too long.
+  static bool make_address(const fs::path& path, struct sockaddr_un& addr) noexcept {
+    addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.string().size() >= sizeof(addr.sun_path)) return false;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    return true;
+  }
+
+  /// Connect to the server socket in a database directory. Returns -1 if no server is listening.
+  static int connect_to(fs::path db_dir) noexcept {
+    struct sockaddr_un addr;
+    if (!make_address(socket_path(db_dir), addr)) return -1;
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) return -1;
+    if (::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+      ::close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  bool forward(int argc, char* argv[], fs::path db_dir) noexcept {
+    // A build started by the server must run in its own process
+    if (_in_server_build) return false;
+
+    int sock = connect_to(db_dir);
+    if (sock == -1) return false;
+
+    // The request is a list of NUL-terminated strings: the working directory, the number of
+    // arguments, the arguments, and then the environment
+    string request = fs::current_path().string();
+    request += '\0';
+    request += std::to_string(argc);
+    request += '\0';
+    for (int i = 0; i < argc; i++) {
+      request += argv[i];
+      request += '\0';
+    }
+    for (char** e = environ; *e != nullptr; e++) {
+      request += *e;
+      request += '\0';
+    }
+
+    // Send the request's length along with the standard streams, then the request itself
+    uint64_t length = request.size();
+    struct iovec iov = {&length, sizeof(length)};
+    char control[CMSG_SPACE(sizeof(int) * StreamCount)] = {};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * StreamCount);
+    int streams[StreamCount] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    memcpy(CMSG_DATA(cmsg), streams, sizeof(streams));
+
+    if (::sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(length) ||
+        !send_all(sock, request.data(), request.size())) {
+      WARN << "Failed to send a build to the build server: " << ERR;
+      ::close(sock);
+      return false;
+    }
+
+    LOG(phase) << "Running build in the build server";
+
+    // Wait for the build's exit status. The server only replies once the build is finished.
+    int32_t status;
+    if (!read_all(sock, &status, sizeof(status))) {
+      WARN << "Lost connection to the build server";
+      status = 1;
+    }
+    ::close(sock);
+
+    _forwarded_status = status;
+    return true;
+  }
+
+  unique_ptr<IRBuffer> take_trace() noexcept {
+    return std::move(_trace);
+  }
+
+  int forwarded_status() noexcept {
+    return _forwarded_status;
+  }
+
+  /// Identifies a version of the database file, so the server can tell when it changes
+  struct DatabaseStamp {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+
+    bool operator==(const DatabaseStamp& other) const noexcept {
+      return dev == other.dev && ino == other.ino && size == other.size &&
+             mtime.tv_sec == other.mtime.tv_sec && mtime.tv_nsec == other.mtime.tv_nsec;
+    }
+  };
+
+  /// Get the current stamp for the database file, or nullopt if it does not exist
+  static optional<DatabaseStamp> get_stamp(fs::path db_file) noexcept {
+    struct stat statbuf;
+    if (::stat(db_file.c_str(), &statbuf) != 0) return std::nullopt;
+    return DatabaseStamp{statbuf.st_dev, statbuf.st_ino, statbuf.st_size, statbuf.st_mtim};
+  }
+
+  /// The stamp of the database file the server's trace was decoded from
+  static optional<DatabaseStamp> _loaded_stamp;
+
+  /// Decode the trace in the database, if it has changed since it was last decoded
+  static void refresh(fs::path db_file) noexcept {
+    auto stamp = get_stamp(db_file);
+    if (_trace && stamp.has_value() && _loaded_stamp.has_value() &&
+        stamp.value() == _loaded_stamp.value()) {
+      return;
+    }
+
+    _trace.reset();
+    _loaded_stamp = stamp;
+
+    auto loaded = TraceReader::load(db_file);
+    if (!loaded) return;
+
+    _trace = make_unique<IRBuffer>();
+    loaded->sendTo(*_trace);
+
+    LOG(phase) << "Loaded a trace with " << _trace->size() << " steps into the build server";
+  }
+
+  /// Receive a request from a client. Returns false if the request could not be read.
+  static bool receive_request(int sock,
+                              int streams[StreamCount],
+                              string& cwd,
+                              vector<string>& args,
+                              vector<string>& env) noexcept {
+    uint64_t length;
+    struct iovec iov = {&length, sizeof(length)};
+    char control[CMSG_SPACE(sizeof(int) * StreamCount)] = {};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (::recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != sizeof(length)) return false;
+
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == nullptr || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(int) * StreamCount)) {
+      return false;
+    }
+    memcpy(streams, CMSG_DATA(cmsg), sizeof(int) * StreamCount);
+
+    string request(length, '\0');
+    if (!read_all(sock, request.data(), length)) return false;
+
+    // Split the request into strings
+    vector<string> parts;
+    for (size_t start = 0; start < request.size();) {
+      auto end = request.find('\0', start);
+      if (end == string::npos) return false;
+      parts.emplace_back(request, start, end - start);
+      start = end + 1;
+    }
+
+    if (parts.size() < 2) return false;
+    cwd = parts[0];
+    size_t argc = std::strtoul(parts[1].c_str(), nullptr, 10);
+    if (parts.size() < 2 + argc) return false;
+    args.assign(parts.begin() + 2, parts.begin() + 2 + argc);
+    env.assign(parts.begin() + 2 + argc, parts.end());
+    return true;
+  }
+
+  /// Run a build in a child process with the client's streams, directory and environment
+  [[noreturn]] static void run_build(int streams[StreamCount],
+                                     const string& cwd,
+                                     vector<string>& args,
+                                     const vector<string>& env) noexcept {
+    _in_server_build = true;
+    ::signal(SIGINT, SIG_DFL);
+    ::signal(SIGTERM, SIG_DFL);
+
+    for (size_t i = 0; i < StreamCount; i++) {
+      ::dup2(streams[i], i);
+      ::close(streams[i]);
+    }
+
+    if (::chdir(cwd.c_str()) != 0) {
+      WARN << "Failed to change to directory " << cwd << ": " << ERR;
+      ::_exit(1);
+    }
+
+    ::clearenv();
+    for (const auto& var : env) {
+      ::putenv(::strdup(var.c_str()));
+    }
+
+    vector<char*> argv;
+    for (auto& arg : args) argv.push_back(arg.data());
+    argv.push_back(nullptr);
+
+    int status = rkr_main(args.size(), argv.data());
+    std::cout.flush();
+    std::exit(status);
+  }
+
+  /// Wait for a build to finish. Interrupt it if the client goes away. Returns its exit status.
+  static int32_t wait_for_build(pid_t child, int sock) noexcept {
+    bool interrupted = false;
+    while (true) {
+      int status;
+      pid_t rc = ::waitpid(child, &status, WNOHANG);
+      if (rc == child) {
+        if (WIFEXITED(status)) return WEXITSTATUS(status);
+        return 128 + WTERMSIG(status);
+      }
+      if (rc == -1 && errno != EINTR) return 1;
+
+      // The client never sends anything after its request, so any event means it has gone away
+      struct pollfd pfd = {sock, POLLIN | POLLRDHUP, 0};
+      if (::poll(&pfd, 1, PollIntervalMS) > 0 && pfd.revents != 0 && !interrupted) {
+        LOG(phase) << "Client disconnected; interrupting build";
+        ::kill(child, SIGINT);
+        interrupted = true;
+      }
+    }
+  }
+
+  /// Stop the server after the current build
+  static void on_signal(int) noexcept {
+    _stop = 1;
+  }
+}
+
+using namespace server;
+
+/**
+ * Run the `server` subcommand
+ */
+void do_server(fs::path dbDir) noexcept {
+  fs::create_directories(dbDir);
+  auto path = socket_path(dbDir);
+
+  // Only one server can run for a database
+  int existing = connect_to(dbDir);
+  if (existing != -1) {
+    ::close(existing);
+    FAIL << "A build server is already running for " << dbDir;
+  }
+
+  struct sockaddr_un addr;
+  FAIL_IF(!make_address(path, addr)) << "The build server socket path " << path << " is too long";
+
+  ::unlink(path.c_str());
+  int listen_sock = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  FAIL_IF(listen_sock == -1) << "Failed to create the build server socket: " << ERR;
+  FAIL_IF(::bind(listen_sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0)
+      << "Failed to bind the build server socket " << path << ": " << ERR;
+  FAIL_IF(::listen(listen_sock, 16) != 0) << "Failed to listen on " << path << ": " << ERR;
+
+  struct sigaction sa = {};
+  sa.sa_handler = on_signal;
+  ::sigaction(SIGINT, &sa, nullptr);
+  ::sigaction(SIGTERM, &sa, nullptr);
+
+  auto db_file = dbDir / "db";
+  refresh(db_file);
+
+  LOG(phase) << "Build server listening on " << path;
+
+  // Builds run one at a time, because they share the database and the project's files
+  while (!_stop) {
+    int sock = ::accept4(listen_sock, nullptr, nullptr, SOCK_CLOEXEC);
+    if (sock == -1) {
+      if (errno == EINTR) continue;
+      FAIL << "Failed to accept a connection to the build server: " << ERR;
+    }
+
+    int streams[StreamCount] = {-1, -1, -1};
+    string cwd;
+    vector<string> args;
+    vector<string> env;
+    if (!receive_request(sock, streams, cwd, args, env)) {
+      WARN << "Received an invalid request from a build client";
+      for (auto fd : streams) {
+        if (fd != -1) ::close(fd);
+      }
+      ::close(sock);
+      continue;
+    }
+
+    // Make sure the trace matches the database. It could have been changed by another tool.
+    refresh(db_file);
+
+    pid_t child = ::fork();
+    FAIL_IF(child == -1) << "Failed to start a build: " << ERR;
+    if (child == 0) {
+      ::close(listen_sock);
+      ::close(sock);
+      run_build(streams, cwd, args, env);
+    }
+
+    for (auto fd : streams) ::close(fd);
+
+    int32_t status = wait_for_build(child, sock);
+    send_all(sock, &status, sizeof(status));
+    ::close(sock);
+
+    // Decode the trace the build just saved, before the next request arrives
+    refresh(db_file);
+  }
+
+  ::close(listen_sock);
+  ::unlink(path.c_str());
+}
@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <string>
@@ -9,9 +11,12 @@
 #include "data/Trace.hh"
 #include "runtime/Build.hh"
 #include "runtime/env.hh"
+#include "runtime/profile.hh"
 #include "ui/commands.hh"
 #include "util/Graph.hh"
 #include "util/TracePrinter.hh"
+#include "util/cache.hh"
+#include "util/constants.hh"
 #include "util/stats.hh"
 
 using std::cout;
@@ -26,8 +31,16 @@ namespace fs = std::filesystem;
 /**
  * Run the `stats` subcommand
  * \param list_artifacts  Should the output include a list of artifacts and versions?
+ * \param cache_stats     Should the output include statistics for the build cache?
+ * \param timer_stats     Should the output include the time spent in each part of the last build?
+ * \param command_stats   Should the output include a table of what each command cost?
  */
-void do_stats(vector<string> args, bool list_artifacts, fs::path dbDir) noexcept {
+void do_stats(vector<string> args,
+              bool list_artifacts,
+              bool cache_stats,
+              bool timer_stats,
+              bool command_stats,
+              fs::path dbDir) noexcept {
   // Turn on input/output tracking
   options::track_inputs_outputs = true;
 
@@ -49,6 +62,67 @@ void do_stats(vector<string> args, bool list_artifacts, fs::path dbDir) noexcept
   cout << "  Artifacts: " << stats::artifacts << endl;
   cout << "  Artifact Versions: " << stats::versions << endl;
 
+  if (cache_stats) {
+    constants::CacheDir = options::cache_dir.value_or(dbDir / "cache");
+    auto summary = cache::summarize();
+    auto lookups = summary.hits + summary.misses;
+
+    cout << endl;
+    cout << "Cache Statistics:" << endl;
+    cout << "  Files: " << summary.entries << endl;
+    cout << "  Size: " << summary.bytes << " bytes" << endl;
+    if (options::cache_size_limit > 0) {
+      cout << "  Size Limit: " << options::cache_size_limit << " bytes" << endl;
+    }
+    cout << "  Hits: " << summary.hits << endl;
+    cout << "  Misses: " << summary.misses << endl;
+    cout << "  Hit Rate: " << std::fixed << std::setprecision(1)
+         << (lookups > 0 ? 100.0 * summary.hits / lookups : 0.0) << "%" << endl;
+    cout << "  Bytes Saved: " << summary.bytes_saved << endl;
+    cout << "  Bytes Evicted: " << summary.bytes_evicted << endl;
+  }
+
+  if (timer_stats) {
+    cout << endl;
+    cout << "Build Timers:" << endl;
+    if (auto timers = stats::load_timers(dbDir / "timers"); timers) {
+      uint64_t total = 0;
+      for (auto ns : timers.value()) total += ns;
+
+      for (size_t i = 0; i < stats::TimerCount; i++) {
+        auto ns = timers.value()[i];
+        cout << "  " << stats::timer_label(i) << ": " << std::fixed << std::setprecision(3)
+             << ns / 1e6 << " ms (" << std::setprecision(1)
+             << (total > 0 ? 100.0 * ns / total : 0.0) << "%)" << endl;
+      }
+    } else {
+      cout << "  No timers were saved. Run a build first." << endl;
+    }
+  }
+
+  if (command_stats) {
+    // Rank commands by wall time, then by the time spent tracing them
+    auto entries = profile::load(dbDir / "profile");
+    std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) {
+      if (a.counters.wall_ns != b.counters.wall_ns) return a.counters.wall_ns > b.counters.wall_ns;
+      return a.counters.tracer_ns > b.counters.tracer_ns;
+    });
+
+    cout << endl;
+    cout << "Command Costs:" << endl;
+    cout << std::right << std::setw(12) << "Wall ms" << std::setw(12) << "Tracer ms"
+         << std::setw(10) << "Ptrace" << std::setw(10) << "Channel" << std::setw(14) << "Read B"
+         << std::setw(14) << "Written B" << std::setw(12) << "Predicates"
+         << "  Command" << endl;
+
+    for (const auto& [p, name] : entries) {
+      cout << std::fixed << std::setprecision(3) << std::setw(12) << p.wall_ns / 1e6
+           << std::setw(12) << p.tracer_ns / 1e6 << std::setw(10) << p.ptrace_stops
+           << std::setw(10) << p.channel_events << std::setw(14) << p.bytes_read << std::setw(14)
+           << p.bytes_written << std::setw(12) << p.predicates << "  " << name << endl;
+    }
+  }
+
   if (list_artifacts) {
     cout << endl;
     cout << "Artifacts:" << endl;
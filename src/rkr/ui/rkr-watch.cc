@@ -0,0 +1,221 @@
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "runtime/journal.hh"
+#include "ui/commands.hh"
+#include "util/log.hh"
+
+namespace fs = std::filesystem;
+
+using std::string;
+using std::unordered_map;
+
+/// The journal is restarted once it grows past this size, so builds don't read a huge file
+enum : size_t { MaxJournalSize = 64 << 20 };
+
+/// The events that mean a path, or the directory entry for it, has changed
+static const uint32_t WatchEvents = IN_ATTRIB | IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE | IN_DELETE |
+                                    IN_DELETE_SELF | IN_MOVED_FROM | IN_MOVED_TO | IN_MOVE_SELF |
+                                    IN_DONT_FOLLOW | IN_ONLYDIR;
+
+/// Set by the signal handler when the watcher should exit
+static volatile sig_atomic_t _stop = 0;
+
+/// The watcher state
+struct Watcher {
+  /// The project root being watched
+  fs::path root;
+
+  /// The database directory, which is not watched
+  fs::path db_dir;
+
+  /// The inotify file descriptor
+  int inotify_fd;
+
+  /// The journal file descriptor
+  int journal_fd = -1;
+
+  /// The number of bytes written to the journal
+  size_t journal_size = 0;
+
+  /// Changed paths waiting to be written to the journal
+  string pending;
+
+  /// The directory watched by each watch descriptor
+  unordered_map<int, fs::path> dirs;
+
+  /// Start a new journal session. Builds will not reuse stat results from an earlier session.
+  void restart() noexcept {
+    if (journal_fd != -1) ::close(journal_fd);
+    pending.clear();
+
+    std::random_device rd;
+    uint64_t session = (uint64_t(rd()) << 32) | rd();
+
+    auto path = journal::journal_path(db_dir);
+    auto tmp = path;
+    tmp += ".tmp";
+
+    journal_fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    FAIL_IF(journal_fd == -1) << "Failed to create the change journal " << tmp << ": " << ERR;
+
+    string header = journal::Header + " " + std::to_string(journal::Version) + " " +
+                    std::to_string(::getpid()) + " " + std::to_string(session) + " " +
+                    root.string() + "\n";
+    FAIL_IF(::write(journal_fd, header.data(), header.size()) != (ssize_t)header.size())
+        << "Failed to write the change journal " << tmp << ": " << ERR;
+    journal_size = header.size();
+
+    FAIL_IF(::rename(tmp.c_str(), path.c_str()) != 0)
+        << "Failed to create the change journal " << path << ": " << ERR;
+
+    LOG(phase) << "Started change journal session " << session;
+  }
+
+  /// Record a changed path. If subtree is set, everything under the path may have changed too.
+  void changed(const fs::path& path, bool subtree = false) noexcept {
+    pending += path.string();
+    if (subtree) pending += '/';
+    pending += '\n';
+  }
+
+  /// Write pending paths to the journal
+  void flush() noexcept {
+    if (pending.empty()) return;
+
+    // Each write is a single append, so a build never sees a partial batch unless a line is split
+    // across two writes. Builds ignore an incomplete last line.
+    size_t written = 0;
+    while (written < pending.size()) {
+      ssize_t n = ::write(journal_fd, pending.data() + written, pending.size() - written);
+      if (n == -1 && errno == EINTR) continue;
+      FAIL_IF(n <= 0) << "Failed to write the change journal: " << ERR;
+      written += n;
+    }
+    journal_size += pending.size();
+    pending.clear();
+
+    if (journal_size > MaxJournalSize) restart();
+  }
+
+  /// Watch a directory and every directory under it
+  void watch(const fs::path& dir) noexcept {
+    if (dir == db_dir) return;
+
+    int wd = ::inotify_add_watch(inotify_fd, dir.c_str(), WatchEvents);
+    if (wd == -1) {
+      if (errno == ENOSPC) {
+        FAIL << "Out of inotify watches. Raise fs.inotify.max_user_watches to watch this project.";
+      }
+      // The directory may have been removed already, or it is not a directory
+      return;
+    }
+    dirs[wd] = dir;
+
+    std::error_code ec;
+    for (auto iter = fs::directory_iterator(dir, ec); !ec && iter != fs::directory_iterator();
+         iter.increment(ec)) {
+      if (iter->is_directory(ec) && !iter->is_symlink(ec)) watch(iter->path());
+    }
+  }
+
+  /// Handle one inotify event
+  void handle(const struct inotify_event* event) noexcept {
+    // Lost events mean the journal is incomplete, so start over
+    if (event->mask & IN_Q_OVERFLOW) {
+      LOG(phase) << "Change notifications overflowed";
+      restart();
+      return;
+    }
+
+    auto iter = dirs.find(event->wd);
+    if (iter == dirs.end()) return;
+    auto dir = iter->second;
+
+    if (event->mask & IN_IGNORED) {
+      dirs.erase(iter);
+      return;
+    }
+
+    auto path = event->len > 0 ? dir / event->name : dir;
+    changed(path);
+
+    // Adding or removing an entry also changes the directory that holds it
+    if (event->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)) changed(dir);
+
+    // A directory moved out of or within the tree leaves watches that report the wrong paths
+    if ((event->mask & IN_ISDIR) && (event->mask & IN_MOVED_FROM)) {
+      for (auto& [wd, _] : dirs) ::inotify_rm_watch(inotify_fd, wd);
+      dirs.clear();
+      watch(root);
+      restart();
+      return;
+    }
+
+    // Watch new directories. Anything in them may have been created before the watch was added.
+    if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+      changed(path, true);
+      watch(path);
+    }
+  }
+};
+
+/// Stop watching, so the journal can be removed before the watcher exits
+static void on_signal(int) noexcept {
+  _stop = 1;
+}
+
+/**
+ * Run the `watch` subcommand
+ */
+void do_watch(fs::path dbDir) noexcept {
+  fs::create_directories(dbDir);
+
+  Watcher w;
+  w.root = fs::current_path();
+  w.db_dir = fs::absolute(dbDir).lexically_normal();
+  if (w.db_dir.filename().empty()) w.db_dir = w.db_dir.parent_path();
+
+  w.inotify_fd = ::inotify_init1(IN_CLOEXEC);
+  FAIL_IF(w.inotify_fd == -1) << "Failed to start inotify: " << ERR;
+
+  struct sigaction sa = {};
+  sa.sa_handler = on_signal;
+  ::sigaction(SIGINT, &sa, nullptr);
+  ::sigaction(SIGTERM, &sa, nullptr);
+
+  // Add watches before starting the journal, so no change after the header is missed
+  w.watch(w.root);
+  w.restart();
+
+  LOG(phase) << "Watching " << w.dirs.size() << " directories under " << w.root;
+
+  alignas(struct inotify_event) char buf[64 * (sizeof(struct inotify_event) + NAME_MAX + 1)];
+  while (!_stop) {
+    ssize_t n = ::read(w.inotify_fd, buf, sizeof(buf));
+    if (n == -1 && errno == EINTR) continue;
+    FAIL_IF(n <= 0) << "Failed to read change notifications: " << ERR;
+
+    for (char* p = buf; p < buf + n;) {
+      auto event = reinterpret_cast<struct inotify_event*>(p);
+      w.handle(event);
+      p += sizeof(struct inotify_event) + event->len;
+    }
+
+    w.flush();
+  }
+
+  ::unlink(journal::journal_path(w.db_dir).c_str());
+}
@@ -14,6 +14,8 @@
 #include <CLI/CLI.hpp>
 
 #include "ui/commands.hh"
+#include "ui/server.hh"
+#include "util/cache.hh"
 #include "util/log.hh"
 #include "util/options.hh"
 
@@ -33,9 +35,10 @@ static bool stderr_supports_colors() noexcept {
 }
 
 /**
- * This is the entry point for the rkr command line tool
+ * Parse a command line and run the selected subcommand. The build server also calls this to run
+ * each build it receives.
  */
-int main(int argc, char* argv[]) noexcept {
+int rkr_main(int argc, char* argv[]) noexcept {
   // Set color output based on TERM setting (can be overridden with command line option)
   if (!stderr_supports_colors()) options::disable_color = true;
 
@@ -109,6 +112,40 @@ int main(int argc, char* argv[]) noexcept {
       ->description("Disable the build cache")
       ->group("Optimizations");
 
+  app.add_flag_callback("--no-prefetch", [] { options::prefetch_stats = false; })
+      ->description("Do not stat the paths the last build used ahead of time")
+      ->group("Optimizations");
+
+  app.add_flag_callback("--no-async-cache", [] { options::async_cache = false; })
+      ->description("Copy files into the build cache before continuing the build")
+      ->group("Optimizations");
+
+  app.add_option("--cache-storage", options::cache_storage,
+                 "Set how files are stored in the build cache (default=auto)")
+      ->type_name("MODE")
+      ->transform(
+          CLI::CheckedTransformer(map<string, CacheStorage>{{"auto", CacheStorage::Auto},
+                                                            {"hardlink", CacheStorage::Hardlink},
+                                                            {"copy", CacheStorage::Copy}},
+                                  CLI::ignore_case)
+              .description("{auto, hardlink, copy}"))
+      ->group("Optimizations");
+
+  app.add_flag("--cache-chunks", options::cache_chunks,
+               "Store large files in the build cache as chunks shared between similar files")
+      ->group("Optimizations");
+
+  app.add_option_function<string>(
+         "--cache-size",
+         [](string size) {
+           auto limit = cache::parse_size(size);
+           if (!limit.has_value()) throw CLI::ValidationError("--cache-size", "Invalid size");
+           options::cache_size_limit = limit.value();
+         },
+         "Limit the size of the build cache, evicting least-recently used files (e.g. 10G)")
+      ->type_name("SIZE")
+      ->group("Optimizations");
+
   // [pash]
   app.add_flag_callback("--frontier", [] { options::frontier = true; })
       ->description("Frontier")
@@ -120,6 +157,15 @@ int main(int argc, char* argv[]) noexcept {
       "Path to put the riker db and other temp files")
       ->type_name("FILE");
 
+  app.add_option("--cache-dir", options::cache_dir,
+                 "Directory for the build cache, which may be shared by several workspaces")
+      ->type_name("DIR");
+
+  app.add_option("--cache-server", options::cache_server,
+                 "Fetch and upload cached files with a cache server (unix:PATH or HOST:PORT)")
+      ->type_name("ADDR")
+      ->group("Optimizations");
+
   app.add_option("--rikerfile", options::rikerfile,
       "rikerfile to run")
       ->type_name("FILE");
@@ -142,6 +188,20 @@ int main(int argc, char* argv[]) noexcept {
 
   build->add_flag("--syscall-stats", options::syscall_stats, "Collect system call statistics");
 
+  build
+      ->add_option("--timeline", options::timeline,
+                   "Write a Chrome trace-event timeline of the build to this file")
+      ->type_name("FILE");
+
+  build->add_flag("--replay-post-build", options::replay_post_build,
+                  "Emulate the final trace again to compute post-build checks");
+
+  build
+      ->add_option("--events", options::events,
+                   "Stream each command's reads, writes, and execs as JSON lines to this file, "
+                   "FIFO, or Unix socket while the build runs")
+      ->type_name("FILE");
+
   // Flags to turn the parallel compiler wrapper on/off
   build
       ->add_flag_callback(
@@ -168,7 +228,11 @@ int main(int argc, char* argv[]) noexcept {
                     "Output file where commands should be printed (default: -)");
 
   /************* Check Subcommand *************/
+  bool full_check = false;
+
   auto check = app.add_subcommand("check", "Check which commands must be rerun");
+  check->add_flag("--full", full_check,
+                  "Emulate the whole build trace instead of checking the saved build summary");
 
   /************* Trace Subcommand *************/
   string trace_output = "-";
@@ -180,20 +244,43 @@ int main(int argc, char* argv[]) noexcept {
   // Leave output file and type empty for later default processing
   string graph_output;
   string graph_type;
-  bool show_all = false;
+  Graph::Filter graph_filter;
   bool no_render = false;
 
   auto graph = app.add_subcommand("graph", "Generate a build graph");
   graph->add_option("-o,--output", graph_output, "Output file for the graph");
-  graph->add_option("-t,--type", graph_type, "Output format for the graph (png, pdf, jpg, etc.)");
+  graph->add_option("-t,--type", graph_type,
+                    "Output format for the graph (png, pdf, jpg, etc.), or json for an edge list");
   graph->add_flag("-n,--no-render", no_render, "Generate graphiz source instead of rendering");
-  graph->add_flag("-a,--all", show_all, "Include all files in the graph");
+  graph->add_flag("-a,--all", graph_filter.show_all, "Include all files in the graph");
+  graph->add_flag("--collapse-system", graph_filter.collapse_system,
+                  "Show system files as one node for each top-level directory");
+  graph->add_option("-p,--path", graph_filter.paths, "Only include files that match a glob pattern")
+      ->type_name("GLOB");
+  graph->add_option("-c,--command", graph_filter.commands,
+                    "Only include commands that match a glob pattern, and their descendants")
+      ->type_name("GLOB");
+  graph->add_option("-d,--depth", graph_filter.depth,
+                    "Only include commands up to this many levels below the top of the graph")
+      ->type_name("N");
 
   /************* Stats Subcommand *************/
   bool list_artifacts = false;
 
   auto stats = app.add_subcommand("stats", "Print build statistics");
   stats->add_flag("-a,--artifacts", list_artifacts, "Print a list of artifacts and their versions");
+  bool cache_stats = false;
+  stats->add_flag("-c,--cache", cache_stats, "Print statistics for the build cache");
+  bool timer_stats = false;
+  stats->add_flag("-t,--timers", timer_stats, "Print the time the last build spent in each part");
+  bool command_stats = false;
+  stats->add_flag("--commands", command_stats, "Print what each command cost in the last build");
+
+  /************* Watch Subcommand *************/
+  auto watch = app.add_subcommand("watch", "Record changed files so builds can skip unchanged paths");
+
+  /************* Server Subcommand *************/
+  auto serve = app.add_subcommand("server", "Keep the latest build trace in memory and run builds");
 
   /************* Rikerfile Arguments ***********/
   vector<string> args;
@@ -206,17 +293,23 @@ int main(int argc, char* argv[]) noexcept {
   // every argument in std::ref to pass values by reference.
 
   // build subcommand
-  build->final_callback([&] { do_build(args, stats_log, command_output, db_dir); });
+  build->final_callback([&] {
+    if (!server::forward(argc, argv, db_dir)) do_build(args, stats_log, command_output, db_dir);
+  });
   // audit subcommand
   audit->final_callback([&] { do_audit(args, command_output); });
   // check subcommand
-  check->final_callback([&] { do_check(args, db_dir); });
+  check->final_callback([&] { do_check(args, full_check, db_dir); });
   // trace subcommand
   trace->final_callback([&] { do_trace(args, trace_output, db_dir); });
   // graph subcommand
-  graph->final_callback([&] { do_graph(args, graph_output, graph_type, show_all, no_render, db_dir); });
+  graph->final_callback([&] { do_graph(args, graph_output, graph_type, graph_filter, no_render, db_dir); });
   // stats subcommand
-  stats->final_callback([&] { do_stats(args, list_artifacts, db_dir); });
+  stats->final_callback([&] { do_stats(args, list_artifacts, cache_stats, timer_stats, command_stats, db_dir); });
+  // watch subcommand
+  watch->final_callback([&] { do_watch(db_dir); });
+  // server subcommand
+  serve->final_callback([&] { do_server(db_dir); });
 
   /************* Argument Parsing *************/
 
@@ -254,5 +347,6 @@ int main(int argc, char* argv[]) noexcept {
     }
   }
 
-  return 0;
+  // A build run by the build server exits with the server's status
+  return server::forwarded_status();
 }
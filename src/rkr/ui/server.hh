@@ -0,0 +1,54 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+
+class IRBuffer;
+
+namespace fs = std::filesystem;
+
+/**
+ * The server namespace lets `rkr build` run inside a long-lived build server (`rkr server`). The
+ * server keeps the steps from the latest build's trace decoded in memory, so a build it runs skips
+ * reading and decoding the database. That is all it saves. Every build runs in a new process
+ * forked from the server, and that process emulates every buffered step again, which rebuilds the
+ * whole model of commands and artifacts from scratch. Emulation changes the decoded commands and
+ * versions, and the fork keeps those changes out of the server's copy. After each build the
+ * server decodes the new trace, ready for the next request.
+ *
+ * The reload benchmark in src/bench/bench.cc compares the two parts. Decoding is about 5% of the
+ * time spent decoding and emulating its synthetic trace, so the server only saves that share.
+ *
+ * The filesystem model is not kept between builds. It has to be checked against the filesystem
+ * in any case. The change journal (see journal.hh) can keep most of those checks cheap.
+ *
+ * When a server is listening on the database directory's socket, `rkr build` sends its working
+ * directory, arguments, environment, and standard streams to the server. It then waits for the
+ * build's exit status. If no server is running, the build runs in the current process as usual.
+ */
+namespace server {
+  /// Get the path to the build server's socket in a database directory
+  inline fs::path socket_path(fs::path db_dir) noexcept {
+    return db_dir / "server.sock";
+  }
+
+  /**
+   * Try to run a build in a build server
+   * \param argc   The number of arguments passed to rkr
+   * \param argv   The arguments passed to rkr
+   * \param db_dir The database directory
+   * \returns true if a server ran the build, and false if the build should run in this process
+   */
+  bool forward(int argc, char* argv[], fs::path db_dir) noexcept;
+
+  /**
+   * Get the trace the build server decoded for this build. Returns nullptr if this process was not
+   * started by a build server, or the server had no trace to decode.
+   */
+  std::unique_ptr<IRBuffer> take_trace() noexcept;
+
+  /**
+   * Get the exit status forwarded from a build server, or zero if no build was forwarded
+   */
+  int forwarded_status() noexcept;
+}
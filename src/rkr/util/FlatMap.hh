@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+/**
+ * A hash map that keeps its entries in a dense vector and finds them with an open-addressing
+ * (linear probing) index. Iteration visits entries in insertion order until an entry is erased;
+ * erasing moves the last entry into the erased entry's place.
+ *
+ * Inserting an entry may invalidate iterators and references to other entries.
+ */
+template <class K, class V, class Hash = std::hash<K>>
+class FlatMap {
+ public:
+  using value_type = std::pair<K, V>;
+  using iterator = typename std::vector<value_type>::iterator;
+  using const_iterator = typename std::vector<value_type>::const_iterator;
+
+  iterator begin() noexcept { return _entries.begin(); }
+  iterator end() noexcept { return _entries.end(); }
+  const_iterator begin() const noexcept { return _entries.begin(); }
+  const_iterator end() const noexcept { return _entries.end(); }
+
+  /// Get the number of entries in this map
+  size_t size() const noexcept { return _entries.size(); }
+
+  /// Check if this map is empty
+  bool empty() const noexcept { return _entries.empty(); }
+
+  /// Look up an entry by key. Returns end() if there is no such entry
+  iterator find(const K& key) noexcept {
+    if (_slots.empty()) return end();
+
+    for (size_t s = home(key);; s = (s + 1) & mask()) {
+      auto slot = _slots[s];
+      if (slot == 0) return end();
+      if (_entries[slot - 1].first == key) return begin() + (slot - 1);
+    }
+  }
+
+  /// Look up an entry by key. Returns end() if there is no such entry
+  const_iterator find(const K& key) const noexcept {
+    return const_cast<FlatMap*>(this)->find(key);
+  }
+
+  /// Insert an entry constructed from args if the key is not already present. Returns an iterator
+  /// to the entry with the key, and true if a new entry was inserted.
+  template <typename... Args>
+  std::pair<iterator, bool> try_emplace(const K& key, Args&&... args) noexcept {
+    // Keep the index at most half full
+    if ((_entries.size() + 1) * 2 > _slots.size()) grow();
+
+    size_t s = home(key);
+    for (;; s = (s + 1) & mask()) {
+      auto slot = _slots[s];
+      if (slot == 0) break;
+      if (_entries[slot - 1].first == key) return {begin() + (slot - 1), false};
+    }
+
+    _entries.emplace_back(std::piecewise_construct, std::forward_as_tuple(key),
+                          std::forward_as_tuple(std::forward<Args>(args)...));
+    _slots[s] = _entries.size();
+    return {end() - 1, true};
+  }
+
+  /// Get the value for a key, inserting a default-constructed value if there is none
+  V& operator[](const K& key) noexcept { return try_emplace(key).first->second; }
+
+  /// Erase an entry. Returns an iterator to the entry that took its place, which may be end()
+  iterator erase(iterator pos) noexcept {
+    size_t index = pos - begin();
+
+    // Remove the erased entry from the index, shifting back any entries that probed past it
+    size_t i = slotOf(index);
+    for (size_t j = (i + 1) & mask(); _slots[j] != 0; j = (j + 1) & mask()) {
+      size_t h = home(_entries[_slots[j] - 1].first);
+      bool movable = (i <= j) ? (h <= i || h > j) : (h <= i && h > j);
+      if (movable) {
+        _slots[i] = _slots[j];
+        i = j;
+      }
+    }
+    _slots[i] = 0;
+
+    // Move the last entry into the erased entry's place
+    size_t last = _entries.size() - 1;
+    if (index != last) {
+      _slots[slotOf(last)] = index + 1;
+      _entries[index] = std::move(_entries[last]);
+    }
+    _entries.pop_back();
+
+    return begin() + index;
+  }
+
+  /// Erase an entry by key. Returns the number of entries erased
+  size_t erase(const K& key) noexcept {
+    auto iter = find(key);
+    if (iter == end()) return 0;
+    erase(iter);
+    return 1;
+  }
+
+  /// Remove every entry that satisfies a predicate
+  template <class Pred>
+  void erase_if(Pred pred) noexcept {
+    for (auto iter = begin(); iter != end();) {
+      if (pred(*iter)) {
+        iter = erase(iter);
+      } else {
+        ++iter;
+      }
+    }
+  }
+
+ private:
+  /// Get the mask used to wrap slot positions
+  size_t mask() const noexcept { return _slots.size() - 1; }
+
+  /// Get the preferred slot for a key. The hash is mixed so sequential keys spread out
+  size_t home(const K& key) const noexcept {
+    uint64_t h = Hash()(key) * 0x9E3779B97F4A7C15ull;
+    return (h ^ (h >> 32)) & mask();
+  }
+
+  /// Find the slot that refers to the entry at a given index
+  size_t slotOf(size_t index) const noexcept {
+    size_t s = home(_entries[index].first);
+    while (_slots[s] != index + 1) s = (s + 1) & mask();
+    return s;
+  }
+
+  /// Double the size of the index and re-insert every entry
+  void grow() noexcept {
+    _slots.assign(_slots.empty() ? 8 : _slots.size() * 2, 0);
+    for (size_t index = 0; index < _entries.size(); index++) {
+      size_t s = home(_entries[index].first);
+      while (_slots[s] != 0) s = (s + 1) & mask();
+      _slots[s] = index + 1;
+    }
+  }
+
+  /// The entries in this map
+  std::vector<value_type> _entries;
+
+  /// The open-addressing index. Each slot holds an index into _entries plus one, or zero if empty
+  std::vector<uint32_t> _slots;
+};
@@ -1,10 +1,17 @@
 #include "Graph.hh"
 
+#include <cstdio>
 #include <filesystem>
-#include <list>
+#include <iterator>
+#include <map>
 #include <memory>
+#include <optional>
 #include <ostream>
 #include <string>
+#include <utility>
+#include <vector>
+
+#include <fnmatch.h>
 
 #include "artifacts/Artifact.hh"
 #include "runtime/Command.hh"
@@ -12,15 +19,23 @@
 #include "versions/DirVersion.hh"
 #include "versions/MetadataVersion.hh"
 
+using std::map;
+using std::nullopt;
+using std::optional;
 using std::ostream;
+using std::pair;
 using std::shared_ptr;
 using std::string;
 using std::to_string;
+using std::vector;
 
 namespace fs = std::filesystem;
 
+/// Flags that record which directions an input/output edge runs in
+enum : int { InputEdge = 1, OutputEdge = 2 };
+
 /// Escape a string for safe printing inside a graphviz string
-string escape(string s) noexcept {
+static string escape(string s) noexcept {
   auto pos = s.find('"');
   if (pos == string::npos)
     return s;
@@ -28,173 +43,298 @@ string escape(string s) noexcept {
     return s.substr(0, pos) + "\\\"" + escape(s.substr(pos + 1));
 }
 
-string Graph::addCommand(shared_ptr<Command> c) noexcept {
-  // Look to see if we already have a record of this command. Return if we do.
-  auto iter = _command_ids.find(c);
-  if (iter != _command_ids.end()) return iter->second;
-
-  // Create an ID for this command and save it
-  string command_id = "c" + to_string(_command_ids.size());
-  _command_ids.emplace_hint(iter, c, command_id);
-
-  // Add this command's children
-  for (auto& child : c->getChildren()) {
-    auto child_id = addCommand(child);
-    _command_edges.emplace(command_id, child_id);
+/// Escape a string for safe printing inside a graphviz HTML label
+static string escape_html(const string& s) noexcept {
+  string result;
+  for (char c : s) {
+    if (c == '&') {
+      result += "&amp;";
+    } else if (c == '<') {
+      result += "&lt;";
+    } else if (c == '>') {
+      result += "&gt;";
+    } else {
+      result += c;
+    }
   }
+  return result;
+}
 
-  // Add this command's inputs
-  for (const auto& [a, v, weak_creator] : c->getInputs()) {
-    auto creator = weak_creator.lock();
-
-    // If we're not showing all artifacts and versions, we may skip this one
-    if (!_show_all) {
-      // Does the version have a creator? If not, we may skip it
-      if (!creator) {
-        // If the artifact name is an absolute path, skip it
-        if (fs::path(a->getName()).is_absolute()) continue;
-
-        // If the version is a base directory version, we can skip it
-        // if (v->is_a<DirVersion>()) continue;
-
-        // If the version is a MetadataVersion, skip it
-        if (v->is_a<MetadataVersion>()) continue;
-      }
+/// Escape a string and quote it as a JSON string
+static string quote_json(const string& s) noexcept {
+  string result = "\"";
+  for (unsigned char c : s) {
+    if (c == '"' || c == '\\') {
+      result += '\\';
+      result += c;
+    } else if (c < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      result += buf;
+    } else {
+      result += c;
     }
+  }
+  return result + "\"";
+}
 
-    // Add the artifact and version
-    auto artifact_id = addArtifact(a);
-    auto version_id = addVersion(v);
+/// Does a string match any of a list of glob patterns?
+static bool matches_any(const vector<string>& patterns, const string& s) noexcept {
+  for (const auto& pattern : patterns) {
+    if (::fnmatch(pattern.c_str(), s.c_str(), 0) == 0) return true;
+  }
+  return false;
+}
 
-    // Add the input edge
-    _io_edges.emplace(artifact_id + ":" + version_id, command_id);
+/// Get the name used for a command's marking in JSON output
+static const char* marking_name(RebuildMarking m) noexcept {
+  switch (m) {
+    case RebuildMarking::Emulate:
+      return "emulate";
+    case RebuildMarking::MayRun:
+      return "may-run";
+    case RebuildMarking::MustRun:
+      return "must-run";
   }
+  return "unknown";
+}
 
-  // Add this command's outputs
-  for (const auto& [a, v] : c->getOutputs()) {
-    // Add the artifact and version
-    auto artifact_id = addArtifact(a);
-    auto version_id = addVersion(v);
+void Graph::write(const shared_ptr<Command>& root) noexcept {
+  if (_format == Format::Dot) {
+    _o << "digraph {\n";
+    _o << "  graph [rankdir=LR]\n";
+  }
 
-    // Add the output edge
-    _io_edges.emplace(command_id, artifact_id + ":" + version_id);
+  // Without command patterns, the whole build is one included subtree
+  if (_filter.commands.empty()) {
+    visit(root, nullopt, 0);
+  } else {
+    visit(root, nullopt, nullopt);
   }
 
-  // Return the new command's ID
-  return command_id;
+  if (_format == Format::Dot) _o << "}\n";
 }
 
-string Graph::addArtifact(shared_ptr<Artifact> a) noexcept {
-  // Look for the artifact. If it's already in the map, return its ID.
-  auto iter = _artifact_ids.find(a);
-  if (iter != _artifact_ids.end()) return iter->second;
+void Graph::visit(const shared_ptr<Command>& c,
+                  optional<size_t> parent_id,
+                  optional<size_t> depth) noexcept {
+  // A command outside any included subtree starts one if it matches a command pattern
+  if (!depth.has_value() && matches_any(_filter.commands, c->getFullName())) depth = 0;
 
-  // Create an ID for the artifact and save it
-  string artifact_id = "a" + to_string(_artifact_ids.size());
-  _artifact_ids.emplace_hint(iter, a, artifact_id);
+  optional<size_t> id;
+  if (depth.has_value()) {
+    // Stop at the depth limit. Nothing below this command will be included either.
+    if (_filter.depth.has_value() && depth.value() > _filter.depth.value()) return;
 
-  // Add all of this artifact's versions to the graph
-  for (auto& v : a->getVersions()) {
-    addVersion(v);
+    id = addCommand(c);
+    if (parent_id.has_value()) writeChildEdge(parent_id.value(), id.value());
   }
 
-  return artifact_id;
-}
-
-string Graph::addVersion(shared_ptr<Version> v) noexcept {
-  // Look for the version. If it's already in the map, return its ID.
-  auto iter = _version_ids.find(v);
-  if (iter != _version_ids.end()) return iter->second;
-
-  // Create an ID for the version and save it
-  string version_id = "v" + to_string(_version_ids.size());
-  _version_ids.emplace_hint(iter, v, version_id);
+  optional<size_t> child_depth;
+  if (depth.has_value()) child_depth = depth.value() + 1;
 
-  return version_id;
+  for (const auto& child : c->getChildren()) {
+    visit(child, id, child_depth);
+  }
 }
 
-ostream& operator<<(ostream& o, Graph& g) noexcept {
-  o << "digraph {\n";
-  o << "  graph [rankdir=LR]\n";
+size_t Graph::addCommand(const shared_ptr<Command>& c) noexcept {
+  size_t id = _command_count++;
 
-  // Create command vertices
-  for (const auto& [c, id] : g._command_ids) {
-    o << "  " << id << " [";
-    o << "label=\"" << escape(c->getShortName()) << "\" ";
-    o << "tooltip=\"" << escape(c->getFullName()) << "\" ";
-    o << "fontname=Courier ";
+  if (_format == Format::Dot) {
+    _o << "  c" << id << " [";
+    _o << "label=\"" << escape(c->getShortName()) << "\" ";
+    _o << "tooltip=\"" << escape(c->getFullName()) << "\" ";
+    _o << "fontname=Courier ";
 
     // Color the command based on its marking state
     if (c->getMarking() == RebuildMarking::MayRun) {
       // Commands that may run are yellow
-      o << "style=\"filled\" ";
-      o << "fillcolor=\"yellow\" ";
+      _o << "style=\"filled\" ";
+      _o << "fillcolor=\"yellow\" ";
 
     } else if (c->getMarking() == RebuildMarking::MustRun) {
       // Commands that must run are red
-      o << "style=\"filled\" ";
-      o << "fillcolor=\"red\" ";
+      _o << "style=\"filled\" ";
+      _o << "fillcolor=\"red\" ";
     }
 
-    o << "]\n";
+    _o << "]\n";
+
+  } else {
+    _o << "{\"type\":\"command\",\"id\":\"c" << id << "\",\"name\":"
+       << quote_json(c->getShortName()) << ",\"full_name\":" << quote_json(c->getFullName())
+       << ",\"marking\":\"" << marking_name(c->getMarking()) << "\"}\n";
   }
 
-  // Create command edges
-  for (const auto& [parent, child] : g._command_edges) {
-    o << "  " << parent << " -> " << child << " [style=dotted weight=1]\n";
+  // A command may read or write the same version many times, but each version only gets one
+  // edge. An artifact version that is both read and written gets a single bidirectional edge.
+  map<pair<size_t, optional<size_t>>, int> edges;
+
+  // Add this command's inputs
+  for (const auto& [a, v, weak_creator] : c->getInputs()) {
+    auto creator = weak_creator.lock();
+    auto name = a->getName();
+
+    if (!_filter.paths.empty() && !matches_any(_filter.paths, name)) continue;
+
+    // Inputs that no command created may be skipped or collapsed
+    if (!creator) {
+      // Is this a system file? If so, collapse it or skip it
+      auto path = fs::path(name);
+      if (path.is_absolute()) {
+        if (_filter.collapse_system) {
+          // The first element of an absolute path is the root, and the second is the directory
+          auto dir = std::next(path.begin());
+          auto dir_name = "/" + (dir == path.end() ? string() : dir->string());
+          edges[{addSystemDir(dir_name), nullopt}] |= InputEdge;
+          continue;
+        }
+        if (!_filter.show_all) continue;
+      }
+
+      // If the version is a MetadataVersion, skip it
+      if (!_filter.show_all && v->is_a<MetadataVersion>()) continue;
+    }
+
+    auto artifact_id = addArtifact(a);
+    edges[{artifact_id, getPort(v)}] |= InputEdge;
+  }
+
+  // Add this command's outputs
+  for (const auto& [a, v] : c->getOutputs()) {
+    if (!_filter.paths.empty() && !matches_any(_filter.paths, a->getName())) continue;
+
+    auto artifact_id = addArtifact(a);
+    edges[{artifact_id, getPort(v)}] |= OutputEdge;
+  }
+
+  for (const auto& [endpoint, directions] : edges) {
+    const auto& [artifact_id, port] = endpoint;
+    writeIOEdge(id, artifact_id, port, directions);
+  }
+
+  return id;
+}
+
+size_t Graph::addArtifact(const shared_ptr<Artifact>& a) noexcept {
+  // Look for the artifact. If it has already been written, return its ID.
+  auto iter = _artifact_ids.find(a.get());
+  if (iter != _artifact_ids.end()) return iter->second;
+
+  // Create an ID for the artifact and save it
+  size_t id = _artifact_count++;
+  _artifact_ids.emplace_hint(iter, a.get(), id);
+
+  // Each version gets a port in the artifact's vertex
+  size_t port = 0;
+  for (const auto& v : a->getVersions()) {
+    _version_ports.emplace(v.get(), port++);
   }
 
-  // Create artifact vertices
-  for (const auto& [artifact, artifact_id] : g._artifact_ids) {
+  auto name = a->getName();
+
+  if (_format == Format::Dot) {
     // Start the vertex with HTML output
-    o << "  " << artifact_id << " [label=<";
+    _o << "  a" << id << " [label=<";
 
     // Begin a table
-    o << "<table border=\"0\" cellspacing=\"0\" cellborder=\"1\" cellpadding=\"5\">";
+    _o << "<table border=\"0\" cellspacing=\"0\" cellborder=\"1\" cellpadding=\"5\">";
 
     // Print the artifact type
-    o << "<tr><td border=\"0\"><sub>" << artifact->getTypeName() << "</sub></td></tr>";
+    _o << "<tr><td border=\"0\"><sub>" << a->getTypeName() << "</sub></td></tr>";
 
     // Add a row with the artifact name, unless the artifact is unnamed
-    auto name = artifact->getName();
     if (!name.empty()) {
-      o << "<tr><td>" + name + "</td></tr>";
+      _o << "<tr><td>" << escape_html(name) << "</td></tr>";
     }
 
     // Add a row for each version
-    for (const auto& v : artifact->getVersions()) {
-      o << "<tr><td port=\"" + g.addVersion(v) + "\"";
-      /*if (_changed_versions.find(v) != _changed_versions.end()) {
-        o << " bgcolor=\"yellow\"";
-      }*/
-      o << ">";
-      o << "<font point-size=\"10\">" << v->getTypeName() << "</font>";
-      o << "</td></tr>";
+    port = 0;
+    for (const auto& v : a->getVersions()) {
+      _o << "<tr><td port=\"v" << port++ << "\">";
+      _o << "<font point-size=\"10\">" << v->getTypeName() << "</font>";
+      _o << "</td></tr>";
     }
 
     // Finish the vertex line
-    o << "</table>> shape=plain]\n";
+    _o << "</table>> shape=plain]\n";
+
+  } else {
+    _o << "{\"type\":\"artifact\",\"id\":\"a" << id << "\",\"kind\":"
+       << quote_json(a->getTypeName()) << ",\"name\":" << quote_json(name) << ",\"versions\":[";
+    bool first = true;
+    for (const auto& v : a->getVersions()) {
+      if (!first) _o << ",";
+      _o << quote_json(v->getTypeName());
+      first = false;
+    }
+    _o << "]}\n";
   }
 
-  // Create I/O edges
-  for (const auto& [src, dest] : g._io_edges) {
-    // Does the reverse edges also appear in our set?
-    if (auto iter = g._io_edges.find({dest, src}); iter != g._io_edges.end()) {
-      // Yes. Draw this as a bidirectional edge
-      o << "  " << src << " -> " << dest
-        << " [arrowhead=empty weight=2 dir=both arrowtail=empty]\n";
+  return id;
+}
 
-      // Erase the other edge, since we've already drawn it
-      g._io_edges.erase(iter);
+size_t Graph::addSystemDir(const string& dir) noexcept {
+  auto iter = _system_dirs.find(dir);
+  if (iter != _system_dirs.end()) return iter->second;
 
-    } else {
-      // No, this is just a regular input edge
-      o << "  " << src << " -> " << dest << " [arrowhead=empty weight=2]\n";
-    }
+  size_t id = _artifact_count++;
+  _system_dirs.emplace_hint(iter, dir, id);
+
+  if (_format == Format::Dot) {
+    _o << "  a" << id << " [label=\"" << escape(dir) << "/*\" shape=box style=dashed]\n";
+  } else {
+    _o << "{\"type\":\"artifact\",\"id\":\"a" << id << "\",\"kind\":\"System\",\"name\":"
+       << quote_json(dir) << ",\"versions\":[]}\n";
+  }
+
+  return id;
+}
+
+optional<size_t> Graph::getPort(const shared_ptr<Version>& v) const noexcept {
+  auto iter = _version_ports.find(v.get());
+  if (iter == _version_ports.end()) return nullopt;
+  return iter->second;
+}
+
+void Graph::writeChildEdge(size_t parent_id, size_t child_id) noexcept {
+  if (_format == Format::Dot) {
+    _o << "  c" << parent_id << " -> c" << child_id << " [style=dotted weight=1]\n";
+  } else {
+    _o << "{\"type\":\"child\",\"from\":\"c" << parent_id << "\",\"to\":\"c" << child_id << "\"}\n";
   }
+}
 
-  // Close the graph
-  o << "}\n";
+void Graph::writeIOEdge(size_t command_id,
+                        size_t artifact_id,
+                        optional<size_t> port,
+                        int directions) noexcept {
+  if (_format == Format::Dot) {
+    string artifact = "a" + to_string(artifact_id);
+    if (port.has_value()) artifact += ":v" + to_string(port.value());
+    string command = "c" + to_string(command_id);
+
+    if (directions == (InputEdge | OutputEdge)) {
+      // Draw a version that is read and written as a bidirectional edge
+      _o << "  " << artifact << " -> " << command
+         << " [arrowhead=empty weight=2 dir=both arrowtail=empty]\n";
+    } else if (directions == InputEdge) {
+      _o << "  " << artifact << " -> " << command << " [arrowhead=empty weight=2]\n";
+    } else {
+      _o << "  " << command << " -> " << artifact << " [arrowhead=empty weight=2]\n";
+    }
 
-  return o;
+  } else {
+    // Write an input edge and an output edge for a version that is both read and written
+    auto write_edge = [&](const char* type) {
+      _o << "{\"type\":\"" << type << "\",\"command\":\"c" << command_id << "\",\"artifact\":\"a"
+         << artifact_id << "\"";
+      if (port.has_value()) _o << ",\"version\":" << port.value();
+      _o << "}\n";
+    };
+
+    if (directions & InputEdge) write_edge("input");
+    if (directions & OutputEdge) write_edge("output");
+  }
 }
@@ -1,58 +1,114 @@
 #pragma once
 
-#include <map>
+#include <cstddef>
 #include <memory>
+#include <optional>
 #include <ostream>
-#include <set>
 #include <string>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 class Artifact;
 class Command;
 class Version;
 
+/**
+ * A Graph writes the build graph for a trace. Vertices and edges are written as soon as they are
+ * found, so the graph does not keep its own copy of the output. The graph is read from an emulated
+ * build that records every command's inputs and outputs (see options::track_inputs_outputs), and
+ * that build still holds the whole trace, so rkr graph's memory use still grows with the number of
+ * edges.
+ */
 class Graph {
  public:
-  /// Create a graph from the commands in an input trace
-  Graph(bool show_all) noexcept : _show_all(show_all) {}
+  /// The formats a graph can be written in
+  enum class Format {
+    Dot,  // Graphviz source
+    JSON  // One JSON object per line for each vertex and edge
+  };
 
-  /// Print a Graph reference
-  friend std::ostream& operator<<(std::ostream& o, Graph& g) noexcept;
+  /// Options that select which parts of a build appear in the graph
+  struct Filter {
+    /// Include system files and metadata inputs
+    bool show_all = false;
 
-  /// Add an iterable set of commands to the graph
-  template <class T>
-  void addCommands(const T& commands) noexcept {
-    for (const auto& c : commands) {
-      addCommand(c);
-    }
-  }
+    /// Replace system files with one vertex for each top-level directory
+    bool collapse_system = false;
+
+    /// If not empty, only include artifacts whose paths match one of these glob patterns
+    std::vector<std::string> paths;
+
+    /// If not empty, only include commands that match one of these glob patterns, and their
+    /// descendants
+    std::vector<std::string> commands;
+
+    /// If set, only include commands up to this many levels below each included command
+    std::optional<size_t> depth;
+  };
+
+  /// Create a graph writer
+  Graph(std::ostream& o, Format format, Filter filter) noexcept :
+      _o(o), _format(format), _filter(std::move(filter)) {}
+
+  /// Write the graph for a build, starting from its root command
+  void write(const std::shared_ptr<Command>& root) noexcept;
 
  private:
-  /// Add a command to the graph
-  std::string addCommand(std::shared_ptr<Command> c) noexcept;
+  /// Visit a command. Commands are written if they are inside an included subtree.
+  void visit(const std::shared_ptr<Command>& c,
+             std::optional<size_t> parent_id,
+             std::optional<size_t> depth) noexcept;
+
+  /// Write a command vertex and its input and output edges. Returns the command's ID.
+  size_t addCommand(const std::shared_ptr<Command>& c) noexcept;
 
-  /// Add an artifact to the graph
-  std::string addArtifact(std::shared_ptr<Artifact> c) noexcept;
+  /// Get the ID for an artifact, writing its vertex the first time it is seen
+  size_t addArtifact(const std::shared_ptr<Artifact>& a) noexcept;
 
-  /// Add a version to the graph
-  std::string addVersion(std::shared_ptr<Version> c) noexcept;
+  /// Get the ID for the vertex that stands in for a collapsed system directory
+  size_t addSystemDir(const std::string& dir) noexcept;
+
+  /// Get the port for a version within its artifact's vertex
+  std::optional<size_t> getPort(const std::shared_ptr<Version>& v) const noexcept;
+
+  /// Write an edge from a parent command to its child
+  void writeChildEdge(size_t parent_id, size_t child_id) noexcept;
+
+  /**
+   * Write the edges between a command and an artifact it used
+   * \param command_id  The command's ID
+   * \param artifact_id The artifact's ID
+   * \param port        The port for the version used, if it has one
+   * \param directions  InputEdge, OutputEdge, or both
+   */
+  void writeIOEdge(size_t command_id,
+                   size_t artifact_id,
+                   std::optional<size_t> port,
+                   int directions) noexcept;
 
  private:
-  /// Should the graph output include all artifacts?
-  bool _show_all;
+  /// The output stream
+  std::ostream& _o;
+
+  /// The output format
+  Format _format;
+
+  /// The parts of the build to include
+  Filter _filter;
 
-  /// A map from commands to their IDs in the graph output
-  std::map<std::shared_ptr<Command>, std::string> _command_ids;
+  /// The number of command vertices written so far, used to assign command IDs
+  size_t _command_count = 0;
 
-  /// A map from artifacts to the ID used to represent the entire artifact in the build graph
-  std::map<std::shared_ptr<Artifact>, std::string> _artifact_ids;
+  /// The number of artifact vertices written so far, used to assign artifact IDs
+  size_t _artifact_count = 0;
 
-  /// A map from versions to their ID (not prefixed by artifact ID)
-  std::map<std::shared_ptr<Version>, std::string> _version_ids;
+  /// The IDs of artifacts that have been written
+  std::unordered_map<const Artifact*, size_t> _artifact_ids;
 
-  /// A set of command edges, from parent to child
-  std::set<std::pair<std::string, std::string>> _command_edges;
+  /// The port for each version of the artifacts that have been written
+  std::unordered_map<const Version*, size_t> _version_ports;
 
-  // Command input edges (artifact -> command)
-  std::set<std::pair<std::string, std::string>> _io_edges;
+  /// The artifact IDs of collapsed system directories
+  std::unordered_map<std::string, size_t> _system_dirs;
 };
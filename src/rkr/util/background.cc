@@ -0,0 +1,81 @@
+#include "background.hh"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+
+using std::deque;
+using std::function;
+using std::mutex;
+using std::packaged_task;
+using std::shared_future;
+using std::unique_lock;
+
+namespace background {
+  /// The state shared with the worker thread
+  struct Queue {
+    /// Protects the job queue
+    mutex guard;
+
+    /// Signalled when a job is queued or finished
+    std::condition_variable changed;
+
+    /// Jobs waiting to run
+    deque<packaged_task<bool()>> jobs;
+
+    /// The number of jobs that have been submitted but have not finished
+    size_t unfinished = 0;
+  };
+
+  /// Run queued jobs forever
+  static void worker(Queue* q) noexcept {
+    while (true) {
+      packaged_task<bool()> job;
+      {
+        unique_lock lock(q->guard);
+        q->changed.wait(lock, [q] { return !q->jobs.empty(); });
+        job = std::move(q->jobs.front());
+        q->jobs.pop_front();
+      }
+
+      job();
+
+      unique_lock lock(q->guard);
+      q->unfinished--;
+      q->changed.notify_all();
+    }
+  }
+
+  /// Get the queue, starting the worker thread on first use. The queue is never destroyed,
+  /// because the worker thread waits on it until the process exits.
+  static Queue* get_queue() noexcept {
+    static Queue* q = [] {
+      auto q = new Queue();
+      std::thread(worker, q).detach();
+      return q;
+    }();
+    return q;
+  }
+
+  shared_future<bool> run(function<bool()> job) noexcept {
+    packaged_task<bool()> task(std::move(job));
+    auto result = task.get_future().share();
+
+    auto q = get_queue();
+    unique_lock lock(q->guard);
+    q->jobs.push_back(std::move(task));
+    q->unfinished++;
+    q->changed.notify_all();
+
+    return result;
+  }
+
+  void wait() noexcept {
+    auto q = get_queue();
+    unique_lock lock(q->guard);
+    q->changed.wait(lock, [q] { return q->unfinished == 0; });
+  }
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <functional>
+#include <future>
+
+/**
+ * The background namespace runs slow filesystem work on a worker thread so the main thread can
+ * keep servicing traced commands. Jobs run one at a time in the order they were submitted.
+ *
+ * Jobs must only use code that is safe to call from another thread. The content cache code
+ * (storage, chunks, cache, and remote) is; artifacts, versions, and commands are not.
+ */
+namespace background {
+  /**
+   * Run a job on the background thread
+   * \param job The job to run
+   * \returns a future that is set to the job's result when it finishes
+   */
+  std::shared_future<bool> run(std::function<bool()> job) noexcept;
+
+  /// Wait for every job submitted so far to finish
+  void wait() noexcept;
+}
@@ -0,0 +1,408 @@
+#include "cache.hh"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include "util/chunks.hh"
+#include "util/constants.hh"
+#include "util/log.hh"
+#include "util/options.hh"
+#include "util/stats.hh"
+
+using std::ifstream;
+using std::lock_guard;
+using std::map;
+using std::mutex;
+using std::nullopt;
+using std::ofstream;
+using std::optional;
+using std::set;
+using std::string;
+using std::tuple;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+namespace cache {
+  // The first line of a cache index file
+  static const string IndexHeader = "rkr-cache-index 1";
+
+  /// A file recorded in the cache index
+  struct Entry {
+    /// The index clock value when this file was last used
+    uint64_t last_access = 0;
+
+    /// The size of the file in bytes
+    uint64_t size = 0;
+  };
+
+  /// The persistent record of the cache contents
+  struct Index {
+    /// Incremented once per build. Entries used during a build are stamped with this value
+    uint64_t clock = 0;
+
+    /// Totals over all builds
+    Summary totals;
+
+    /// The files in the cache, keyed by path relative to the cache directory
+    map<string, Entry> entries;
+  };
+
+  /// The files used during this build and their sizes
+  static map<string, uint64_t> _accessed;
+
+  /// The cached files the trace saved by this build refers to, as paths of whole cached files
+  static set<string> _referenced;
+
+  /// Lookups and savings during this build
+  static Summary _session;
+
+  /// Protects the record of this build's accesses. Files may be cached from a background thread.
+  static mutex _accessed_mutex;
+
+  /// The build lock file, held with a shared lock from begin() until finish(), or -1
+  static int _build_lock_fd = -1;
+
+  /// Get the path to the cache index
+  static fs::path index_path() noexcept {
+    return constants::CacheDir / "index";
+  }
+
+  /// Load the cache index. If there is no index, build one from the files in the cache directory.
+  static Index load_index() noexcept {
+    Index index;
+
+    ifstream f(index_path());
+    string header;
+    if (f && std::getline(f, header) && header == IndexHeader) {
+      auto& t = index.totals;
+      f >> index.clock >> t.hits >> t.misses >> t.bytes_saved >> t.bytes_evicted;
+
+      uint64_t last_access;
+      uint64_t size;
+      string path;
+      while (f >> last_access >> size >> path) {
+        index.entries[path] = Entry{last_access, size};
+      }
+      return index;
+    }
+
+    // There is no usable index. Record every file in the cache as unused.
+    LOG(cache) << "Rebuilding cache index from " << constants::CacheDir;
+    std::error_code ec;
+    for (auto iter = fs::recursive_directory_iterator(constants::CacheDir, ec);
+         !ec && iter != fs::recursive_directory_iterator(); iter.increment(ec)) {
+      if (!iter->is_regular_file(ec)) continue;
+
+      // Skip the cache's own bookkeeping files and any temporary files being inserted
+      auto path = iter->path().lexically_relative(constants::CacheDir);
+      if (path.begin()->string().size() != 2) continue;
+      if (path.filename().string().find(".tmp") != string::npos) continue;
+
+      index.entries[path.string()] = Entry{0, iter->file_size(ec)};
+    }
+
+    return index;
+  }
+
+  /// Save the cache index, replacing the old index atomically
+  static void save_index(const Index& index) noexcept {
+    auto tmp = index_path();
+    tmp += ".tmp";
+
+    ofstream f(tmp);
+    const auto& t = index.totals;
+    f << IndexHeader << "\n";
+    f << index.clock << " " << t.hits << " " << t.misses << " " << t.bytes_saved << " "
+      << t.bytes_evicted << "\n";
+    for (const auto& [path, entry] : index.entries) {
+      f << entry.last_access << " " << entry.size << " " << path << "\n";
+    }
+    f.close();
+
+    if (!f) {
+      WARN << "Failed to write cache index " << tmp;
+      return;
+    }
+
+    std::error_code ec;
+    fs::rename(tmp, index_path(), ec);
+    if (ec) WARN << "Failed to replace cache index " << index_path() << ": " << ec.message();
+  }
+
+  void begin() noexcept {
+    std::error_code ec;
+    fs::create_directories(constants::CacheDir, ec);
+
+    // Every build sharing this cache holds a shared lock while it runs. Files are only evicted
+    // by a build that can take the lock exclusively.
+    auto lock_path = constants::CacheDir / "builds.lock";
+    _build_lock_fd = ::open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (_build_lock_fd == -1 || ::flock(_build_lock_fd, LOCK_SH) == -1) {
+      WARN << "Failed to lock cache " << lock_path << ", so no files will be evicted: " << ERR;
+      if (_build_lock_fd != -1) ::close(_build_lock_fd);
+      _build_lock_fd = -1;
+    }
+  }
+
+  void hit(fs::path hash_path, uint64_t size) noexcept {
+    lock_guard lock(_accessed_mutex);
+    _accessed[hash_path.string()] = size;
+    _session.hits++;
+    _session.bytes_saved += size;
+    stats::cache_hits++;
+    stats::cache_bytes_saved += size;
+  }
+
+  void miss(fs::path hash_path, uint64_t size) noexcept {
+    lock_guard lock(_accessed_mutex);
+    _accessed[hash_path.string()] = size;
+    _session.misses++;
+    stats::cache_misses++;
+  }
+
+  void chunk(fs::path hash_path, uint64_t size, bool stored) noexcept {
+    lock_guard lock(_accessed_mutex);
+    _accessed[hash_path.string()] = size;
+    if (!stored) {
+      _session.bytes_saved += size;
+      stats::cache_bytes_saved += size;
+    }
+  }
+
+  void reference(fs::path hash_path) noexcept {
+    _referenced.insert(hash_path.string());
+  }
+
+  void clear_references() noexcept {
+    _referenced.clear();
+  }
+
+  /// Is a path in the cache a chunk manifest? Manifests have the suffix chunks::manifest_path adds.
+  static bool is_manifest(const string& path) noexcept {
+    return fs::path(path).extension() == ".chunks";
+  }
+
+  /// Record the files this workspace used in its latest build or refers to from its saved trace,
+  /// and collect the files recorded by every workspace that still exists
+  static set<string> update_refs(fs::path db_dir) noexcept {
+    std::error_code ec;
+    auto refs_dir = constants::CacheDir / "refs";
+    fs::create_directories(refs_dir, ec);
+
+    // Each workspace has a refs file named for the hash of its absolute database path
+    auto workspace = fs::absolute(db_dir, ec).lexically_normal().string();
+    auto my_refs = refs_dir / std::to_string(std::hash<string>()(workspace));
+
+    // A build with nothing to do uses no cached files, but its saved trace still relies on them.
+    // Files cached as chunks are kept along with every chunk their manifest lists.
+    set<string> mine;
+    for (const auto& [path, size] : _accessed) {
+      mine.insert(path);
+    }
+    for (const auto& path : _referenced) {
+      mine.insert(path);
+
+      auto manifest = chunks::manifest_path(path);
+      auto parts = chunks::parts(manifest);
+      if (parts.empty()) continue;
+
+      mine.insert(manifest.string());
+      for (const auto& part : parts) {
+        mine.insert(part.string());
+      }
+    }
+
+    ofstream out(my_refs);
+    out << workspace << "\n";
+    for (const auto& path : mine) {
+      out << path << "\n";
+    }
+    out.close();
+
+    // Read every workspace's refs, removing refs for workspaces that no longer exist
+    set<string> referenced;
+    for (auto iter = fs::directory_iterator(refs_dir, ec);
+         !ec && iter != fs::directory_iterator(); iter.increment(ec)) {
+      ifstream in(iter->path());
+      string line;
+      if (!std::getline(in, line) || !fs::exists(line, ec)) {
+        LOG(cache) << "Removing stale cache references " << iter->path();
+        fs::remove(iter->path(), ec);
+        continue;
+      }
+
+      while (std::getline(in, line)) {
+        referenced.insert(line);
+      }
+    }
+
+    return referenced;
+  }
+
+  void finish(fs::path db_dir) noexcept {
+    // Hold an exclusive lock on the index while it is updated. Other rkr processes sharing this
+    // cache wait here.
+    auto lock_path = constants::CacheDir / "index.lock";
+    int lock_fd = ::open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    bool index_locked = lock_fd != -1 && ::flock(lock_fd, LOCK_EX) == 0;
+    if (!index_locked) {
+      WARN << "Failed to lock cache index " << lock_path << ", so no files will be evicted: "
+           << ERR;
+    }
+
+    // Files can only be evicted if no other build sharing the cache is running, since it could
+    // be staging any of them. Builds that start now wait for the exclusive lock to be released.
+    bool evict = options::cache_size_limit > 0 && index_locked && _build_lock_fd != -1;
+    if (evict && ::flock(_build_lock_fd, LOCK_EX | LOCK_NB) == -1) {
+      LOG(cache) << "Not evicting cached files while another build is using the cache";
+      evict = false;
+    }
+
+    auto index = load_index();
+
+    // Stamp every file used during this build with a new clock value
+    index.clock++;
+    for (const auto& [path, size] : _accessed) {
+      index.entries[path] = Entry{index.clock, size};
+    }
+
+    // Files used by the latest build of any workspace sharing this cache are not evicted
+    auto referenced = update_refs(db_dir);
+
+    // Add this build's lookups to the totals
+    index.totals.hits += _session.hits;
+    index.totals.misses += _session.misses;
+    index.totals.bytes_saved += _session.bytes_saved;
+
+    uint64_t total = 0;
+    for (const auto& [path, entry] : index.entries) {
+      total += entry.size;
+    }
+
+    // Evict the least-recently used files until the cache fits within its limit
+    if (evict && total > options::cache_size_limit) {
+      // Chunks are only evicted along with a manifest that lists them, so a manifest is never left
+      // without its chunks. Count the manifests that list each chunk, so a chunk shared with
+      // another manifest is kept until that manifest is evicted too.
+      map<string, vector<string>> manifest_parts;
+      map<string, size_t> chunk_users;
+      for (const auto& [path, entry] : index.entries) {
+        if (!is_manifest(path)) continue;
+
+        auto& parts = manifest_parts[path];
+        for (const auto& part : chunks::parts(path)) {
+          parts.push_back(part.string());
+          chunk_users[part.string()]++;
+        }
+      }
+
+      // Can a file be evicted? Files used by this build or referenced by a workspace are kept.
+      auto evictable = [&](const string& path) {
+        auto iter = index.entries.find(path);
+        return iter != index.entries.end() && iter->second.last_access < index.clock &&
+               referenced.count(path) == 0;
+      };
+
+      // Evict one file. Returns false if it could not be removed.
+      auto evict_file = [&](const string& path) {
+        auto full_path = constants::CacheDir / path;
+        if (::unlink(full_path.c_str()) != 0 && errno != ENOENT) {
+          WARN << "Failed to evict cached file " << full_path << ": " << ERR;
+          return false;
+        }
+
+        auto size = index.entries[path].size;
+        LOG(cache) << "Evicted cached file " << full_path << " (" << size << " bytes)";
+
+        total -= size;
+        index.totals.bytes_evicted += size;
+        stats::cache_bytes_evicted += size;
+        index.entries.erase(path);
+        return true;
+      };
+
+      vector<tuple<uint64_t, string>> candidates;
+      for (const auto& [path, entry] : index.entries) {
+        if (evictable(path) && chunk_users[path] == 0) {
+          candidates.emplace_back(entry.last_access, path);
+        }
+      }
+      std::sort(candidates.begin(), candidates.end());
+
+      for (const auto& [last_access, path] : candidates) {
+        if (total <= options::cache_size_limit) break;
+        if (!evict_file(path)) continue;
+
+        // The manifest is removed first, so an interrupted eviction leaves unlisted chunks, which
+        // later builds can evict, rather than a manifest that cannot be restored
+        for (const auto& part : manifest_parts[path]) {
+          if (--chunk_users[part] == 0 && evictable(part)) evict_file(part);
+        }
+      }
+
+      if (total > options::cache_size_limit) {
+        LOG(cache) << "Cache holds " << total << " bytes used by this build, over the limit of "
+                   << options::cache_size_limit << " bytes";
+      }
+    }
+
+    save_index(index);
+
+    if (lock_fd != -1) ::close(lock_fd);
+
+    // Release the build lock
+    if (_build_lock_fd != -1) ::close(_build_lock_fd);
+    _build_lock_fd = -1;
+
+    _accessed.clear();
+    _referenced.clear();
+    _session = Summary();
+  }
+
+  Summary summarize() noexcept {
+    auto index = load_index();
+
+    Summary s = index.totals;
+    s.entries = index.entries.size();
+    for (const auto& [path, entry] : index.entries) {
+      s.bytes += entry.size;
+    }
+    return s;
+  }
+
+  optional<uint64_t> parse_size(string s) noexcept {
+    if (s.empty()) return nullopt;
+
+    // Split the number from any suffix
+    size_t digits = 0;
+    while (digits < s.size() && isdigit(s[digits])) digits++;
+    if (digits == 0 || digits > 19) return nullopt;
+
+    uint64_t value = std::stoull(s.substr(0, digits));
+    auto suffix = s.substr(digits);
+
+    if (suffix.empty() || suffix == "B" || suffix == "b") return value;
+    if (suffix == "K" || suffix == "k") return value << 10;
+    if (suffix == "M" || suffix == "m") return value << 20;
+    if (suffix == "G" || suffix == "g") return value << 30;
+    if (suffix == "T" || suffix == "t") return value << 40;
+    return nullopt;
+  }
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+
+namespace fs = std::filesystem;
+
+/**
+ * The cache namespace manages the content cache as a whole. FileVersion stores and restores
+ * individual files; this code keeps an index of every cached file with its size and the last
+ * build that used it. At the end of each build the index is updated, and if the cache is larger
+ * than the configured limit the least-recently used files are evicted.
+ *
+ * Several workspaces may share one cache directory (see --cache-dir). Files are inserted
+ * atomically, the index is updated under a lock, and each workspace records the files its latest
+ * build used or its saved trace refers to, so other workspaces do not evict them. Each build also
+ * holds a shared lock on the cache while it runs, and files are only evicted when no other build
+ * holds that lock.
+ *
+ * Files used during the current build and files referenced by the saved trace of any workspace
+ * are never evicted. A version whose cached copy is gone anyway, for example because it was
+ * removed by hand, can no longer be committed, so the command that produced it will rerun if its
+ * output is needed.
+ */
+namespace cache {
+  /// A summary of the cache's contents and its use over all builds
+  struct Summary {
+    /// The number of files in the cache
+    size_t entries = 0;
+
+    /// The total size of the files in the cache
+    uint64_t bytes = 0;
+
+    /// The number of times a file was found in the cache
+    uint64_t hits = 0;
+
+    /// The number of times a file had to be added to the cache
+    uint64_t misses = 0;
+
+    /// The number of bytes that did not have to be copied into the cache or regenerated
+    uint64_t bytes_saved = 0;
+
+    /// The number of bytes removed from the cache by eviction
+    uint64_t bytes_evicted = 0;
+  };
+
+  /// Start using the cache for a build. Files are not evicted while the build runs.
+  void begin() noexcept;
+
+  /**
+   * Record a lookup that found a file already in the cache
+   * \param hash_path The path to the cached file, relative to the cache directory
+   * \param size      The size of the cached file
+   */
+  void hit(fs::path hash_path, uint64_t size) noexcept;
+
+  /**
+   * Record a lookup that added a file to the cache
+   * \param hash_path The path to the cached file, relative to the cache directory
+   * \param size      The size of the cached file
+   */
+  void miss(fs::path hash_path, uint64_t size) noexcept;
+
+  /**
+   * Record the use of one chunk of a file cached as chunks (see chunks.hh)
+   * \param hash_path The path to the cached chunk, relative to the cache directory
+   * \param size      The size of the chunk
+   * \param stored    True if the chunk was just added to the cache. Otherwise it was already
+   *                  cached, and its bytes did not have to be written.
+   */
+  void chunk(fs::path hash_path, uint64_t size, bool stored) noexcept;
+
+  /**
+   * Record that the trace saved by this build refers to a cached file. The file is kept for as
+   * long as this workspace's latest trace refers to it, even in builds that do not use it.
+   * \param hash_path The path a whole cached file would have, relative to the cache directory.
+   *                  If the file is cached as chunks, its manifest and chunks are kept.
+   */
+  void reference(fs::path hash_path) noexcept;
+
+  /// Forget the files recorded with reference(). Called before the trace that will be saved is
+  /// written, so files only the traces of earlier phases referred to can be evicted.
+  void clear_references() noexcept;
+
+  /**
+   * Update the cache index with this build's accesses, and evict files if the cache is too large.
+   * The cache may be shared by several workspaces. Files used by the latest build of any of them,
+   * or referenced by its saved trace, are kept.
+   * \param db_dir The database directory of the workspace that just finished a build
+   */
+  void finish(fs::path db_dir) noexcept;
+
+  /// Summarize the cache's contents and use
+  Summary summarize() noexcept;
+
+  /// Parse a size with an optional K, M, G, or T suffix. Returns nullopt if the size is invalid.
+  std::optional<uint64_t> parse_size(std::string s) noexcept;
+}
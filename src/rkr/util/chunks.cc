@@ -0,0 +1,333 @@
+#include "chunks.hh"
+
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "blake3.h"
+#include "util/cache.hh"
+#include "util/constants.hh"
+#include "util/log.hh"
+#include "util/options.hh"
+#include "util/remote.hh"
+#include "util/storage.hh"
+
+using std::array;
+using std::ifstream;
+using std::nullopt;
+using std::ofstream;
+using std::optional;
+using std::string;
+using std::tuple;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+namespace chunks {
+  // The first line of a manifest file
+  static const string ManifestHeader = "rkr-chunks 1";
+
+  // The chunker places a boundary where the top bits of the rolling hash are all zero. With 14
+  // bits the average chunk is about 16KiB past the minimum.
+  static const uint64_t BoundaryMask = ~(~uint64_t(0) >> 14);
+
+  // The size of the buffer used when copying chunks with read/write
+  enum : size_t { COPYBUFSZ = 1 << 16 };
+
+  /// A chunk listed in a manifest
+  using Chunk = tuple<remote::Hash, uint64_t>;
+
+  /// The random values the gear hash adds for each byte value. The table is fixed so every build
+  /// picks the same boundaries for the same content.
+  static const array<uint64_t, 256> Gear = [] {
+    array<uint64_t, 256> table;
+    uint64_t x = 0x9e3779b97f4a7c15;
+    for (auto& entry : table) {
+      // splitmix64
+      x += 0x9e3779b97f4a7c15;
+      uint64_t z = x;
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+      entry = z ^ (z >> 31);
+    }
+    return table;
+  }();
+
+  /// Find the length of the next chunk in a buffer
+  static size_t next_chunk(const uint8_t* data, size_t len) noexcept {
+    if (len <= MinChunkSize) return len;
+    if (len > MaxChunkSize) len = MaxChunkSize;
+
+    // Bytes before the minimum chunk size can't end a chunk, so they are skipped. The hash only
+    // depends on the last 64 bytes, so its value at the minimum is the same either way.
+    uint64_t h = 0;
+    for (size_t i = MinChunkSize - 64; i < len; i++) {
+      h = (h << 1) + Gear[data[i]];
+      if (i >= MinChunkSize && (h & BoundaryMask) == 0) return i + 1;
+    }
+    return len;
+  }
+
+  /// Get the BLAKE3 hash of a chunk
+  static remote::Hash hash_chunk(const uint8_t* data, size_t len) noexcept {
+    blake3_hasher hasher;
+    blake3_hasher_init(&hasher);
+    blake3_hasher_update(&hasher, data, len);
+
+    remote::Hash output;
+    blake3_hasher_finalize(&hasher, output.data(), BLAKE3_OUT_LEN);
+    return output;
+  }
+
+  /// Parse a hash written in hexadecimal
+  static optional<remote::Hash> parse_hash(const string& hex) noexcept {
+    if (hex.size() != remote::HashLength * 2) return nullopt;
+
+    auto digit = [](char c) -> int {
+      if (c >= '0' && c <= '9') return c - '0';
+      if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+      return -1;
+    };
+
+    remote::Hash hash;
+    for (size_t i = 0; i < hash.size(); i++) {
+      int hi = digit(hex[i * 2]);
+      int lo = digit(hex[i * 2 + 1]);
+      if (hi == -1 || lo == -1) return nullopt;
+      hash[i] = (hi << 4) | lo;
+    }
+    return hash;
+  }
+
+  /// Load the list of chunks in a manifest. Returns nullopt if the manifest is missing or invalid.
+  static optional<vector<Chunk>> load_manifest(fs::path manifest) noexcept {
+    ifstream f(constants::CacheDir / manifest);
+    string header;
+    if (!f || !std::getline(f, header) || header != ManifestHeader) return nullopt;
+
+    vector<Chunk> result;
+    string hex;
+    uint64_t size;
+    while (f >> hex >> size) {
+      auto hash = parse_hash(hex);
+      if (!hash.has_value()) return nullopt;
+      result.emplace_back(hash.value(), size);
+    }
+
+    return result;
+  }
+
+  /// Get the size of a file in the cache, or nullopt if it does not exist
+  static optional<uint64_t> cached_size(fs::path hash_path) noexcept {
+    struct stat statbuf;
+    if (::stat((constants::CacheDir / hash_path).c_str(), &statbuf) != 0) return nullopt;
+    return statbuf.st_size;
+  }
+
+  /// Add one chunk to the cache if it is not already there. Returns false on failure.
+  static bool store_chunk(const remote::Hash& hash, const uint8_t* data, size_t len) noexcept {
+    auto hash_path = remote::hash_path(hash);
+    if (cached_size(hash_path).has_value()) {
+      cache::chunk(hash_path, len, false);
+      return true;
+    }
+
+    auto dest = constants::CacheDir / hash_path;
+    std::error_code ec;
+    fs::create_directories(dest.parent_path(), ec);
+
+    auto tmp = storage::temp_path(dest);
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd == -1) return false;
+
+    size_t written = 0;
+    while (written < len) {
+      ssize_t n = ::write(fd, data + written, len - written);
+      if (n == -1 && errno == EINTR) continue;
+      if (n <= 0) break;
+      written += n;
+    }
+    ::close(fd);
+
+    if (written < len || !storage::publish(tmp, dest)) {
+      int err = errno;
+      ::unlink(tmp.c_str());
+      errno = err;
+      return false;
+    }
+
+    cache::chunk(hash_path, len, true);
+    return true;
+  }
+
+  bool enabled_for(uint64_t size) noexcept {
+    return options::cache_chunks && size >= MinFileSize;
+  }
+
+  fs::path manifest_path(fs::path hash_path) noexcept {
+    hash_path += ".chunks";
+    return hash_path;
+  }
+
+  bool store(fs::path src, fs::path manifest) noexcept {
+    // If the file is already cached, record the use of its chunks and stop
+    if (available(manifest)) {
+      for (const auto& [hash, size] : load_manifest(manifest).value()) {
+        cache::chunk(remote::hash_path(hash), size, false);
+      }
+      cache::hit(manifest, cached_size(manifest).value_or(0));
+      return true;
+    }
+
+    int fd = ::open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return false;
+
+    struct stat statbuf;
+    if (::fstat(fd, &statbuf) != 0) {
+      ::close(fd);
+      return false;
+    }
+
+    size_t len = statbuf.st_size;
+    void* p = ::mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) return false;
+
+    // Split the file into chunks and store any that are not already cached
+    auto data = static_cast<const uint8_t*>(p);
+    vector<Chunk> chunks;
+    bool ok = true;
+    for (size_t offset = 0; ok && offset < len;) {
+      size_t chunk_len = next_chunk(data + offset, len - offset);
+      auto hash = hash_chunk(data + offset, chunk_len);
+      ok = store_chunk(hash, data + offset, chunk_len);
+      chunks.emplace_back(hash, chunk_len);
+      offset += chunk_len;
+    }
+
+    ::munmap(p, len);
+    if (!ok) return false;
+
+    // Write the manifest, then move it into place once it is complete
+    auto dest = constants::CacheDir / manifest;
+    std::error_code ec;
+    fs::create_directories(dest.parent_path(), ec);
+
+    auto tmp = storage::temp_path(dest);
+    ofstream f(tmp);
+    f << ManifestHeader << "\n";
+    for (const auto& [hash, size] : chunks) {
+      f << remote::hash_path(hash).filename().string() << " " << size << "\n";
+    }
+    f.close();
+
+    if (!f || !storage::publish(tmp, dest)) {
+      int err = errno;
+      ::unlink(tmp.c_str());
+      errno = err;
+      return false;
+    }
+
+    LOG(cache) << "Cached " << src << " as " << chunks.size() << " chunks in " << dest;
+
+    cache::miss(manifest, cached_size(manifest).value_or(0));
+    return true;
+  }
+
+  vector<fs::path> parts(fs::path manifest) noexcept {
+    vector<fs::path> result;
+    for (const auto& [hash, size] : load_manifest(manifest).value_or(vector<Chunk>())) {
+      result.push_back(remote::hash_path(hash));
+    }
+    return result;
+  }
+
+  bool available(fs::path manifest) noexcept {
+    auto chunks = load_manifest(manifest);
+    if (!chunks.has_value()) return false;
+
+    for (const auto& [hash, size] : chunks.value()) {
+      if (cached_size(remote::hash_path(hash)) != size) return false;
+    }
+    return true;
+  }
+
+  /// Append a chunk's contents to the end of an open file. Returns false on failure.
+  static bool append_chunk(int dest_fd, fs::path hash_path, uint64_t size) noexcept {
+    int fd = ::open((constants::CacheDir / hash_path).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return false;
+
+    // Copy in the kernel if possible, and fall back to read/write
+    uint64_t remaining = size;
+    while (remaining > 0) {
+      ssize_t n = ::copy_file_range(fd, nullptr, dest_fd, nullptr, remaining, 0);
+      if (n <= 0) break;
+      remaining -= n;
+    }
+
+    char buf[COPYBUFSZ];
+    while (remaining > 0) {
+      ssize_t n = ::read(fd, buf, remaining < sizeof(buf) ? remaining : sizeof(buf));
+      if (n == -1 && errno == EINTR) continue;
+      if (n <= 0) break;
+
+      ssize_t written = 0;
+      while (written < n) {
+        ssize_t w = ::write(dest_fd, buf + written, n - written);
+        if (w == -1 && errno == EINTR) continue;
+        if (w <= 0) {
+          ::close(fd);
+          return false;
+        }
+        written += w;
+      }
+      remaining -= n;
+    }
+
+    ::close(fd);
+    return remaining == 0;
+  }
+
+  bool restore(fs::path manifest, fs::path dest, mode_t mode) noexcept {
+    auto chunks = load_manifest(manifest);
+    if (!chunks.has_value()) {
+      errno = ENOENT;
+      return false;
+    }
+
+    // Remove any existing file first. It may be a hard link to a file in the cache.
+    if (::unlink(dest.c_str()) != 0 && errno != ENOENT) return false;
+
+    int fd = ::open(dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+    if (fd == -1) return false;
+
+    for (const auto& [hash, size] : chunks.value()) {
+      auto hash_path = remote::hash_path(hash);
+      if (!append_chunk(fd, hash_path, size)) {
+        int err = errno;
+        ::close(fd);
+        errno = err;
+        return false;
+      }
+      cache::chunk(hash_path, size, false);
+    }
+
+    ::close(fd);
+
+    cache::hit(manifest, cached_size(manifest).value_or(0));
+    return true;
+  }
+}
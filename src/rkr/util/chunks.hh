@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace fs = std::filesystem;
+
+/**
+ * The chunks namespace stores large files in the content cache as a sequence of chunks, so
+ * successive versions of a large output that differ in only a few places share most of their
+ * storage (see --cache-chunks).
+ *
+ * Files are split with a content-defined chunker: a gear rolling hash over the file's bytes picks
+ * chunk boundaries, so an insertion or deletion only changes the chunks around it. Each chunk is
+ * stored in the cache under its own BLAKE3 hash, exactly like a whole cached file with the same
+ * contents. A file is recorded with a manifest that lists its chunks in order. The manifest is
+ * stored next to where the whole file would be, with a ".chunks" suffix.
+ */
+namespace chunks {
+  /// Files smaller than this are always cached whole
+  enum : uint64_t { MinFileSize = 1 << 20 };
+
+  /// The smallest chunk the chunker produces, except at the end of a file
+  enum : size_t { MinChunkSize = 4 << 10 };
+
+  /// The largest chunk the chunker produces
+  enum : size_t { MaxChunkSize = 64 << 10 };
+
+  /// Should a file of a given size be cached as chunks?
+  bool enabled_for(uint64_t size) noexcept;
+
+  /// Get the path to a manifest, relative to the cache directory, from the path a whole cached
+  /// file with the same contents would have
+  fs::path manifest_path(fs::path hash_path) noexcept;
+
+  /**
+   * Add a file to the cache as chunks. Chunks that are already cached are not written again.
+   * \param src      The path to the file to cache
+   * \param manifest The path to the file's manifest, relative to the cache directory
+   * \returns true if the file's manifest and all of its chunks are in the cache
+   */
+  bool store(fs::path src, fs::path manifest) noexcept;
+
+  /**
+   * Get the chunks a manifest lists
+   * \param manifest The path to the manifest, relative to the cache directory
+   * \returns the paths to the chunks relative to the cache directory, or an empty list if the
+   *          manifest is missing or invalid
+   */
+  std::vector<fs::path> parts(fs::path manifest) noexcept;
+
+  /**
+   * Check that a manifest and all of the chunks it lists are in the cache
+   * \param manifest The path to the manifest, relative to the cache directory
+   */
+  bool available(fs::path manifest) noexcept;
+
+  /**
+   * Rebuild a file from its chunks
+   * \param manifest The path to the file's manifest, relative to the cache directory
+   * \param dest     The path where the file should be created. Any existing file is replaced.
+   * \param mode     The permissions for the new file
+   * \returns true if the file was rebuilt. On failure, errno describes the error.
+   */
+  bool restore(fs::path manifest, fs::path dest, mode_t mode) noexcept;
+}
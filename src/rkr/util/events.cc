@@ -0,0 +1,266 @@
+#include "events.hh"
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "artifacts/Artifact.hh"
+#include "runtime/Command.hh"
+#include "util/log.hh"
+
+using std::condition_variable;
+using std::mutex;
+using std::pair;
+using std::set;
+using std::string;
+using std::to_string;
+using std::unique_lock;
+using std::unordered_map;
+
+namespace fs = std::filesystem;
+
+namespace events {
+  /// Producers wait for the writer once this many bytes of events are buffered
+  enum : size_t { MaxBuffered = 1 << 20 };
+
+  /// The file descriptor events are written to
+  static int _fd = -1;
+
+  /// Protects the buffer and the state below, which the writer thread shares
+  static mutex _mutex;
+
+  /// Signaled when events are added to the buffer, or the stream is finishing
+  static condition_variable _ready;
+
+  /// Signaled when the writer takes the buffered events
+  static condition_variable _space;
+
+  /// Events waiting to be written
+  static string _buffer;
+
+  /// Set when finish() asks the writer thread to exit
+  static bool _stopping = false;
+
+  /// Set if a write failed. Later events are dropped.
+  static bool _failed = false;
+
+  /// The thread that writes events
+  static std::thread _writer;
+
+  /// The IDs of commands that have been mentioned in the stream
+  static unordered_map<const Command*, size_t> _command_ids;
+
+  /// The paths each running command has reported for each type of access, so each is only
+  /// reported once. Paths are used instead of artifacts, because an artifact can be freed and its
+  /// address reused by another. A command's entry is dropped when it exits.
+  static unordered_map<size_t, set<pair<string, Access>>> _reported;
+
+  /// Escape a string and quote it as a JSON string
+  static string quote(const string& s) noexcept {
+    string result = "\"";
+    for (unsigned char c : s) {
+      if (c == '"' || c == '\\') {
+        result += '\\';
+        result += c;
+      } else if (c < 0x20) {
+        char buf[8];
+        snprintf(buf, sizeof(buf), "\\u%04x", c);
+        result += buf;
+      } else {
+        result += c;
+      }
+    }
+    return result + "\"";
+  }
+
+  /// Write a whole buffer to the stream. Returns false if the reader has gone away.
+  static bool write_all(const string& data) noexcept {
+    size_t done = 0;
+    while (done < data.size()) {
+      ssize_t rc = ::write(_fd, data.data() + done, data.size() - done);
+      if (rc < 0 && errno == EINTR) continue;
+      if (rc <= 0) return false;
+      done += rc;
+    }
+    return true;
+  }
+
+  /// Write buffered events until finish() is called or the stream fails
+  static void write_events() noexcept {
+    // A reader that closes a pipe or socket should not kill rkr. SIGPIPE is sent to the thread
+    // that wrote, so blocking it here only affects this thread. Traced commands are started from
+    // the main thread, so they still see the default disposition.
+    sigset_t sigpipe;
+    sigemptyset(&sigpipe);
+    sigaddset(&sigpipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &sigpipe, nullptr);
+
+    unique_lock lock(_mutex);
+    while (true) {
+      _ready.wait(lock, [] { return !_buffer.empty() || _stopping; });
+      if (_buffer.empty()) break;
+
+      string batch;
+      batch.swap(_buffer);
+      _space.notify_all();
+
+      lock.unlock();
+      bool ok = write_all(batch);
+      lock.lock();
+
+      if (!ok) {
+        WARN << "Stopped streaming events: " << strerror(errno);
+        _failed = true;
+        _buffer.clear();
+        _space.notify_all();
+
+        // Discard the SIGPIPE the failed write raised, if there was one
+        struct timespec no_wait = {0, 0};
+        sigtimedwait(&sigpipe, nullptr, &no_wait);
+        break;
+      }
+    }
+  }
+
+  /// Add an event to the buffer, waiting for space if the buffer is full. The lock must be held.
+  static void emit(unique_lock<mutex>& lock, const string& event) noexcept {
+    _space.wait(lock, [] { return _buffer.size() < MaxBuffered || _failed; });
+    if (_failed) return;
+
+    _buffer += event;
+    _buffer += '\n';
+    _ready.notify_one();
+  }
+
+  /// Get the ID for a command, introducing it to the stream the first time it is seen. The lock
+  /// must be held.
+  static size_t command_id(unique_lock<mutex>& lock, const Command& c) noexcept {
+    auto [iter, added] = _command_ids.emplace(&c, _command_ids.size());
+    if (added) {
+      emit(lock, "{\"type\":\"command\",\"command\":" + to_string(iter->second) +
+                     ",\"name\":" + quote(c.getFullName()) + "}");
+    }
+    return iter->second;
+  }
+
+  /// Get the name of the event for a type of access
+  static const char* access_name(Access kind) noexcept {
+    switch (kind) {
+      case Access::Read:
+        return "read";
+      case Access::Write:
+        return "write";
+      case Access::Exec:
+        return "exec-file";
+    }
+    return "unknown";
+  }
+
+  void start(fs::path destination) noexcept {
+    // Connect to a Unix socket, or open anything else as a file
+    struct stat statbuf;
+    if (::stat(destination.c_str(), &statbuf) == 0 && S_ISSOCK(statbuf.st_mode)) {
+      struct sockaddr_un addr;
+      addr.sun_family = AF_UNIX;
+      if (destination.string().size() >= sizeof(addr.sun_path)) {
+        WARN << "Event socket path is too long: " << destination;
+        return;
+      }
+      strcpy(addr.sun_path, destination.c_str());
+
+      _fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      if (_fd >= 0 && ::connect(_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        ::close(_fd);
+        _fd = -1;
+      }
+
+    } else {
+      _fd = ::open(destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+
+    if (_fd < 0) {
+      WARN << "Failed to open " << destination << " to stream events: " << strerror(errno);
+      return;
+    }
+
+    _writer = std::thread(write_events);
+    enabled = true;
+  }
+
+  void exec(const Command& parent, const Command& child) noexcept {
+    if (!enabled) return;
+
+    unique_lock lock(_mutex);
+    auto parent_id = command_id(lock, parent);
+    auto child_id = command_id(lock, child);
+    emit(lock, "{\"type\":\"exec\",\"command\":" + to_string(child_id) +
+                   ",\"parent\":" + to_string(parent_id) + "}");
+  }
+
+  void access(const Command& c, const Artifact& a, Access kind) noexcept {
+    if (!enabled) return;
+
+    // Pipes and other anonymous artifacts have no path to report
+    auto path = a.getPath();
+    if (!path.has_value()) return;
+
+    access(c, path.value(), kind);
+  }
+
+  void access(const Command& c, const fs::path& path, Access kind) noexcept {
+    if (!enabled) return;
+
+    unique_lock lock(_mutex);
+    auto id = command_id(lock, c);
+    if (!_reported[id].emplace(path.string(), kind).second) return;
+
+    emit(lock, string("{\"type\":\"") + access_name(kind) + "\",\"command\":" + to_string(id) +
+                   ",\"path\":" + quote(path.string()) + "}");
+  }
+
+  void exit(const Command& c, int status) noexcept {
+    if (!enabled) return;
+
+    unique_lock lock(_mutex);
+    auto id = command_id(lock, c);
+    _reported.erase(id);
+    emit(lock, "{\"type\":\"exit\",\"command\":" + to_string(id) +
+                   ",\"status\":" + to_string(status) + "}");
+  }
+
+  void finish() noexcept {
+    if (!enabled) return;
+    enabled = false;
+
+    {
+      unique_lock lock(_mutex);
+      _stopping = true;
+      _ready.notify_one();
+    }
+
+    _writer.join();
+    ::close(_fd);
+    _fd = -1;
+
+    LOG(phase) << "Streamed events for " << _command_ids.size() << " commands";
+  }
+}
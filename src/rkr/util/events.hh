@@ -0,0 +1,64 @@
+#pragma once
+
+#include <filesystem>
+
+class Artifact;
+class Command;
+
+namespace fs = std::filesystem;
+
+/**
+ * The events namespace streams the dependencies of traced commands as they are observed (see
+ * --events). A scheduler running rkr in frontier mode can read the stream to start dependent work
+ * while a command is still running, instead of waiting for the final trace.
+ *
+ * Each event is one JSON object on its own line:
+ *   {"type":"command","command":N,"name":"..."}        The first time a command is mentioned
+ *   {"type":"exec","command":N,"parent":P}             Command P launched command N
+ *   {"type":"read","command":N,"path":"..."}           N read a file, directory, or symlink
+ *   {"type":"write","command":N,"path":"..."}          N wrote a file, or created, removed, or
+ *                                                      renamed the entry at this path
+ *   {"type":"exec-file","command":N,"path":"..."}      N runs this executable
+ *   {"type":"exit","command":N,"status":S}             N exited, so its sets are complete
+ *
+ * Changes to directory entries are reported as writes of the paths they affect, so a command that
+ * writes a temporary file and renames it over its output reports a write of the output. A rename
+ * reports both paths, and link, symlink, mkdir, and unlink report the path they create or remove.
+ * An open with O_CREAT reports a write if it creates the file.
+ *
+ * Each command reports each path at most once for each type of access. Events are written by a
+ * background thread from a bounded buffer. When the reader falls behind and the buffer fills, the
+ * tracer waits for space, which pauses the traced commands instead of dropping events.
+ *
+ * Streaming is off unless start() is called. Every recording function returns immediately when it
+ * is off, so callers don't need to check first.
+ */
+namespace events {
+  /// The ways a command can access an artifact
+  enum class Access { Read, Write, Exec };
+
+  /// Are events being streamed?
+  inline bool enabled = false;
+
+  /**
+   * Start streaming events. If the destination is a Unix socket, rkr connects to it. Otherwise it
+   * is opened for writing, which waits for a reader if the destination is a FIFO.
+   * \param destination The file, FIFO, or socket to write events to
+   */
+  void start(fs::path destination) noexcept;
+
+  /// Record that a traced command launched a child command
+  void exec(const Command& parent, const Command& child) noexcept;
+
+  /// Record an access to an artifact by a traced command. Artifacts without a path are skipped.
+  void access(const Command& c, const Artifact& a, Access kind) noexcept;
+
+  /// Record an access to a path by a traced command
+  void access(const Command& c, const fs::path& path, Access kind) noexcept;
+
+  /// Record that a traced command exited
+  void exit(const Command& c, int status) noexcept;
+
+  /// Write any buffered events and close the stream
+  void finish() noexcept;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/**
+ * Path components are interned to small integer IDs so directory entries can be stored and found
+ * by ID instead of by string. Each distinct component is stored once for the life of the process.
+ */
+namespace intern {
+  /// The type of an interned string ID
+  using ID = uint32_t;
+
+  /// Storage for interned strings. A deque keeps references stable as strings are added.
+  inline std::deque<std::string> _strings;
+
+  /// A map from each interned string to its ID
+  inline std::unordered_map<std::string_view, ID> _ids;
+
+  /// Get the ID for a string, interning it if this is the first time it has been seen
+  inline ID get(std::string_view s) noexcept {
+    auto iter = _ids.find(s);
+    if (iter != _ids.end()) return iter->second;
+
+    ID id = _strings.size();
+    const auto& stored = _strings.emplace_back(s);
+    _ids.emplace(stored, id);
+    return id;
+  }
+
+  /// Get the string for an interned ID
+  inline const std::string& name(ID id) noexcept {
+    return _strings[id];
+  }
+}
@@ -1,8 +1,13 @@
 #pragma once
+#include <cstdint>
 #include <filesystem>
+#include <optional>
+#include <string>
 
 enum class FingerprintLevel { None, Local, All };
 
+enum class CacheStorage { Auto, Hardlink, Copy };
+
 // Namespace to contain global flags that control build behavior
 namespace options {
   // The length limit for commands printed to the terminal
@@ -33,9 +38,41 @@ namespace options {
   /// Enable file-staging cache
   inline bool enable_cache = true;
 
+  /// How file contents are stored in and restored from the cache
+  inline CacheStorage cache_storage = CacheStorage::Auto;
+
+  /// Copy files into the content cache on a background thread
+  inline bool async_cache = true;
+
+  /// Store large files in the content cache as deduplicated chunks
+  inline bool cache_chunks = false;
+
+  /// The size limit for the content cache in bytes, or zero for no limit
+  inline uint64_t cache_size_limit = 0;
+
+  /// A cache directory to use in place of the one in the database directory. Several workspaces
+  /// can share one cache directory.
+  inline std::optional<std::filesystem::path> cache_dir;
+
+  /// The address of a cache server to fetch and upload cached files, or empty for none
+  inline std::string cache_server;
+
+  /// Stat the paths the last build used on background threads before they are needed
+  inline bool prefetch_stats = true;
+
+  /// Compute post-build predicates by emulating the last phase's trace again, instead of applying
+  /// the outcomes recorded while the phase ran
+  inline bool replay_post_build = false;
+
+  /// Write a timeline of the build to this path in the Chrome trace-event format
+  inline std::optional<std::filesystem::path> timeline;
+
   /// PaSH: Enable frontier mode
   inline bool frontier = false;
 
+  /// Stream the dependencies of traced commands to this file, FIFO, or Unix socket as JSON lines
+  inline std::optional<std::filesystem::path> events;
+
   inline std::filesystem::path db_dir = ".rkr";
 
   inline std::string rikerfile = "Rikerfile";
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <thread>
+#include <utility>
+
+#include "util/log.hh"
+#include "util/stats.hh"
+
+/**
+ * Small objects that are created for every IR step (references, versions, and directory entries)
+ * are allocated from size-class free lists instead of the general-purpose heap. Blocks are carved
+ * from large chunks and recycled when objects are freed, which keeps allocation cheap and avoids
+ * fragmenting the heap while each build phase rebuilds these objects from the trace.
+ *
+ * Chunks are never returned to the system; they live until the rkr process exits. The pools are
+ * not thread-safe, which is fine because build phases run on a single thread. Each free list is
+ * owned by the first thread that takes a block from it, and debug builds check that every block is
+ * taken and given back on that thread.
+ */
+namespace pool {
+  /// The number of blocks carved from each chunk
+  enum { blocks_per_chunk = 1024 };
+
+  /// A free list of fixed-size blocks. There is one free list for each size and alignment
+  template <size_t Size, size_t Align>
+  class FreeList {
+   public:
+    /// Take a block from the free list, allocating a new chunk if the list is empty
+    static void* take() noexcept {
+      checkOwner();
+      if (_free == nullptr) grow();
+
+      stats::pool_allocations++;
+
+      auto b = _free;
+      _free = b->next;
+      return b;
+    }
+
+    /// Return a block to the free list
+    static void give(void* p) noexcept {
+      checkOwner();
+      auto b = static_cast<Block*>(p);
+      b->next = _free;
+      _free = b;
+    }
+
+   private:
+    /// Make sure the free list is only used by the thread that owns it
+    static void checkOwner() noexcept {
+#ifndef NDEBUG
+      if (_owner == std::thread::id()) _owner = std::this_thread::get_id();
+      ASSERT(_owner == std::this_thread::get_id())
+          << "Pooled objects must be created and freed on the thread that owns the pool";
+#endif
+    }
+
+    /// Each block either holds an object or points to the next free block
+    union Block {
+      Block* next;
+      alignas(Align) std::byte data[Size];
+    };
+
+    /// Allocate a new chunk and thread its blocks onto the free list
+    static void grow() noexcept {
+      auto chunk = static_cast<Block*>(
+          ::operator new(sizeof(Block) * blocks_per_chunk, std::align_val_t(alignof(Block))));
+
+      for (size_t i = 0; i < blocks_per_chunk; i++) {
+        chunk[i].next = _free;
+        _free = &chunk[i];
+      }
+
+      stats::pool_chunks++;
+    }
+
+    /// The head of the free list
+    inline static Block* _free = nullptr;
+
+    /// The thread that owns the free list, or no thread if it has not been used yet
+    inline static std::thread::id _owner;
+  };
+}
+
+/// An allocator that places single objects in the size-class pools, and falls back to the heap
+/// for arrays
+template <class T>
+class PoolAllocator {
+ public:
+  using value_type = T;
+
+  PoolAllocator() noexcept = default;
+
+  template <class U>
+  PoolAllocator(const PoolAllocator<U>&) noexcept {}
+
+  T* allocate(size_t n) noexcept {
+    if (n != 1) return std::allocator<T>().allocate(n);
+    return static_cast<T*>(pool::FreeList<sizeof(T), alignof(T)>::take());
+  }
+
+  void deallocate(T* p, size_t n) noexcept {
+    if (n != 1) return std::allocator<T>().deallocate(p, n);
+    pool::FreeList<sizeof(T), alignof(T)>::give(p);
+  }
+
+  template <class U>
+  bool operator==(const PoolAllocator<U>&) const noexcept {
+    return true;
+  }
+
+  template <class U>
+  bool operator!=(const PoolAllocator<U>&) const noexcept {
+    return false;
+  }
+};
+
+/// Create an object with shared ownership in the pools. The object and its reference count share
+/// a single pooled block, just like make_shared.
+template <class T, typename... Args>
+std::shared_ptr<T> make_pooled(Args&&... args) noexcept {
+  return std::allocate_shared<T>(PoolAllocator<T>(), std::forward<Args>(args)...);
+}
@@ -0,0 +1,421 @@
+#include "remote.hh"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "blake3.h"
+#include "util/log.hh"
+#include "util/options.hh"
+#include "util/storage.hh"
+
+using std::deque;
+using std::make_shared;
+using std::map;
+using std::mutex;
+using std::promise;
+using std::shared_future;
+using std::shared_ptr;
+using std::string;
+using std::unique_lock;
+
+namespace fs = std::filesystem;
+
+namespace remote {
+  /// Write an entire buffer to a socket. Returns false on failure. A closed connection is
+  /// reported as an error rather than with SIGPIPE, which rkr must not ignore because commands
+  /// would inherit the disposition.
+  static bool send_all(int fd, const void* data, size_t len) noexcept {
+    auto p = static_cast<const char*>(data);
+    while (len > 0) {
+      ssize_t n = ::send(fd, p, len, MSG_NOSIGNAL);
+      if (n == -1 && errno == EINTR) continue;
+      if (n <= 0) return false;
+      p += n;
+      len -= n;
+    }
+    return true;
+  }
+
+  /// Write an entire buffer to a file. Returns false on failure.
+  static bool write_all(int fd, const void* data, size_t len) noexcept {
+    auto p = static_cast<const char*>(data);
+    while (len > 0) {
+      ssize_t n = ::write(fd, p, len);
+      if (n == -1 && errno == EINTR) continue;
+      if (n <= 0) return false;
+      p += n;
+      len -= n;
+    }
+    return true;
+  }
+
+  /// Read an entire buffer from a file descriptor. Returns false on failure or end of file.
+  static bool read_all(int fd, void* data, size_t len) noexcept {
+    auto p = static_cast<char*>(data);
+    while (len > 0) {
+      ssize_t n = ::read(fd, p, len);
+      if (n == -1 && errno == EINTR) continue;
+      if (n <= 0) return false;
+      p += n;
+      len -= n;
+    }
+    return true;
+  }
+
+  /// Open a connection to a cache server. The address is either a path to a Unix socket, written
+  /// as "unix:PATH" or an absolute path, or a loopback TCP address written as "HOST:PORT".
+  static int connect_to(const string& address) noexcept {
+    string path;
+    if (address.rfind("unix:", 0) == 0) {
+      path = address.substr(5);
+    } else if (!address.empty() && address[0] == '/') {
+      path = address;
+    }
+
+    // Connect to a Unix socket
+    if (!path.empty()) {
+      struct sockaddr_un addr = {};
+      addr.sun_family = AF_UNIX;
+      if (path.size() >= sizeof(addr.sun_path)) return -1;
+      strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+      int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      if (fd == -1) return -1;
+      if (::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == -1) {
+        ::close(fd);
+        return -1;
+      }
+      return fd;
+    }
+
+    // Connect over TCP
+    auto colon = address.rfind(':');
+    if (colon == string::npos) return -1;
+    auto host = address.substr(0, colon);
+    auto port = address.substr(colon + 1);
+
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo* result;
+    if (::getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0) return -1;
+
+    int fd = -1;
+    for (auto ai = result; ai != nullptr; ai = ai->ai_next) {
+      fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+      if (fd == -1) continue;
+      if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+      ::close(fd);
+      fd = -1;
+    }
+    ::freeaddrinfo(result);
+
+    return fd;
+  }
+
+  /// A request waiting to be sent, or waiting for its response
+  struct Request {
+    Op op;
+    Hash hash;
+    fs::path path;
+    promise<bool> done;
+  };
+
+  /// A connection to the cache server, with threads that send requests and receive responses
+  class Client {
+   public:
+    Client(int fd) noexcept : _fd(fd) {
+      std::thread([this] { sendRequests(); }).detach();
+      std::thread([this] { receiveResponses(); }).detach();
+    }
+
+    /// Queue a request. Returns a future for the request's result. A fetch of content that is
+    /// already being fetched to the same path shares the earlier request.
+    shared_future<bool> submit(Op op, const Hash& hash, fs::path path) noexcept {
+      unique_lock lock(_mutex);
+
+      if (op == Get) {
+        auto iter = _fetches.find({hash, path});
+        if (iter != _fetches.end()) return iter->second;
+      }
+
+      auto r = make_shared<Request>();
+      r->op = op;
+      r->hash = hash;
+      r->path = path;
+      shared_future<bool> result = r->done.get_future().share();
+
+      if (_failed) {
+        r->done.set_value(false);
+      } else {
+        _to_send.push_back(r);
+        if (op == Get) _fetches.emplace(std::make_pair(hash, path), result);
+        _changed.notify_all();
+      }
+      return result;
+    }
+
+    /// Wait until every queued request has received a response
+    void flush() noexcept {
+      unique_lock lock(_mutex);
+      _changed.wait(lock, [this] { return _to_send.empty() && _in_flight.empty(); });
+    }
+
+   private:
+    /// Send queued requests without waiting for responses
+    void sendRequests() noexcept {
+      while (true) {
+        shared_ptr<Request> r;
+        {
+          unique_lock lock(_mutex);
+          _changed.wait(lock, [this] { return _failed || !_to_send.empty(); });
+          if (_failed) return;
+          r = _to_send.front();
+          _to_send.pop_front();
+          _in_flight.push_back(r);
+        }
+
+        if (!sendRequest(r)) {
+          fail("Failed to send a request to the cache server");
+          return;
+        }
+      }
+    }
+
+    /// Send a single request
+    bool sendRequest(const shared_ptr<Request>& r) noexcept {
+      if (r->op == Get) {
+        return send_all(_fd, &r->op, sizeof(r->op)) && send_all(_fd, r->hash.data(), HashLength);
+      }
+
+      // Send a put request with the file's contents. If the file can't be read, the request is
+      // dropped without sending anything, so no response will arrive for it.
+      int file_fd = ::open(r->path.c_str(), O_RDONLY | O_CLOEXEC);
+      struct stat statbuf;
+      if (file_fd == -1 || ::fstat(file_fd, &statbuf) == -1) {
+        if (file_fd != -1) ::close(file_fd);
+
+        unique_lock lock(_mutex);
+        auto iter = std::find(_in_flight.begin(), _in_flight.end(), r);
+        if (iter != _in_flight.end()) {
+          r->done.set_value(false);
+          _in_flight.erase(iter);
+          _changed.notify_all();
+        }
+        return true;
+      }
+
+      uint64_t size = statbuf.st_size;
+      bool ok = send_all(_fd, &r->op, sizeof(r->op)) && send_all(_fd, r->hash.data(), HashLength) &&
+                send_all(_fd, &size, sizeof(size));
+
+      // Cached files never change, so a short read means something is badly wrong. The server
+      // would store incomplete content, so give up on the connection instead.
+      char buf[65536];
+      while (ok && size > 0) {
+        size_t chunk = size < sizeof(buf) ? size : sizeof(buf);
+        ok = read_all(file_fd, buf, chunk) && send_all(_fd, buf, chunk);
+        size -= chunk;
+      }
+
+      ::close(file_fd);
+      return ok;
+    }
+
+    /// Receive responses, which arrive in the order requests were sent
+    void receiveResponses() noexcept {
+      while (true) {
+        uint8_t status;
+        if (!read_all(_fd, &status, sizeof(status))) {
+          fail("Lost connection to the cache server");
+          return;
+        }
+
+        shared_ptr<Request> r;
+        {
+          unique_lock lock(_mutex);
+          if (_in_flight.empty()) {
+            fail("Received an unexpected response from the cache server");
+            return;
+          }
+          r = _in_flight.front();
+        }
+
+        bool result = status == Ok;
+        if (result && r->op == Get) {
+          uint64_t size;
+          bool connected = read_all(_fd, &size, sizeof(size));
+          if (connected) result = receiveFile(r->hash, r->path, size, connected);
+          if (!connected) {
+            fail("Failed to receive a file from the cache server");
+            return;
+          }
+        }
+
+        // Promises are only set with the lock held, so a concurrent failure can't set one twice
+        unique_lock lock(_mutex);
+        if (_failed) return;
+        r->done.set_value(result);
+        _in_flight.pop_front();
+        if (r->op == Get) _fetches.erase({r->hash, r->path});
+        _changed.notify_all();
+      }
+    }
+
+    /**
+     * Receive a file's contents and save them at a path. The file appears atomically, and only if
+     * its contents match the expected hash.
+     * \param hash      The hash the contents must have
+     * \param path      The path where the file should be saved
+     * \param size      The number of bytes the server is sending
+     * \param connected Cleared if the connection failed, so the server's responses can't be read
+     * \returns true if the file was saved
+     */
+    bool receiveFile(const Hash& hash,
+                     const fs::path& path,
+                     uint64_t size,
+                     bool& connected) noexcept {
+      std::error_code ec;
+      fs::create_directories(path.parent_path(), ec);
+
+      auto tmp = storage::temp_path(path);
+      int file_fd =
+          ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, storage::EntryMode);
+
+      blake3_hasher hasher;
+      blake3_hasher_init(&hasher);
+
+      // Read the contents even if they can't be saved, to stay in sync with the server
+      char buf[65536];
+      bool saved = file_fd != -1;
+      while (size > 0) {
+        size_t chunk = size < sizeof(buf) ? size : sizeof(buf);
+        if (!read_all(_fd, buf, chunk)) {
+          if (file_fd != -1) ::close(file_fd);
+          ::unlink(tmp.c_str());
+          connected = false;
+          return false;
+        }
+        blake3_hasher_update(&hasher, buf, chunk);
+        if (saved) saved = write_all(file_fd, buf, chunk);
+        size -= chunk;
+      }
+
+      if (file_fd != -1) ::close(file_fd);
+
+      Hash received;
+      blake3_hasher_finalize(&hasher, received.data(), received.size());
+      if (saved && received != hash) {
+        WARN << "Discarded " << path << " from the cache server because its content is wrong";
+        ::unlink(tmp.c_str());
+        return false;
+      }
+
+      if (!saved || !storage::publish(tmp, path)) {
+        WARN << "Failed to save " << path << " from the cache server: " << ERR;
+        ::unlink(tmp.c_str());
+        return false;
+      }
+
+      return true;
+    }
+
+    /// Give up on the connection. Every pending request fails.
+    void fail(const char* message) noexcept {
+      unique_lock lock(_mutex);
+      if (_failed) return;
+      WARN << message;
+      _failed = true;
+
+      for (auto& r : _to_send) r->done.set_value(false);
+      for (auto& r : _in_flight) r->done.set_value(false);
+      _to_send.clear();
+      _in_flight.clear();
+      _fetches.clear();
+
+      ::shutdown(_fd, SHUT_RDWR);
+      _changed.notify_all();
+    }
+
+    /// The connection to the server
+    int _fd;
+
+    /// Protects the request queues
+    mutex _mutex;
+
+    /// Signalled whenever a queue changes
+    std::condition_variable _changed;
+
+    /// Requests that have not been sent yet
+    deque<shared_ptr<Request>> _to_send;
+
+    /// Requests that have been sent and are waiting for a response, in order
+    deque<shared_ptr<Request>> _in_flight;
+
+    /// The results of fetches that have not finished, by hash and destination
+    map<std::pair<Hash, fs::path>, shared_future<bool>> _fetches;
+
+    /// Set if the connection failed
+    bool _failed = false;
+  };
+
+  /// Get the client for the configured cache server, connecting on first use. Returns nullptr if
+  /// no server is configured or the connection failed.
+  static Client* get_client() noexcept {
+    // The client is never destroyed, because its threads run until the process exits
+    static Client* client = [] () -> Client* {
+      if (options::cache_server.empty()) return nullptr;
+
+      int fd = connect_to(options::cache_server);
+      if (fd == -1) {
+        WARN << "Unable to connect to cache server " << options::cache_server << ": " << ERR;
+        return nullptr;
+      }
+
+      LOG(cache) << "Connected to cache server " << options::cache_server;
+      return new Client(fd);
+    }();
+
+    return client;
+  }
+
+  bool enabled() noexcept {
+    return get_client() != nullptr;
+  }
+
+  shared_future<bool> fetch(const Hash& hash, fs::path dest) noexcept {
+    auto client = get_client();
+    if (!client) {
+      promise<bool> p;
+      p.set_value(false);
+      return p.get_future().share();
+    }
+    return client->submit(Get, hash, dest);
+  }
+
+  void upload(const Hash& hash, fs::path src) noexcept {
+    if (auto client = get_client(); client) client->submit(Put, hash, src);
+  }
+
+  void flush() noexcept {
+    if (auto client = get_client(); client) client->flush();
+  }
+}
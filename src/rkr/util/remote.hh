@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <future>
+#include <string>
+
+namespace fs = std::filesystem;
+
+/**
+ * The remote namespace talks to a content-addressed cache server (see rkr-cache-server). The
+ * server stores file contents keyed by their BLAKE3 hash, so a build can fetch outputs that were
+ * cached by a build on another machine or in another checkout.
+ *
+ * Requests are sent over a single Unix socket or loopback TCP connection. A writer thread sends
+ * requests as soon as they are queued without waiting for earlier responses, and a reader thread
+ * handles responses in order, so many uploads and fetches can be in flight at once.
+ *
+ * Content is checked against its BLAKE3 hash when the server receives an upload and when a
+ * client receives a fetched file, and mismatched content is discarded. The server never replaces
+ * content it already has.
+ *
+ * The protocol is a simple sequence of requests and responses:
+ *   Request:  op (1 byte), hash (32 bytes), and for Put, size (8 bytes) followed by the content
+ *   Response: status (1 byte), and for a successful Get, size (8 bytes) followed by the content
+ * Sizes are sent in the host's byte order; the server is expected to run on the same host.
+ */
+namespace remote {
+  /// The length of a content hash
+  enum : size_t { HashLength = 32 };
+
+  /// The type of a content hash
+  using Hash = std::array<uint8_t, HashLength>;
+
+  /// The operations a client can request
+  enum Op : uint8_t { Get = 'G', Put = 'P' };
+
+  /// The status codes a server can return
+  enum Status : uint8_t { Ok = 0, Missing = 1, Error = 2 };
+
+  /// Is a cache server configured?
+  bool enabled() noexcept;
+
+  /**
+   * Fetch content from the cache server. Fetches are sent without waiting for earlier responses,
+   * so callers should start every fetch they will need before waiting on any of them.
+   * \param hash The hash of the content to fetch
+   * \param dest The path where the content should be saved. The file appears atomically, and
+   *             only if its contents match the hash.
+   * \returns a future that is set to true if the content was fetched
+   */
+  std::shared_future<bool> fetch(const Hash& hash, fs::path dest) noexcept;
+
+  /**
+   * Upload content to the cache server. The upload happens in the background.
+   * \param hash The hash of the content to upload
+   * \param src  The path to a file with the content. It must not change until the upload is done.
+   */
+  void upload(const Hash& hash, fs::path src) noexcept;
+
+  /// Wait for all outstanding requests to finish
+  void flush() noexcept;
+
+  /**
+   * Get the path where content with a given hash is stored, relative to a cache directory. The
+   * local cache and the cache server use the same three-level directory prefix scheme, which
+   * avoids having too many files in one directory.
+   */
+  inline fs::path hash_path(const Hash& hash) noexcept {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    for (auto byte : hash) {
+      hex += digits[byte >> 4];
+      hex += digits[byte & 0xf];
+    }
+    return fs::path(hex.substr(0, 2)) / hex.substr(2, 2) / hex.substr(4, 2) / hex;
+  }
+}
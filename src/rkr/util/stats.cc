@@ -1,10 +1,16 @@
 #include "stats.hh"
 
+#include <array>
 #include <chrono>
+#include <cstdint>
 #include <fstream>
 #include <optional>
+#include <sstream>
 #include <string>
 
+#include <sys/resource.h>
+
+using std::array;
 using std::endl;
 using std::fstream;
 using std::optional;
@@ -16,8 +22,64 @@ namespace fs = std::filesystem;
 #define HEADER                                                                         \
   {                                                                                    \
     "phase", "emulated_commands", "traced_commands", "emulated_steps", "traced_steps", \
-        "artifacts", "versions", "ptrace_stops", "syscalls", "elapsed_ns"              \
+        "artifacts", "versions", "ptrace_stops", "syscalls", "elapsed_ns",             \
+        "promoted_commands", "pool_allocations", "pool_chunks", "max_rss_kb",          \
+        "resolution_hits", "resolution_misses", "cache_hits", "cache_misses",          \
+        "cache_bytes_saved", "cache_bytes_evicted", "trace_load_ns", "emulation_ns",   \
+        "tracing_ns", "fingerprint_ns", "cache_ns", "commit_ns", "post_build_ns",      \
+        "db_write_ns", "phase_count"                                                   \
+  }
+
+namespace stats {
+  /// The CSV column and display name for each timer, in the order of the Timer enum
+  static const char* TimerNames[TimerCount][2] = {{"trace_load_ns", "Trace Load"},
+                                                  {"emulation_ns", "Emulation"},
+                                                  {"tracing_ns", "Tracing"},
+                                                  {"fingerprint_ns", "Fingerprinting"},
+                                                  {"cache_ns", "Caching"},
+                                                  {"commit_ns", "Commit"},
+                                                  {"post_build_ns", "Post-Build Checks"},
+                                                  {"db_write_ns", "Database Write"}};
+
+  const char* timer_column(size_t index) noexcept {
+    return TimerNames[index][0];
+  }
+
+  const char* timer_label(size_t index) noexcept {
+    return TimerNames[index][1];
+  }
+
+  void save_timers(fs::path path) noexcept {
+    std::ofstream output(path);
+    for (size_t i = 0; i < TimerCount; i++) {
+      output << timer_column(i) << " " << timer_ns[i].load(std::memory_order_relaxed) << endl;
+    }
+  }
+
+  optional<array<uint64_t, TimerCount>> load_timers(fs::path path) noexcept {
+    std::ifstream input(path);
+    if (!input) return std::nullopt;
+
+    array<uint64_t, TimerCount> result = {};
+    string column;
+    uint64_t ns;
+    while (input >> column >> ns) {
+      for (size_t i = 0; i < TimerCount; i++) {
+        if (column == timer_column(i)) result[i] = ns;
+      }
+    }
+    return result;
   }
+}
+
+/**
+ * Get the peak resident set size of this process in kilobytes.
+ */
+long max_rss_kb() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+  return usage.ru_maxrss;
+}
 
 /**
  * Quote string.
@@ -60,18 +122,26 @@ int stats_header(string& header) {
 /**
  * Write stats to CSV.
  */
-void write_stats(optional<fs::path> p, optional<string> stats) {
-  if (p.has_value()) {  // if the log doesn't exist, write a header
-    if (!std::filesystem::exists(p.value())) {
+void write_stats(optional<fs::path> p, optional<string> stats, size_t phases) {
+  if (p.has_value()) {
+    // Add the phase count to the end of each row
+    string rows;
+    std::istringstream lines(stats.value());
+    string line;
+    while (std::getline(lines, line)) {
+      rows += line + "," + q(to_string(phases)) + "\n";
+    }
+
+    if (!std::filesystem::exists(p.value())) {  // if the log doesn't exist, write a header
       string header = "";
       stats_header(header);
       std::ofstream output(p.value());
-      output << header << endl << stats.value() << endl;
+      output << header << endl << rows;
       output.close();
     } else {  // otherwise, append
       std::ofstream output;
       output.open(p.value(), std::ostream::out | std::ostream::app);
-      output << stats.value() << endl;
+      output << rows;
       output.close();
     }
   }
@@ -105,6 +175,19 @@ void gather_stats(optional<fs::path> p, optional<string>& stats_opt, int phase)
     stats_opt.value() += q(to_string(stats::versions)) + ",";
     stats_opt.value() += q(to_string(stats::ptrace_stops)) + ",";
     stats_opt.value() += q(std::to_string(stats::syscalls)) + ",";
-    stats_opt.value() += q(std::to_string((end_time - stats::start_time).count()));
+    stats_opt.value() += q(std::to_string((end_time - stats::start_time).count())) + ",";
+    stats_opt.value() += q(std::to_string(stats::promoted_commands)) + ",";
+    stats_opt.value() += q(std::to_string(stats::pool_allocations)) + ",";
+    stats_opt.value() += q(std::to_string(stats::pool_chunks)) + ",";
+    stats_opt.value() += q(std::to_string(max_rss_kb())) + ",";
+    stats_opt.value() += q(std::to_string(stats::resolution_hits)) + ",";
+    stats_opt.value() += q(std::to_string(stats::resolution_misses)) + ",";
+    stats_opt.value() += q(std::to_string(stats::cache_hits)) + ",";
+    stats_opt.value() += q(std::to_string(stats::cache_misses)) + ",";
+    stats_opt.value() += q(std::to_string(stats::cache_bytes_saved)) + ",";
+    stats_opt.value() += q(std::to_string(stats::cache_bytes_evicted));
+    for (size_t i = 0; i < stats::TimerCount; i++) {
+      stats_opt.value() += "," + q(std::to_string(stats::timer_elapsed(i)));
+    }
   }
 }
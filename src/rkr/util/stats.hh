@@ -1,11 +1,16 @@
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <chrono>
 #include <cstddef>
+#include <cstdint>
 #include <filesystem>
 #include <optional>
 #include <string>
 
+#include "util/timeline.hh"
+
 namespace fs = std::filesystem;
 
 namespace stats {
@@ -35,8 +40,147 @@ namespace stats {
 
   /// The total number of traced syscalls
   inline size_t syscalls = 0;
+
+  /// The number of MayRun commands promoted to MustRun without waiting for another phase
+  inline size_t promoted_commands = 0;
+
+  /// The number of objects allocated from the small-object pools
+  inline size_t pool_allocations = 0;
+
+  /// The number of chunks the small-object pools allocated from the heap
+  inline size_t pool_chunks = 0;
+
+  /// The number of path resolutions answered from the resolution cache
+  inline size_t resolution_hits = 0;
+
+  /// The number of path resolutions that had to walk the path
+  inline size_t resolution_misses = 0;
+
+  /// The number of lookups that found a file already in the content cache. The cache counters
+  /// are updated from the background caching thread too, so they are atomic.
+  inline std::atomic<size_t> cache_hits = 0;
+
+  /// The number of lookups that added a file to the content cache
+  inline std::atomic<size_t> cache_misses = 0;
+
+  /// The number of bytes that did not need to be copied into the cache or regenerated
+  inline std::atomic<size_t> cache_bytes_saved = 0;
+
+  /// The number of bytes evicted from the content cache
+  inline std::atomic<size_t> cache_bytes_evicted = 0;
+
+  /// The subsystems with their own timers. Update TimerNames in stats.cc when adding a timer.
+  enum class Timer : size_t {
+    TraceLoad,
+    Emulation,
+    Tracing,
+    Fingerprint,
+    Cache,
+    Commit,
+    PostBuild,
+    DatabaseWrite,
+    Count
+  };
+
+  /// The number of timers
+  enum : size_t { TimerCount = static_cast<size_t>(Timer::Count) };
+
+  /// The total time spent in each timer since the process started, in nanoseconds. Timers are
+  /// updated from background threads too, so the totals are atomic.
+  inline std::array<std::atomic<uint64_t>, TimerCount> timer_ns = {};
+
+  /// The timer totals when the stats counters were last reset
+  inline std::array<uint64_t, TimerCount> timer_base_ns = {};
+
+  /// Get the column name used for a timer in the stats CSV
+  const char* timer_column(size_t index) noexcept;
+
+  /// Get the name used for a timer in `rkr stats`
+  const char* timer_label(size_t index) noexcept;
+
+  /**
+   * A ScopedTimer adds the time between its creation and destruction to a timer. Timers nest:
+   * while a timer runs on a thread, any timer it encloses pauses it. Each timer reports only the
+   * time that is not claimed by a nested timer, so the totals don't overlap. Use the TIME_SCOPE
+   * macro, which compiles to nothing when rkr is built with -DRKR_NO_TIMERS.
+   *
+   * When a timeline is being recorded, each scope also appears on it as a span that covers the
+   * scope's whole lifetime, including any nested timers.
+   */
+  class ScopedTimer {
+   public:
+    /// Start timing a subsystem
+    ScopedTimer(Timer timer) noexcept : _timer(timer), _parent(_current) {
+      _start = _began = std::chrono::steady_clock::now();
+      if (_parent) _parent->pause(_start);
+      _current = this;
+    }
+
+    /// Stop timing, and resume the enclosing timer
+    ~ScopedTimer() noexcept {
+      auto now = std::chrono::steady_clock::now();
+      pause(now);
+      if (_parent) _parent->_start = now;
+      _current = _parent;
+
+      if (timeline::enabled) {
+        timeline::span("timer", timer_label(static_cast<size_t>(_timer)), _began, now);
+      }
+    }
+
+    // Disallow copy and move
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+   private:
+    /// Add the time since this timer last started to its total
+    void pause(std::chrono::steady_clock::time_point now) noexcept {
+      auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - _start).count();
+      timer_ns[static_cast<size_t>(_timer)].fetch_add(elapsed, std::memory_order_relaxed);
+    }
+
+    /// The timer this scope adds to
+    Timer _timer;
+
+    /// The time this scope was created
+    std::chrono::steady_clock::time_point _began;
+
+    /// The time this scope last started or resumed
+    std::chrono::steady_clock::time_point _start;
+
+    /// The enclosing timer on this thread, if any
+    ScopedTimer* _parent;
+
+    /// The innermost running timer on this thread
+    inline static thread_local ScopedTimer* _current = nullptr;
+  };
+
+  /// Get the time spent in a timer since the stats counters were last reset
+  inline uint64_t timer_elapsed(size_t index) noexcept {
+    return timer_ns[index].load(std::memory_order_relaxed) - timer_base_ns[index];
+  }
+
+  /**
+   * Save the total time in each timer, so `rkr stats --timers` can print them later
+   * \param path The file to write
+   */
+  void save_timers(fs::path path) noexcept;
+
+  /**
+   * Load timer totals saved by save_timers
+   * \param path The file to read
+   * \returns the totals, or nullopt if the file could not be read
+   */
+  std::optional<std::array<uint64_t, TimerCount>> load_timers(fs::path path) noexcept;
 }
 
+/// Time the rest of the enclosing scope as part of a subsystem's timer (see stats::ScopedTimer)
+#ifdef RKR_NO_TIMERS
+#define TIME_SCOPE(timer)
+#else
+#define TIME_SCOPE(timer) stats::ScopedTimer _scoped_timer(stats::Timer::timer)
+#endif
+
 /// Reset all stats counters to their default values
 inline static void reset_stats() noexcept {
   stats::start_time = std::chrono::high_resolution_clock::now();
@@ -48,12 +192,25 @@ inline static void reset_stats() noexcept {
   stats::versions = 0;
   stats::ptrace_stops = 0;
   stats::syscalls = 0;
+  stats::promoted_commands = 0;
+  stats::pool_allocations = 0;
+  stats::pool_chunks = 0;
+  stats::resolution_hits = 0;
+  stats::resolution_misses = 0;
+  stats::cache_hits = 0;
+  stats::cache_misses = 0;
+  stats::cache_bytes_saved = 0;
+  stats::cache_bytes_evicted = 0;
+  for (size_t i = 0; i < stats::TimerCount; i++) {
+    stats::timer_base_ns[i] = stats::timer_ns[i].load(std::memory_order_relaxed);
+  }
 }
 
 /**
- * Write stats to CSV.
+ * Write stats to CSV. Every row is tagged with the number of phases the whole build took, which
+ * is only known once the build finishes.
  */
-void write_stats(std::optional<fs::path> p, std::optional<std::string> stats);
+void write_stats(std::optional<fs::path> p, std::optional<std::string> stats, size_t phases);
 
 /**
  * Generate a stats row fragment in CSV format
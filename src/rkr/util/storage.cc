@@ -0,0 +1,245 @@
+#include "storage.hh"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "util/log.hh"
+#include "util/options.hh"
+
+using std::lock_guard;
+using std::map;
+using std::mutex;
+using std::pair;
+
+namespace fs = std::filesystem;
+
+namespace storage {
+  // The size of the buffer used for read/write copies
+  enum : size_t { COPYBUFSZ = 1 << 20 };
+
+  /// The ways file contents can be copied, from most to least preferred
+  enum class Method { Reflink, CopyRange, SendFile, ReadWrite };
+
+  /// The methods known to work between a pair of filesystems
+  struct Support {
+    /// Can files be hard linked between these filesystems?
+    bool link = true;
+
+    /// The most preferred copy method that has not failed between these filesystems
+    Method method = Method::Reflink;
+  };
+
+  /// Probed support for each (source device, destination device) pair
+  static map<pair<dev_t, dev_t>, Support> _support;
+
+  /// Protects the probed support map. Files may be cached from a background thread.
+  static mutex _support_mutex;
+
+  /// Check if an errno value means an operation is not supported, rather than failed
+  static bool unsupported(int err) noexcept {
+    return err == EXDEV || err == EOPNOTSUPP || err == ENOTTY || err == ENOSYS || err == EINVAL ||
+           err == EPERM || err == EMLINK;
+  }
+
+  /// Get the name of a copy method
+  static const char* method_name(Method m) noexcept {
+    switch (m) {
+      case Method::Reflink:
+        return "reflink";
+      case Method::CopyRange:
+        return "copy_file_range";
+      case Method::SendFile:
+        return "sendfile";
+      case Method::ReadWrite:
+        return "read/write";
+    }
+    return "unknown";
+  }
+
+  /// Copy len bytes from src_fd to dst_fd using a specific method. Returns 0 on success, or an
+  /// errno value if the copy failed.
+  static int copy_with(Method m, int src_fd, int dst_fd, loff_t len) noexcept {
+    if (m == Method::Reflink) {
+      if (::ioctl(dst_fd, FICLONE, src_fd) == -1) return errno;
+
+    } else if (m == Method::CopyRange) {
+      loff_t in_off = 0;
+      loff_t out_off = 0;
+      while (in_off < len) {
+        ssize_t n = ::copy_file_range(src_fd, &in_off, dst_fd, &out_off, len - in_off, 0);
+        if (n == -1) return errno;
+        if (n == 0) break;
+      }
+
+    } else if (m == Method::SendFile) {
+      off_t in_off = 0;
+      while (in_off < len) {
+        ssize_t n = ::sendfile(dst_fd, src_fd, &in_off, len - in_off);
+        if (n == -1) return errno;
+        if (n == 0) break;
+      }
+
+    } else {
+      auto buf = std::make_unique<char[]>(COPYBUFSZ);
+      if (::lseek(src_fd, 0, SEEK_SET) == -1) return errno;
+
+      ssize_t bytes_read;
+      while ((bytes_read = ::read(src_fd, buf.get(), COPYBUFSZ)) != 0) {
+        if (bytes_read == -1) return errno;
+
+        ssize_t written = 0;
+        while (written < bytes_read) {
+          ssize_t n = ::write(dst_fd, buf.get() + written, bytes_read - written);
+          if (n == -1) return errno;
+          written += n;
+        }
+      }
+    }
+
+    return 0;
+  }
+
+  bool copy(fs::path src, fs::path dest, mode_t mode, bool replace) noexcept {
+    // Stat the source file, and the directory that will hold the destination
+    struct stat src_stat;
+    if (::stat(src.c_str(), &src_stat) == -1) return false;
+
+    auto dest_dir = dest.has_parent_path() ? dest.parent_path() : fs::path(".");
+    struct stat dir_stat;
+    if (::stat(dest_dir.c_str(), &dir_stat) == -1) return false;
+
+    // Find the methods known to work between these filesystems, or start with the fastest
+    pair<dev_t, dev_t> devices = {src_stat.st_dev, dir_stat.st_dev};
+    Support support;
+    {
+      lock_guard lock(_support_mutex);
+      auto [iter, added] = _support.try_emplace(devices);
+      if (added && options::cache_storage == CacheStorage::Copy) {
+        iter->second.method = Method::CopyRange;
+      }
+      support = iter->second;
+    }
+
+    // Record a method that turned out not to work so later copies skip it
+    auto remember = [&] {
+      lock_guard lock(_support_mutex);
+      _support[devices] = support;
+    };
+
+    // Remove any existing file first. It may be a hard link to a file in the cache, which must
+    // not be written through.
+    if (replace && ::unlink(dest.c_str()) == -1 && errno != ENOENT) return false;
+
+    // Try a hard link first if hard link storage was requested. The source is shared with the
+    // destination, so it is only linked if it is read-only and already has the requested mode.
+    if (options::cache_storage == CacheStorage::Hardlink && support.link &&
+        (src_stat.st_mode & 07777) == (mode & 07777) && (mode & 0222) == 0) {
+      if (::link(src.c_str(), dest.c_str()) == 0) return true;
+      if (!unsupported(errno)) return false;
+
+      LOG(cache) << "Hard links are not supported from " << src << " to " << dest_dir;
+      support.link = false;
+      remember();
+    }
+
+    // Open the source and destination files
+    int src_fd = ::open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (src_fd == -1) return false;
+
+    int dst_fd = ::open(dest.c_str(), O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, mode);
+    if (dst_fd == -1) {
+      int err = errno;
+      ::close(src_fd);
+      errno = err;
+      return false;
+    }
+
+    // Apply the requested mode exactly, without the umask
+    if (::fchmod(dst_fd, mode) == -1) {
+      int err = errno;
+      ::close(src_fd);
+      ::close(dst_fd);
+      errno = err;
+      return false;
+    }
+
+    // Copy with the most preferred method, moving to the next one if a method is not supported
+    int err;
+    while ((err = copy_with(support.method, src_fd, dst_fd, src_stat.st_size)) != 0) {
+      // Stop if the method failed for some other reason, or if there are no methods left
+      if (!unsupported(err) || support.method == Method::ReadWrite) break;
+
+      LOG(cache) << "Falling back from " << method_name(support.method) << " for copies from "
+                 << src << " to " << dest_dir << ": " << strerror(err);
+      support.method = static_cast<Method>(static_cast<int>(support.method) + 1);
+      remember();
+
+      // Discard anything a partial copy wrote before trying again
+      if (::ftruncate(dst_fd, 0) == -1 || ::lseek(dst_fd, 0, SEEK_SET) == -1) {
+        err = errno;
+        break;
+      }
+    }
+
+    ::close(src_fd);
+    ::close(dst_fd);
+
+    errno = err;
+    return err == 0;
+  }
+
+  bool insert(fs::path src, fs::path dest) noexcept {
+    // Copy to a temporary file next to the destination. The source is never linked into place,
+    // because whoever owns it could write to it later.
+    auto tmp = temp_path(dest);
+
+    if (!copy(src, tmp, EntryMode, false)) {
+      int err = errno;
+      ::unlink(tmp.c_str());
+      errno = err;
+      return false;
+    }
+
+    return publish(tmp, dest);
+  }
+
+  bool publish(fs::path tmp, fs::path dest) noexcept {
+    // Link the complete copy into place. If the link fails because links are not supported,
+    // rename instead. A rename may replace a copy another process just added, which is harmless
+    // because the two files have the same content.
+    int rc = ::link(tmp.c_str(), dest.c_str());
+    if (rc == 0 || errno == EEXIST) {
+      ::unlink(tmp.c_str());
+      return true;
+    }
+
+    if (::rename(tmp.c_str(), dest.c_str()) == 0) return true;
+
+    int err = errno;
+    ::unlink(tmp.c_str());
+    errno = err;
+    return false;
+  }
+
+  fs::path temp_path(fs::path dest) noexcept {
+    static std::atomic<size_t> counter = 0;
+    auto tmp = dest;
+    tmp += ".tmp." + std::to_string(::getpid()) + "." + std::to_string(counter++);
+    return tmp;
+  }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <filesystem>
+
+#include <sys/types.h>
+
+namespace fs = std::filesystem;
+
+/**
+ * File contents are moved into and out of the content cache with the cheapest method the
+ * filesystems involved support. In order of preference:
+ *   1. A hard link, only if --cache-storage=hardlink is selected and the file is read-only
+ *   2. A reflink (FICLONE), which shares extents on filesystems like btrfs and xfs
+ *   3. copy_file_range, which copies in the kernel and may offload to the filesystem
+ *   4. sendfile, for copies between filesystems where copy_file_range is not supported
+ *   5. A plain read/write loop with a large buffer
+ *
+ * Each pair of source and destination filesystems is probed once. When a method fails because
+ * it is not supported, later copies between the same filesystems skip it.
+ *
+ * Files in the cache are stored read-only, and are always copied in rather than linked, so a
+ * command that later rewrites its output can't change a cache entry. A hard link shares both the
+ * contents and the mode of a file, so a cache entry is only linked out to a path that should be
+ * read-only as well. Other files are copied out, and any existing file is removed first.
+ */
+namespace storage {
+  /// The mode of files stored in the cache
+  enum : mode_t { EntryMode = 0444 };
+
+  /**
+   * Copy the contents of one file to another
+   * \param src     The path to the file to copy
+   * \param dest    The path where the copy should be placed
+   * \param mode    The permissions dest is created with. The umask is not applied.
+   * \param replace If true, remove any existing file at dest first. Otherwise dest must not exist
+   * \returns true if the copy succeeded. On failure, errno describes the error.
+   */
+  bool copy(fs::path src, fs::path dest, mode_t mode, bool replace) noexcept;
+
+  /**
+   * Atomically add a copy of a file to a location that other processes may be reading from or
+   * writing to at the same time. The copy is written to a temporary file and then linked into
+   * place, so readers never see a partial file. If another process adds the same file first, its
+   * copy is kept. The copy is read-only, with the mode EntryMode.
+   * \param src  The path to the file to copy
+   * \param dest The path where the copy should be placed
+   * \returns true if a complete file exists at dest. On failure, errno describes the error.
+   */
+  bool insert(fs::path src, fs::path dest) noexcept;
+
+  /**
+   * Move a complete temporary file into a location that other processes may be using, as the
+   * last step of insert. The temporary file is removed.
+   * \param tmp  The path to the temporary file, which must be on the same filesystem as dest
+   * \param dest The path where the file should be placed
+   * \returns true if a complete file exists at dest. On failure, errno describes the error.
+   */
+  bool publish(fs::path tmp, fs::path dest) noexcept;
+
+  /// Get a temporary path next to dest that is unique to this process
+  fs::path temp_path(fs::path dest) noexcept;
+}
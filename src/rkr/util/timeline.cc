@@ -0,0 +1,156 @@
+#include "timeline.hh"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "util/log.hh"
+
+using std::mutex;
+using std::ofstream;
+using std::string;
+using std::unique_lock;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+namespace timeline {
+  /// A recorded span
+  struct Event {
+    const char* category;
+    string name;
+    pid_t pid;
+    pid_t tid;
+    int64_t begin_ns;
+    int64_t duration_ns;
+  };
+
+  /// The time recording started
+  static clock::time_point _origin;
+
+  /// Protects the recorded events, which background threads add to
+  static mutex _mutex;
+
+  /// The recorded events
+  static vector<Event> _events;
+
+  /// Get the calling thread's id, which names its track
+  static pid_t current_tid() noexcept {
+    static thread_local pid_t tid = ::syscall(SYS_gettid);
+    return tid;
+  }
+
+  /// Write a string as a JSON string literal
+  static void write_string(ofstream& f, const string& s) noexcept {
+    f << '"';
+    for (unsigned char c : s) {
+      if (c == '"' || c == '\\') {
+        f << '\\' << c;
+      } else if (c < 0x20) {
+        char buf[8];
+        snprintf(buf, sizeof(buf), "\\u%04x", c);
+        f << buf;
+      } else {
+        f << c;
+      }
+    }
+    f << '"';
+  }
+
+  /// Write a time in nanoseconds as the microseconds the trace-event format uses
+  static void write_time(ofstream& f, int64_t ns) noexcept {
+    f << ns / 1000 << '.';
+    auto frac = std::to_string(ns % 1000);
+    f << string(3 - frac.size(), '0') << frac;
+  }
+
+  /// Write a metadata event that names a process or track
+  static void write_name(ofstream& f,
+                         const char* kind,
+                         pid_t pid,
+                         pid_t tid,
+                         const string& name) noexcept {
+    f << ",\n{\"name\":\"" << kind << "\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << tid
+      << ",\"args\":{\"name\":";
+    write_string(f, name);
+    f << "}}";
+  }
+
+  void start() noexcept {
+    _origin = clock::now();
+    enabled = true;
+  }
+
+  void span(const char* category,
+            string name,
+            pid_t pid,
+            pid_t tid,
+            clock::time_point begin,
+            clock::time_point end) noexcept {
+    if (!enabled) return;
+
+    // Spans that started before recording began are clipped
+    if (begin < _origin) begin = _origin;
+    if (end < begin) end = begin;
+
+    auto ns = [](clock::duration d) {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+    };
+
+    unique_lock lock(_mutex);
+    _events.push_back(
+        Event{category, std::move(name), pid, tid, ns(begin - _origin), ns(end - begin)});
+  }
+
+  void span(const char* category,
+            string name,
+            clock::time_point begin,
+            clock::time_point end) noexcept {
+    span(category, std::move(name), RkrProcess, current_tid(), begin, end);
+  }
+
+  void write(fs::path path) noexcept {
+    if (!enabled) return;
+
+    unique_lock lock(_mutex);
+
+    ofstream f(path);
+    if (!f) {
+      WARN << "Failed to write the build timeline to " << path;
+      return;
+    }
+
+    // Every event after the first starts with a separator, so the list has no trailing comma
+    f << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    f << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << RkrProcess
+      << ",\"tid\":0,\"args\":{\"name\":\"rkr\"}}";
+
+    // Name the other process and the fixed tracks
+    write_name(f, "process_name", CommandProcess, 0, "Commands");
+    write_name(f, "thread_name", RkrProcess, TracerTrack, "Tracer");
+    write_name(f, "thread_name", RkrProcess, ::getpid(), "Build");
+
+    for (const auto& e : _events) {
+      f << ",\n{\"name\":";
+      write_string(f, e.name);
+      f << ",\"cat\":\"" << e.category << "\",\"ph\":\"X\",\"ts\":";
+      write_time(f, e.begin_ns);
+      f << ",\"dur\":";
+      write_time(f, e.duration_ns);
+      f << ",\"pid\":" << e.pid << ",\"tid\":" << e.tid << "}";
+    }
+
+    f << "\n]}\n";
+
+    LOG(phase) << "Wrote " << _events.size() << " timeline events to " << path;
+  }
+}
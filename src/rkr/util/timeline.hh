@@ -0,0 +1,95 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <utility>
+
+#include <sys/types.h>
+
+namespace fs = std::filesystem;
+
+/**
+ * The timeline namespace records a build as a Chrome trace-event timeline (see --timeline). The
+ * output can be opened in Perfetto or chrome://tracing.
+ *
+ * Events are grouped into two processes. The rkr process has one track for each rkr thread, which
+ * shows build phases and subsystem timers, plus a Tracer track that shows the time spent in each
+ * system call handler. The Commands process has one track for each traced process, which shows
+ * the lifetime of the command running in it.
+ *
+ * Recording is off unless start() is called. Every recording function returns immediately when
+ * it is off, so callers don't need to check first.
+ */
+namespace timeline {
+  using clock = std::chrono::steady_clock;
+
+  /// The trace-event process ids used to group tracks
+  enum : pid_t { RkrProcess = 1, CommandProcess = 2 };
+
+  /// The track in the rkr process that holds system call handler spans
+  enum : pid_t { TracerTrack = 0 };
+
+  /// Is a timeline being recorded?
+  inline bool enabled = false;
+
+  /// Start recording. Event times are measured from this point.
+  void start() noexcept;
+
+  /**
+   * Record a span on a specific track
+   * \param category The event category
+   * \param name     The name shown for the span
+   * \param pid      The process that holds the track
+   * \param tid      The track within the process
+   * \param begin    When the span started
+   * \param end      When the span ended
+   */
+  void span(const char* category,
+            std::string name,
+            pid_t pid,
+            pid_t tid,
+            clock::time_point begin,
+            clock::time_point end) noexcept;
+
+  /// Record a span on the calling thread's track in the rkr process
+  void span(const char* category,
+            std::string name,
+            clock::time_point begin,
+            clock::time_point end) noexcept;
+
+  /**
+   * Write the recorded timeline in the Chrome trace-event JSON format
+   * \param path The file to write
+   */
+  void write(fs::path path) noexcept;
+
+  /**
+   * A Span records the time between its creation and destruction on the calling thread's track
+   */
+  class Span {
+   public:
+    /// Start a span
+    Span(const char* category, std::string name) noexcept :
+        _category(category), _name(std::move(name)), _begin(clock::now()) {}
+
+    /// End the span
+    ~Span() noexcept {
+      if (enabled) span(_category, std::move(_name), _begin, clock::now());
+    }
+
+    // Disallow copy and move
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+   private:
+    /// The span's category
+    const char* _category;
+
+    /// The span's name
+    std::string _name;
+
+    /// When the span started
+    clock::time_point _begin;
+  };
+}
@@ -16,11 +16,14 @@
 #include "artifacts/DirArtifact.hh"
 #include "tracing/Flags.hh"
 #include "util/log.hh"
+#include "util/stats.hh"
 
 namespace fs = std::filesystem;
 
 // Commit a base directory version
 void BaseDirVersion::commit(fs::path path, mode_t mode) noexcept {
+  TIME_SCOPE(Commit);
+
   // This directory better be one we've created, otherwise it should have been committed already
   ASSERT(_created) << "An on-disk directory is somehow not committed";
 
@@ -1,12 +1,15 @@
 #include "FileVersion.hh"
 
 #include <cerrno>
+#include <chrono>
 #include <filesystem>
+#include <future>
 #include <iomanip>
 #include <memory>
 #include <optional>
 #include <sstream>
 #include <string>
+#include <system_error>
 
 #include <fcntl.h>
 #include <sys/mman.h>
@@ -15,9 +18,15 @@
 #include <unistd.h>
 
 #include "blake3.h"
+#include "util/background.hh"
+#include "util/cache.hh"
+#include "util/chunks.hh"
 #include "util/constants.hh"
 #include "util/log.hh"
 #include "util/options.hh"
+#include "util/remote.hh"
+#include "util/stats.hh"
+#include "util/storage.hh"
 #include "util/wrappers.hh"
 
 using std::nullopt;
@@ -93,16 +102,12 @@ static optional<FileVersion::Hash> blake3(fs::path path, struct stat& statbuf) n
   return output;
 }
 
+// The local cache and the cache server identify content with the same hash
+static_assert(remote::HashLength == BLAKE3_OUT_LEN);
+
 /// Generate a path from a hash value. The result does not include the cache directory path.
-static fs::path hashPath(FileVersion::Hash& hash) noexcept {
-  // We use a three-level directory prefix scheme to store cached files
-  // to avoid having too many files in a given folder.  This scheme
-  // below has 16^6 unique directory prefixes.
-  string hash_str = b3hex(hash);
-  fs::path dir_lvl_0 = hash_str.substr(0, 2);
-  fs::path dir_lvl_1 = hash_str.substr(2, 2);
-  fs::path dir_lvl_2 = hash_str.substr(4, 2);
-  return dir_lvl_0 / dir_lvl_1 / dir_lvl_2 / hash_str;
+static fs::path hashPath(const FileVersion::Hash& hash) noexcept {
+  return remote::hash_path(hash);
 }
 
 /// Tell the garbage collector to preserve this version.
@@ -149,13 +154,63 @@ void FileVersion::gcLink() noexcept {
   }
 }
 
-// Is this version saved in a way that can be committed?
+// Is this version saved in a way that can be committed? A copy that is still being added to the
+// cache in the background counts as saved, so planning and caching never wait for the worker.
 bool FileVersion::canCommit() const noexcept {
-  return _empty || (options::enable_cache && _cached);
+  if (_empty) return true;
+  if (!options::enable_cache || !_cached) return false;
+
+  // If a copy is being added to the cache in the background, use its result only if it is ready
+  if (_pending.has_value()) {
+    if (_pending->wait_for(std::chrono::seconds(0)) != std::future_status::ready) return true;
+    return finishCaching();
+  }
+
+  // The cached copy may have been evicted since this version was saved. Check once, and wait for
+  // a missing copy to be fetched from the cache server.
+  if (!_cache_checked && _hash.has_value()) {
+    prefetch();
+    _cache_checked = true;
+
+    if (_fetching.has_value()) {
+      _cached = _fetching->get();
+      _fetching.reset();
+      if (!_cached) LOG(cache) << "Cached copy of " << this << " was evicted";
+    }
+  }
+
+  return _cached;
+}
+
+// Wait for a copy that is being added to the cache in the background
+bool FileVersion::finishCaching() const noexcept {
+  if (_pending.has_value()) {
+    _cached = _pending->get();
+    _pending.reset();
+    if (!_cached) LOG(cache) << "Background copy of " << this << " was not cached";
+  }
+  return _cached;
+}
+
+// Start fetching a missing cached copy of this version
+void FileVersion::prefetch() const noexcept {
+  if (_empty || !_cached || _cache_checked || _fetching.has_value() || !_hash.has_value()) return;
+  if (!options::enable_cache) return;
+
+  auto hash_path = hashPath(_hash.value());
+  auto hash_file = constants::CacheDir / hash_path;
+  if (fileExists(hash_file) || chunks::available(chunks::manifest_path(hash_path))) {
+    _cache_checked = true;
+    return;
+  }
+
+  _fetching = remote::fetch(_hash.value(), hash_file);
 }
 
 /// Commit this version to the filesystem
 void FileVersion::commit(fs::path path, mode_t mode) noexcept {
+  TIME_SCOPE(Commit);
+
   ASSERT(canCommit()) << "Attempted to commit unsaved version " << this << " to " << path;
 
   // is this an empty file?
@@ -197,6 +252,8 @@ void FileVersion::fingerprint(fs::path path, FingerprintType type) noexcept {
   // If a full fingerprint was requested and we already have an mtime and hash, return immediately
   if (type == FingerprintType::Full && _mtime.has_value() && _hash.has_value()) return;
 
+  TIME_SCOPE(Fingerprint);
+
   // Stat the file to get mtime, empty, and size
   struct stat statbuf;
   int rc = ::lstat(path.c_str(), &statbuf);
@@ -232,112 +289,106 @@ void FileVersion::makeEmptyFingerprint() noexcept {
 /// Returns true if the cache file exists and restoration was successful.
 /// The exact error message can be printed by the caller by inspecting errno.
 bool FileVersion::stage(fs::path path, mode_t mode) noexcept {
+  TIME_SCOPE(Cache);
+
   // Make sure we have a hash and that this version is cached
   ASSERT(_hash.has_value()) << "Un-hashed file version " << this << " cannot be staged from cache";
   ASSERT(_cached) << "Attempted to stage un-cached file version " << this << " from cache.";
 
+  // If the copy is still being added to the cache in the background, wait for it
+  FAIL_IF(!finishCaching()) << "Unable to stage in file version " << this << " at " << path
+                            << " because it could not be cached";
+
   // Path to cached file
   fs::path hash_file = constants::CacheDir / hashPath(_hash.value());
 
   // does the cached file exist, and if so, how big is it in bytes?
   off_t len = fileLength(hash_file);
+
+  // If not, the file may be cached as chunks, or the cache server may still have a copy
+  if (len == -1) {
+    auto manifest = chunks::manifest_path(hashPath(_hash.value()));
+    if (chunks::available(manifest)) {
+      FAIL_IF(!chunks::restore(manifest, path, mode))
+          << "Could not rebuild " << path << " from cached chunks: " << ERR;
+
+      LOG(cache) << "Staged in file version at path " << path << " from cached chunks";
+      return true;
+    }
+
+    if (remote::fetch(_hash.value(), hash_file).get()) len = fileLength(hash_file);
+  }
   bool file_exists = len != -1;
 
   // the call to stage must succeed
   FAIL_IF(!file_exists) << "Unable to stage in cached file " << path << " from cached file "
                         << hash_file << ": " << ERR;
 
-  // Open source and destination fds
-  int src_fd = ::open(hash_file.c_str(), O_RDONLY);
-  FAIL_IF(src_fd == -1) << "Unable to open cache file " << hash_file << ": " << ERR;
-  int dst_fd = ::open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, mode);
-  FAIL_IF(dst_fd == -1) << "Unable to create stage file " << path << ": " << ERR;
+  // Copy the cached file to the stage location
+  FAIL_IF(!storage::copy(hash_file, path, mode, true))
+      << "Could not copy cache file " << hash_file << " to stage location " << path << ": " << ERR;
 
-  // copy file to cache using non-POSIX fast copy
-  loff_t bytes_cp;
-  do {
-    bytes_cp = ::copy_file_range(src_fd, NULL, dst_fd, NULL, len, 0);
-    FAIL_IF(bytes_cp == -1) << "Could not copy cache file " << hash_file << " to stage location "
-                            << path << ": " << ERR;
-
-    len -= bytes_cp;
-  } while (len > 0 && bytes_cp > 0);
-
-  close(src_fd);
-  close(dst_fd);
+  // Record the use of the cached file
+  cache::hit(hashPath(_hash.value()), len);
 
   LOG(cache) << "Staged in file version at path " << path << " from cache file " << hash_file;
 
   return true;
 }
 
-bool fast_copy(fs::path src, fs::path dest) noexcept {
-  // Get the length of the src file
-  loff_t len = fileLength(src);
-  if (len == -1) {
-    WARN << "Failed to stat " << src << " for fast copy: " << ERR;
-    return false;
-  }
+/// Add a snapshot of a file to the cache. This runs on the background thread, so the file may be
+/// modified by a traced command while it is copied. The copy is hashed and discarded if its
+/// contents do not match the version being cached. Returns true if the file was cached.
+static bool cacheSnapshot(fs::path path, FileVersion::Hash hash, bool chunked) noexcept {
+  TIME_SCOPE(Cache);
+
+  auto hash_path = hashPath(hash);
+  auto hash_file = constants::CacheDir / hash_path;
+
+  std::error_code ec;
+  fs::create_directories(hash_file.parent_path(), ec);
 
-  // Open source and destination fds
-  int src_fd = ::open(src.c_str(), O_RDONLY);
-  if (src_fd == -1) {
-    WARN << "Unable to open file " << src << " for caching: " << ERR;
+  // Copy the file next to its final location in the cache
+  auto tmp = storage::temp_path(hash_file);
+  struct stat statbuf;
+  if (!storage::copy(path, tmp, storage::EntryMode, false) || ::stat(tmp.c_str(), &statbuf) != 0) {
+    WARN << "Unable to cache file " << path << " in " << hash_file << ": " << ERR;
+    ::unlink(tmp.c_str());
     return false;
   }
 
-  int dst_fd = ::open(dest.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0600);
-  if (dst_fd == -1) {
-    WARN << "Unable to create cache file '" << dest << " for file " << src << ": " << ERR;
+  // Make sure the copy has the expected contents
+  if (blake3(tmp, statbuf) != hash) {
+    LOG(cache) << "Not caching " << path << " because it changed while it was copied";
+    ::unlink(tmp.c_str());
     return false;
   }
 
-  // copy file to cache using non-POSIX fast copy
-  loff_t bytes_cp;
-  bool use_fallback_copy = false;
-  do {
-    bytes_cp = ::copy_file_range(src_fd, NULL, dst_fd, NULL, len, 0);
-
-    // Did the copy fail?
-    if (bytes_cp == -1) {
-      // Yes. Was it because we're copying across devices?
-      if (errno == EXDEV) {
-        use_fallback_copy = true;
-        break;
-      } else {
-        WARN << "Could not copy file " << src << " to cache location '" << dest << ": " << ERR;
-        return false;
-      }
-    }
+  // Large files are split into chunks. The copy is no longer needed once they are stored.
+  if (chunked) {
+    bool stored = chunks::store(tmp, chunks::manifest_path(hash_path));
+    if (!stored) LOG(cache) << "Unable to cache " << path << " as chunks: " << ERR;
+    ::unlink(tmp.c_str());
+    return stored;
+  }
 
-    len -= bytes_cp;
-  } while (len > 0 && bytes_cp > 0);
-
-  // Do we need to use a fallback copy?
-  if (use_fallback_copy) {
-    // Seek both files back to the beginning
-    ::lseek(src_fd, 0, SEEK_SET);
-    ::lseek(dst_fd, 0, SEEK_SET);
-
-    // Copy chunks
-    char buf[128];
-    int bytes_read;
-    while ((bytes_read = ::read(src_fd, buf, 128)) != 0) {
-      int rc = ::write(dst_fd, buf, bytes_read);
-      if (rc != bytes_read) {
-        WARN << "Write failed during copy: " << ERR;
-        return false;
-      }
-    }
+  if (!storage::publish(tmp, hash_file)) {
+    WARN << "Unable to cache file " << path << " in " << hash_file << ": " << ERR;
+    return false;
   }
 
-  close(src_fd);
-  close(dst_fd);
+  LOG(artifact) << "Cached file version at path " << path << " in " << hash_file;
+  cache::miss(hash_path, statbuf.st_size);
+
+  // Share the new file with other builds through the cache server
+  remote::upload(hash, hash_file);
 
   return true;
 }
 
 void FileVersion::cache(fs::path path) noexcept {
+  TIME_SCOPE(Cache);
+
   // Don't cache if already cached
   if (_cached) {
     LOG(artifact) << "Not caching version " << this << " at path " << path
@@ -366,20 +417,54 @@ void FileVersion::cache(fs::path path) noexcept {
   fs::path hash_dir = hash_file.parent_path();
 
   // Is the cache file already in the current cache?  If so, we're done.
-  if (fileExists(hash_file)) {
+  struct stat statbuf;
+  if (fileExists(hash_file, statbuf)) {
+    cache::hit(hashPath(_hash.value()), statbuf.st_size);
     _cached = true;
+    _cache_checked = true;
     return;
   }
 
   // Otherwise, we need to cache the file
+  auto hash_path = hashPath(_hash.value());
+  bool chunked = chunks::enabled_for(fileLength(path));
 
-  // Create the directories, if needed
-  fs::create_directories(hash_dir);
+  // Copy the file in the background unless it is already cached as chunks
+  if (options::async_cache && !(chunked && chunks::available(chunks::manifest_path(hash_path)))) {
+    LOG(cache) << "Caching version " << this << " at path " << path << " in the background";
+    auto hash = _hash.value();
+    _pending = background::run([=] { return cacheSnapshot(path, hash, chunked); });
+    _cached = true;
+    _cache_checked = true;
+    return;
+  }
+
+  // Large files may be cached as chunks, which are shared with similar files
+  if (chunked) {
+    if (chunks::store(path, chunks::manifest_path(hash_path))) {
+      _cached = true;
+      _cache_checked = true;
+      return;
+    }
+
+    LOG(cache) << "Unable to cache " << path << " as chunks: " << ERR;
+  }
 
-  // Copy the file, fast hopefully
-  if (fast_copy(path, hash_file)) {
+  // Create the directories, if needed. Another rkr process sharing the cache may do the same.
+  std::error_code ec;
+  fs::create_directories(hash_dir, ec);
+
+  // Copy the file into the cache, fast hopefully
+  if (storage::insert(path, hash_file)) {
     LOG(artifact) << "Cached file version at path " << path << " in " << hash_file;
+    cache::miss(hashPath(_hash.value()), fileLength(hash_file));
     _cached = true;
+    _cache_checked = true;
+
+    // Share the new file with other builds through the cache server
+    remote::upload(_hash.value(), hash_file);
+  } else {
+    WARN << "Unable to cache file " << path << " in " << hash_file << ": " << ERR;
   }
 }
 
@@ -455,11 +540,14 @@ bool FileVersion::matches(shared_ptr<ContentVersion> other) noexcept {
       _hash = other_file->_hash;
     }
 
-    // If either file version is cached, propagate that to the other version
+    // If either file version is cached, propagate that to the other version. A copy that is
+    // still being cached is shared, so both versions wait for it.
     if (_cached) {
       other_file->_cached = true;
+      if (_pending.has_value()) other_file->_pending = _pending;
     } else if (other_file->_cached) {
       _cached = true;
+      _pending = other_file->_pending;
     }
 
     return true;
@@ -4,6 +4,7 @@
 #include <cstdint>
 #include <ctime>
 #include <filesystem>
+#include <future>
 #include <memory>
 #include <optional>
 #include <sstream>
@@ -46,9 +47,14 @@ class FileVersion final : public ContentVersion {
     }
   }
 
-  /// Can this version be committed to the filesystem?
+  /// Can this version be committed to the filesystem? This does not wait for a copy that is
+  /// still being added to the cache in the background. commit() waits for it instead.
   bool canCommit() const noexcept override;
 
+  /// If the cached copy of this version is missing from the local cache, start fetching it from
+  /// the cache server. canCommit() waits for the fetch.
+  void prefetch() const noexcept;
+
   /// Commit this version to the filesystem
   void commit(fs::path path, mode_t mode = 0) noexcept;
 
@@ -95,12 +101,25 @@ class FileVersion final : public ContentVersion {
   /// Restore a cached copy to the given path
   bool stage(fs::path path, mode_t mode) noexcept;
 
+  /// Wait for a copy being added to the cache in the background. Returns true if it was cached.
+  bool finishCaching() const noexcept;
+
  private:
   /// Is this an empty file?
   bool _empty = false;
 
-  /// Is there a cached copy of this file?
-  bool _cached = false;
+  /// Is there a cached copy of this file? Cleared if the cached copy turns out to be evicted
+  mutable bool _cached = false;
+
+  /// Transient field: has the cached copy been checked since this version was loaded?
+  mutable bool _cache_checked = false;
+
+  /// Transient field: set while a copy is being added to the cache in the background. The
+  /// version is treated as cached until the copy finishes, and stage() waits for it.
+  mutable std::optional<std::shared_future<bool>> _pending;
+
+  /// Transient field: set while a missing cached copy is being fetched from the cache server
+  mutable std::optional<std::shared_future<bool>> _fetching;
 
   /// When was this file version modified?
   std::optional<struct timespec> _mtime;
@@ -15,6 +15,7 @@
 
 #include "data/AccessFlags.hh"
 #include "util/log.hh"
+#include "util/stats.hh"
 #include "util/wrappers.hh"
 
 using std::make_shared;
@@ -98,6 +99,8 @@ mode_t MetadataVersion::getMode() const noexcept {
 
 // Commit this version to the filesystem
 void MetadataVersion::commit(fs::path path) noexcept {
+  TIME_SCOPE(Commit);
+
   int rc = ::lchown(path.c_str(), _uid, _gid);
   FAIL_IF(rc != 0) << "Failed to commit owner and group to " << path << ": " << ERR;
 
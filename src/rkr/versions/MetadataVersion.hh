@@ -37,6 +37,12 @@ class MetadataVersion : public Version {
   /// Check if a given access is allowed by the mode bits in this metadata record
   bool checkAccess(AccessFlags flags) noexcept;
 
+  /// Get the user id from this metadata version
+  uid_t getUser() const noexcept { return _uid; }
+
+  /// Get the group id from this metadata version
+  gid_t getGroup() const noexcept { return _gid; }
+
   /// Get the mode field from this metadata version
   mode_t getMode() const noexcept;
 
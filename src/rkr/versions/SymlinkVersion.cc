@@ -9,10 +9,13 @@
 
 #include "tracing/Flags.hh"
 #include "util/log.hh"
+#include "util/stats.hh"
 
 namespace fs = std::filesystem;
 
 void SymlinkVersion::commit(fs::path path) noexcept {
+  TIME_SCOPE(Commit);
+
   struct stat statbuf;
 
   // does the file already exist?
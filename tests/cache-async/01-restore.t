@@ -0,0 +1,40 @@
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any previous build
+  $ rm -rf .rkr mid output
+  $ echo one > input
+
+Run a full build. The second command reads mid, so mid is copied into the cache on the background
+thread while the build goes on.
+  $ rkr --show
+  rkr-launch
+  Rikerfile
+  cat input
+  cat mid
+
+Remove mid. The rebuild restores it from the cache without running anything.
+  $ rm mid
+  $ rkr --show
+  $ cat mid
+  one
+
+Remove both files. Only the second command has to run, and it reads mid restored from the cache.
+  $ rm mid output
+  $ rkr --show
+  cat mid
+  $ cat mid output
+  one
+  one
+
+The same builds work when files are cached on the main thread
+  $ rm -rf .rkr mid output
+  $ rkr --no-async-cache > /dev/null
+  $ rm mid output
+  $ rkr --show --no-async-cache
+  cat mid
+  $ cat output
+  one
+
+Clean up
+  $ rm -rf .rkr mid output
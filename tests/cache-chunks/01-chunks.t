@@ -0,0 +1,36 @@
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any previous build
+  $ rm -rf .rkr input big
+
+Run a full build that writes an output large enough to be cached as chunks
+  $ seq 1 400000 > input
+  $ rkr --cache-chunks --show
+  rkr-launch
+  Rikerfile
+  cat input
+  $ find .rkr/cache -name '*.chunks' | wc -l
+  1
+
+Remove the output. The next build rebuilds it from its chunks without running anything.
+  $ rm big
+  $ rkr --cache-chunks --show
+  $ cmp input big
+
+Change the end of the input, and limit the cache so every file this build does not need is
+evicted. The old output's manifest is evicted along with the chunks only it used. The chunks it
+shares with the new output stay.
+  $ seq 1 400001 > input
+  $ rkr --cache-chunks --cache-size 1 --show
+  cat input
+  $ find .rkr/cache -name '*.chunks' | wc -l
+  1
+
+The new output can still be rebuilt from its chunks
+  $ rm big
+  $ rkr --cache-chunks --show
+  $ cmp input big
+
+Clean up
+  $ rm -rf .rkr input big
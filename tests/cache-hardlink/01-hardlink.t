@@ -0,0 +1,28 @@
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any previous build
+  $ rm -rf .rkr output
+  $ echo one > input
+
+Run a full build that stores cached files with hard links where it can
+  $ rkr --cache-storage hardlink --show
+  rkr-launch
+  Rikerfile
+  cat input
+
+The output was copied into the cache, not linked, so writing to it in place leaves the cached copy
+alone
+  $ stat -c %h output
+  1
+  $ echo junk >> output
+
+The next build puts back the right output. It is a separate file with the mode the build gave it.
+  $ rkr --cache-storage hardlink > /dev/null
+  $ cat output
+  one
+  $ stat -c '%h %a' output
+  1 644
+
+Clean up
+  $ rm -rf .rkr output
@@ -0,0 +1,40 @@
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any previous build
+  $ rm -rf .rkr output server-cache server.sock server.pid
+
+Start a cache server on a Unix socket
+  $ rkr-cache-server --unix $TESTDIR/server.sock $TESTDIR/server-cache > /dev/null 2>&1 &
+  $ echo $! > server.pid
+  $ while [ ! -S server.sock ]; do sleep 0.1; done
+
+Run a full build, which uploads its output to the server
+  $ rkr --cache-server unix:$TESTDIR/server.sock --show
+  rkr-launch
+  Rikerfile
+  tr a-z A-Z
+  $ grep -rlx ONE server-cache | wc -l
+  1
+
+Remove the local cache and the output. The next build fetches the output from the server, so
+no command runs.
+  $ rm -rf .rkr/cache output
+  $ rkr --cache-server unix:$TESTDIR/server.sock --show
+  $ cat output
+  ONE
+  $ grep -rlx ONE .rkr/cache | wc -l
+  1
+
+Tamper with the server's copy. The fetched file does not match its hash, so it is discarded and
+the output is built again.
+  $ for f in $(grep -rlx ONE server-cache); do chmod u+w $f; echo TAMPERED > $f; done
+  $ rm -rf .rkr/cache output
+  $ rkr --cache-server unix:$TESTDIR/server.sock --show 2> /dev/null
+  tr a-z A-Z
+  $ cat output
+  ONE
+
+Stop the server and clean up
+  $ kill $(cat server.pid)
+  $ rm -rf .rkr output server-cache server.sock server.pid
@@ -0,0 +1,37 @@
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any previous builds
+  $ rm -rf cache a/.rkr a/mid a/output b/.rkr b/mid b/output
+
+Build the first workspace with a shared cache. The second command reads mid, so mid is cached.
+  $ cd a
+  $ rkr --cache-dir ../cache --show
+  rkr-launch
+  Rikerfile
+  cat input
+  cat mid
+
+A build with nothing to do uses no cached files, but its saved trace still relies on the cached
+copy of mid
+  $ rkr --cache-dir ../cache --show
+
+Build the second workspace with a cache size limit that every file is over. Its own files are in
+use, and the first workspace's trace still refers to its cached mid, so nothing can be evicted.
+  $ cd ../b
+  $ rkr --cache-dir ../cache --cache-size 1 --show
+  rkr-launch
+  Rikerfile
+  cat input
+  cat mid
+
+The first workspace can still restore mid from the cache without running anything
+  $ cd ../a
+  $ rm mid
+  $ rkr --cache-dir ../cache --show
+  $ cat mid
+  one
+
+Clean up
+  $ cd ..
+  $ rm -rf cache a/.rkr a/mid a/output b/.rkr b/mid b/output
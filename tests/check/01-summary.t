@@ -0,0 +1,57 @@
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any previous build
+  $ rm -rf .rkr output1 output2 output3 extra fast full
+  $ echo "one" > input1
+  $ echo "two" > input2
+
+Run a build, which saves a summary for rkr check
+  $ rkr
+  $ test -f .rkr/summary
+
+Nothing has changed, so nothing needs to run
+  $ rkr check
+  No commands to rerun
+
+Change an input. The check uses the summary, and agrees with a check that emulates the trace.
+  $ echo "three" > input2
+  $ rkr check > fast
+  $ grep -A1 "must run" fast
+  Commands that must run:
+    cat input2
+  $ rkr check --full > full
+  $ diff fast full
+
+Rebuild, then create a file a command looked for but did not find
+  $ rkr
+  $ touch extra
+  $ rkr check > fast
+  $ grep -A1 "must run" fast
+  Commands that must run:
+    cat extra
+  $ rkr check --full > full
+  $ diff fast full
+
+A summary that does not match the database is ignored
+  $ rkr
+  $ touch .rkr/db
+  $ rkr check
+  No commands to rerun
+
+Build from scratch without the cache, then remove an output. There is no cached copy to restore,
+so the command that wrote it must run.
+  $ rm -rf .rkr
+  $ rkr --no-caching
+  $ rm output1
+  $ rkr --no-caching check > fast
+  $ grep -A1 "must run" fast
+  Commands that must run:
+    cat input1
+  $ rkr --no-caching check --full > full
+  $ diff fast full
+
+Clean up
+  $ rm -rf .rkr output1 output2 output3 extra fast full
+  $ echo "one" > input1
+  $ echo "two" > input2
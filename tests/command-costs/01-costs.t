@@ -0,0 +1,40 @@
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any previous build
+  $ rm -rf .rkr input part output costs
+  $ seq 1 2000 > input
+
+Run a full build
+  $ rkr --show
+  rkr-launch
+  Rikerfile
+  head -c 5000 input
+  cat part part
+
+The last build's cost is listed for each command
+  $ rkr stats --commands > costs
+  $ sed -n '/^Command Costs:/,+1p' costs
+  Command Costs:
+       Wall ms   Tracer ms    Ptrace   Channel        Read B     Written B  Predicates  Command
+
+Each command that ran has a wall time and the bytes it wrote
+  $ grep ' head -c 5000 input$' costs | awk '{ print ($1 > 0), ($5 >= 5000), $6 }'
+  1 1 5000
+  $ grep ' cat part part$' costs | awk '{ print ($1 > 0), ($5 >= 10000), $6 }'
+  1 1 10000
+
+Change the end of the input, so only head has to run again
+  $ seq 1 2001 > input
+  $ rkr --show
+  head -c 5000 input
+
+Now cat was only checked, so it has predicates but no wall time or I/O
+  $ rkr stats --commands > costs
+  $ grep ' head -c 5000 input$' costs | awk '{ print ($1 > 0), $6 }'
+  1 5000
+  $ grep ' cat part part$' costs | awk '{ print $1, $5, $6, ($7 > 0) }'
+  0.000 0 0 1
+
+Clean up
+  $ rm -rf .rkr input part output costs
@@ -0,0 +1,70 @@
+The build removes and recreates one entry in a directory, and moves another away and back. The
+directory's entries must reflect each change, or the listing and the files read would be stale.
+
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any previous build, and create the directory out of order
+  $ rm -rf .rkr d listing output
+  $ mkdir d
+  $ echo c > d/c
+  $ echo a > d/a
+  $ echo b > d/b
+  $ echo one > input
+
+Run the first build
+  $ rkr --show
+  rkr-launch
+  Rikerfile
+  rm d/a
+  cat input
+  mv d/b d/tmp
+  mv d/tmp d/b
+  ls d
+  cat d/a d/b d/c
+  $ cat listing
+  a
+  b
+  c
+  $ cat output
+  one
+  b
+  c
+
+A rebuild with no changes does nothing
+  $ rkr --show
+
+Change the input. The recreated d/a changes, but the listing does not.
+  $ echo two > input
+  $ rkr --show
+  cat input
+  cat d/a d/b d/c
+  $ cat output
+  two
+  b
+  c
+
+Change a file that was never removed
+  $ echo C > d/c
+  $ rkr --show
+  cat d/a d/b d/c
+  $ cat output
+  two
+  b
+  C
+
+Add an entry to the directory. Only the listing changes.
+  $ touch d/e
+  $ rkr --show
+  ls d
+  $ cat listing
+  a
+  b
+  c
+  e
+
+Run a final rebuild, which should do nothing
+  $ rkr --show
+
+Clean up
+  $ rm -rf .rkr d input listing output
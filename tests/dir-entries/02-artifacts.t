@@ -0,0 +1,43 @@
+After the build, each file in the directory is one artifact with the name it was left at. The
+removed d/a and the temporary d/tmp name must not be listed for any artifact.
+
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any previous build, and create the directory out of order
+  $ rm -rf .rkr d listing output
+  $ mkdir d
+  $ echo c > d/c
+  $ echo a > d/a
+  $ echo b > d/b
+  $ echo one > input
+
+Run the first build
+  $ rkr --show
+  rkr-launch
+  Rikerfile
+  rm d/a
+  cat input
+  mv d/b d/tmp
+  mv d/tmp d/b
+  ls d
+  cat d/a d/b d/c
+
+List the artifacts in the directory
+  $ rkr stats -a | grep '^  File: d/' | sort
+    File: d/a
+    File: d/b
+    File: d/c
+
+Change the input and rebuild. The artifacts are the same.
+  $ echo two > input
+  $ rkr --show
+  cat input
+  cat d/a d/b d/c
+  $ rkr stats -a | grep '^  File: d/' | sort
+    File: d/a
+    File: d/b
+    File: d/c
+
+Clean up
+  $ rm -rf .rkr d input listing output
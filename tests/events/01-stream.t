@@ -0,0 +1,32 @@
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any previous build
+  $ rm -rf .rkr output renamed renamed.tmp events.json
+
+Run a build and stream its dependency events to a file
+  $ rkr --events events.json
+
+The cat command is introduced, launched, reads its input, writes its output, and exits
+  $ grep -c '"name":"cat input"' events.json
+  1
+  $ grep -q '"type":"exec","command":[0-9]*,"parent":' events.json
+  $ grep -q '"type":"read","command":[0-9]*,"path":".*/input"' events.json
+  $ grep -q '"type":"write","command":[0-9]*,"path":".*/output"' events.json
+  $ grep -q '"type":"exit","command":[0-9]*,"status":0' events.json
+
+A file written to a temporary path and renamed into place is reported as a write of both paths
+by the command that renamed it
+  $ mv=$(grep '"name":"mv renamed.tmp renamed"' events.json | sed 's/.*"command":\([0-9]*\).*/\1/')
+  $ grep -c "\"type\":\"write\",\"command\":$mv,\"path\":\".*/renamed.tmp\"" events.json
+  1
+  $ grep -c "\"type\":\"write\",\"command\":$mv,\"path\":\".*/renamed\"" events.json
+  1
+
+A rebuild runs nothing, so there are no events
+  $ rkr --events events.json
+  $ wc -l < events.json
+  0
+
+Clean up
+  $ rm -rf .rkr output renamed renamed.tmp events.json
@@ -0,0 +1,32 @@
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any previous build
+  $ rm -rf .rkr output out.json
+
+Run a build
+  $ rkr
+
+Write the graph as a JSON edge list on stdout, and look for the output file
+  $ rkr graph -t json -o - | grep -o '"name":"output"'
+  "name":"output"
+
+Write the graph to the default file for the json type
+  $ rkr graph -t json
+  $ grep -c '"type":"command"' out.json
+  [0-9]+ (re)
+
+Only include files that match a pattern. The output file is the only match.
+  $ rkr graph -t json -o - -p 'out*' | grep -c '"type":"artifact"'
+  1
+
+Limit the depth of the graph to the root command
+  $ rkr graph -t json -o - -d 0 | grep -c '"type":"command"'
+  1
+
+Collapse system files into one node for each top-level directory
+  $ rkr graph -t json -o - --collapse-system | grep -oE '"kind":"System","name":"/[a-z0-9]+"' | head -n 1
+  "kind":"System","name":"/[a-z0-9]+" (re)
+
+Clean up
+  $ rm -rf .rkr output out.json
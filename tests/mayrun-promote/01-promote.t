@@ -0,0 +1,37 @@
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any previous build
+  $ rm -rf .rkr mid output stats.csv
+  $ echo one > input
+
+Run a full build
+  $ rkr --show
+  rkr-launch
+  Rikerfile
+  cat input
+  cat mid
+
+Change the input to the first command. The second command reads the first command's cached
+output, so it starts out marked MayRun. The first command exits before the second is launched,
+so the second command sees its input has changed and is promoted to run in the same phase.
+  $ echo two > input
+  $ rkr --show --stats stats.csv
+  cat input
+  cat mid
+  $ cat output
+  two
+
+The build needed one phase to emulate the trace and one to run both commands. Without promotion,
+the second command would have forced a third phase.
+  $ awk -F, 'NR == 1 { for (i = 1; i <= NF; i++) col[$i] = i }
+  >          NR > 1 { gsub(/"/, ""); p += $col["\"promoted_commands\""]; n = $col["\"phase_count\""] }
+  >          END { print p, n }' stats.csv
+  1 2
+
+A rebuild does nothing
+  $ rkr --show
+
+Clean up
+  $ rm -rf .rkr mid output stats.csv
+  $ echo one > input
@@ -0,0 +1,48 @@
+The build script writes enough files that the refs and versions it creates fill several pool
+chunks. Those objects are recycled between phases, so a version freed too early would look
+changed in a later phase and force the script to run again.
+
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any previous build
+  $ rm -rf .rkr files output stats.csv
+  $ echo one > input
+
+Run the first build
+  $ rkr --show --stats stats.csv
+  rkr-launch
+  Rikerfile
+  mkdir -p files
+  seq 1 2000
+  cat input
+  cat files/1 files/2000 files/input
+  $ cat output
+  1
+  2000
+  one
+
+The build used more than one pool chunk
+  $ awk -F, 'NR == 1 { for (i = 1; i <= NF; i++) if ($i == "\"pool_chunks\"") c = i }
+  >   NR > 1 { gsub(/"/, "", $c); if ($c > n) n = $c } END { print (n > 1) }' stats.csv
+  1
+
+A rebuild with no changes does nothing
+  $ rkr --show
+
+Change the input. The script's writes are emulated, and only the commands that read the input
+run again.
+  $ echo two > input
+  $ rkr --show
+  cat input
+  cat files/1 files/2000 files/input
+  $ cat output
+  1
+  2000
+  two
+
+Run a final rebuild, which should do nothing
+  $ rkr --show
+
+Clean up
+  $ rm -rf .rkr files input output stats.csv
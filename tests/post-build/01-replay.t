@@ -0,0 +1,23 @@
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any previous build
+  $ rm -rf .rkr Rikerfile tmp out1 gone final default.out replay.out log
+  $ cp Rikerfile-replay Rikerfile
+
+The build renames a file, and deletes and recreates another, within its last phase. Predicates on
+those paths fall between their first and last modification, so the outcomes recorded during the
+last phase are not exact and the default builds emulate the final trace again as well. The
+default builds must run the same commands and leave the same predicates as forced replays.
+  $ ./run.sh --log phase > default.out 2> log
+  $ grep -q "Replaying the final trace" log
+  $ ./run.sh --replay-post-build > replay.out
+  $ diff default.out replay.out
+
+The rebuild used the new input
+  $ grep -c two default.out
+  2
+
+Clean up
+  $ rm -rf .rkr Rikerfile tmp out1 gone final default.out replay.out log
+  $ echo one > input
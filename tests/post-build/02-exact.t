@@ -0,0 +1,28 @@
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any previous build
+  $ rm -rf .rkr Rikerfile out1 final default.out replay.out log
+  $ cp Rikerfile-exact Rikerfile
+
+Every file in this build is written once, so the outcomes recorded during the last phase are exact.
+The full build and the rebuild run post-build checks by applying them, without emulating the final
+trace again.
+  $ ./run.sh --log phase > default.out 2> log
+  $ grep -c "Starting post-build checks" log
+  2
+  $ grep -c "Replaying the final trace" log
+  0
+  [1]
+
+Emulating the final trace instead must run the same commands and leave the same predicates
+  $ ./run.sh --replay-post-build > replay.out
+  $ diff default.out replay.out
+
+The rebuild used the new input
+  $ cat final
+  two
+
+Clean up
+  $ rm -rf .rkr Rikerfile out1 final default.out replay.out log
+  $ echo one > input
@@ -0,0 +1,12 @@
+#!/bin/sh
+
+# Run a full build, a rebuild after an input change, and a build with nothing to do, passing any
+# arguments along to rkr. Then print the output and the scenarios of the predicates in the trace.
+rm -rf .rkr tmp out1 gone final
+echo one > input
+rkr --show "$@" || exit 1
+echo two > input
+rkr --show "$@" || exit 1
+rkr --show "$@" || exit 1
+cat final
+rkr trace | grep -o '\[\(build\|post-build\|build, post-build\)\]'
@@ -0,0 +1,39 @@
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any previous build
+  $ rm -rf .rkr sub log
+  $ echo one > input
+
+Run a full build. It saves the paths it looked up next to the database.
+  $ rkr --show
+  rkr-launch
+  Rikerfile
+  mkdir -p sub
+  cat input
+  $ tr '\0' '\n' < .rkr/paths | grep -c "prefetch/\(input\|sub\|sub/output\)$"
+  3
+
+A rebuild with nothing to do stats those paths ahead of time and uses the results
+  $ rkr --show --log phase 2> log
+  $ grep -c "Prefetching stat results for [1-9][0-9]* paths" log
+  1
+  $ grep -c "Used [1-9][0-9]* prefetched stat results" log
+  1
+
+Change the input. The rebuild stops using the prefetched results before it runs a command, and
+still sees the change.
+  $ echo two > input
+  $ rkr --show
+  cat input
+  $ cat sub/output
+  two
+
+Without prefetching, the same builds do nothing and leave the same output
+  $ rkr --show --no-prefetch
+  $ cat sub/output
+  two
+
+Clean up
+  $ rm -rf .rkr sub log
+  $ echo one > input
@@ -0,0 +1,55 @@
+Two commands in the same build resolve d/f from the same directory with the same flags, but d is
+renamed and replaced between them. A cached resolution of d/f must not outlive the rename.
+
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any previous build
+  $ rm -rf .rkr d old first second
+  $ echo one > input
+  $ echo new > other
+
+Run the first build
+  $ rkr --show
+  rkr-launch
+  Rikerfile
+  mkdir d
+  cat input
+  cat d/f
+  mv d old
+  mkdir d
+  cat other
+  cat d/f
+  rm -r old d
+
+Each cat d/f read the file that was at d/f when it ran
+  $ cat first second
+  one
+  new
+
+A rebuild with no changes does nothing
+  $ rkr --show
+
+Change the input. Only the first cat d/f read the file it wrote, so only that one runs again.
+  $ echo two > input
+  $ rkr --show
+  cat input
+  cat d/f
+  $ cat first second
+  two
+  new
+
+Change the other input. Now only the second cat d/f runs again.
+  $ echo newer > other
+  $ rkr --show
+  cat other
+  cat d/f
+  $ cat first second
+  two
+  newer
+
+Run a final rebuild, which should do nothing
+  $ rkr --show
+
+Clean up
+  $ rm -rf .rkr d old input other first second
@@ -0,0 +1,51 @@
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any previous build
+  $ rm -rf .rkr output server.pid log
+  $ echo "one" > input
+
+Start a build server and wait for its socket
+  $ rkr server > /dev/null 2>&1 &
+  $ echo $! > server.pid
+  $ while [ ! -S .rkr/server.sock ]; do sleep 0.1; done
+
+Run a full build through the server. The server's standard streams are not the client's, so the
+commands it shows prove the client's streams were passed along.
+  $ rkr --show --log phase 2> log; echo $?
+  rkr-launch
+  Rikerfile
+  tr a-z A-Z
+  0
+  $ grep -c "Running build in the build server" log
+  1
+  $ cat output
+  ONE
+
+Change the input and run a second build through the same server. The forked build starts from
+the trace the server decoded after the first build.
+  $ echo "two" > input
+  $ rkr --show --log phase 2> log; echo $?
+  tr a-z A-Z
+  0
+  $ grep -c "Running build in the build server" log
+  1
+  $ cat output
+  TWO
+
+Nothing has changed, so nothing runs
+  $ rkr --show; echo $?
+  0
+
+Stop the server. Builds run in the rkr process again.
+  $ kill $(cat server.pid)
+  $ while [ -S .rkr/server.sock ]; do sleep 0.1; done
+  $ rkr --show --log phase 2> log; echo $?
+  0
+  $ grep -c "Running build in the build server" log
+  0
+  [1]
+
+Clean up
+  $ rm -rf .rkr output server.pid log
+  $ echo "one" > input
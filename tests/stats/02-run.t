@@ -18,6 +18,23 @@ Verify the output is correct
     Artifacts: [0-9]+ (re)
     Artifact Versions: [0-9]+ (re)
 
+Verify the --cache output is correct
+  $ rkr stats --cache
+  Build Statistics:
+    Commands: [0-9]+ (re)
+    Steps: [0-9]+ (re)
+    Artifacts: [0-9]+ (re)
+    Artifact Versions: [0-9]+ (re)
+  
+  Cache Statistics:
+    Files: [0-9]+ (re)
+    Size: [0-9]+ bytes (re)
+    Hits: [0-9]+ (re)
+    Misses: [0-9]+ (re)
+    Hit Rate: [0-9.]+% (re)
+    Bytes Saved: [0-9]+ (re)
+    Bytes Evicted: 0
+
 Verify the -a output is correct
   $ rkr stats -a | head -n 8
   Build Statistics:
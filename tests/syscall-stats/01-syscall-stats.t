@@ -0,0 +1,44 @@
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any previous build
+  $ rm -rf .rkr output stats
+
+Run a build that writes its output one line at a time, and print system call statistics
+  $ rkr --syscall-stats > stats
+  $ wc -l < output
+  200
+
+Each echo writes once, through the shared memory channel
+  $ sed -n '/^System Call Stats:/p' stats
+  System Call Stats:
+  $ grep '^  write ' stats
+    write (fast): [1-9][0-9]{2,} (re)
+  $ grep 'syscalls handed by fast tracing' stats
+  [1-9][0-9]*/[1-9][0-9]* \([0-9]+%\) syscalls handed by fast tracing (re)
+
+The channel statistics count those round trips
+  $ sed -n '/^Shared Memory Channel Stats:/,/^  Tracer polls:/p' stats
+  Shared Memory Channel Stats:
+    Acquisitions: [1-9][0-9]{2,} \([0-9]+ blocked, [0-9]+ busy channels probed\) (re)
+    Waits: [1-9][0-9]* \([0-9]+ spins, [0-9]+ semaphore fallbacks\) (re)
+    Tracer polls: [1-9][0-9]* \([1-9][0-9]* channel events observed\) (re)
+  $ grep '^  Round-trip latency:' stats
+    Round-trip latency: p50 [0-9]+ns, p90 [0-9]+ns, p99 [0-9]+ns, max [0-9]+ns (re)
+  $ sed -n '/^  Channel  Acquired/,$p' stats | head -n 2
+    Channel  Acquired     Waits     Spins  Fallbacks  p50 ns  p99 ns
+   +[0-9]+ +[1-9][0-9]* +[0-9]+ +[0-9]+ +[0-9]+ +[0-9]+ +[0-9]+ (re)
+
+Without the injected library, every write stops the tracer, and there is no channel to report on
+  $ rm -rf .rkr output
+  $ rkr --syscall-stats --no-inject > stats
+  $ grep '^  write ' stats
+    write \(ptrace .*\): [1-9][0-9]{2,} (re)
+  $ grep 'syscalls handed by fast tracing' stats
+  0/[1-9][0-9]* \(0%\) syscalls handed by fast tracing (re)
+  $ grep -c 'Shared Memory Channel Stats' stats
+  0
+  [1]
+
+Clean up
+  $ rm -rf .rkr output stats
@@ -0,0 +1,54 @@
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any previous build
+  $ rm -rf .rkr output timeline.json
+
+Print the phases, commands, and timers in a timeline, and check that each command ran inside a
+phase
+  $ spans() {
+  > python3 - "$1" <<'EOF'
+  > import json, sys
+  > trace = json.load(open(sys.argv[1]))
+  > spans = [e for e in trace["traceEvents"] if e["ph"] == "X"]
+  > phases = [e for e in spans if e["cat"] == "phase"]
+  > for e in sorted(phases, key=lambda e: e["ts"]):
+  >     print("phase:", e["name"])
+  > for e in sorted(spans, key=lambda e: e["ts"]):
+  >     if e["cat"] != "command":
+  >         continue
+  >     inside = [p["name"] for p in phases
+  >               if p["ts"] <= e["ts"] and e["ts"] + e["dur"] <= p["ts"] + p["dur"]]
+  >     print("command:", e["name"], "in", ", ".join(inside))
+  > print("timers:", ", ".join(sorted({e["name"] for e in spans if e["cat"] == "timer"})))
+  > EOF
+  > }
+
+Run a full build and write its timeline
+  $ rkr --show --timeline timeline.json
+  rkr-launch
+  Rikerfile
+  cat input
+
+The first phase emulates the default trace, and the second runs every command
+  $ spans timeline.json | grep -e '^phase' -e '^command: cat' -e '^timers'
+  phase: Phase 0
+  phase: Phase 1
+  command: cat input in Phase 1
+  timers: .*Emulation.*Tracing.* (re)
+
+The timeline names the tracks it uses
+  $ grep -o '"args":{"name":"[A-Za-z]*"}' timeline.json
+  "args":{"name":"rkr"}
+  "args":{"name":"Commands"}
+  "args":{"name":"Tracer"}
+  "args":{"name":"Build"}
+
+A rebuild with nothing to do only has the first phase, and no commands
+  $ rkr --show --timeline timeline.json
+  $ spans timeline.json
+  phase: Phase 0
+  timers: .*Emulation.* (re)
+
+Clean up
+  $ rm -rf .rkr output timeline.json
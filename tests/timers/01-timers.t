@@ -0,0 +1,70 @@
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any previous build
+  $ rm -rf .rkr output stats.csv
+
+Print one column of the stats CSV, with one line for each row
+  $ stat_column() { awk -F, -v name="\"$1\"" \
+  >   'NR == 1 { for (i = 1; i <= NF; i++) if ($i == name) c = i } NR > 1 { print $c }' stats.csv; }
+
+Run a full build and record statistics
+  $ rkr --show --stats stats.csv
+  rkr-launch
+  Rikerfile
+  cat input
+
+The stats CSV has a column for each timer
+  $ head -n 1 stats.csv | cut -d, -f21-28 | tr ',' '\n'
+  "trace_load_ns"
+  "emulation_ns"
+  "tracing_ns"
+  "fingerprint_ns"
+  "cache_ns"
+  "commit_ns"
+  "post_build_ns"
+  "db_write_ns"
+
+Only the phase that ran commands spent time tracing them
+  $ stat_column phase
+  "0"
+  "1"
+  "2"
+  $ stat_column tracing_ns | sed 's/"[1-9][0-9]*"/nonzero/'
+  "0"
+  nonzero
+  "0"
+
+Every phase emulated some steps, and the checks after the last phase wrote the database
+  $ stat_column emulation_ns | sed 's/"[1-9][0-9]*"/nonzero/'
+  nonzero
+  nonzero
+  "0"
+  $ stat_column db_write_ns | sed 's/"[1-9][0-9]*"/nonzero/' | tail -n 1
+  nonzero
+
+The saved timers show the time the build spent in each part
+  $ rkr stats --timers
+  Build Statistics:
+    Commands: [0-9]+ (re)
+    Steps: [0-9]+ (re)
+    Artifacts: [0-9]+ (re)
+    Artifact Versions: [0-9]+ (re)
+  
+  Build Timers:
+    Trace Load: [0-9]+\.[0-9]{3} ms \([0-9]+\.[0-9]%\) (re)
+    Emulation: [0-9]+\.[0-9]{3} ms \([0-9]+\.[0-9]%\) (re)
+    Tracing: [0-9]+\.[0-9]{3} ms \([0-9]+\.[0-9]%\) (re)
+    Fingerprinting: [0-9]+\.[0-9]{3} ms \([0-9]+\.[0-9]%\) (re)
+    Caching: [0-9]+\.[0-9]{3} ms \([0-9]+\.[0-9]%\) (re)
+    Commit: [0-9]+\.[0-9]{3} ms \([0-9]+\.[0-9]%\) (re)
+    Post-Build Checks: [0-9]+\.[0-9]{3} ms \([0-9]+\.[0-9]%\) (re)
+    Database Write: [0-9]+\.[0-9]{3} ms \([0-9]+\.[0-9]%\) (re)
+
+A rebuild with nothing to do traces nothing, and its timers replace the saved ones
+  $ rkr --show
+  $ rkr stats -t | grep Tracing
+    Tracing: 0.000 ms (0.0%)
+
+Clean up
+  $ rm -rf .rkr output stats.csv
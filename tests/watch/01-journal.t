@@ -0,0 +1,50 @@
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any previous build
+  $ rm -rf .rkr output watch.pid
+  $ echo "one" > input
+
+Start the watcher and wait for its journal
+  $ mkdir .rkr
+  $ rkr watch > /dev/null 2>&1 &
+  $ echo $! > watch.pid
+  $ while [ ! -f .rkr/journal ]; do sleep 0.1; done
+
+Run a full build
+  $ rkr --show
+  rkr-launch
+  Rikerfile
+  cat input
+  $ cat output
+  one
+
+Nothing has changed, so nothing runs
+  $ rkr --show
+
+Change the input just before a build. The build waits for the watcher to journal its cookie, so
+the change is seen.
+  $ echo "two" > input && rkr --show
+  cat input
+  $ cat output
+  two
+
+The cookie file is removed once the watcher has seen it
+  $ ls -A | grep rkr-cookie
+  [1]
+
+Stop the watcher. Builds fall back to checking every path.
+  $ kill $(cat watch.pid)
+  $ while [ -f .rkr/journal ]; do sleep 0.1; done
+  $ echo "three" > input
+  $ rkr --show
+  cat input
+  $ cat output
+  three
+
+Nothing has changed, so nothing runs
+  $ rkr --show
+
+Clean up
+  $ rm -rf .rkr output watch.pid
+  $ echo "one" > input